@@ -0,0 +1,363 @@
+/* aperture-barcode-result.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+/**
+ * SECTION:aperture-barcode-result
+ * @title: ApertureBarcodeResult
+ * @short_description: A barcode found in the camera feed
+ *
+ * An #ApertureBarcodeResult describes one barcode that an
+ * #ApertureViewfinder found in its camera feed: what it says, where it is in
+ * the frame, and which frame it was found in.
+ *
+ * Since: 0.2
+ */
+
+/**
+ * ApertureBarcodeResult:
+ *
+ * An opaque, immutable structure describing a detected barcode.
+ *
+ * Since: 0.2
+ */
+
+
+#include <string.h>
+
+#include "private/aperture-barcode-result-private.h"
+#include "aperture-barcode-result.h"
+
+
+struct _ApertureBarcodeResult
+{
+  gatomicrefcount ref_count;
+
+  ApertureBarcode barcode_type;
+  char *data;
+  int quality;
+  GstClockTime timestamp;
+  GstClockTime latency;
+
+  GdkPoint *polygon;
+  guint n_points;
+};
+
+G_DEFINE_BOXED_TYPE (ApertureBarcodeResult, aperture_barcode_result, aperture_barcode_result_ref, aperture_barcode_result_unref)
+
+
+/* PRIVATE */
+
+
+/**
+ * PRIVATE:aperture_barcode_result_new:
+ * @barcode_type: the type of barcode
+ * @data: the data encoded in the barcode
+ * @quality: the quality reported by the decoder
+ * @timestamp: the timestamp of the frame the barcode was found in
+ *
+ * Creates a new #ApertureBarcodeResult, without a position or latency.
+ *
+ * Returns: (transfer full): a new #ApertureBarcodeResult
+ */
+ApertureBarcodeResult *
+aperture_barcode_result_new (ApertureBarcode barcode_type, const char *data, int quality, GstClockTime timestamp)
+{
+  ApertureBarcodeResult *self = g_new0 (ApertureBarcodeResult, 1);
+
+  g_atomic_ref_count_init (&self->ref_count);
+  self->barcode_type = barcode_type;
+  self->data = g_strdup (data);
+  self->quality = quality;
+  self->timestamp = timestamp;
+  self->latency = GST_CLOCK_TIME_NONE;
+
+  return self;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_result_copy:
+ * @self: an #ApertureBarcodeResult
+ *
+ * Creates a copy of @self. Results are shared once they are handed out, so
+ * to change one, make a copy and change that before handing it out.
+ *
+ * Returns: (transfer full): a new #ApertureBarcodeResult
+ */
+ApertureBarcodeResult *
+aperture_barcode_result_copy (ApertureBarcodeResult *self)
+{
+  ApertureBarcodeResult *copy;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  copy = aperture_barcode_result_new (self->barcode_type, self->data, self->quality, self->timestamp);
+  copy->latency = self->latency;
+  if (self->polygon != NULL) {
+    aperture_barcode_result_set_polygon (copy, self->polygon, self->n_points);
+  }
+
+  return copy;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_result_set_polygon:
+ * @self: an #ApertureBarcodeResult
+ * @points: (array length=n_points): the outline of the barcode, in pixels of
+ * the camera frame
+ * @n_points: the number of points
+ *
+ * Sets the position of the barcode. Only to be used before the result is
+ * handed out.
+ */
+void
+aperture_barcode_result_set_polygon (ApertureBarcodeResult *self, const GdkPoint *points, guint n_points)
+{
+  g_return_if_fail (self != NULL);
+
+  g_free (self->polygon);
+  self->polygon = g_new (GdkPoint, n_points);
+  memcpy (self->polygon, points, n_points * sizeof (GdkPoint));
+  self->n_points = n_points;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_result_set_latency:
+ * @self: an #ApertureBarcodeResult
+ * @latency: the time between the frame being captured and the result being
+ * delivered
+ *
+ * Sets the detection latency. Only to be used before the result is handed
+ * out.
+ */
+void
+aperture_barcode_result_set_latency (ApertureBarcodeResult *self, GstClockTime latency)
+{
+  g_return_if_fail (self != NULL);
+  self->latency = latency;
+}
+
+
+/* PUBLIC */
+
+
+/**
+ * aperture_barcode_result_ref:
+ * @self: an #ApertureBarcodeResult
+ *
+ * Increases the reference count of @self.
+ *
+ * Returns: (transfer full): @self
+ * Since: 0.2
+ */
+ApertureBarcodeResult *
+aperture_barcode_result_ref (ApertureBarcodeResult *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_ref_count_inc (&self->ref_count);
+  return self;
+}
+
+
+/**
+ * aperture_barcode_result_unref:
+ * @self: (transfer full): an #ApertureBarcodeResult
+ *
+ * Decreases the reference count of @self, and frees it when the count
+ * reaches zero.
+ *
+ * Since: 0.2
+ */
+void
+aperture_barcode_result_unref (ApertureBarcodeResult *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (g_atomic_ref_count_dec (&self->ref_count)) {
+    g_free (self->data);
+    g_free (self->polygon);
+    g_free (self);
+  }
+}
+
+
+/**
+ * aperture_barcode_result_get_barcode_type:
+ * @self: an #ApertureBarcodeResult
+ *
+ * Gets the type of the barcode.
+ *
+ * Returns: the type of barcode
+ * Since: 0.2
+ */
+ApertureBarcode
+aperture_barcode_result_get_barcode_type (ApertureBarcodeResult *self)
+{
+  g_return_val_if_fail (self != NULL, APERTURE_BARCODE_UNKNOWN);
+  return self->barcode_type;
+}
+
+
+/**
+ * aperture_barcode_result_get_data:
+ * @self: an #ApertureBarcodeResult
+ *
+ * Gets the data encoded in the barcode.
+ *
+ * Returns: the data encoded in the barcode
+ * Since: 0.2
+ */
+const char *
+aperture_barcode_result_get_data (ApertureBarcodeResult *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  return self->data;
+}
+
+
+/**
+ * aperture_barcode_result_get_quality:
+ * @self: an #ApertureBarcodeResult
+ *
+ * Gets the quality of the detection, as reported by the decoder. Higher is
+ * better; for linear barcodes, this is usually the number of times the code
+ * was read across the frame.
+ *
+ * Returns: the quality
+ * Since: 0.2
+ */
+int
+aperture_barcode_result_get_quality (ApertureBarcodeResult *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+  return self->quality;
+}
+
+
+/**
+ * aperture_barcode_result_get_timestamp:
+ * @self: an #ApertureBarcodeResult
+ *
+ * Gets the presentation timestamp of the frame the barcode was found in.
+ *
+ * Returns: the timestamp, or %GST_CLOCK_TIME_NONE if the frame had none
+ * Since: 0.2
+ */
+GstClockTime
+aperture_barcode_result_get_timestamp (ApertureBarcodeResult *self)
+{
+  g_return_val_if_fail (self != NULL, GST_CLOCK_TIME_NONE);
+  return self->timestamp;
+}
+
+
+/**
+ * aperture_barcode_result_get_latency:
+ * @self: an #ApertureBarcodeResult
+ *
+ * Gets the time between the frame being captured and the barcode being
+ * delivered to the application.
+ *
+ * Returns: the latency, or %GST_CLOCK_TIME_NONE if it is not known
+ * Since: 0.2
+ */
+GstClockTime
+aperture_barcode_result_get_latency (ApertureBarcodeResult *self)
+{
+  g_return_val_if_fail (self != NULL, GST_CLOCK_TIME_NONE);
+  return self->latency;
+}
+
+
+/**
+ * aperture_barcode_result_get_bounding_box:
+ * @self: an #ApertureBarcodeResult
+ * @box: (out caller-allocates) (optional): return location for the bounding
+ * box, in pixels of the camera frame
+ *
+ * Gets the smallest rectangle containing the barcode.
+ *
+ * Not every decoder reports positions. See
+ * aperture_barcode_result_get_polygon().
+ *
+ * Returns: %TRUE if the position of the barcode is known, otherwise %FALSE
+ * Since: 0.2
+ */
+gboolean
+aperture_barcode_result_get_bounding_box (ApertureBarcodeResult *self, GdkRectangle *box)
+{
+  int x1, y1, x2, y2;
+  guint i;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  if (self->n_points == 0) {
+    return FALSE;
+  }
+
+  if (box == NULL) {
+    return TRUE;
+  }
+
+  x1 = x2 = self->polygon[0].x;
+  y1 = y2 = self->polygon[0].y;
+
+  for (i = 1; i < self->n_points; i ++) {
+    x1 = MIN (x1, self->polygon[i].x);
+    y1 = MIN (y1, self->polygon[i].y);
+    x2 = MAX (x2, self->polygon[i].x);
+    y2 = MAX (y2, self->polygon[i].y);
+  }
+
+  box->x = x1;
+  box->y = y1;
+  box->width = x2 - x1 + 1;
+  box->height = y2 - y1 + 1;
+
+  return TRUE;
+}
+
+
+/**
+ * aperture_barcode_result_get_polygon:
+ * @self: an #ApertureBarcodeResult
+ * @n_points: (out): return location for the number of points
+ *
+ * Gets the outline of the barcode, in pixels of the camera frame.
+ *
+ * For linear barcodes, the points are where the scan lines crossed the
+ * barcode; for 2D codes, they are its corners. Barcodes found by the
+ * GStreamer zbar element have no position, and an empty polygon.
+ *
+ * Returns: (array length=n_points) (nullable): the points of the outline
+ * Since: 0.2
+ */
+const GdkPoint *
+aperture_barcode_result_get_polygon (ApertureBarcodeResult *self, guint *n_points)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (n_points != NULL, NULL);
+
+  *n_points = self->n_points;
+  return self->polygon;
+}
@@ -0,0 +1,58 @@
+/* aperture-barcode-result.h
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#pragma once
+
+#include <gdk/gdk.h>
+#include <gst/gst.h>
+
+#if !defined(_LIBAPERTURE_INSIDE) && !defined(_LIBAPERTURE_COMPILATION)
+#error "Only <aperture.h> can be included directly."
+#endif
+
+#include "aperture-utils.h"
+
+
+G_BEGIN_DECLS
+
+
+#define APERTURE_TYPE_BARCODE_RESULT (aperture_barcode_result_get_type())
+
+typedef struct _ApertureBarcodeResult ApertureBarcodeResult;
+
+GType                  aperture_barcode_result_get_type         (void) G_GNUC_CONST;
+
+ApertureBarcodeResult *aperture_barcode_result_ref              (ApertureBarcodeResult *self);
+void                   aperture_barcode_result_unref            (ApertureBarcodeResult *self);
+
+ApertureBarcode        aperture_barcode_result_get_barcode_type (ApertureBarcodeResult *self);
+const char            *aperture_barcode_result_get_data         (ApertureBarcodeResult *self);
+int                    aperture_barcode_result_get_quality      (ApertureBarcodeResult *self);
+GstClockTime           aperture_barcode_result_get_timestamp    (ApertureBarcodeResult *self);
+GstClockTime           aperture_barcode_result_get_latency      (ApertureBarcodeResult *self);
+gboolean               aperture_barcode_result_get_bounding_box (ApertureBarcodeResult *self,
+                                                                 GdkRectangle          *box);
+const GdkPoint        *aperture_barcode_result_get_polygon      (ApertureBarcodeResult *self,
+                                                                 guint                 *n_points);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ApertureBarcodeResult, aperture_barcode_result_unref)
+
+G_END_DECLS
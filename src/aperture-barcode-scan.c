@@ -0,0 +1,377 @@
+/* aperture-barcode-scan.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+/**
+ * SECTION:aperture-barcode-scan
+ * @title: Scanning image files
+ * @short_description: Look for barcodes in images that are already captured
+ *
+ * aperture_scan_barcodes_in_files_async() looks for barcodes in image files
+ * rather than in a camera feed, for example to go through an archive of
+ * pictures taken earlier. It doesn't need an #ApertureViewfinder or a
+ * camera, and uses the same decoders and the same #ApertureBarcode types as
+ * the viewfinder.
+ *
+ * Images are loaded and scanned on several threads at once, and the results
+ * for each image are handed back as soon as it is done.
+ *
+ * Since: 0.2
+ */
+
+
+#ifdef HAVE_BARCODE_DECODER
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "barcode/aperture-barcode-decoder.h"
+#endif
+#include "aperture-barcode-scan.h"
+
+
+#ifdef HAVE_BARCODE_DECODER
+typedef struct {
+  ApertureBarcodeScanFunc func;
+  gpointer data;
+  GDestroyNotify data_destroy;
+  GMainContext *context;
+
+  GPtrArray *files;
+  /* decoders not in use by any thread right now */
+  GAsyncQueue *decoders;
+} Scan;
+
+/* The results for one file, on their way to the caller's main context */
+typedef struct {
+  GTask *task;
+  GFile *file;
+  GPtrArray *results;
+  GError *error;
+} Report;
+
+
+static void
+scan_free (Scan *scan)
+{
+  if (scan->data_destroy) {
+    scan->data_destroy (scan->data);
+  }
+  g_main_context_unref (scan->context);
+  g_ptr_array_unref (scan->files);
+  g_async_queue_unref (scan->decoders);
+  g_free (scan);
+}
+
+
+static void
+report_free (Report *report)
+{
+  g_object_unref (report->task);
+  g_object_unref (report->file);
+  g_clear_pointer (&report->results, g_ptr_array_unref);
+  g_clear_error (&report->error);
+  g_free (report);
+}
+
+
+static gboolean
+report_func (gpointer user_data)
+{
+  Report *report = user_data;
+  Scan *scan = g_task_get_task_data (report->task);
+
+  if (!g_cancellable_is_cancelled (g_task_get_cancellable (report->task))) {
+    scan->func (report->file, report->results, report->error, scan->data);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+
+/* Hands the results for a file to the scan function, in the main context
+ * the scan was started from. Takes ownership of @results and @error. */
+static void
+report_file (GTask *task, GFile *file, GPtrArray *results, GError *error)
+{
+  Scan *scan = g_task_get_task_data (task);
+  Report *report;
+
+  report = g_new0 (Report, 1);
+  report->task = g_object_ref (task);
+  report->file = g_object_ref (file);
+  report->results = results;
+  report->error = error;
+
+  g_main_context_invoke_full (scan->context,
+                              G_PRIORITY_DEFAULT,
+                              report_func,
+                              report,
+                              (GDestroyNotify) report_free);
+}
+
+
+/* Runs on the thread pool, once per image */
+static void
+scan_file_func (gpointer data, gpointer user_data)
+{
+  g_autoptr(GFile) file = data;
+  GTask *task = user_data;
+  Scan *scan = g_task_get_task_data (task);
+  GCancellable *cancellable = g_task_get_cancellable (task);
+  g_autoptr(GFileInputStream) stream = NULL;
+  g_autoptr(GdkPixbuf) pixbuf = NULL;
+  ApertureBarcodeDecoder *decoder;
+  GPtrArray *results;
+  GError *error = NULL;
+
+  if (g_cancellable_is_cancelled (cancellable)) {
+    return;
+  }
+
+  stream = g_file_read (file, cancellable, &error);
+  if (stream != NULL) {
+    pixbuf = gdk_pixbuf_new_from_stream (G_INPUT_STREAM (stream), cancellable, &error);
+  }
+
+  if (pixbuf == NULL) {
+    report_file (task, file, NULL, error);
+    return;
+  }
+
+  decoder = g_async_queue_try_pop (scan->decoders);
+  if (decoder == NULL) {
+    decoder = aperture_barcode_decoder_new (NULL);
+  }
+
+  results = aperture_barcode_decoder_decode_pixbuf (decoder, pixbuf);
+
+  g_async_queue_push (scan->decoders, decoder);
+
+  report_file (task, file, results, NULL);
+}
+
+
+/* Queues @file, or the images in it if it is a directory, recursively */
+static void
+queue_file (GTask *task, GThreadPool *pool, GFile *file)
+{
+  GCancellable *cancellable = g_task_get_cancellable (task);
+  g_autoptr(GFileEnumerator) enumerator = NULL;
+  GError *error = NULL;
+
+  if (g_file_query_file_type (file, G_FILE_QUERY_INFO_NONE, cancellable) != G_FILE_TYPE_DIRECTORY) {
+    /* files that were asked for explicitly are always tried */
+    g_thread_pool_push (pool, g_object_ref (file), NULL);
+    return;
+  }
+
+  enumerator = g_file_enumerate_children (file,
+                                          G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                          G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                                          G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
+                                          G_FILE_QUERY_INFO_NONE,
+                                          cancellable,
+                                          &error);
+  if (enumerator == NULL) {
+    report_file (task, file, NULL, error);
+    return;
+  }
+
+  while (!g_cancellable_is_cancelled (cancellable)) {
+    GFileInfo *info;
+    GFile *child;
+    const char *content_type;
+    g_autofree char *mime_type = NULL;
+
+    if (!g_file_enumerator_iterate (enumerator, &info, &child, cancellable, NULL) || info == NULL) {
+      break;
+    }
+
+    if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY) {
+      queue_file (task, pool, child);
+      continue;
+    }
+
+    /* in directories, only look at images */
+    content_type = g_file_info_get_content_type (info);
+    if (content_type != NULL) {
+      mime_type = g_content_type_get_mime_type (content_type);
+    }
+
+    if (mime_type != NULL && g_str_has_prefix (mime_type, "image/")) {
+      g_thread_pool_push (pool, g_object_ref (child), NULL);
+    }
+  }
+}
+
+
+static void
+scan_thread_func (GTask        *task,
+                  gpointer      source_object,
+                  gpointer      task_data,
+                  GCancellable *cancellable)
+{
+  Scan *scan = task_data;
+  GThreadPool *pool;
+  guint i;
+
+  /* decoding images takes longer than finding them, so every processor
+   * gets a thread */
+  pool = g_thread_pool_new (scan_file_func, task, g_get_num_processors (), FALSE, NULL);
+
+  for (i = 0; i < scan->files->len && !g_cancellable_is_cancelled (cancellable); i ++) {
+    queue_file (task, pool, g_ptr_array_index (scan->files, i));
+  }
+
+  /* wait for all the images to be scanned */
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  g_async_queue_lock (scan->decoders);
+  while (g_async_queue_length_unlocked (scan->decoders) > 0) {
+    aperture_barcode_decoder_free (g_async_queue_pop_unlocked (scan->decoders));
+  }
+  g_async_queue_unlock (scan->decoders);
+
+  if (!g_task_return_error_if_cancelled (task)) {
+    g_task_return_boolean (task, TRUE);
+  }
+}
+#endif
+
+
+/**
+ * ApertureBarcodeScanFunc:
+ * @file: the image file that was scanned
+ * @results: (element-type ApertureBarcodeResult) (nullable): the barcodes
+ * found in @file, or %NULL if it could not be read
+ * @error: (nullable): the reason @file could not be read, or %NULL
+ * @user_data: the user data passed to aperture_scan_barcodes_in_files_async()
+ *
+ * Called for each image scanned by aperture_scan_barcodes_in_files_async().
+ *
+ * Since: 0.2
+ */
+
+
+/**
+ * aperture_scan_barcodes_in_files_async:
+ * @files: (array length=n_files): the image files and directories to scan
+ * @n_files: the number of items in @files
+ * @scan_func: (scope notified): function to call with the results for each
+ * image
+ * @scan_data: user data for @scan_func
+ * @scan_data_destroy: (nullable): function to free @scan_data when the scan
+ * is done, which may be called on any thread
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: function to call when all the images have been scanned
+ * @user_data: user data for @callback
+ *
+ * Looks for barcodes in image files, without a camera.
+ *
+ * Directories in @files are searched recursively for images, going by
+ * their content type. Files listed directly in @files are always tried.
+ *
+ * Images are scanned on a pool of threads, with one thread per processor.
+ * @scan_func is called in the thread-default main context of the caller
+ * once for each image, as soon as it is done, so results come in while the
+ * rest of the images are still being scanned. Images are not necessarily
+ * reported in the order they were given. A file that can't be read as an
+ * image is reported with an error, and doesn't stop the scan.
+ *
+ * The results have no timestamp or latency. Their positions are in pixels
+ * of the image.
+ *
+ * @callback is called after @scan_func has been called for the last time.
+ * This only works if Aperture was built against a barcode library (zbar or
+ * ZXing-C++); otherwise, the scan fails with %G_IO_ERROR_NOT_SUPPORTED.
+ *
+ * Since: 0.2
+ */
+void
+aperture_scan_barcodes_in_files_async (GFile                   **files,
+                                       guint                     n_files,
+                                       ApertureBarcodeScanFunc   scan_func,
+                                       gpointer                  scan_data,
+                                       GDestroyNotify            scan_data_destroy,
+                                       GCancellable             *cancellable,
+                                       GAsyncReadyCallback       callback,
+                                       gpointer                  user_data)
+{
+#ifdef HAVE_BARCODE_DECODER
+  g_autoptr(GTask) task = NULL;
+  Scan *scan;
+#endif
+  guint i;
+
+  g_return_if_fail (files != NULL || n_files == 0);
+  for (i = 0; i < n_files; i ++) {
+    g_return_if_fail (G_IS_FILE (files[i]));
+  }
+  g_return_if_fail (scan_func != NULL);
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+#ifdef HAVE_BARCODE_DECODER
+  scan = g_new0 (Scan, 1);
+  scan->func = scan_func;
+  scan->data = scan_data;
+  scan->data_destroy = scan_data_destroy;
+  scan->context = g_main_context_ref_thread_default ();
+  scan->files = g_ptr_array_new_with_free_func (g_object_unref);
+  scan->decoders = g_async_queue_new ();
+
+  for (i = 0; i < n_files; i ++) {
+    g_ptr_array_add (scan->files, g_object_ref (files[i]));
+  }
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, aperture_scan_barcodes_in_files_async);
+  g_task_set_task_data (task, scan, (GDestroyNotify) scan_free);
+  g_task_run_in_thread (task, scan_thread_func);
+#else
+  if (scan_data_destroy) {
+    scan_data_destroy (scan_data);
+  }
+
+  g_task_report_new_error (NULL, callback, user_data,
+                           aperture_scan_barcodes_in_files_async,
+                           G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Scanning image files needs Aperture to be built against a barcode library");
+#endif
+}
+
+
+/**
+ * aperture_scan_barcodes_in_files_finish:
+ * @result: a #GAsyncResult
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes an operation started by aperture_scan_barcodes_in_files_async().
+ *
+ * Returns: %TRUE if the scan finished, %FALSE if it was cancelled or could
+ * not be done
+ *
+ * Since: 0.2
+ */
+gboolean
+aperture_scan_barcodes_in_files_finish (GAsyncResult *result, GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
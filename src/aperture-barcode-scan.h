@@ -0,0 +1,53 @@
+/* aperture-barcode-scan.h
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#pragma once
+
+#include <gio/gio.h>
+
+#if !defined(_LIBAPERTURE_INSIDE) && !defined(_LIBAPERTURE_COMPILATION)
+#error "Only <aperture.h> can be included directly."
+#endif
+
+#include "aperture-barcode-result.h"
+
+
+G_BEGIN_DECLS
+
+
+typedef void (*ApertureBarcodeScanFunc) (GFile        *file,
+                                         GPtrArray    *results,
+                                         const GError *error,
+                                         gpointer      user_data);
+
+
+void     aperture_scan_barcodes_in_files_async  (GFile                   **files,
+                                                 guint                     n_files,
+                                                 ApertureBarcodeScanFunc   scan_func,
+                                                 gpointer                  scan_data,
+                                                 GDestroyNotify            scan_data_destroy,
+                                                 GCancellable             *cancellable,
+                                                 GAsyncReadyCallback       callback,
+                                                 gpointer                  user_data);
+gboolean aperture_scan_barcodes_in_files_finish (GAsyncResult             *result,
+                                                 GError                  **error);
+
+G_END_DECLS
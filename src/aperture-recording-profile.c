@@ -0,0 +1,367 @@
+/* aperture-recording-profile.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+/**
+ * SECTION:aperture-recording-profile
+ * @title: ApertureRecordingProfile
+ * @short_description: How videos are encoded
+ *
+ * An #ApertureRecordingProfile describes how an #ApertureViewfinder encodes
+ * the videos it records: the codec, bitrate, keyframe interval, framerate
+ * and resolution. See aperture_viewfinder_set_recording_profile().
+ *
+ * Settings left at 0 are up to the encoder or the camera.
+ *
+ * Since: 0.2
+ */
+
+/**
+ * ApertureRecordingProfile:
+ *
+ * An opaque structure describing how videos are encoded.
+ *
+ * Since: 0.2
+ */
+
+/**
+ * ApertureVideoCodec:
+ * @APERTURE_VIDEO_CODEC_H264: H.264, also known as AVC. Plays almost
+ * anywhere.
+ * @APERTURE_VIDEO_CODEC_H265: H.265, also known as HEVC. Smaller files at
+ * the same quality, but slower to encode in software.
+ *
+ * The codecs that videos can be recorded in.
+ *
+ * Since: 0.2
+ */
+
+/**
+ * ApertureRateControl:
+ * @APERTURE_RATE_CONTROL_VARIABLE: Spend fewer bits on simple scenes. The
+ * bitrate is an upper limit.
+ * @APERTURE_RATE_CONTROL_CONSTANT: Keep close to the bitrate all the time,
+ * which is easier to stream.
+ *
+ * How the encoder spends its bitrate.
+ *
+ * Since: 0.2
+ */
+
+
+#include "aperture-recording-profile.h"
+
+
+struct _ApertureRecordingProfile
+{
+  ApertureVideoCodec codec;
+  guint bitrate;
+  ApertureRateControl rate_control;
+  guint keyframe_interval;
+  guint framerate;
+  guint width;
+  guint height;
+};
+
+G_DEFINE_BOXED_TYPE (ApertureRecordingProfile, aperture_recording_profile, aperture_recording_profile_copy, aperture_recording_profile_free)
+
+
+/* PUBLIC */
+
+
+/**
+ * aperture_recording_profile_new:
+ *
+ * Creates a new #ApertureRecordingProfile, for H.264 at 30 frames per
+ * second, with everything else up to the encoder.
+ *
+ * Returns: (transfer full): a new #ApertureRecordingProfile
+ * Since: 0.2
+ */
+ApertureRecordingProfile *
+aperture_recording_profile_new (void)
+{
+  ApertureRecordingProfile *self = g_new0 (ApertureRecordingProfile, 1);
+
+  self->codec = APERTURE_VIDEO_CODEC_H264;
+  self->rate_control = APERTURE_RATE_CONTROL_VARIABLE;
+  self->framerate = 30;
+
+  return self;
+}
+
+
+/**
+ * aperture_recording_profile_copy:
+ * @self: an #ApertureRecordingProfile
+ *
+ * Copies @self.
+ *
+ * Returns: (transfer full): a copy of @self
+ * Since: 0.2
+ */
+ApertureRecordingProfile *
+aperture_recording_profile_copy (const ApertureRecordingProfile *self)
+{
+  ApertureRecordingProfile *copy;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  copy = g_new (ApertureRecordingProfile, 1);
+  *copy = *self;
+  return copy;
+}
+
+
+/**
+ * aperture_recording_profile_free:
+ * @self: (transfer full): an #ApertureRecordingProfile
+ *
+ * Frees @self.
+ *
+ * Since: 0.2
+ */
+void
+aperture_recording_profile_free (ApertureRecordingProfile *self)
+{
+  g_free (self);
+}
+
+
+/**
+ * aperture_recording_profile_set_codec:
+ * @self: an #ApertureRecordingProfile
+ * @codec: the codec to encode in
+ *
+ * Sets the codec. Not every container can hold every codec; both MP4 and
+ * Matroska can hold all of them.
+ *
+ * Since: 0.2
+ */
+void
+aperture_recording_profile_set_codec (ApertureRecordingProfile *self, ApertureVideoCodec codec)
+{
+  g_return_if_fail (self != NULL);
+  self->codec = codec;
+}
+
+
+/**
+ * aperture_recording_profile_get_codec:
+ * @self: an #ApertureRecordingProfile
+ *
+ * Gets the codec.
+ *
+ * Returns: the codec to encode in
+ * Since: 0.2
+ */
+ApertureVideoCodec
+aperture_recording_profile_get_codec (const ApertureRecordingProfile *self)
+{
+  g_return_val_if_fail (self != NULL, APERTURE_VIDEO_CODEC_H264);
+  return self->codec;
+}
+
+
+/**
+ * aperture_recording_profile_set_bitrate:
+ * @self: an #ApertureRecordingProfile
+ * @bitrate: the bitrate in kbit/s, or 0
+ *
+ * Sets the bitrate, in kilobits per second. How it is used depends on the
+ * rate control; see aperture_recording_profile_set_rate_control().
+ *
+ * Since: 0.2
+ */
+void
+aperture_recording_profile_set_bitrate (ApertureRecordingProfile *self, guint bitrate)
+{
+  g_return_if_fail (self != NULL);
+  self->bitrate = bitrate;
+}
+
+
+/**
+ * aperture_recording_profile_get_bitrate:
+ * @self: an #ApertureRecordingProfile
+ *
+ * Gets the bitrate, in kilobits per second.
+ *
+ * Returns: the bitrate in kbit/s, or 0 if it is up to the encoder
+ * Since: 0.2
+ */
+guint
+aperture_recording_profile_get_bitrate (const ApertureRecordingProfile *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+  return self->bitrate;
+}
+
+
+/**
+ * aperture_recording_profile_set_rate_control:
+ * @self: an #ApertureRecordingProfile
+ * @rate_control: how to spend the bitrate
+ *
+ * Sets how the encoder spends its bitrate.
+ *
+ * Since: 0.2
+ */
+void
+aperture_recording_profile_set_rate_control (ApertureRecordingProfile *self, ApertureRateControl rate_control)
+{
+  g_return_if_fail (self != NULL);
+  self->rate_control = rate_control;
+}
+
+
+/**
+ * aperture_recording_profile_get_rate_control:
+ * @self: an #ApertureRecordingProfile
+ *
+ * Gets how the encoder spends its bitrate.
+ *
+ * Returns: the rate control
+ * Since: 0.2
+ */
+ApertureRateControl
+aperture_recording_profile_get_rate_control (const ApertureRecordingProfile *self)
+{
+  g_return_val_if_fail (self != NULL, APERTURE_RATE_CONTROL_VARIABLE);
+  return self->rate_control;
+}
+
+
+/**
+ * aperture_recording_profile_set_keyframe_interval:
+ * @self: an #ApertureRecordingProfile
+ * @interval: the maximum number of frames between keyframes, or 0
+ *
+ * Sets the maximum number of frames from one keyframe to the next. 0 means
+ * one keyframe per second.
+ *
+ * Shorter intervals make seeking faster, and let segments and fragments be
+ * cut closer to their target durations, at the cost of bigger files.
+ *
+ * Since: 0.2
+ */
+void
+aperture_recording_profile_set_keyframe_interval (ApertureRecordingProfile *self, guint interval)
+{
+  g_return_if_fail (self != NULL);
+  self->keyframe_interval = interval;
+}
+
+
+/**
+ * aperture_recording_profile_get_keyframe_interval:
+ * @self: an #ApertureRecordingProfile
+ *
+ * Gets the maximum number of frames from one keyframe to the next.
+ *
+ * Returns: the keyframe interval in frames, or 0 for one per second
+ * Since: 0.2
+ */
+guint
+aperture_recording_profile_get_keyframe_interval (const ApertureRecordingProfile *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+  return self->keyframe_interval;
+}
+
+
+/**
+ * aperture_recording_profile_set_framerate:
+ * @self: an #ApertureRecordingProfile
+ * @framerate: frames per second
+ *
+ * Sets the framerate.
+ *
+ * Since: 0.2
+ */
+void
+aperture_recording_profile_set_framerate (ApertureRecordingProfile *self, guint framerate)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (framerate > 0);
+
+  self->framerate = framerate;
+}
+
+
+/**
+ * aperture_recording_profile_get_framerate:
+ * @self: an #ApertureRecordingProfile
+ *
+ * Gets the framerate.
+ *
+ * Returns: frames per second
+ * Since: 0.2
+ */
+guint
+aperture_recording_profile_get_framerate (const ApertureRecordingProfile *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+  return self->framerate;
+}
+
+
+/**
+ * aperture_recording_profile_set_resolution:
+ * @self: an #ApertureRecordingProfile
+ * @width: the width in pixels, or 0
+ * @height: the height in pixels, or 0
+ *
+ * Sets the size of the video. 0 leaves it up to the camera.
+ *
+ * Since: 0.2
+ */
+void
+aperture_recording_profile_set_resolution (ApertureRecordingProfile *self, guint width, guint height)
+{
+  g_return_if_fail (self != NULL);
+
+  self->width = width;
+  self->height = height;
+}
+
+
+/**
+ * aperture_recording_profile_get_resolution:
+ * @self: an #ApertureRecordingProfile
+ * @width: (out) (optional): return location for the width, or 0
+ * @height: (out) (optional): return location for the height, or 0
+ *
+ * Gets the size of the video.
+ *
+ * Since: 0.2
+ */
+void
+aperture_recording_profile_get_resolution (const ApertureRecordingProfile *self, guint *width, guint *height)
+{
+  g_return_if_fail (self != NULL);
+
+  if (width != NULL) {
+    *width = self->width;
+  }
+  if (height != NULL) {
+    *height = self->height;
+  }
+}
@@ -0,0 +1,80 @@
+/* aperture-recording-profile.h
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+
+#pragma once
+
+#include <glib-object.h>
+
+#if !defined(_LIBAPERTURE_INSIDE) && !defined(_LIBAPERTURE_COMPILATION)
+#error "Only <aperture.h> can be included directly."
+#endif
+
+
+G_BEGIN_DECLS
+
+
+typedef enum {
+  APERTURE_VIDEO_CODEC_H264,
+  APERTURE_VIDEO_CODEC_H265,
+} ApertureVideoCodec;
+
+typedef enum {
+  APERTURE_RATE_CONTROL_VARIABLE,
+  APERTURE_RATE_CONTROL_CONSTANT,
+} ApertureRateControl;
+
+
+#define APERTURE_TYPE_RECORDING_PROFILE (aperture_recording_profile_get_type())
+
+typedef struct _ApertureRecordingProfile ApertureRecordingProfile;
+
+GType                     aperture_recording_profile_get_type              (void) G_GNUC_CONST;
+
+ApertureRecordingProfile *aperture_recording_profile_new                   (void);
+ApertureRecordingProfile *aperture_recording_profile_copy                  (const ApertureRecordingProfile *self);
+void                      aperture_recording_profile_free                  (ApertureRecordingProfile       *self);
+
+void                      aperture_recording_profile_set_codec             (ApertureRecordingProfile       *self,
+                                                                            ApertureVideoCodec              codec);
+ApertureVideoCodec        aperture_recording_profile_get_codec             (const ApertureRecordingProfile *self);
+void                      aperture_recording_profile_set_bitrate           (ApertureRecordingProfile       *self,
+                                                                            guint                           bitrate);
+guint                     aperture_recording_profile_get_bitrate           (const ApertureRecordingProfile *self);
+void                      aperture_recording_profile_set_rate_control      (ApertureRecordingProfile       *self,
+                                                                            ApertureRateControl             rate_control);
+ApertureRateControl       aperture_recording_profile_get_rate_control      (const ApertureRecordingProfile *self);
+void                      aperture_recording_profile_set_keyframe_interval (ApertureRecordingProfile       *self,
+                                                                            guint                           interval);
+guint                     aperture_recording_profile_get_keyframe_interval (const ApertureRecordingProfile *self);
+void                      aperture_recording_profile_set_framerate         (ApertureRecordingProfile       *self,
+                                                                            guint                           framerate);
+guint                     aperture_recording_profile_get_framerate         (const ApertureRecordingProfile *self);
+void                      aperture_recording_profile_set_resolution        (ApertureRecordingProfile       *self,
+                                                                            guint                           width,
+                                                                            guint                           height);
+void                      aperture_recording_profile_get_resolution        (const ApertureRecordingProfile *self,
+                                                                            guint                          *width,
+                                                                            guint                          *height);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ApertureRecordingProfile, aperture_recording_profile_free)
+
+G_END_DECLS
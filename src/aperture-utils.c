@@ -24,6 +24,9 @@
 
 #include "aperture-build-info.h"
 #include "aperture-utils.h"
+#ifdef HAVE_BARCODE_DECODER
+#include "barcode/aperture-barcode-decoder.h"
+#endif
 
 
 #define BOOL_STR(x) (x ? "TRUE" : "FALSE")
@@ -115,9 +118,13 @@ aperture_private_ensure_initialized (void)
  * plugin yourself. For a Flatpak example, see the demo application in
  * Aperture's source code.
  *
- * Note that Aperture itself does *not* need to be recompiled to enable
- * barcode detection. It is based solely on whether the GStreamer plugin
- * is available.
+ * If Aperture was built against a barcode library itself (zbar or
+ * ZXing-C++), barcode detection is always available, and frames are decoded
+ * on several threads instead of using the GStreamer plugin. The
+ * `APERTURE_BARCODE_BACKEND` environment variable picks the library, if
+ * Aperture was built against both. Otherwise, Aperture does *not* need to be
+ * recompiled to enable barcode detection; it is based solely on whether the
+ * GStreamer plugin is available.
  *
  * Returns: %TRUE if barcode detection is available, otherwise %FALSE
  * Since: 0.1
@@ -125,8 +132,12 @@ aperture_private_ensure_initialized (void)
 gboolean
 aperture_is_barcode_detection_enabled (void)
 {
+#ifdef HAVE_BARCODE_DECODER
+  return TRUE;
+#else
   g_autoptr(GstElementFactory) factory = gst_element_factory_find ("zbar");
   return factory != NULL;
+#endif
 }
 
 
@@ -167,6 +178,12 @@ aperture_get_diagnostic_info (void)
   g_autolist(GstDevice) devices = NULL;
   g_autoptr(GString) device_info = g_string_new (NULL);
   g_autofree char *etc_os_release = read_file ("/etc/os-release");
+#ifdef HAVE_BARCODE_DECODER
+  g_auto(GStrv) backends = aperture_barcode_decoder_list_backends ();
+  g_autofree char *barcode_backends = g_strjoinv (", ", backends);
+#else
+  const char *barcode_backends = "none";
+#endif
 
   if (gst_is_initialized ()) {
     int n = 0;
@@ -214,6 +231,7 @@ aperture_get_diagnostic_info (void)
     "  version = %d.%d.%d\n"
     "  initialized = %s\n"
     "  zbar_enabled = %s\n"
+    "  barcode_backends = %s\n"
     "%s"
     ,
     etc_os_release,
@@ -224,6 +242,7 @@ aperture_get_diagnostic_info (void)
     APERTURE_MAJOR_VERSION, APERTURE_MINOR_VERSION, APERTURE_MICRO_VERSION,
     BOOL_STR (aperture_is_initialized ()),
     BOOL_STR (aperture_is_barcode_detection_enabled ()),
+    barcode_backends,
     device_info->str
   );
 }
@@ -261,6 +280,36 @@ aperture_get_diagnostic_info (void)
  */
 
 
+/* The names ZBar uses for each barcode type, indexed by #ApertureBarcode.
+ * This list is from https://github.com/ZBar/ZBar/blob/854a5d97059e395807091ac4d80c53f7968abb8f/zbar/symbol.c */
+static const char * const barcode_names[] = {
+  [APERTURE_BARCODE_UNKNOWN] = NULL,
+  [APERTURE_BARCODE_COMPOSITE] = "COMPOSITE",
+  [APERTURE_BARCODE_EAN2] = "EAN-2",
+  [APERTURE_BARCODE_EAN5] = "EAN-5",
+  [APERTURE_BARCODE_EAN8] = "EAN-8",
+  [APERTURE_BARCODE_EAN13] = "EAN-13",
+  [APERTURE_BARCODE_UPCA] = "UPC-A",
+  [APERTURE_BARCODE_UPCE] = "UPC-E",
+  [APERTURE_BARCODE_ISBN10] = "ISBN-10",
+  [APERTURE_BARCODE_ISBN13] = "ISBN-13",
+  [APERTURE_BARCODE_I25] = "I2/5",
+  [APERTURE_BARCODE_DATABAR] = "DataBar",
+  [APERTURE_BARCODE_DATABAR_EXP] = "DataBar-Exp",
+  [APERTURE_BARCODE_CODABAR] = "Codabar",
+  [APERTURE_BARCODE_CODE39] = "CODE-39",
+  [APERTURE_BARCODE_CODE93] = "CODE-93",
+  [APERTURE_BARCODE_CODE128] = "CODE-128",
+  [APERTURE_BARCODE_PDF417] = "PDF417",
+  [APERTURE_BARCODE_QR] = "QR-Code",
+};
+
+/* Fails to compile if a value is added to the enum but not to the table */
+G_STATIC_ASSERT (G_N_ELEMENTS (barcode_names) == APERTURE_BARCODE_N_TYPES);
+/* Sets of barcode types are passed around as a guint32 mask */
+G_STATIC_ASSERT (APERTURE_BARCODE_N_TYPES <= 32);
+
+
 /**
  * PRIVATE:aperture_barcode_type_from_string:
  * @string: a barcode type string from ZBar
@@ -274,45 +323,25 @@ aperture_get_diagnostic_info (void)
 ApertureBarcode
 aperture_barcode_type_from_string (const char *string)
 {
-  // This list is from https://github.com/ZBar/ZBar/blob/854a5d97059e395807091ac4d80c53f7968abb8f/zbar/symbol.c
-
-  if (g_strcmp0 (string, "COMPOSITE") == 0) {
-    return APERTURE_BARCODE_COMPOSITE;
-  } else if (g_strcmp0 (string, "EAN-2") == 0) {
-    return APERTURE_BARCODE_EAN2;
-  } else if (g_strcmp0 (string, "EAN-5") == 0) {
-    return APERTURE_BARCODE_EAN5;
-  } else if (g_strcmp0 (string, "EAN-8") == 0) {
-    return APERTURE_BARCODE_EAN8;
-  } else if (g_strcmp0 (string, "EAN-13") == 0) {
-    return APERTURE_BARCODE_EAN13;
-  } else if (g_strcmp0 (string, "UPC-A") == 0) {
-    return APERTURE_BARCODE_UPCA;
-  } else if (g_strcmp0 (string, "UPC-E") == 0) {
-    return APERTURE_BARCODE_UPCE;
-  } else if (g_strcmp0 (string, "ISBN-10") == 0) {
-    return APERTURE_BARCODE_ISBN13;
-  } else if (g_strcmp0 (string, "ISBN-13") == 0) {
-    return APERTURE_BARCODE_ISBN10;
-  } else if (g_strcmp0 (string, "I2/5") == 0) {
-    return APERTURE_BARCODE_I25;
-  } else if (g_strcmp0 (string, "DataBar") == 0) {
-    return APERTURE_BARCODE_DATABAR;
-  } else if (g_strcmp0 (string, "DataBar-Exp") == 0) {
-    return APERTURE_BARCODE_DATABAR_EXP;
-  } else if (g_strcmp0 (string, "Codabar") == 0) {
-    return APERTURE_BARCODE_CODABAR;
-  } else if (g_strcmp0 (string, "CODE-39") == 0) {
-    return APERTURE_BARCODE_CODE39;
-  } else if (g_strcmp0 (string, "CODE-93") == 0) {
-    return APERTURE_BARCODE_CODE93;
-  } else if (g_strcmp0 (string, "CODE-128") == 0) {
-    return APERTURE_BARCODE_CODE128;
-  } else if (g_strcmp0 (string, "PDF417") == 0) {
-    return APERTURE_BARCODE_PDF417;
-  } else if (g_strcmp0 (string, "QR-Code") == 0) {
-    return APERTURE_BARCODE_QR;
-  } else {
-    return APERTURE_BARCODE_UNKNOWN;
+  static GHashTable *types = NULL;
+  gpointer type;
+
+  if (g_once_init_enter (&types)) {
+    GHashTable *table = g_hash_table_new (g_str_hash, g_str_equal);
+    int i;
+
+    for (i = 0; i < (int) G_N_ELEMENTS (barcode_names); i ++) {
+      if (barcode_names[i] != NULL) {
+        g_hash_table_insert (table, (gpointer) barcode_names[i], GINT_TO_POINTER (i));
+      }
+    }
+
+    g_once_init_leave (&types, table);
   }
+
+  if (string != NULL && g_hash_table_lookup_extended (types, string, NULL, &type)) {
+    return GPOINTER_TO_INT (type);
+  }
+
+  return APERTURE_BARCODE_UNKNOWN;
 }
@@ -51,6 +51,8 @@ typedef enum {
   APERTURE_BARCODE_CODE128,
   APERTURE_BARCODE_PDF417,
   APERTURE_BARCODE_QR,
+  /*< private >*/
+  APERTURE_BARCODE_N_TYPES,
 } ApertureBarcode;
 
 
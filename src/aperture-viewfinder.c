@@ -47,6 +47,17 @@
  * Since: 0.1
  */
 
+/**
+ * ApertureVideoContainer:
+ * @APERTURE_VIDEO_CONTAINER_MP4: An MP4 file.
+ * @APERTURE_VIDEO_CONTAINER_MATROSKA: A Matroska (.mkv) file.
+ *
+ * The file format that videos are recorded in. See
+ * #ApertureViewfinder:video-container.
+ *
+ * Since: 0.2
+ */
+
 /**
  * APERTURE_MEDIA_CAPTURE_ERROR:
  *
@@ -71,7 +82,19 @@
  */
 
 
+#include <gst/app/app.h>
+#include <string.h>
+
+#ifdef HAVE_BARCODE_DECODER
+#include "barcode/aperture-barcode-decoder.h"
+#endif
+#include "pipeline/aperture-pipeline-barcode.h"
+#include "pipeline/aperture-pipeline-encoder.h"
+#include "pipeline/aperture-pipeline-preroll.h"
+#include "pipeline/aperture-pipeline-proxy.h"
+#include "pipeline/aperture-pipeline-recorder.h"
 #include "pipeline/aperture-pipeline-tee.h"
+#include "private/aperture-barcode-result-private.h"
 #include "private/aperture-camera-private.h"
 #include "private/aperture-private.h"
 #include "aperture-camera.h"
@@ -79,6 +102,17 @@
 #include "aperture-utils.h"
 #include "aperture-viewfinder.h"
 
+
+/* How often a recording is checked for storage falling behind */
+#define ADAPT_INTERVAL_MS 500
+/* Checks to skip at the start of a recording, while the pre-roll ring is
+ * written out */
+#define ADAPT_GRACE_CHECKS 4
+/* How many checks in a row storage has to keep up before the rate goes
+ * back up */
+#define ADAPT_RECOVER_CHECKS 10
+
+
 struct _ApertureViewfinder
 {
   GtkBin parent_instance;
@@ -89,7 +123,12 @@ struct _ApertureViewfinder
   GstElement *camera_src;
   ApertureViewfinderState state;
 
-  GstElement *branch_zbar;
+  AperturePipelineBarcode *branch_zbar;
+  gboolean has_barcode_roi;
+  GdkRectangle barcode_roi;
+  double barcode_scale;
+  /* one bit per ApertureBarcode, or 0 for all */
+  guint32 barcode_types;
 
   GstElement *gtksink;
   GstElement *vf_csp;
@@ -101,16 +140,64 @@ struct _ApertureViewfinder
   GstElement *fs_q;
   const gchar *tmp_pic_path;
 
-  GstElement *filesink;
+  /* Encodes the camera's video for the recording profile. The pre-roll
+   * ring and the recording branches hang off it. */
+  AperturePipelineEncoder *encoder;
+  ApertureRecordingProfile *recording_profile;
+  /* the profile changed during a recording */
+  gboolean encoder_outdated;
+  AperturePipelineRecorder *recorder;
+  /* the branch for the next recording to a file, linked and waiting */
+  AperturePipelineRecorder *standby;
+  /* A low-resolution copy of the recording, made from the viewfinder's
+   * frames. The recording is done once both files are. */
+  AperturePipelineProxy *proxy;
+  ApertureRecordingProfile *proxy_profile;
+  gboolean recorder_done;
+  ApertureVideoContainer video_container;
+  guint video_fragment_duration;
+  gboolean video_faststart;
+  guint video_segment_duration;
+  guint64 video_segment_size;
+  guint64 video_write_buffer_size;
+  guint video_sync_interval;
+
+  /* Throttles the encoder while storage can't keep up with a recording */
+  gboolean video_adaptive_rate;
+  guint adapt_source;
+  guint64 adapt_buffer_size;
+  guint64 adapt_written;
+  GstClockTime adapt_blocked_time;
+  guint adapt_calm;
+  guint adapt_cooldown;
+
+  /* NULL unless video-preroll is set. While it is capturing, the camera
+   * stays in video mode and its video goes into the ring. */
+  AperturePipelinePreroll *preroll;
+  guint video_preroll;
+  gboolean preroll_capturing;
 
   GstElement *camerabin;
   AperturePipelineTee *tee;
   GstElement *pipeline;
 
+  GHashTable *frame_taps;
+  guint next_frame_tap_id;
+
   GTask *task_take_picture;
+  /* the one-shot frame tap that takes a picture during a recording */
+  GstElement *snapshot_tap;
+  guint snapshot_serial;
+  gint64 snapshot_requested;
 
   gboolean recording_video;
+  GTask *task_start_video;
+  /* returns task_start_video early if its cancellable is cancelled */
+  guint start_video_cancel_source;
   GTask *task_take_video;
+  /* why the last recording ended on its own, for the next
+   * aperture_viewfinder_stop_recording_async() */
+  GError *recording_error;
 };
 
 G_DEFINE_TYPE (ApertureViewfinder, aperture_viewfinder, GTK_TYPE_BIN)
@@ -120,795 +207,3631 @@ enum {
   PROP_CAMERA,
   PROP_STATE,
   PROP_DETECT_BARCODES,
+  PROP_BARCODE_ROI,
+  PROP_BARCODE_SCALE,
+  PROP_VIDEO_CONTAINER,
+  PROP_VIDEO_FRAGMENT_DURATION,
+  PROP_VIDEO_FASTSTART,
+  PROP_VIDEO_SEGMENT_DURATION,
+  PROP_VIDEO_SEGMENT_SIZE,
+  PROP_VIDEO_PREROLL,
+  PROP_VIDEO_WRITE_BUFFER_SIZE,
+  PROP_VIDEO_SYNC_INTERVAL,
+  PROP_VIDEO_ADAPTIVE_RATE,
+  PROP_RECORDING_PROFILE,
+  PROP_PROXY_PROFILE,
   N_PROPS,
 };
 static GParamSpec *props[N_PROPS];
 
 enum {
   SIGNAL_BARCODE_DETECTED,
+  SIGNAL_BARCODES_DETECTED,
+  SIGNAL_BARCODE_LOST,
+  SIGNAL_SEGMENT_CLOSED,
+  SIGNAL_RECORDING_ADAPTED,
   N_SIGNALS,
 };
 static guint signals[N_SIGNALS];
 
 
+/* Keeps the camera recording into the pre-roll ring, if there is one and
+ * the pipeline is running */
 static void
-end_take_photo_operation (ApertureViewfinder *self)
+start_preroll_capture (ApertureViewfinder *self)
 {
-  g_clear_object (&self->task_take_picture);
+  if (self->preroll == NULL || self->preroll_capturing || self->task_take_picture) {
+    return;
+  }
+  if (GST_STATE (self->pipeline) != GST_STATE_PLAYING) {
+    return;
+  }
+
+  self->preroll_capturing = TRUE;
+  g_object_set (self->camerabin, "mode", 2, NULL);
+  g_signal_emit_by_name (self->camerabin, "start-capture");
 }
 
 
+/* Takes the camera out of video mode, e.g. to take a picture */
 static void
-end_take_video_operation (ApertureViewfinder *self)
+stop_preroll_capture (ApertureViewfinder *self)
 {
-  self->recording_video = FALSE;
-  g_clear_object (&self->task_take_video);
+  if (!self->preroll_capturing) {
+    return;
+  }
+
+  self->preroll_capturing = FALSE;
+  g_signal_emit_by_name (self->camerabin, "stop-capture");
 }
 
 
-/* Cancels any ongoing operations. Called when an error occurs, or when the
- * current camera is unplugged. @err is copied, so you still need to unref it
- * afterward. */
+/* Links a recording branch to the camera's video, or to the pre-roll ring
+ * if there is one */
 static void
-cancel_current_operation (ApertureViewfinder *self, GError *err)
+link_recorder (ApertureViewfinder *self, AperturePipelineRecorder *recorder)
 {
-  if (self->task_take_picture) {
-    g_task_return_error (self->task_take_picture, g_error_copy (err));
-    end_take_photo_operation (self);
-  } else if (self->task_take_video) {
-    g_task_return_error (self->task_take_video, g_error_copy (err));
-    end_take_video_operation (self);
-  }
+  GstElement *src = self->preroll != NULL ? GST_ELEMENT (self->preroll) : GST_ELEMENT (self->encoder);
+
+  gst_element_link_pads (src, "src", GST_ELEMENT (recorder), "sink");
 }
 
 
+/* Takes an element out of the pipeline, after unlinking its sink pad */
 static void
-set_state (ApertureViewfinder *self, ApertureViewfinderState state)
+remove_linked_element (ApertureViewfinder *self, GstElement *element)
 {
-  g_autoptr(GError) err = NULL;
-
-  if (self->state == state) {
-    return;
-  }
-
-  if (state != APERTURE_VIEWFINDER_STATE_READY) {
-    if (state == APERTURE_VIEWFINDER_STATE_NO_CAMERAS) {
-      err = g_error_new (APERTURE_MEDIA_CAPTURE_ERROR,
-                         APERTURE_MEDIA_CAPTURE_ERROR_CAMERA_DISCONNECTED,
-                         "The active camera was disconnected during the operation");
-    } else {
-      err = g_error_new (APERTURE_MEDIA_CAPTURE_ERROR,
-                         APERTURE_MEDIA_CAPTURE_ERROR_INTERRUPTED,
-                         "An error occurred during the operation");
-    }
+  g_autoptr(GstPad) sinkpad = gst_element_get_static_pad (element, "sink");
+  g_autoptr(GstPad) peer = gst_pad_get_peer (sinkpad);
 
-    cancel_current_operation (self, err);
+  if (peer != NULL) {
+    gst_pad_unlink (peer, sinkpad);
   }
 
-  self->state = state;
-  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_STATE]);
+  gst_element_set_state (element, GST_STATE_NULL);
+  gst_bin_remove (GST_BIN (self->pipeline), element);
 }
 
 
-/* Creates an element. Puts the viewfinder in the error state if that fails.
- * Thus, should only be used where the viewfinder doesn't work without the
- * element (otherwise, use gst_element_factory_make()). */
-static GstElement *
-create_element (ApertureViewfinder *self, const char *type)
+/* Sets up the branch for the next recording to a file ahead of time, so
+ * starting it only has to open the file */
+static void
+prepare_standby_recorder (ApertureViewfinder *self)
 {
-  GstElement *element = gst_element_factory_make (type, NULL);
-
-  if (element == NULL) {
-    g_critical ("Element %s is not installed", type);
-    set_state (self, APERTURE_VIEWFINDER_STATE_ERROR);
+  if (self->standby != NULL || self->recording_video || self->encoder == NULL) {
+    return;
   }
 
-  return element;
+  self->standby = aperture_pipeline_recorder_new (self->video_container, aperture_recording_profile_get_codec (self->recording_profile));
+  aperture_pipeline_recorder_hold (self->standby);
+  /* the muxer settings can't change once the branch is running */
+  aperture_pipeline_recorder_set_fragment_duration (self->standby, self->video_fragment_duration * GST_MSECOND);
+  aperture_pipeline_recorder_set_faststart (self->standby, self->video_faststart);
+
+  gst_bin_add (GST_BIN (self->pipeline), GST_ELEMENT (self->standby));
+  link_recorder (self, self->standby);
+  gst_element_sync_state_with_parent (GST_ELEMENT (self->standby));
 }
 
 
-static GstElement *
-create_zbar_bin ()
+static void
+discard_standby_recorder (ApertureViewfinder *self)
 {
-  GstElement *bin = gst_bin_new (NULL);
-  g_autoptr(GstPad) pad = NULL;
-  GstPad *ghost_pad;
-
-  GstElement *videoconvert;
-  GstElement *zbar;
-  GstElement *fakesink;
+  if (self->standby == NULL) {
+    return;
+  }
 
-  videoconvert = gst_element_factory_make ("videoconvert", NULL);
-  zbar = gst_element_factory_make ("zbar", NULL);
-  fakesink = gst_element_factory_make ("fakesink", NULL);
+  remove_linked_element (self, GST_ELEMENT (self->standby));
+  self->standby = NULL;
+}
 
-  g_object_set (zbar, "cache", TRUE, NULL);
 
-  gst_bin_add_many (GST_BIN (bin), videoconvert, zbar, fakesink, NULL);
-  gst_element_link_many (videoconvert, zbar, fakesink, NULL);
+static void
+remove_preroll (ApertureViewfinder *self)
+{
+  if (self->preroll == NULL) {
+    return;
+  }
 
-  pad = gst_element_get_static_pad (videoconvert, "sink");
-  ghost_pad = gst_ghost_pad_new ("sink", pad);
-  gst_pad_set_active (ghost_pad, TRUE);
-  gst_element_add_pad (bin, ghost_pad);
+  /* the standby branch has to move to where the ring was */
+  discard_standby_recorder (self);
+  stop_preroll_capture (self);
 
-  return bin;
+  remove_linked_element (self, GST_ELEMENT (self->preroll));
+  self->preroll = NULL;
 }
 
 
-/* If an operation (take photo, take video, switch camera) is in progress,
- * set @err. */
+/* Adds or removes the pre-roll ring to match the video-preroll property.
+ * This waits until the current recording is over, and until there is an
+ * encoder; see prepare_preroll_encoder(). */
 static void
-get_current_operation (ApertureViewfinder *self, GError **err)
+update_preroll (ApertureViewfinder *self)
 {
-  /* for convenience, do nothing if there's already an error */
-  if (err && *err) {
+  if (self->recording_video || self->encoder == NULL) {
     return;
   }
 
-  if (self->task_take_picture) {
-    g_set_error (err,
-                 APERTURE_MEDIA_CAPTURE_ERROR,
-                 APERTURE_MEDIA_CAPTURE_ERROR_OPERATION_IN_PROGRESS,
-                 "Operation in progress: Take picture");
-  } else if (self->task_take_video || self->recording_video) {
-    g_set_error (err,
-                 APERTURE_MEDIA_CAPTURE_ERROR,
-                 APERTURE_MEDIA_CAPTURE_ERROR_OPERATION_IN_PROGRESS,
-                 "Operation in progress: Video recording");
+  if (self->video_preroll == 0 && self->preroll != NULL) {
+    remove_preroll (self);
+  } else if (self->video_preroll != 0 && self->preroll == NULL) {
+    discard_standby_recorder (self);
+
+    self->preroll = aperture_pipeline_preroll_new ();
+    aperture_pipeline_preroll_set_max_duration (self->preroll, self->video_preroll * GST_MSECOND);
+    gst_bin_add (GST_BIN (self->pipeline), GST_ELEMENT (self->preroll));
+    gst_element_link (GST_ELEMENT (self->encoder), GST_ELEMENT (self->preroll));
+
+    gst_element_sync_state_with_parent (GST_ELEMENT (self->preroll));
+    start_preroll_capture (self);
   }
+
+  prepare_standby_recorder (self);
 }
 
 
-static void
-set_error_if_not_ready (ApertureViewfinder *self, GError **err)
+/* Sets up the encoder for the recording profile, and everything that hangs
+ * off it, if it isn't already. The camera's own encoder is used if it can
+ * produce the profile's codec; otherwise the video is encoded in software.
+ *
+ * This is done when it is first needed, rather than up front, so a
+ * viewfinder that never records doesn't pay for it. That's also when the
+ * camera is running: before that, its pads only have their template caps,
+ * which don't say what it can actually encode. */
+static gboolean
+ensure_video_encoder (ApertureViewfinder *self, GError **error)
 {
-  /* for convenience, do nothing if there's already an error */
-  if (err && *err) {
-    return;
+  ApertureVideoCodec codec = aperture_recording_profile_get_codec (self->recording_profile);
+  g_autoptr(GstPad) vidsrc = NULL;
+  g_autoptr(GstCaps) camera_caps = NULL;
+  g_autoptr(GstCaps) codec_caps = NULL;
+  gboolean software;
+
+  if (self->encoder != NULL) {
+    return TRUE;
   }
 
-  if (aperture_viewfinder_get_state (self) != APERTURE_VIEWFINDER_STATE_READY) {
-    g_set_error (err,
-                 APERTURE_MEDIA_CAPTURE_ERROR,
-                 APERTURE_MEDIA_CAPTURE_ERROR_NOT_READY,
-                 "The viewfinder is not in the READY state.");
+  vidsrc = gst_element_get_static_pad (self->camerabin, "vidsrc");
+  camera_caps = gst_pad_query_caps (vidsrc, NULL);
+  codec_caps = aperture_pipeline_encoder_get_codec_caps (codec);
+  software = !gst_caps_can_intersect (camera_caps, codec_caps);
+
+  if (software && !aperture_pipeline_encoder_can_encode (codec)) {
+    g_set_error (error,
+                 G_IO_ERROR,
+                 G_IO_ERROR_NOT_SUPPORTED,
+                 "The camera can't encode video in the recording profile's codec, and no software encoder for it is installed");
+    return FALSE;
   }
+  g_debug ("Encoding video %s", software ? "in software" : "in the camera");
+
+  self->encoder = aperture_pipeline_encoder_new (self->recording_profile, software);
+  gst_bin_add (GST_BIN (self->pipeline), GST_ELEMENT (self->encoder));
+  gst_element_link_pads (self->camerabin, "vidsrc", GST_ELEMENT (self->encoder), "sink");
+  gst_element_sync_state_with_parent (GST_ELEMENT (self->encoder));
+
+  update_preroll (self);
+  return TRUE;
 }
 
 
+/* The pre-roll ring needs the encoder all the time, not just during
+ * recordings, so it is set up as soon as the camera is running */
 static void
-on_pipeline_error (ApertureViewfinder *self, GstMessage *message)
+prepare_preroll_encoder (ApertureViewfinder *self)
 {
-  g_autoptr(GError) err = NULL;
-  g_autofree char *debug_info = NULL;
+  g_autoptr(GError) error = NULL;
 
-  gst_message_parse_error (message, &err, &debug_info);
-  g_prefix_error (&err, "Error received from element %s: ", message->src->name);
-
-  cancel_current_operation (self, err);
-  g_debug ("Debugging information: %s", debug_info ? debug_info : "none");
+  if (self->video_preroll == 0 || self->encoder != NULL || self->recording_video) {
+    return;
+  }
+  if (GST_STATE (self->pipeline) != GST_STATE_PLAYING) {
+    return;
+  }
 
-  if (GST_ELEMENT (self->camerabin)->current_state != GST_STATE_PLAYING) {
-    set_state (self, APERTURE_VIEWFINDER_STATE_ERROR);
-    g_critical ("%s", err->message);
+  if (!ensure_video_encoder (self, &error)) {
+    g_warning ("Can't keep a pre-roll of the video: %s", error->message);
   }
 }
 
 
+/* Throws away the encoder and everything that hangs off it, after the
+ * recording profile or the camera has changed. The next recording sets it
+ * up again. This waits until the current recording is over. */
 static void
-on_multi_filesink (ApertureViewfinder *self, GstMessage *message)
+update_video_encoder (ApertureViewfinder *self)
 {
-  FILE *tmpfile;
-  guint8 *buffer;
-  gsize length;
-  GdkPixbufLoader *loader;
-  GdkPixbuf *pixbuf;
+  if (self->recording_video) {
+    self->encoder_outdated = TRUE;
+    return;
+  }
+  self->encoder_outdated = FALSE;
 
-  if (self->task_take_picture) {
-    tmpfile = fopen(self->tmp_pic_path, "r");
-    fseek(tmpfile, 0, SEEK_END);
-    length = ftell(tmpfile);
-    fseek(tmpfile, 0, SEEK_SET);
-    buffer = (guint8 *)malloc(length + 1);
-    if (fread(buffer, length, 1, tmpfile)) {
-      fclose(tmpfile);
+  discard_standby_recorder (self);
+  remove_preroll (self);
+  if (self->encoder != NULL) {
+    remove_linked_element (self, GST_ELEMENT (self->encoder));
+    self->encoder = NULL;
+  }
 
-      loader = gdk_pixbuf_loader_new();
-      gdk_pixbuf_loader_write(loader, buffer, length, NULL);
-      pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+  prepare_preroll_encoder (self);
+}
 
-      g_task_return_pointer (self->task_take_picture, pixbuf, g_object_unref);
-      end_take_photo_operation (self);
 
-      free(buffer);
-      remove(self->tmp_pic_path);
-    }
-  }
+static void
+end_start_video_task (ApertureViewfinder *self)
+{
+  g_clear_handle_id (&self->start_video_cancel_source, g_source_remove);
+  g_clear_object (&self->task_start_video);
 }
 
 
 static void
-on_video_done (ApertureViewfinder *self)
+end_take_photo_operation (ApertureViewfinder *self)
 {
-  g_task_return_boolean (self->task_take_video, TRUE);
-  end_take_video_operation (self);
+  g_clear_object (&self->task_take_picture);
+
+  if (self->snapshot_tap != NULL) {
+    aperture_pipeline_tee_remove_branch (self->tee, self->snapshot_tap);
+    self->snapshot_tap = NULL;
+  }
+
+  start_preroll_capture (self);
 }
 
 
 static void
-on_barcode_detected (ApertureViewfinder *self, GstMessage *message)
+set_throttle (ApertureViewfinder *self, guint throttle)
 {
-  const char *code_type_str = NULL;
-  ApertureBarcode code_type;
-  const char *data = NULL;
-  const GstStructure *structure;
+  g_autoptr(ApertureRecordingProfile) effective = NULL;
 
-  structure = gst_message_get_structure (message);
-  code_type_str = gst_structure_get_string (structure, "type");
-  code_type = aperture_barcode_type_from_string (code_type_str);
-  data = gst_structure_get_string (structure, "symbol");
+  aperture_pipeline_encoder_set_throttle (self->encoder, throttle);
 
-  g_signal_emit (self, signals[SIGNAL_BARCODE_DETECTED], 0, code_type, data);
+  effective = aperture_pipeline_encoder_get_effective_profile (self->encoder);
+  g_signal_emit (self, signals[SIGNAL_RECORDING_ADAPTED], 0, effective);
 }
 
 
-/* Bus message handler for the pipeline */
+/* Checks whether storage is keeping up with the recording, and throttles
+ * the encoder if it isn't. It is falling behind when the write buffer is
+ * filling up, or when the recording was already held up waiting for it. */
 static gboolean
-on_bus_message_async (GstBus *bus, GstMessage *message, gpointer user_data)
+on_adapt_timeout (gpointer user_data)
 {
   ApertureViewfinder *self = APERTURE_VIEWFINDER (user_data);
+  AperturePipelineRecorderWriterStats stats;
+  guint throttle;
+  guint64 throughput;
+  gboolean blocked;
+  double fill;
+
+  if (self->recorder == NULL) {
+    return G_SOURCE_CONTINUE;
+  }
 
-  switch (message->type) {
-  case GST_MESSAGE_ERROR:
-    on_pipeline_error (self, message);
-    break;
+  aperture_pipeline_recorder_get_writer_stats (self->recorder, &stats);
 
-  case GST_MESSAGE_ELEMENT:
-    if (gst_message_has_name (message, "GstMultiFileSink")) {
-      on_multi_filesink (self, message);
-    } else if (gst_message_has_name (message, "video-done")) {
-      on_video_done (self);
-    } else if (gst_message_has_name (message, "barcode")) {
-      on_barcode_detected (self, message);
+  throughput = (stats.written_bytes - self->adapt_written) * 1000 / ADAPT_INTERVAL_MS;
+  blocked = stats.blocked_time > self->adapt_blocked_time;
+  fill = (double) stats.queued_bytes / self->adapt_buffer_size;
+  self->adapt_written = stats.written_bytes;
+  self->adapt_blocked_time = stats.blocked_time;
+
+  throttle = aperture_pipeline_encoder_get_throttle (self->encoder);
+
+  if (self->adapt_cooldown > 0) {
+    self->adapt_cooldown --;
+  }
+
+  if (blocked || fill > 0.5) {
+    self->adapt_calm = 0;
+    /* give each step a moment to take effect before the next one */
+    if (self->adapt_cooldown == 0 && throttle < aperture_pipeline_encoder_get_max_throttle (self->encoder)) {
+      throttle ++;
+      self->adapt_cooldown = 2;
     }
-    break;
+  } else if (fill < 0.1) {
+    self->adapt_calm ++;
+    if (self->adapt_calm >= ADAPT_RECOVER_CHECKS && throttle > 0) {
+      throttle --;
+      self->adapt_calm = 0;
+    }
+  } else {
+    self->adapt_calm = 0;
+  }
 
-  default:
-    break;
+  if (throttle != aperture_pipeline_encoder_get_throttle (self->encoder)) {
+    g_debug ("Storage is writing %" G_GUINT64_FORMAT " KiB/s with %.0f%% of the write buffer in use; throttle level %u",
+             throughput / 1024, fill * 100, throttle);
+    set_throttle (self, throttle);
   }
 
   return G_SOURCE_CONTINUE;
 }
 
-/* VFUNCS */
-
 
 static void
-aperture_viewfinder_finalize (GObject *object)
+start_rate_adaptation (ApertureViewfinder *self)
 {
-  ApertureViewfinder *self = APERTURE_VIEWFINDER (object);
-
-  g_clear_object (&self->devices);
-  g_clear_object (&self->pipeline);
-  g_clear_object (&self->camerabin);
-  g_clear_object (&self->tee);
+  if (!self->video_adaptive_rate
+      || aperture_pipeline_encoder_get_max_throttle (self->encoder) == 0) {
+    return;
+  }
 
-  G_OBJECT_CLASS (aperture_viewfinder_parent_class)->finalize (object);
+  self->adapt_buffer_size = self->video_write_buffer_size;
+  self->adapt_written = 0;
+  self->adapt_blocked_time = 0;
+  self->adapt_calm = 0;
+  self->adapt_cooldown = ADAPT_GRACE_CHECKS;
+  self->adapt_source = g_timeout_add (ADAPT_INTERVAL_MS, on_adapt_timeout, self);
 }
 
 
 static void
-aperture_viewfinder_get_property (GObject    *object,
-                                  guint       prop_id,
-                                  GValue     *value,
-                                  GParamSpec *pspec)
+stop_rate_adaptation (ApertureViewfinder *self)
 {
-  ApertureViewfinder *self = APERTURE_VIEWFINDER (object);
+  g_clear_handle_id (&self->adapt_source, g_source_remove);
 
-  switch (prop_id) {
-  case PROP_CAMERA:
-    g_value_set_object (value, aperture_viewfinder_get_camera (self));
-    break;
-  case PROP_STATE:
-    g_value_set_enum (value, aperture_viewfinder_get_state (self));
-    break;
-  case PROP_DETECT_BARCODES:
-    g_value_set_boolean (value, aperture_viewfinder_get_detect_barcodes (self));
-    break;
-  default:
-    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  if (self->encoder != NULL && aperture_pipeline_encoder_get_throttle (self->encoder) > 0) {
+    set_throttle (self, 0);
   }
 }
 
 
+/* Starts recording with @recorder. If it is the standby branch, it only has
+ * to be released to @location; otherwise it is put in the pipeline first.
+ * @location is %NULL for a streaming recorder. With pre-roll, the recording
+ * starts with the contents of the ring. */
 static void
-aperture_viewfinder_set_property (GObject      *object,
-                                  guint         prop_id,
-                                  const GValue *value,
-                                  GParamSpec   *pspec)
+start_recording (ApertureViewfinder *self, AperturePipelineRecorder *recorder, const char *location)
 {
-  ApertureViewfinder *self = APERTURE_VIEWFINDER (object);
+  AperturePipelinePrerollStats stats;
 
-  switch (prop_id) {
-  case PROP_CAMERA:
-    aperture_viewfinder_set_camera (self, g_value_get_object (value), NULL);
-    break;
-  case PROP_DETECT_BARCODES:
-    aperture_viewfinder_set_detect_barcodes (self, g_value_get_boolean (value));
-    break;
-  default:
-    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  self->recording_video = TRUE;
+  self->recorder = recorder;
+  self->recorder_done = FALSE;
+  g_clear_error (&self->recording_error);
+
+  aperture_pipeline_recorder_set_max_queued_bytes (self->recorder, self->video_write_buffer_size);
+  aperture_pipeline_recorder_set_sync_interval (self->recorder, self->video_sync_interval * GST_MSECOND);
+
+  if (recorder == self->standby) {
+    /* already set up with the current settings; see
+     * prepare_standby_recorder() */
+    self->standby = NULL;
+    aperture_pipeline_recorder_release (self->recorder, location);
+  } else {
+    /* it's in the way; another one is set up after this recording */
+    discard_standby_recorder (self);
+
+    aperture_pipeline_recorder_set_fragment_duration (self->recorder, self->video_fragment_duration * GST_MSECOND);
+    aperture_pipeline_recorder_set_faststart (self->recorder, self->video_faststart);
+
+    if (location != NULL) {
+      aperture_pipeline_recorder_set_location (self->recorder, location);
+    }
+
+    gst_bin_add (GST_BIN (self->pipeline), GST_ELEMENT (self->recorder));
+    link_recorder (self, self->recorder);
+    gst_element_sync_state_with_parent (GST_ELEMENT (self->recorder));
   }
-}
 
+  start_rate_adaptation (self);
 
-/* Starts the pipeline when the widget is realized */
-static void
-aperture_viewfinder_realize (GtkWidget *widget)
-{
-  ApertureViewfinder *self = APERTURE_VIEWFINDER (widget);
+  if (self->preroll != NULL) {
+    aperture_pipeline_preroll_get_stats (self->preroll, &stats);
+    g_debug ("Starting recording with %" GST_TIME_FORMAT " of pre-roll (%u buffers, %" G_GUINT64_FORMAT " bytes)",
+             GST_TIME_ARGS (stats.duration), stats.n_buffers, stats.bytes);
 
-  GTK_WIDGET_CLASS (aperture_viewfinder_parent_class)->realize (widget);
+    aperture_pipeline_preroll_start (self->preroll);
+    start_preroll_capture (self);
+    return;
+  }
 
-  gst_element_set_state (self->pipeline, GST_STATE_PLAYING);
+  g_object_set (self->camerabin, "mode", 2, NULL);
+  g_signal_emit_by_name (self->camerabin, "start-capture");
 }
 
 
-/* Stops the pipeline when the widget is unrealized */
+/* Stops sending video to the recording branch */
 static void
-aperture_viewfinder_unrealize (GtkWidget *widget)
+stop_video_capture (ApertureViewfinder *self)
+{
+  if (self->preroll != NULL) {
+    /* keep the camera running, so the ring fills up again */
+    aperture_pipeline_preroll_stop (self->preroll);
+  } else {
+    g_signal_emit_by_name (self->camerabin, "stop-capture");
+  }
+}
+
+
+static void
+remove_proxy (ApertureViewfinder *self)
+{
+  if (self->proxy == NULL) {
+    return;
+  }
+
+  aperture_pipeline_tee_remove_branch (self->tee, GST_ELEMENT (self->proxy));
+  self->proxy = NULL;
+}
+
+
+static void
+end_take_video_operation (ApertureViewfinder *self)
+{
+  self->recording_video = FALSE;
+  stop_rate_adaptation (self);
+  remove_proxy (self);
+
+  if (self->recorder != NULL) {
+    remove_linked_element (self, GST_ELEMENT (self->recorder));
+    self->recorder = NULL;
+  }
+
+  g_clear_object (&self->task_take_video);
+
+  /* it never got to the first keyframe */
+  if (self->task_start_video) {
+    g_task_return_new_error (self->task_start_video,
+                             APERTURE_MEDIA_CAPTURE_ERROR,
+                             APERTURE_MEDIA_CAPTURE_ERROR_INTERRUPTED,
+                             "The recording ended before it started");
+    end_start_video_task (self);
+  }
+
+  if (self->encoder_outdated) {
+    update_video_encoder (self);
+  } else {
+    update_preroll (self);
+  }
+}
+
+
+/* Ends the recording once the file, and the proxy if there is one, have
+ * been written */
+static void
+complete_recording_if_done (ApertureViewfinder *self)
+{
+  if (!self->recorder_done || self->proxy != NULL) {
+    return;
+  }
+
+  if (self->task_take_video) {
+    g_task_return_boolean (self->task_take_video, TRUE);
+  }
+  end_take_video_operation (self);
+}
+
+
+/* Cancels any ongoing operations. Called when an error occurs, or when the
+ * current camera is unplugged. @err is copied, so you still need to unref it
+ * afterward. */
+static void
+cancel_current_operation (ApertureViewfinder *self, GError *err)
+{
+  if (self->task_take_picture) {
+    g_task_return_error (self->task_take_picture, g_error_copy (err));
+    end_take_photo_operation (self);
+  } else if (self->task_take_video) {
+    g_task_return_error (self->task_take_video, g_error_copy (err));
+    end_take_video_operation (self);
+  }
+}
+
+
+static void
+set_state (ApertureViewfinder *self, ApertureViewfinderState state)
+{
+  g_autoptr(GError) err = NULL;
+
+  if (self->state == state) {
+    return;
+  }
+
+  if (state != APERTURE_VIEWFINDER_STATE_READY) {
+    if (state == APERTURE_VIEWFINDER_STATE_NO_CAMERAS) {
+      err = g_error_new (APERTURE_MEDIA_CAPTURE_ERROR,
+                         APERTURE_MEDIA_CAPTURE_ERROR_CAMERA_DISCONNECTED,
+                         "The active camera was disconnected during the operation");
+    } else {
+      err = g_error_new (APERTURE_MEDIA_CAPTURE_ERROR,
+                         APERTURE_MEDIA_CAPTURE_ERROR_INTERRUPTED,
+                         "An error occurred during the operation");
+    }
+
+    cancel_current_operation (self, err);
+  }
+
+  self->state = state;
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_STATE]);
+}
+
+
+/* Creates an element. Puts the viewfinder in the error state if that fails.
+ * Thus, should only be used where the viewfinder doesn't work without the
+ * element (otherwise, use gst_element_factory_make()). */
+static GstElement *
+create_element (ApertureViewfinder *self, const char *type)
+{
+  GstElement *element = gst_element_factory_make (type, NULL);
+
+  if (element == NULL) {
+    g_critical ("Element %s is not installed", type);
+    set_state (self, APERTURE_VIEWFINDER_STATE_ERROR);
+  }
+
+  return element;
+}
+
+
+/* Passes the barcode region of interest on to the barcode branch */
+static void
+update_barcode_roi (ApertureViewfinder *self)
+{
+  GstVideoRectangle roi;
+
+  if (self->branch_zbar == NULL) {
+    return;
+  }
+
+  if (self->has_barcode_roi) {
+    roi.x = self->barcode_roi.x;
+    roi.y = self->barcode_roi.y;
+    roi.w = self->barcode_roi.width;
+    roi.h = self->barcode_roi.height;
+    aperture_pipeline_barcode_set_roi (self->branch_zbar, &roi);
+  } else {
+    aperture_pipeline_barcode_set_roi (self->branch_zbar, NULL);
+  }
+}
+
+
+typedef struct {
+  ApertureViewfinder *viewfinder;
+  ApertureFrameTapFunc func;
+  gpointer user_data;
+  GDestroyNotify destroy;
+} FrameTap;
+
+
+static void
+frame_tap_free (FrameTap *tap)
+{
+  if (tap->destroy) {
+    tap->destroy (tap->user_data);
+  }
+
+  g_free (tap);
+}
+
+
+/* Called on the tap branch's streaming thread for every frame */
+static GstFlowReturn
+frame_tap_new_sample (GstAppSink *appsink, gpointer user_data)
+{
+  FrameTap *tap = user_data;
+  g_autoptr(GstSample) sample = NULL;
+  GstVideoInfo info;
+  GstVideoFrame frame;
+
+  sample = gst_app_sink_pull_sample (appsink);
+  if (sample == NULL) {
+    return GST_FLOW_EOS;
+  }
+
+  if (!gst_video_info_from_caps (&info, gst_sample_get_caps (sample))) {
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+
+  /* Maps the buffer in place; the frame is never copied */
+  if (!gst_video_frame_map (&frame, &info, gst_sample_get_buffer (sample), GST_MAP_READ)) {
+    g_warning ("Could not map frame for frame tap");
+    return GST_FLOW_OK;
+  }
+
+  tap->func (tap->viewfinder, sample, &frame, tap->user_data);
+
+  gst_video_frame_unmap (&frame);
+  return GST_FLOW_OK;
+}
+
+
+static GstElement *
+create_frame_tap_bin (FrameTap *tap, GstCaps *caps)
+{
+  static GstAppSinkCallbacks callbacks = { .new_sample = frame_tap_new_sample };
+
+  GstElement *bin = gst_bin_new (NULL);
+  g_autoptr(GstPad) pad = NULL;
+  GstPad *ghost_pad;
+
+  GstElement *first;
+  GstElement *appsink;
+
+  appsink = gst_element_factory_make ("appsink", NULL);
+  g_object_set (appsink,
+                "sync", FALSE,
+                "max-buffers", 1,
+                "drop", TRUE,
+                "enable-last-sample", FALSE,
+                NULL);
+  gst_app_sink_set_callbacks (GST_APP_SINK (appsink), &callbacks, tap, (GDestroyNotify) frame_tap_free);
+  gst_bin_add (GST_BIN (bin), appsink);
+  first = appsink;
+
+  /* Only convert if a specific format or size was asked for. If the stream
+   * already matches, these run in passthrough mode. */
+  if (caps != NULL) {
+    GstElement *videoconvert = gst_element_factory_make ("videoconvert", NULL);
+    GstElement *videoscale = gst_element_factory_make ("videoscale", NULL);
+    GstElement *capsfilter = gst_element_factory_make ("capsfilter", NULL);
+
+    g_object_set (capsfilter, "caps", caps, NULL);
+
+    gst_bin_add_many (GST_BIN (bin), videoconvert, videoscale, capsfilter, NULL);
+    gst_element_link_many (videoconvert, videoscale, capsfilter, appsink, NULL);
+    first = videoconvert;
+  }
+
+  pad = gst_element_get_static_pad (first, "sink");
+  ghost_pad = gst_ghost_pad_new ("sink", pad);
+  gst_pad_set_active (ghost_pad, TRUE);
+  gst_element_add_pad (bin, ghost_pad);
+
+  return bin;
+}
+
+
+/* The state of one snapshot tap, on its streaming thread */
+typedef struct {
+  guint serial;
+  gint taken;
+} SnapshotTap;
+
+/* A snapshot on its way to the main thread */
+typedef struct {
+  ApertureViewfinder *viewfinder;
+  guint serial;
+  GdkPixbuf *pixbuf;
+} Snapshot;
+
+
+static gboolean
+snapshot_taken_cb (gpointer user_data)
+{
+  Snapshot *snapshot = user_data;
+  ApertureViewfinder *self = snapshot->viewfinder;
+
+  /* the picture may have been cancelled since, and maybe another one
+   * started */
+  if (self->snapshot_tap != NULL && snapshot->serial == self->snapshot_serial) {
+    g_debug ("Took a picture during the recording in %.1f ms",
+             (g_get_monotonic_time () - self->snapshot_requested) / 1000.0);
+
+    g_task_return_pointer (self->task_take_picture, g_steal_pointer (&snapshot->pixbuf), g_object_unref);
+    end_take_photo_operation (self);
+  }
+
+  g_clear_object (&snapshot->pixbuf);
+  g_object_unref (snapshot->viewfinder);
+  g_free (snapshot);
+  return G_SOURCE_REMOVE;
+}
+
+
+/* Called on the snapshot tap's streaming thread. Copies the first frame
+ * into a pixbuf; the rest are ignored until the tap is removed. */
+static void
+snapshot_frame_cb (ApertureViewfinder *self, GstSample *sample, GstVideoFrame *frame, gpointer user_data)
+{
+  SnapshotTap *tap = user_data;
+  Snapshot *snapshot;
+  const guint8 *data = GST_VIDEO_FRAME_PLANE_DATA (frame, 0);
+  int stride = GST_VIDEO_FRAME_PLANE_STRIDE (frame, 0);
+  int width = GST_VIDEO_FRAME_WIDTH (frame);
+  int height = GST_VIDEO_FRAME_HEIGHT (frame);
+  GdkPixbuf *pixbuf;
+  guint8 *pixels;
+  int rowstride;
+  int y;
+
+  if (!g_atomic_int_compare_and_exchange (&tap->taken, FALSE, TRUE)) {
+    return;
+  }
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+  pixels = gdk_pixbuf_get_pixels (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  for (y = 0; y < height; y ++) {
+    memcpy (pixels + y * rowstride, data + y * stride, width * 3);
+  }
+
+  snapshot = g_new0 (Snapshot, 1);
+  snapshot->viewfinder = g_object_ref (self);
+  snapshot->serial = tap->serial;
+  snapshot->pixbuf = pixbuf;
+  g_idle_add (snapshot_taken_cb, snapshot);
+}
+
+
+/* Takes a picture from the viewfinder's frames, for when the camera is busy
+ * recording. The recording isn't touched: the frame is taken from the tee,
+ * and converted on the tap's own thread. */
+static void
+take_snapshot (ApertureViewfinder *self)
+{
+  /* only the newest frame matters */
+  AperturePipelineTeeBranchPolicy policy = {
+    .drop_policy = APERTURE_PIPELINE_TEE_DROP_OLDEST,
+    .max_buffers = 1,
+  };
+  g_autoptr(GstCaps) caps = gst_caps_new_simple ("video/x-raw",
+                                                 "format", G_TYPE_STRING, "RGB",
+                                                 NULL);
+  SnapshotTap *snapshot_tap;
+  FrameTap *tap;
+
+  snapshot_tap = g_new0 (SnapshotTap, 1);
+  snapshot_tap->serial = ++ self->snapshot_serial;
+
+  tap = g_new0 (FrameTap, 1);
+  tap->viewfinder = self;
+  tap->func = snapshot_frame_cb;
+  tap->user_data = snapshot_tap;
+  tap->destroy = g_free;
+
+  self->snapshot_requested = g_get_monotonic_time ();
+  self->snapshot_tap = create_frame_tap_bin (tap, caps);
+  aperture_pipeline_tee_add_branch_full (self->tee, self->snapshot_tap, &policy);
+}
+
+
+/* If an operation (take photo, take video, switch camera) is in progress,
+ * set @err. */
+static void
+get_current_operation (ApertureViewfinder *self, GError **err)
+{
+  /* for convenience, do nothing if there's already an error */
+  if (err && *err) {
+    return;
+  }
+
+  if (self->task_take_picture) {
+    g_set_error (err,
+                 APERTURE_MEDIA_CAPTURE_ERROR,
+                 APERTURE_MEDIA_CAPTURE_ERROR_OPERATION_IN_PROGRESS,
+                 "Operation in progress: Take picture");
+  } else if (self->task_take_video || self->recording_video) {
+    g_set_error (err,
+                 APERTURE_MEDIA_CAPTURE_ERROR,
+                 APERTURE_MEDIA_CAPTURE_ERROR_OPERATION_IN_PROGRESS,
+                 "Operation in progress: Video recording");
+  }
+}
+
+
+/* Sets up the encoder for a recording, or sets @err if the profile's codec
+ * can't be encoded */
+static void
+set_error_if_cant_encode (ApertureViewfinder *self, GError **err)
+{
+  /* for convenience, do nothing if there's already an error */
+  if (err && *err) {
+    return;
+  }
+
+  ensure_video_encoder (self, err);
+}
+
+
+static void
+set_error_if_not_ready (ApertureViewfinder *self, GError **err)
+{
+  /* for convenience, do nothing if there's already an error */
+  if (err && *err) {
+    return;
+  }
+
+  if (aperture_viewfinder_get_state (self) != APERTURE_VIEWFINDER_STATE_READY) {
+    g_set_error (err,
+                 APERTURE_MEDIA_CAPTURE_ERROR,
+                 APERTURE_MEDIA_CAPTURE_ERROR_NOT_READY,
+                 "The viewfinder is not in the READY state.");
+  }
+}
+
+
+static void
+on_pipeline_error (ApertureViewfinder *self, GstMessage *message)
+{
+  g_autoptr(GError) err = NULL;
+  g_autofree char *debug_info = NULL;
+
+  gst_message_parse_error (message, &err, &debug_info);
+  g_prefix_error (&err, "Error received from element %s: ", message->src->name);
+  g_debug ("Debugging information: %s", debug_info ? debug_info : "none");
+
+  /* The proxy is only a convenience; the full recording carries on
+   * without it */
+  if (self->proxy != NULL
+      && gst_object_has_as_ancestor (GST_MESSAGE_SRC (message), GST_OBJECT (self->proxy))) {
+    g_warning ("The proxy recording failed: %s", err->message);
+    remove_proxy (self);
+    complete_recording_if_done (self);
+    return;
+  }
+
+  /* A recording that can't be written, such as a stream whose consumer
+   * went away, only ends the recording. The camera is fine. */
+  if (self->recorder != NULL
+      && gst_object_has_as_ancestor (GST_MESSAGE_SRC (message), GST_OBJECT (self->recorder))) {
+    if (self->task_start_video) {
+      g_task_return_error (self->task_start_video, g_error_copy (err));
+      end_start_video_task (self);
+    }
+
+    if (self->task_take_video) {
+      g_task_return_error (self->task_take_video, g_steal_pointer (&err));
+    } else {
+      stop_video_capture (self);
+      g_clear_error (&self->recording_error);
+      self->recording_error = g_steal_pointer (&err);
+    }
+    end_take_video_operation (self);
+    return;
+  }
+
+  cancel_current_operation (self, err);
+
+  if (GST_ELEMENT (self->camerabin)->current_state != GST_STATE_PLAYING) {
+    set_state (self, APERTURE_VIEWFINDER_STATE_ERROR);
+    g_critical ("%s", err->message);
+  }
+}
+
+
+static void
+on_multi_filesink (ApertureViewfinder *self, GstMessage *message)
+{
+  FILE *tmpfile;
+  guint8 *buffer;
+  gsize length;
+  GdkPixbufLoader *loader;
+  GdkPixbuf *pixbuf;
+
+  if (self->task_take_picture) {
+    tmpfile = fopen(self->tmp_pic_path, "r");
+    fseek(tmpfile, 0, SEEK_END);
+    length = ftell(tmpfile);
+    fseek(tmpfile, 0, SEEK_SET);
+    buffer = (guint8 *)malloc(length + 1);
+    if (fread(buffer, length, 1, tmpfile)) {
+      fclose(tmpfile);
+
+      loader = gdk_pixbuf_loader_new();
+      gdk_pixbuf_loader_write(loader, buffer, length, NULL);
+      pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+
+      g_task_return_pointer (self->task_take_picture, pixbuf, g_object_unref);
+      end_take_photo_operation (self);
+
+      free(buffer);
+      remove(self->tmp_pic_path);
+    }
+  }
+}
+
+
+/* A segmented recording has moved on to the next file */
+static void
+on_segment_closed (ApertureViewfinder *self, GstMessage *message)
+{
+  const GstStructure *structure = gst_message_get_structure (message);
+
+  if (self->recorder == NULL || GST_MESSAGE_SRC (message) != GST_OBJECT (self->recorder)) {
+    return;
+  }
+
+  g_signal_emit (self, signals[SIGNAL_SEGMENT_CLOSED], 0,
+                 gst_structure_get_string (structure, "location"));
+}
+
+
+/* The first keyframe has gone into the recording */
+static void
+on_recording_started (ApertureViewfinder *self, GstMessage *message)
+{
+  const GstStructure *structure = gst_message_get_structure (message);
+  GstClockTime latency = GST_CLOCK_TIME_NONE;
+
+  if (self->recorder == NULL || GST_MESSAGE_SRC (message) != GST_OBJECT (self->recorder)) {
+    return;
+  }
+
+  gst_structure_get_uint64 (structure, "latency", &latency);
+  g_debug ("Recording started after %" GST_TIME_FORMAT, GST_TIME_ARGS (latency));
+
+  if (self->task_start_video) {
+    GstClockTime *result = g_new (GstClockTime, 1);
+
+    *result = latency;
+    g_task_return_pointer (self->task_start_video, result, g_free);
+    end_start_video_task (self);
+  }
+}
+
+
+/* The recording branch, or the proxy, has finished writing its file */
+static void
+on_recording_done (ApertureViewfinder *self, GstMessage *message)
+{
+  GstObject *src = GST_MESSAGE_SRC (message);
+
+  if (self->proxy != NULL && gst_object_has_as_ancestor (src, GST_OBJECT (self->proxy))) {
+    remove_proxy (self);
+  } else if (self->recorder != NULL && src == GST_OBJECT (self->recorder)) {
+    self->recorder_done = TRUE;
+  } else {
+    return;
+  }
+
+  complete_recording_if_done (self);
+}
+
+
+/* Gets how long ago the frame with the given running time was captured */
+static GstClockTime
+get_latency (ApertureViewfinder *self, GstClockTime running_time)
+{
+  g_autoptr(GstClock) clock = gst_element_get_clock (self->pipeline);
+  GstClockTime now;
+
+  if (clock == NULL || !GST_CLOCK_TIME_IS_VALID (running_time)) {
+    return GST_CLOCK_TIME_NONE;
+  }
+
+  now = gst_clock_get_time (clock) - gst_element_get_base_time (self->pipeline);
+  return now > running_time ? now - running_time : 0;
+}
+
+
+static void
+on_barcodes_detected (ApertureViewfinder *self, GstMessage *message)
+{
+  const GstStructure *structure;
+  GPtrArray *posted = NULL;
+  GPtrArray *results;
+  guint64 running_time = GST_CLOCK_TIME_NONE;
+  GstClockTime latency;
+  guint i;
+
+  structure = gst_message_get_structure (message);
+  gst_structure_get (structure, "results", G_TYPE_PTR_ARRAY, &posted, NULL);
+  gst_structure_get_uint64 (structure, "running-time", &running_time);
+
+  if (posted == NULL) {
+    return;
+  }
+
+  /* the message may still be read elsewhere, so the latency goes on
+   * copies of its results */
+  latency = get_latency (self, running_time);
+  results = g_ptr_array_new_full (posted->len, (GDestroyNotify) aperture_barcode_result_unref);
+  for (i = 0; i < posted->len; i ++) {
+    ApertureBarcodeResult *result = aperture_barcode_result_copy (g_ptr_array_index (posted, i));
+
+    aperture_barcode_result_set_latency (result, latency);
+    g_ptr_array_add (results, result);
+  }
+  g_ptr_array_unref (posted);
+
+  g_signal_emit (self, signals[SIGNAL_BARCODES_DETECTED], 0, results);
+
+  for (i = 0; i < results->len; i ++) {
+    ApertureBarcodeResult *result = g_ptr_array_index (results, i);
+
+    g_signal_emit (self, signals[SIGNAL_BARCODE_DETECTED], 0,
+                   aperture_barcode_result_get_barcode_type (result),
+                   aperture_barcode_result_get_data (result));
+  }
+
+  g_ptr_array_unref (results);
+}
+
+
+static void
+on_barcodes_lost (ApertureViewfinder *self, GstMessage *message)
+{
+  const GstStructure *structure;
+  GPtrArray *results = NULL;
+  guint i;
+
+  structure = gst_message_get_structure (message);
+  gst_structure_get (structure, "results", G_TYPE_PTR_ARRAY, &results, NULL);
+
+  if (results == NULL) {
+    return;
+  }
+
+  for (i = 0; i < results->len; i ++) {
+    ApertureBarcodeResult *result = g_ptr_array_index (results, i);
+
+    g_signal_emit (self, signals[SIGNAL_BARCODE_LOST], 0,
+                   aperture_barcode_result_get_barcode_type (result),
+                   aperture_barcode_result_get_data (result));
+  }
+
+  g_ptr_array_unref (results);
+}
+
+
+/* The camera stops capturing whenever the pipeline stops, e.g. to switch
+ * cameras, so the pre-roll capture has to be started again */
+static void
+on_pipeline_state_changed (ApertureViewfinder *self, GstMessage *message)
+{
+  GstState new_state;
+
+  if (GST_MESSAGE_SRC (message) != GST_OBJECT (self->pipeline)) {
+    return;
+  }
+
+  gst_message_parse_state_changed (message, NULL, &new_state, NULL);
+
+  if (new_state == GST_STATE_PLAYING) {
+    prepare_preroll_encoder (self);
+    start_preroll_capture (self);
+  } else {
+    self->preroll_capturing = FALSE;
+  }
+}
+
+
+/* Bus message handler for the pipeline */
+static gboolean
+on_bus_message_async (GstBus *bus, GstMessage *message, gpointer user_data)
+{
+  ApertureViewfinder *self = APERTURE_VIEWFINDER (user_data);
+
+  switch (message->type) {
+  case GST_MESSAGE_ERROR:
+    on_pipeline_error (self, message);
+    break;
+
+  case GST_MESSAGE_ELEMENT:
+    if (gst_message_has_name (message, "GstMultiFileSink")) {
+      on_multi_filesink (self, message);
+    } else if (gst_message_has_name (message, "segment-closed")) {
+      on_segment_closed (self, message);
+    } else if (gst_message_has_name (message, "recording-started")) {
+      on_recording_started (self, message);
+    } else if (gst_message_has_name (message, "recording-done")) {
+      on_recording_done (self, message);
+    } else if (gst_message_has_name (message, "barcodes")) {
+      on_barcodes_detected (self, message);
+    } else if (gst_message_has_name (message, "barcodes-lost")) {
+      on_barcodes_lost (self, message);
+    }
+    break;
+
+  case GST_MESSAGE_STATE_CHANGED:
+    on_pipeline_state_changed (self, message);
+    break;
+
+  default:
+    break;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* VFUNCS */
+
+
+static void
+aperture_viewfinder_finalize (GObject *object)
+{
+  ApertureViewfinder *self = APERTURE_VIEWFINDER (object);
+
+  g_clear_object (&self->devices);
+  g_clear_pointer (&self->frame_taps, g_hash_table_unref);
+  g_clear_object (&self->pipeline);
+  g_clear_object (&self->camerabin);
+  g_clear_object (&self->tee);
+  g_clear_error (&self->recording_error);
+  g_clear_pointer (&self->recording_profile, aperture_recording_profile_free);
+  g_clear_pointer (&self->proxy_profile, aperture_recording_profile_free);
+  g_clear_handle_id (&self->adapt_source, g_source_remove);
+
+  G_OBJECT_CLASS (aperture_viewfinder_parent_class)->finalize (object);
+}
+
+
+static void
+aperture_viewfinder_get_property (GObject    *object,
+                                  guint       prop_id,
+                                  GValue     *value,
+                                  GParamSpec *pspec)
+{
+  ApertureViewfinder *self = APERTURE_VIEWFINDER (object);
+
+  switch (prop_id) {
+  case PROP_CAMERA:
+    g_value_set_object (value, aperture_viewfinder_get_camera (self));
+    break;
+  case PROP_STATE:
+    g_value_set_enum (value, aperture_viewfinder_get_state (self));
+    break;
+  case PROP_DETECT_BARCODES:
+    g_value_set_boolean (value, aperture_viewfinder_get_detect_barcodes (self));
+    break;
+  case PROP_BARCODE_ROI:
+    {
+      GdkRectangle roi;
+      if (aperture_viewfinder_get_barcode_roi (self, &roi)) {
+        g_value_set_boxed (value, &roi);
+      } else {
+        g_value_set_boxed (value, NULL);
+      }
+    }
+    break;
+  case PROP_BARCODE_SCALE:
+    g_value_set_double (value, aperture_viewfinder_get_barcode_scale (self));
+    break;
+  case PROP_VIDEO_CONTAINER:
+    g_value_set_enum (value, aperture_viewfinder_get_video_container (self));
+    break;
+  case PROP_VIDEO_FRAGMENT_DURATION:
+    g_value_set_uint (value, aperture_viewfinder_get_video_fragment_duration (self));
+    break;
+  case PROP_VIDEO_FASTSTART:
+    g_value_set_boolean (value, aperture_viewfinder_get_video_faststart (self));
+    break;
+  case PROP_VIDEO_SEGMENT_DURATION:
+    g_value_set_uint (value, aperture_viewfinder_get_video_segment_duration (self));
+    break;
+  case PROP_VIDEO_SEGMENT_SIZE:
+    g_value_set_uint64 (value, aperture_viewfinder_get_video_segment_size (self));
+    break;
+  case PROP_VIDEO_PREROLL:
+    g_value_set_uint (value, aperture_viewfinder_get_video_preroll (self));
+    break;
+  case PROP_VIDEO_WRITE_BUFFER_SIZE:
+    g_value_set_uint64 (value, aperture_viewfinder_get_video_write_buffer_size (self));
+    break;
+  case PROP_VIDEO_SYNC_INTERVAL:
+    g_value_set_uint (value, aperture_viewfinder_get_video_sync_interval (self));
+    break;
+  case PROP_VIDEO_ADAPTIVE_RATE:
+    g_value_set_boolean (value, aperture_viewfinder_get_video_adaptive_rate (self));
+    break;
+  case PROP_RECORDING_PROFILE:
+    g_value_take_boxed (value, aperture_viewfinder_get_recording_profile (self));
+    break;
+  case PROP_PROXY_PROFILE:
+    g_value_take_boxed (value, aperture_viewfinder_get_proxy_profile (self));
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+}
+
+
+static void
+aperture_viewfinder_set_property (GObject      *object,
+                                  guint         prop_id,
+                                  const GValue *value,
+                                  GParamSpec   *pspec)
+{
+  ApertureViewfinder *self = APERTURE_VIEWFINDER (object);
+
+  switch (prop_id) {
+  case PROP_CAMERA:
+    aperture_viewfinder_set_camera (self, g_value_get_object (value), NULL);
+    break;
+  case PROP_DETECT_BARCODES:
+    aperture_viewfinder_set_detect_barcodes (self, g_value_get_boolean (value));
+    break;
+  case PROP_BARCODE_ROI:
+    aperture_viewfinder_set_barcode_roi (self, g_value_get_boxed (value));
+    break;
+  case PROP_BARCODE_SCALE:
+    aperture_viewfinder_set_barcode_scale (self, g_value_get_double (value));
+    break;
+  case PROP_VIDEO_CONTAINER:
+    aperture_viewfinder_set_video_container (self, g_value_get_enum (value));
+    break;
+  case PROP_VIDEO_FRAGMENT_DURATION:
+    aperture_viewfinder_set_video_fragment_duration (self, g_value_get_uint (value));
+    break;
+  case PROP_VIDEO_FASTSTART:
+    aperture_viewfinder_set_video_faststart (self, g_value_get_boolean (value));
+    break;
+  case PROP_VIDEO_SEGMENT_DURATION:
+    aperture_viewfinder_set_video_segment_duration (self, g_value_get_uint (value));
+    break;
+  case PROP_VIDEO_SEGMENT_SIZE:
+    aperture_viewfinder_set_video_segment_size (self, g_value_get_uint64 (value));
+    break;
+  case PROP_VIDEO_PREROLL:
+    aperture_viewfinder_set_video_preroll (self, g_value_get_uint (value));
+    break;
+  case PROP_VIDEO_WRITE_BUFFER_SIZE:
+    aperture_viewfinder_set_video_write_buffer_size (self, g_value_get_uint64 (value));
+    break;
+  case PROP_VIDEO_SYNC_INTERVAL:
+    aperture_viewfinder_set_video_sync_interval (self, g_value_get_uint (value));
+    break;
+  case PROP_VIDEO_ADAPTIVE_RATE:
+    aperture_viewfinder_set_video_adaptive_rate (self, g_value_get_boolean (value));
+    break;
+  case PROP_RECORDING_PROFILE:
+    aperture_viewfinder_set_recording_profile (self, g_value_get_boxed (value));
+    break;
+  case PROP_PROXY_PROFILE:
+    aperture_viewfinder_set_proxy_profile (self, g_value_get_boxed (value));
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+}
+
+
+/* Starts the pipeline when the widget is realized */
+static void
+aperture_viewfinder_realize (GtkWidget *widget)
+{
+  ApertureViewfinder *self = APERTURE_VIEWFINDER (widget);
+
+  GTK_WIDGET_CLASS (aperture_viewfinder_parent_class)->realize (widget);
+
+  gst_element_set_state (self->pipeline, GST_STATE_PLAYING);
+}
+
+
+/* Stops the pipeline when the widget is unrealized */
+static void
+aperture_viewfinder_unrealize (GtkWidget *widget)
 {
   ApertureViewfinder *self = APERTURE_VIEWFINDER (widget);
 
-  GTK_WIDGET_CLASS (aperture_viewfinder_parent_class)->unrealize (widget);
+  GTK_WIDGET_CLASS (aperture_viewfinder_parent_class)->unrealize (widget);
+
+  gst_element_set_state (self->pipeline, GST_STATE_NULL);
+}
+
+
+/* INIT */
+
+
+static void
+aperture_viewfinder_class_init (ApertureViewfinderClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
+
+  object_class->finalize = aperture_viewfinder_finalize;
+  object_class->get_property = aperture_viewfinder_get_property;
+  object_class->set_property = aperture_viewfinder_set_property;
+  widget_class->realize = aperture_viewfinder_realize;
+  widget_class->unrealize = aperture_viewfinder_unrealize;
+
+  /**
+   * ApertureViewfinder:camera:
+   *
+   * The camera that is currently being used.
+   *
+   * Use #ApertureDeviceManager to obtain #ApertureCamera objects.
+   *
+   * To successfully switch cameras, the #ApertureViewfinder must be in the
+   * %APERTURE_VIEWFINDER_STATE_READY state. This is because switching camera
+   * sources would interrupt any picture or video that is being taken.
+   *
+   * Since: 0.1
+   */
+  props [PROP_CAMERA] =
+    g_param_spec_object ("camera",
+                         "Camera",
+                         "The camera to use",
+                         APERTURE_TYPE_CAMERA,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * ApertureViewfinder:state:
+   *
+   * What the viewfinder is currently doing.
+   *
+   * The state indicates what the viewfinder is currently doing, or sometimes
+   * that an error occurred. Many operations, like taking a picture or starting
+   * a recording, require that the #ApertureViewfinder be in the
+   * %APERTURE_VIEWFINDER_STATE_READY state.
+   *
+   * Since: 0.1
+   */
+  props [PROP_STATE] =
+    g_param_spec_enum ("state",
+                       "State",
+                       "What the viewfinder is currently doing",
+                       APERTURE_TYPE_VIEWFINDER_STATE,
+                       APERTURE_VIEWFINDER_STATE_LOADING,
+                       G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * ApertureViewfinder:detect-barcodes:
+   *
+   * Whether the #ApertureViewfinder should detect barcodes.
+   *
+   * When a barcode is detected, the ::barcode-detected signal will be
+   * emitted.
+   *
+   * This only works if barcode detection is enabled. See
+   * aperture_is_barcode_detection_enabled(). If barcode detection is not
+   * available, the value of this property will always be %FALSE, even if you
+   * try to set it to %TRUE.
+   *
+   * Since: 0.1
+   */
+  props [PROP_DETECT_BARCODES] =
+    g_param_spec_boolean ("detect-barcodes",
+                          "Detect barcodes",
+                          "Whether to detect barcodes in the camera feed",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * ApertureViewfinder:barcode-roi:
+   *
+   * The region of the camera feed to look for barcodes in, in pixels of the
+   * camera's frames, or %NULL to look at the whole frame.
+   *
+   * Scanning only part of the frame is much cheaper than scanning all of it,
+   * so if your UI asks the user to hold the code inside a box, set this to
+   * the area of the box.
+   *
+   * Since: 0.2
+   */
+  props [PROP_BARCODE_ROI] =
+    g_param_spec_boxed ("barcode-roi",
+                        "Barcode region of interest",
+                        "The region of the camera feed to look for barcodes in",
+                        GDK_TYPE_RECTANGLE,
+                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * ApertureViewfinder:barcode-scale:
+   *
+   * The factor by which the camera feed is scaled down before looking for
+   * barcodes in it.
+   *
+   * Barcode detection time grows with the number of pixels scanned, so
+   * lowering the scale saves a lot of CPU time on high-resolution cameras.
+   * Codes that are small in the frame might not be detected anymore,
+   * however.
+   *
+   * Since: 0.2
+   */
+  props [PROP_BARCODE_SCALE] =
+    g_param_spec_double ("barcode-scale",
+                         "Barcode scale",
+                         "Factor to scale the camera feed by before looking for barcodes",
+                         0.01, 1.0, 1.0,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * ApertureViewfinder:video-container:
+   *
+   * The file format to record videos in.
+   *
+   * Changing this does not affect a recording that has already started.
+   *
+   * Since: 0.2
+   */
+  props [PROP_VIDEO_CONTAINER] =
+    g_param_spec_enum ("video-container",
+                       "Video container",
+                       "The file format to record videos in",
+                       APERTURE_TYPE_VIDEO_CONTAINER,
+                       APERTURE_VIDEO_CONTAINER_MP4,
+                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * ApertureViewfinder:video-fragment-duration:
+   *
+   * How many milliseconds of video are written to the file at a time, or 0
+   * to write the file all at once when the recording stops.
+   *
+   * Videos are written in fragments so that they can be played while they
+   * are being recorded, and so that if the application crashes, only the
+   * last fragment is lost. Shorter fragments make the file slightly bigger.
+   *
+   * Changing this does not affect a recording that has already started.
+   *
+   * Since: 0.2
+   */
+  props [PROP_VIDEO_FRAGMENT_DURATION] =
+    g_param_spec_uint ("video-fragment-duration",
+                       "Video fragment duration",
+                       "Milliseconds of video to write to the file at a time",
+                       0, G_MAXUINT, 1000,
+                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * ApertureViewfinder:video-faststart:
+   *
+   * Whether to turn MP4 videos into regular MP4 files, with the index at
+   * the front, when the recording stops.
+   *
+   * Fragmented MP4 files play and seek fine in most players, but some
+   * players and editors handle regular MP4 files better. Finishing the file
+   * takes a moment, but is much quicker than remuxing it afterwards.
+   * Fragmented files are only finalized with GStreamer 1.20 or newer.
+   *
+   * This has no effect on Matroska files, which players can always seek
+   * in.
+   *
+   * Changing this does not affect a recording that has already started.
+   *
+   * Since: 0.2
+   */
+  props [PROP_VIDEO_FASTSTART] =
+    g_param_spec_boolean ("video-faststart",
+                          "Video faststart",
+                          "Whether to put the index at the front of MP4 files",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * ApertureViewfinder:video-segment-duration:
+   *
+   * The maximum length, in milliseconds, of each file of a segmented
+   * recording, or 0 for no limit. See
+   * aperture_viewfinder_start_recording_segments().
+   *
+   * Segments always start on a keyframe, so they can be a bit longer than
+   * this.
+   *
+   * Changing this does not affect a recording that has already started.
+   *
+   * Since: 0.2
+   */
+  props [PROP_VIDEO_SEGMENT_DURATION] =
+    g_param_spec_uint ("video-segment-duration",
+                       "Video segment duration",
+                       "Maximum length of each file of a segmented recording, in milliseconds",
+                       0, G_MAXUINT, 60000,
+                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * ApertureViewfinder:video-segment-size:
+   *
+   * The maximum size, in bytes, of each file of a segmented recording, or 0
+   * for no limit. See aperture_viewfinder_start_recording_segments().
+   *
+   * Segments always start on a keyframe, so they can be a bit bigger than
+   * this.
+   *
+   * Changing this does not affect a recording that has already started.
+   *
+   * Since: 0.2
+   */
+  props [PROP_VIDEO_SEGMENT_SIZE] =
+    g_param_spec_uint64 ("video-segment-size",
+                         "Video segment size",
+                         "Maximum size of each file of a segmented recording, in bytes",
+                         0, G_MAXUINT64, 0,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * ApertureViewfinder:video-preroll:
+   *
+   * How many milliseconds of video from before a recording is started to
+   * include in it, or 0 to start recordings when they are started.
+   *
+   * When this is set, the camera records all the time, and the most recent
+   * video is kept in memory. Starting a recording writes that video to the
+   * file first and then carries on with the live video, so the moments
+   * before an event was noticed are not missed.
+   *
+   * The kept video starts on a keyframe, so it can be up to one keyframe
+   * interval longer than this. It takes up about as much memory as the same
+   * length of recorded video takes on disk. Keeping the camera recording
+   * also uses more power.
+   *
+   * Since: 0.2
+   */
+  props [PROP_VIDEO_PREROLL] =
+    g_param_spec_uint ("video-preroll",
+                       "Video pre-roll",
+                       "Milliseconds of video from before a recording is started to include in it",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * ApertureViewfinder:video-write-buffer-size:
+   *
+   * How many bytes of a recording may wait to be written. Recordings are
+   * written from a worker thread, so that the camera isn't held up by
+   * slow storage, or by the stream or callback of
+   * aperture_viewfinder_start_recording_to_stream().
+   *
+   * Once this much is waiting, the recording is held up and the camera
+   * drops video frames until the writer catches up. This does not apply to
+   * aperture_viewfinder_start_recording_segments().
+   *
+   * Changing this does not affect a recording that has already started.
+   *
+   * Since: 0.2
+   */
+  props [PROP_VIDEO_WRITE_BUFFER_SIZE] =
+    g_param_spec_uint64 ("video-write-buffer-size",
+                         "Video write buffer size",
+                         "Bytes of a recording that may wait to be written",
+                         1, G_MAXUINT64, 4 * 1024 * 1024,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * ApertureViewfinder:video-sync-interval:
+   *
+   * How often, in milliseconds, a recording is synced to storage while it
+   * is being written to a file, or 0 to only sync it when it is finished.
+   *
+   * The recording is written out at least every half second either way;
+   * syncing makes sure it survives a crash of the whole system, not just
+   * of the application. Syncing more often costs some write bandwidth.
+   *
+   * Changing this does not affect a recording that has already started.
+   *
+   * Since: 0.2
+   */
+  props [PROP_VIDEO_SYNC_INTERVAL] =
+    g_param_spec_uint ("video-sync-interval",
+                       "Video sync interval",
+                       "Milliseconds between syncs of a recording to storage",
+                       0, G_MAXUINT, 1000,
+                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * ApertureViewfinder:video-adaptive-rate:
+   *
+   * Whether to lower the bitrate, and then the framerate, of a recording
+   * while storage can't keep up with it, rather than letting
+   * #ApertureViewfinder:video-write-buffer-size fill up and the camera drop
+   * frames. They are raised again, step by step, once storage has kept up
+   * for a few seconds. #ApertureViewfinder::recording-adapted is emitted
+   * on every change.
+   *
+   * This only works when the video is encoded in software (see
+   * #ApertureViewfinder:recording-profile), and not for
+   * aperture_viewfinder_start_recording_segments().
+   *
+   * Changing this does not affect a recording that has already started.
+   *
+   * Since: 0.2
+   */
+  props [PROP_VIDEO_ADAPTIVE_RATE] =
+    g_param_spec_boolean ("video-adaptive-rate",
+                          "Video adaptive rate",
+                          "Whether to lower the bitrate and framerate while storage can't keep up",
+                          TRUE,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * ApertureViewfinder:recording-profile:
+   *
+   * How recorded videos are encoded: the codec, bitrate, keyframe interval,
+   * framerate and resolution.
+   *
+   * If the camera can encode video in the profile's codec, it does, which
+   * is much cheaper than encoding in software. The camera's encoder then
+   * picks its own bitrate and keyframe interval. Otherwise, the video is
+   * encoded in software, following the whole profile. If neither can
+   * encode the codec, starting a recording fails with
+   * %G_IO_ERROR_NOT_SUPPORTED.
+   *
+   * If this is changed during a recording, it takes effect once the
+   * recording is over. Changing it also empties the
+   * #ApertureViewfinder:video-preroll buffer.
+   *
+   * Since: 0.2
+   */
+  props [PROP_RECORDING_PROFILE] =
+    g_param_spec_boxed ("recording-profile",
+                        "Recording profile",
+                        "How recorded videos are encoded",
+                        APERTURE_TYPE_RECORDING_PROFILE,
+                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * ApertureViewfinder:proxy-profile:
+   *
+   * How the proxy of aperture_viewfinder_start_recording_with_proxy() is
+   * encoded. The default is H.264 at 640 pixels wide and 1 Mbit/s.
+   *
+   * The proxy is made from the viewfinder's frames, so it can't have a
+   * higher resolution than the viewfinder. It is always encoded in
+   * software. If only the width or the height is set, the other follows
+   * the aspect ratio of the video.
+   *
+   * Changing this does not affect a recording that has already started.
+   *
+   * Since: 0.2
+   */
+  props [PROP_PROXY_PROFILE] =
+    g_param_spec_boxed ("proxy-profile",
+                        "Proxy profile",
+                        "How the proxies of recorded videos are encoded",
+                        APERTURE_TYPE_RECORDING_PROFILE,
+                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+
+  g_object_class_install_properties (object_class, N_PROPS, props);
+
+  /**
+   * ApertureViewfinder::barcode-detected:
+   * @self: the #ApertureViewfinder
+   * @barcode_type: the type of barcode
+   * @data: the data encoded in the barcode
+   *
+   * Emitted when a barcode is detected in the camera feed.
+   *
+   * This will only be emitted if #ApertureViewfinder:detect-barcodes is %TRUE.
+   *
+   * Barcodes are only detected when they appear on the feed, not on every
+   * frame when they are visible. See also ::barcode-lost.
+   *
+   * Since: 0.1
+   */
+  signals[SIGNAL_BARCODE_DETECTED] =
+    g_signal_new ("barcode-detected",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL, NULL,
+                  G_TYPE_NONE,
+                  2, APERTURE_TYPE_BARCODE, G_TYPE_STRING);
+
+  /**
+   * ApertureViewfinder::barcodes-detected:
+   * @self: the #ApertureViewfinder
+   * @results: (element-type ApertureBarcodeResult): the barcodes found in
+   * the frame
+   *
+   * Emitted with all the barcodes that newly appeared in a frame of the
+   * camera feed, at once. This is emitted before the individual
+   * ::barcode-detected signals for the same barcodes.
+   *
+   * When many barcodes are visible at the same time, handling them together
+   * is cheaper than handling one ::barcode-detected signal per barcode. The
+   * results also contain the positions of the barcodes, if known, and
+   * timing information.
+   *
+   * This will only be emitted if #ApertureViewfinder:detect-barcodes is %TRUE.
+   *
+   * Since: 0.2
+   */
+  signals[SIGNAL_BARCODES_DETECTED] =
+    g_signal_new ("barcodes-detected",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL, NULL,
+                  G_TYPE_NONE,
+                  1, G_TYPE_PTR_ARRAY);
+
+  /**
+   * ApertureViewfinder::barcode-lost:
+   * @self: the #ApertureViewfinder
+   * @barcode_type: the type of barcode
+   * @data: the data encoded in the barcode
+   *
+   * Emitted when a barcode that was detected is no longer in the camera
+   * feed. Each ::barcode-detected signal is eventually followed by one
+   * ::barcode-lost signal for the same barcode, unless barcode detection is
+   * turned off or the viewfinder stops first.
+   *
+   * A barcode is lost when it has not been seen for about a second, so
+   * briefly covering it or moving the camera does not make it lost and
+   * detected again.
+   *
+   * This will only be emitted if #ApertureViewfinder:detect-barcodes is %TRUE.
+   *
+   * Since: 0.2
+   */
+  signals[SIGNAL_BARCODE_LOST] =
+    g_signal_new ("barcode-lost",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL, NULL,
+                  G_TYPE_NONE,
+                  2, APERTURE_TYPE_BARCODE, G_TYPE_STRING);
+
+  /**
+   * ApertureViewfinder::segment-closed:
+   * @self: the #ApertureViewfinder
+   * @location: the path of the finished file
+   *
+   * Emitted when a file of a segmented recording is complete, while the
+   * recording carries on in the next file. The file is closed and can be
+   * uploaded or moved right away.
+   *
+   * This is also emitted for the last file, before the callback of
+   * aperture_viewfinder_stop_recording_async() is called.
+   *
+   * Since: 0.2
+   */
+  signals[SIGNAL_SEGMENT_CLOSED] =
+    g_signal_new ("segment-closed",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL, NULL,
+                  G_TYPE_NONE,
+                  1, G_TYPE_STRING);
+
+  /**
+   * ApertureViewfinder::recording-adapted:
+   * @self: the #ApertureViewfinder
+   * @profile: the settings the video is being recorded with now
+   *
+   * Emitted when the bitrate or framerate of a recording is lowered because
+   * storage can't keep up, and again when they are raised back. @profile
+   * is #ApertureViewfinder:recording-profile with the bitrate and framerate
+   * that are in effect.
+   *
+   * When a recording ends with them lowered, this is emitted once more
+   * with the full settings. See #ApertureViewfinder:video-adaptive-rate.
+   *
+   * Since: 0.2
+   */
+  signals[SIGNAL_RECORDING_ADAPTED] =
+    g_signal_new ("recording-adapted",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL, NULL,
+                  G_TYPE_NONE,
+                  1, APERTURE_TYPE_RECORDING_PROFILE);
+}
+
+
+static void
+aperture_viewfinder_init (ApertureViewfinder *self)
+{
+  g_autoptr(ApertureCamera) camera = NULL;
+  GstBus *bus;
+
+  aperture_private_ensure_initialized ();
+
+  self->frame_taps = g_hash_table_new (NULL, NULL);
+  self->next_frame_tap_id = 1;
+  self->barcode_scale = 1.0;
+  self->video_container = APERTURE_VIDEO_CONTAINER_MP4;
+  self->video_fragment_duration = 1000;
+  self->video_segment_duration = 60000;
+  self->video_write_buffer_size = 4 * 1024 * 1024;
+  self->video_sync_interval = 1000;
+  self->video_adaptive_rate = TRUE;
+  self->recording_profile = aperture_recording_profile_new ();
+  self->proxy_profile = aperture_recording_profile_new ();
+  aperture_recording_profile_set_resolution (self->proxy_profile, 640, 0);
+  aperture_recording_profile_set_bitrate (self->proxy_profile, 1000);
+
+  self->pipeline = gst_pipeline_new(NULL);
+  self->camerabin = create_element(self, "droidcamsrc");
+  self->vf_csp = create_element(self, "capsfilter");
+
+  self->gtksink = create_element (self, "gtksink");
+  g_object_get (self->gtksink, "widget", &self->sink_widget, NULL);
+  gtk_widget_set_hexpand (self->sink_widget, TRUE);
+  gtk_widget_set_vexpand (self->sink_widget, TRUE);
+  gtk_widget_show (self->sink_widget);
+  gtk_container_add (GTK_CONTAINER (self), self->sink_widget);
+  self->tee = aperture_pipeline_tee_new ();
+  aperture_pipeline_tee_add_branch (self->tee, self->gtksink);
+
+  self->vf_vc = create_element(self, "videoconvert");
+
+  self->multifilesink = create_element(self, "multifilesink");
+  self->tmp_pic_path = "/tmp/libaperture-tmp.jpg";
+  g_object_set(self->multifilesink, "async", FALSE, "post-messages",
+               TRUE, "location", self->tmp_pic_path, NULL);
+  self->fs_csp = create_element(self, "capsfilter");
+  self->fs_q = create_element(self, "queue");
+  g_object_set (self->fs_q, "leaky", 1, "max-size-buffers", 1, NULL);
+
+  gst_bin_add_many(GST_BIN(self->pipeline), self->camerabin,
+                   self->vf_csp, self->tee, self->vf_vc,
+                   self->multifilesink, self->fs_csp, self->fs_q,
+                   NULL);
+
+  gst_element_link_pads(self->camerabin, "vfsrc", self->vf_csp, "sink");
+  gst_element_link_pads(self->camerabin, "imgsrc", self->fs_csp, "sink");
+
+  gst_element_link_many(self->vf_csp, self->vf_vc, self->tee, NULL);
+  gst_element_link_many(self->fs_csp, self->fs_q, self->multifilesink, NULL);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (self->pipeline));
+  gst_bus_add_watch (bus, on_bus_message_async, self);
+  gst_object_unref (bus);
+
+  self->camera = NULL;
+  self->devices = aperture_device_manager_get_instance ();
+
+  if (aperture_device_manager_get_num_cameras (self->devices) > 0) {
+    set_state (self, APERTURE_VIEWFINDER_STATE_READY);
+    camera = aperture_device_manager_get_camera (self->devices, 0);
+    aperture_viewfinder_set_camera (self, camera, NULL);
+  } else {
+    set_state (self, APERTURE_VIEWFINDER_STATE_NO_CAMERAS);
+  }
+}
+
+
+/* PUBLIC */
+
+
+/**
+ * aperture_viewfinder_new:
+ *
+ * Creates a new #ApertureViewfinder.
+ *
+ * Returns: (transfer full): a new #ApertureViewfinder
+ * Since: 0.1
+ */
+ApertureViewfinder *
+aperture_viewfinder_new (void)
+{
+  return g_object_new (APERTURE_TYPE_VIEWFINDER, NULL);
+}
+
+
+/**
+ * aperture_viewfinder_set_camera:
+ * @self: an #ApertureViewfinder
+ * @camera: a camera index
+ * @error: a location for a #GError, or %NULL
+ *
+ * Sets the camera that the #ApertureViewfinder will use. See
+ * #ApertureViewfinder:camera.
+ *
+ * Since: 0.1
+ */
+void
+aperture_viewfinder_set_camera (ApertureViewfinder *self, ApertureCamera *camera, GError **error)
+{
+  g_autoptr(GstElement) droidcam = NULL;
+  GError *err = NULL;
+  int idx = 0;
+
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+  g_return_if_fail (camera == NULL || APERTURE_IS_CAMERA (camera));
+
+  get_current_operation (self, &err);
+  set_error_if_not_ready (self, &err);
+  if (err) {
+    g_propagate_error (error, err);
+    return;
+  }
+
+  if (self->camera == camera) {
+    return;
+  }
+
+  g_set_object (&self->camera, camera);
+
+  /* Must change camerabin to NULL and back to PLAYING for the change to take
+   * effect */
+  gst_element_set_state (self->pipeline, GST_STATE_NULL);
+
+  /* the new camera may not be able to encode the same things */
+  update_video_encoder (self);
+
+  if (camera != NULL) {
+    idx = aperture_camera_get_source_element(camera);
+
+    g_object_set(self->camerabin, "camera-device", idx, NULL);
+  }
+
+  if (gtk_widget_get_realized (GTK_WIDGET (self->sink_widget))) {
+    gst_element_set_state (self->pipeline, GST_STATE_PLAYING);
+  }
+
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_CAMERA]);
+}
+
+
+/**
+ * aperture_viewfinder_get_camera:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets the camera that the #ApertureViewfinder is currently using. See
+ * #ApertureViewfinder:camera.
+ *
+ * Returns: (transfer none): the current camera
+ * Since: 0.1
+ */
+ApertureCamera *
+aperture_viewfinder_get_camera (ApertureViewfinder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), NULL);
+  return self->camera;
+}
+
+
+/**
+ * aperture_viewfinder_get_state:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets the state of the #ApertureViewfinder. See #ApertureViewfinder:state.
+ *
+ * Returns: the viewfinder's state
+ * Since: 0.1
+ */
+ApertureViewfinderState
+aperture_viewfinder_get_state (ApertureViewfinder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), 0);
+  return self->state;
+}
+
+
+/**
+ * aperture_viewfinder_set_detect_barcodes:
+ * @self: an #ApertureViewfinder
+ * @detect_barcodes: %TRUE to detect barcodes, otherwise %FALSE
+ *
+ * Sets whether the #ApertureViewfinder should look for barcodes in its camera
+ * feed. See #ApertureViewfinder:detect-barcodes.
+ *
+ * Before calling this function, use aperture_is_barcode_detection_enabled()
+ * to make sure the barcode detection feature is enabled.
+ *
+ * Since: 0.1
+ */
+void
+aperture_viewfinder_set_detect_barcodes (ApertureViewfinder *self, gboolean detect_barcodes)
+{
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+  detect_barcodes = !!detect_barcodes;
+  g_return_if_fail (!detect_barcodes || aperture_is_barcode_detection_enabled ());
+
+  if (aperture_viewfinder_get_detect_barcodes (self) == detect_barcodes) {
+    return;
+  }
+
+  if (detect_barcodes) {
+    /* Barcode scanning is much slower than the camera, so only ever hand it
+     * the newest frame rather than letting raw frames pile up */
+    AperturePipelineTeeBranchPolicy policy = {
+      .drop_policy = APERTURE_PIPELINE_TEE_DROP_OLDEST,
+      .max_buffers = 1,
+    };
+
+    self->branch_zbar = aperture_pipeline_barcode_new ();
+    aperture_pipeline_barcode_set_scale (self->branch_zbar, self->barcode_scale);
+    aperture_pipeline_barcode_set_barcode_types (self->branch_zbar, self->barcode_types);
+    update_barcode_roi (self);
+    aperture_pipeline_tee_add_branch_full (self->tee, GST_ELEMENT (self->branch_zbar), &policy);
+  } else {
+    aperture_pipeline_tee_remove_branch (self->tee, GST_ELEMENT (self->branch_zbar));
+    self->branch_zbar = NULL;
+  }
+
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_DETECT_BARCODES]);
+}
+
+
+/**
+ * aperture_viewfinder_get_detect_barcodes:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets whether the #ApertureViewfinder is looking for barcodes in its camera
+ * feed.
+ *
+ * Returns: %TRUE if the viewfinder is looking for barcodes, otherwise %FALSE
+ * Since: 0.1
+ */
+gboolean
+aperture_viewfinder_get_detect_barcodes (ApertureViewfinder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), FALSE);
+  return self->branch_zbar != NULL;
+}
+
+
+/**
+ * aperture_viewfinder_set_barcode_types:
+ * @self: an #ApertureViewfinder
+ * @types: (array length=n_types) (nullable): the types of barcode to look
+ * for
+ * @n_types: the length of @types, or 0 to look for every type
+ *
+ * Sets which types of barcode the #ApertureViewfinder looks for.
+ *
+ * Each type of barcode takes time to look for on every frame, so if your
+ * application only needs a few types, listing them here makes detection
+ * faster and uses less power. Other types will not be reported.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_set_barcode_types (ApertureViewfinder    *self,
+                                       const ApertureBarcode *types,
+                                       guint                  n_types)
+{
+  guint32 mask = 0;
+  guint i;
+
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+  g_return_if_fail (types != NULL || n_types == 0);
+
+  for (i = 0; i < n_types; i ++) {
+    g_return_if_fail (types[i] > APERTURE_BARCODE_UNKNOWN && types[i] < APERTURE_BARCODE_N_TYPES);
+    mask |= 1u << types[i];
+  }
+
+  self->barcode_types = mask;
+
+  if (self->branch_zbar != NULL) {
+    aperture_pipeline_barcode_set_barcode_types (self->branch_zbar, mask);
+  }
+}
+
+
+/**
+ * aperture_viewfinder_get_barcode_types:
+ * @self: an #ApertureViewfinder
+ * @n_types: (out): return location for the number of types
+ *
+ * Gets the types of barcode the #ApertureViewfinder looks for. See
+ * aperture_viewfinder_set_barcode_types().
+ *
+ * Returns: (array length=n_types) (transfer full) (nullable): the types of
+ * barcode, or %NULL if every type is looked for
+ * Since: 0.2
+ */
+ApertureBarcode *
+aperture_viewfinder_get_barcode_types (ApertureViewfinder *self, guint *n_types)
+{
+  ApertureBarcode *types;
+  ApertureBarcode type;
+  guint n = 0;
+
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), NULL);
+  g_return_val_if_fail (n_types != NULL, NULL);
+
+  *n_types = 0;
+  if (self->barcode_types == 0) {
+    return NULL;
+  }
+
+  types = g_new (ApertureBarcode, APERTURE_BARCODE_N_TYPES - 1);
+  for (type = APERTURE_BARCODE_UNKNOWN + 1; type < APERTURE_BARCODE_N_TYPES; type ++) {
+    if (self->barcode_types & (1u << type)) {
+      types[n ++] = type;
+    }
+  }
+
+  *n_types = n;
+  return types;
+}
+
+
+/**
+ * aperture_viewfinder_set_barcode_roi:
+ * @self: an #ApertureViewfinder
+ * @roi: (nullable): the region to look for barcodes in, or %NULL for the
+ * whole frame
+ *
+ * Sets the region of the camera feed to look for barcodes in. See
+ * #ApertureViewfinder:barcode-roi.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_set_barcode_roi (ApertureViewfinder *self, const GdkRectangle *roi)
+{
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+  g_return_if_fail (roi == NULL || (roi->width > 0 && roi->height > 0));
+
+  if (roi == NULL && !self->has_barcode_roi) {
+    return;
+  }
+  if (roi != NULL && self->has_barcode_roi && gdk_rectangle_equal (roi, &self->barcode_roi)) {
+    return;
+  }
+
+  self->has_barcode_roi = roi != NULL;
+  if (roi != NULL) {
+    self->barcode_roi = *roi;
+  }
+
+  update_barcode_roi (self);
+
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_BARCODE_ROI]);
+}
+
+
+/**
+ * aperture_viewfinder_get_barcode_roi:
+ * @self: an #ApertureViewfinder
+ * @roi: (out caller-allocates) (optional): return location for the region
+ *
+ * Gets the region of the camera feed that barcodes are looked for in. See
+ * #ApertureViewfinder:barcode-roi.
+ *
+ * Returns: %TRUE if a region is set, %FALSE if the whole frame is scanned
+ * Since: 0.2
+ */
+gboolean
+aperture_viewfinder_get_barcode_roi (ApertureViewfinder *self, GdkRectangle *roi)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), FALSE);
+
+  if (roi != NULL && self->has_barcode_roi) {
+    *roi = self->barcode_roi;
+  }
+
+  return self->has_barcode_roi;
+}
+
+
+/**
+ * aperture_viewfinder_set_barcode_scale:
+ * @self: an #ApertureViewfinder
+ * @scale: the scale factor, greater than 0 and at most 1
+ *
+ * Sets the factor by which the camera feed is scaled down before looking for
+ * barcodes in it. See #ApertureViewfinder:barcode-scale.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_set_barcode_scale (ApertureViewfinder *self, double scale)
+{
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+  g_return_if_fail (scale > 0 && scale <= 1);
+
+  if (self->barcode_scale == scale) {
+    return;
+  }
+
+  self->barcode_scale = scale;
+
+  if (self->branch_zbar != NULL) {
+    aperture_pipeline_barcode_set_scale (self->branch_zbar, scale);
+  }
+
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_BARCODE_SCALE]);
+}
+
+
+/**
+ * aperture_viewfinder_get_barcode_scale:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets the factor by which the camera feed is scaled down before looking for
+ * barcodes in it. See #ApertureViewfinder:barcode-scale.
+ *
+ * Returns: the scale factor
+ * Since: 0.2
+ */
+double
+aperture_viewfinder_get_barcode_scale (ApertureViewfinder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), 1.0);
+  return self->barcode_scale;
+}
+
+
+/**
+ * ApertureFrameTapFunc:
+ * @viewfinder: the #ApertureViewfinder
+ * @sample: the frame, with its caps
+ * @frame: the frame's buffer, mapped for reading
+ * @user_data: the user data passed to aperture_viewfinder_add_frame_tap()
+ *
+ * Receives frames from a frame tap. See aperture_viewfinder_add_frame_tap().
+ *
+ * This is called on a worker thread, not the main thread.
+ *
+ * Since: 0.2
+ */
+
+
+/**
+ * aperture_viewfinder_add_frame_tap:
+ * @self: an #ApertureViewfinder
+ * @caps: (nullable): the format and/or size to receive frames in, or %NULL
+ * to receive them in whatever format the viewfinder uses
+ * @max_buffers: how many frames may wait for @func before the oldest ones
+ * are dropped. 0 means 1.
+ * @func: (scope notified) (closure user_data) (destroy destroy): the function
+ * to call with each frame
+ * @user_data: user data for @func
+ * @destroy: (nullable): called on @user_data once the tap is removed
+ *
+ * Gives the application access to the camera feed, for its own processing.
+ *
+ * @func is called for each frame, on a worker thread dedicated to this tap,
+ * with the frame already mapped for reading. The frame is shared with the
+ * rest of the pipeline, not copied, so it must not be modified. To keep it
+ * after @func returns, take a reference to @sample or its buffer.
+ *
+ * If @func is slower than the camera, frames are dropped, oldest first, so
+ * the tap always sees recent frames and never holds up the viewfinder.
+ *
+ * Returns: an ID for use with aperture_viewfinder_remove_frame_tap()
+ * Since: 0.2
+ */
+guint
+aperture_viewfinder_add_frame_tap (ApertureViewfinder *self,
+                                   GstCaps *caps,
+                                   guint max_buffers,
+                                   ApertureFrameTapFunc func,
+                                   gpointer user_data,
+                                   GDestroyNotify destroy)
+{
+  AperturePipelineTeeBranchPolicy policy = {
+    .drop_policy = APERTURE_PIPELINE_TEE_DROP_OLDEST,
+    .max_buffers = MAX (max_buffers, 1),
+  };
+  FrameTap *tap;
+  GstElement *bin;
+  guint id;
+
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), 0);
+  g_return_val_if_fail (caps == NULL || GST_IS_CAPS (caps), 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  tap = g_new0 (FrameTap, 1);
+  tap->viewfinder = self;
+  tap->func = func;
+  tap->user_data = user_data;
+  tap->destroy = destroy;
+
+  /* the bin owns the tap from here on, and frees it when it's destroyed */
+  bin = create_frame_tap_bin (tap, caps);
+
+  id = self->next_frame_tap_id ++;
+  g_hash_table_insert (self->frame_taps, GUINT_TO_POINTER (id), bin);
+  aperture_pipeline_tee_add_branch_full (self->tee, bin, &policy);
+
+  return id;
+}
+
+
+/**
+ * aperture_viewfinder_remove_frame_tap:
+ * @self: an #ApertureViewfinder
+ * @tap_id: an ID from aperture_viewfinder_add_frame_tap()
+ *
+ * Removes a frame tap.
+ *
+ * The tap is shut down asynchronously, so its function may still be called
+ * for a frame that is already being delivered. The tap's destroy notify is
+ * called once that is no longer possible.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_remove_frame_tap (ApertureViewfinder *self, guint tap_id)
+{
+  GstElement *bin;
+
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+
+  bin = g_hash_table_lookup (self->frame_taps, GUINT_TO_POINTER (tap_id));
+  g_return_if_fail (bin != NULL);
+
+  g_hash_table_remove (self->frame_taps, GUINT_TO_POINTER (tap_id));
+  aperture_pipeline_tee_remove_branch (self->tee, bin);
+}
+
+
+/**
+ * aperture_viewfinder_take_picture_async:
+ * @self: an #ApertureViewfinder
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to execute upon completion
+ * @user_data: closure data for @callback
+ *
+ * Takes a picture.
+ *
+ * This may take a while. The resolution might be changed temporarily,
+ * autofocusing might take place, etc. Basically everything you'd expect
+ * to happen when you click the photo button in a camera app.
+ *
+ * During a recording, the picture is taken from the viewfinder instead,
+ * so the camera can keep recording: it doesn't change mode, and the
+ * recording doesn't lose any frames. The picture has the viewfinder's
+ * resolution rather than the camera's full still resolution. It is the
+ * next frame that reaches the viewfinder after this is called, so it is
+ * ready after about one frame interval (33 ms at 30 fps), plus the time to
+ * convert it to RGB, and much sooner than a normal picture. Taking a
+ * picture while a recording is being stopped is not possible.
+ *
+ * When the picture has been taken, @callback will be called. Use
+ * aperture_viewfinder_take_picture_finish() to get the picture as a
+ * #GdkPixbuf.
+ *
+ * Since: 0.1
+ */
+void
+aperture_viewfinder_take_picture_async (ApertureViewfinder *self,
+                                        GCancellable *cancellable,
+                                        GAsyncReadyCallback callback,
+                                        gpointer user_data)
+{
+  GTask *task = NULL;
+  GError *err = NULL;
+
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  /* Set up task */
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, aperture_viewfinder_take_picture_async);
+
+  set_error_if_not_ready (self, &err);
+  /* A recording doesn't get in the way, unless it is being stopped */
+  if (!self->recording_video || self->task_take_video || self->task_take_picture) {
+    get_current_operation (self, &err);
+  }
+  if (err) {
+    g_task_return_error (task, err);
+    g_object_unref (task);
+    return;
+  }
+
+  self->task_take_picture = task;
+
+  if (self->recording_video) {
+    take_snapshot (self);
+    return;
+  }
+
+  /* Start the picture taking process */
+  stop_preroll_capture (self);
+  g_object_set (self->camerabin, "mode", 1, NULL);
+  g_signal_emit_by_name (self->camerabin, "start-capture", NULL);
+}
+
+
+/**
+ * aperture_viewfinder_take_picture_finish:
+ * @self: an #ApertureViewfinder
+ * @result: a #GAsyncResult provided to callback
+ * @error: a location for a #GError, or %NULL
+ *
+ * Finishes an operation started by
+ * aperture_viewfinder_take_picture_async().
+ *
+ * Returns: (transfer full): the image that was taken, or %NULL if there was an
+ * error
+ * Since: 0.1
+ */
+GdkPixbuf *
+aperture_viewfinder_take_picture_finish (ApertureViewfinder *self,
+                                         GAsyncResult *result,
+                                         GError **error)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), NULL);
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+
+typedef struct {
+  GdkPixbuf *pixbuf;
+  GPtrArray *barcodes;
+  guint32 barcode_types;
+} PictureWithBarcodes;
+
+
+#ifdef HAVE_BARCODE_DECODER
+static void
+picture_with_barcodes_free (PictureWithBarcodes *picture)
+{
+  g_clear_object (&picture->pixbuf);
+  g_clear_pointer (&picture->barcodes, g_ptr_array_unref);
+  g_free (picture);
+}
+
+
+static void
+scan_picture_thread_func (GTask        *task,
+                          gpointer      source_object,
+                          gpointer      task_data,
+                          GCancellable *cancellable)
+{
+  PictureWithBarcodes *picture = task_data;
+  g_autoptr(ApertureBarcodeDecoder) decoder = aperture_barcode_decoder_new (NULL);
+
+  aperture_barcode_decoder_set_barcode_types (decoder, picture->barcode_types);
+  picture->barcodes = aperture_barcode_decoder_decode_pixbuf (decoder, picture->pixbuf);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+
+static void
+on_picture_with_barcodes_taken (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  PictureWithBarcodes *picture = g_task_get_task_data (task);
+  GError *error = NULL;
+
+  picture->pixbuf = aperture_viewfinder_take_picture_finish (APERTURE_VIEWFINDER (source), result, &error);
+  if (picture->pixbuf == NULL) {
+    g_task_return_error (task, error);
+    return;
+  }
+
+  /* the full resolution picture takes a while to scan, so don't block the
+   * main thread */
+  g_task_run_in_thread (task, scan_picture_thread_func);
+}
+#endif
+
+
+/**
+ * aperture_viewfinder_take_picture_with_barcodes_async:
+ * @self: an #ApertureViewfinder
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: function to call when the picture has been taken and scanned
+ * @user_data: user data for @callback
+ *
+ * Takes a picture, like aperture_viewfinder_take_picture_async(), and then
+ * looks for barcodes in it on a background thread.
+ *
+ * The picture is taken at the full resolution of the camera, so small or
+ * dense barcodes that are too blurry to read in the viewfinder's feed can
+ * often be read here. The exception is a picture taken during a
+ * recording, which comes from the viewfinder (see
+ * aperture_viewfinder_take_picture_async()), so it is scanned at the
+ * viewfinder's resolution. Only the types set with
+ * aperture_viewfinder_set_barcode_types() are looked for. This doesn't
+ * depend on #ApertureViewfinder:detect-barcodes.
+ *
+ * Use aperture_viewfinder_take_picture_with_barcodes_finish() to get the
+ * picture and the barcodes. This only works if Aperture was built against
+ * a barcode library (zbar or ZXing-C++); otherwise, it fails with
+ * %G_IO_ERROR_NOT_SUPPORTED without taking a picture.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_take_picture_with_barcodes_async (ApertureViewfinder  *self,
+                                                      GCancellable        *cancellable,
+                                                      GAsyncReadyCallback  callback,
+                                                      gpointer             user_data)
+{
+#ifdef HAVE_BARCODE_DECODER
+  GTask *task;
+  PictureWithBarcodes *picture;
+#endif
+
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+#ifdef HAVE_BARCODE_DECODER
+  picture = g_new0 (PictureWithBarcodes, 1);
+  picture->barcode_types = self->barcode_types;
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, aperture_viewfinder_take_picture_with_barcodes_async);
+  g_task_set_task_data (task, picture, (GDestroyNotify) picture_with_barcodes_free);
+
+  aperture_viewfinder_take_picture_async (self, cancellable, on_picture_with_barcodes_taken, task);
+#else
+  /* the zbar element may still find barcodes in the viewfinder, but there
+   * is nothing to scan a picture with */
+  g_task_report_new_error (self, callback, user_data,
+                           aperture_viewfinder_take_picture_with_barcodes_async,
+                           G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Scanning pictures needs Aperture to be built against a barcode library");
+#endif
+}
+
+
+/**
+ * aperture_viewfinder_take_picture_with_barcodes_finish:
+ * @self: an #ApertureViewfinder
+ * @result: a #GAsyncResult provided to callback
+ * @barcodes: (out) (transfer full) (element-type ApertureBarcodeResult) (optional):
+ * return location for the barcodes found in the picture
+ * @error: a location for a #GError, or %NULL
+ *
+ * Finishes an operation started by
+ * aperture_viewfinder_take_picture_with_barcodes_async().
+ *
+ * The positions of the barcodes are in pixels of the picture. They have no
+ * timestamp or latency. If Aperture was built without a barcode library
+ * (zbar or ZXing-C++), this fails with %G_IO_ERROR_NOT_SUPPORTED.
+ *
+ * Returns: (transfer full): the image that was taken, or %NULL if there was an
+ * error
+ * Since: 0.2
+ */
+GdkPixbuf *
+aperture_viewfinder_take_picture_with_barcodes_finish (ApertureViewfinder  *self,
+                                                       GAsyncResult        *result,
+                                                       GPtrArray          **barcodes,
+                                                       GError             **error)
+{
+  PictureWithBarcodes *picture;
+
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), NULL);
+  g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+
+  if (!g_task_propagate_boolean (G_TASK (result), error)) {
+    return NULL;
+  }
+
+  picture = g_task_get_task_data (G_TASK (result));
+
+  if (barcodes != NULL) {
+    *barcodes = g_ptr_array_ref (picture->barcodes);
+  }
+
+  return g_object_ref (picture->pixbuf);
+}
+
+
+/**
+ * aperture_viewfinder_set_video_container:
+ * @self: an #ApertureViewfinder
+ * @container: the file format for videos
+ *
+ * Sets the file format to record videos in. See
+ * #ApertureViewfinder:video-container.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_set_video_container (ApertureViewfinder *self, ApertureVideoContainer container)
+{
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+
+  if (self->video_container == container) {
+    return;
+  }
+
+  self->video_container = container;
+
+  /* the standby branch has the old muxer; a recording in progress keeps
+   * its own, and a new branch is set up once it is done */
+  discard_standby_recorder (self);
+  prepare_standby_recorder (self);
+
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_VIDEO_CONTAINER]);
+}
+
+
+/**
+ * aperture_viewfinder_get_video_container:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets the file format videos are recorded in. See
+ * #ApertureViewfinder:video-container.
+ *
+ * Returns: the file format for videos
+ * Since: 0.2
+ */
+ApertureVideoContainer
+aperture_viewfinder_get_video_container (ApertureViewfinder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), APERTURE_VIDEO_CONTAINER_MP4);
+  return self->video_container;
+}
+
+
+/**
+ * aperture_viewfinder_set_video_fragment_duration:
+ * @self: an #ApertureViewfinder
+ * @duration: the length of a fragment in milliseconds, or 0
+ *
+ * Sets how much video is written to the file at a time. See
+ * #ApertureViewfinder:video-fragment-duration.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_set_video_fragment_duration (ApertureViewfinder *self, guint duration)
+{
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+
+  if (self->video_fragment_duration == duration) {
+    return;
+  }
+
+  self->video_fragment_duration = duration;
+
+  /* the standby branch's muxer is already running with the old setting */
+  discard_standby_recorder (self);
+  prepare_standby_recorder (self);
+
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_VIDEO_FRAGMENT_DURATION]);
+}
+
+
+/**
+ * aperture_viewfinder_get_video_fragment_duration:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets how much video is written to the file at a time. See
+ * #ApertureViewfinder:video-fragment-duration.
+ *
+ * Returns: the length of a fragment in milliseconds, or 0
+ * Since: 0.2
+ */
+guint
+aperture_viewfinder_get_video_fragment_duration (ApertureViewfinder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), 0);
+  return self->video_fragment_duration;
+}
+
+
+/**
+ * aperture_viewfinder_set_video_faststart:
+ * @self: an #ApertureViewfinder
+ * @faststart: whether to finish MP4 videos as regular MP4 files
+ *
+ * Sets whether MP4 videos are turned into regular MP4 files when the
+ * recording stops. See #ApertureViewfinder:video-faststart.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_set_video_faststart (ApertureViewfinder *self, gboolean faststart)
+{
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+
+  faststart = !!faststart;
+  if (self->video_faststart == faststart) {
+    return;
+  }
+
+  self->video_faststart = faststart;
+
+  /* the standby branch's muxer is already running with the old setting */
+  discard_standby_recorder (self);
+  prepare_standby_recorder (self);
+
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_VIDEO_FASTSTART]);
+}
+
+
+/**
+ * aperture_viewfinder_get_video_faststart:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets whether MP4 videos are turned into regular MP4 files when the
+ * recording stops. See #ApertureViewfinder:video-faststart.
+ *
+ * Returns: whether faststart is enabled
+ * Since: 0.2
+ */
+gboolean
+aperture_viewfinder_get_video_faststart (ApertureViewfinder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), FALSE);
+  return self->video_faststart;
+}
+
+
+/**
+ * aperture_viewfinder_set_video_segment_duration:
+ * @self: an #ApertureViewfinder
+ * @duration: the maximum length of a segment in milliseconds, or 0
+ *
+ * Sets the maximum length of each file of a segmented recording. See
+ * #ApertureViewfinder:video-segment-duration.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_set_video_segment_duration (ApertureViewfinder *self, guint duration)
+{
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+
+  if (self->video_segment_duration == duration) {
+    return;
+  }
+
+  self->video_segment_duration = duration;
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_VIDEO_SEGMENT_DURATION]);
+}
+
+
+/**
+ * aperture_viewfinder_get_video_segment_duration:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets the maximum length of each file of a segmented recording. See
+ * #ApertureViewfinder:video-segment-duration.
+ *
+ * Returns: the maximum length of a segment in milliseconds, or 0
+ * Since: 0.2
+ */
+guint
+aperture_viewfinder_get_video_segment_duration (ApertureViewfinder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), 0);
+  return self->video_segment_duration;
+}
+
+
+/**
+ * aperture_viewfinder_set_video_segment_size:
+ * @self: an #ApertureViewfinder
+ * @size: the maximum size of a segment in bytes, or 0
+ *
+ * Sets the maximum size of each file of a segmented recording. See
+ * #ApertureViewfinder:video-segment-size.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_set_video_segment_size (ApertureViewfinder *self, guint64 size)
+{
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+
+  if (self->video_segment_size == size) {
+    return;
+  }
+
+  self->video_segment_size = size;
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_VIDEO_SEGMENT_SIZE]);
+}
+
+
+/**
+ * aperture_viewfinder_get_video_segment_size:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets the maximum size of each file of a segmented recording. See
+ * #ApertureViewfinder:video-segment-size.
+ *
+ * Returns: the maximum size of a segment in bytes, or 0
+ * Since: 0.2
+ */
+guint64
+aperture_viewfinder_get_video_segment_size (ApertureViewfinder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), 0);
+  return self->video_segment_size;
+}
+
+
+/**
+ * aperture_viewfinder_set_video_preroll:
+ * @self: an #ApertureViewfinder
+ * @preroll: milliseconds of video to keep, or 0
+ *
+ * Sets how much video from before a recording is started to include in
+ * it. See #ApertureViewfinder:video-preroll.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_set_video_preroll (ApertureViewfinder *self, guint preroll)
+{
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+
+  if (self->video_preroll == preroll) {
+    return;
+  }
+
+  self->video_preroll = preroll;
+
+  if (self->preroll != NULL && preroll != 0) {
+    aperture_pipeline_preroll_set_max_duration (self->preroll, preroll * GST_MSECOND);
+  }
+  update_preroll (self);
+  prepare_preroll_encoder (self);
+
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_VIDEO_PREROLL]);
+}
+
+
+/**
+ * aperture_viewfinder_get_video_preroll:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets how much video from before a recording is started is included in
+ * it. See #ApertureViewfinder:video-preroll.
+ *
+ * Returns: milliseconds of video to keep, or 0
+ * Since: 0.2
+ */
+guint
+aperture_viewfinder_get_video_preroll (ApertureViewfinder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), 0);
+  return self->video_preroll;
+}
+
+
+/**
+ * aperture_viewfinder_set_video_write_buffer_size:
+ * @self: an #ApertureViewfinder
+ * @size: the size of the buffer in bytes
+ *
+ * Sets how much of a recording may wait to be written. See
+ * #ApertureViewfinder:video-write-buffer-size.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_set_video_write_buffer_size (ApertureViewfinder *self, guint64 size)
+{
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+  g_return_if_fail (size > 0);
+
+  if (self->video_write_buffer_size == size) {
+    return;
+  }
 
-  gst_element_set_state (self->pipeline, GST_STATE_NULL);
+  self->video_write_buffer_size = size;
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_VIDEO_WRITE_BUFFER_SIZE]);
 }
 
 
-/* INIT */
+/**
+ * aperture_viewfinder_get_video_write_buffer_size:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets how much of a recording may wait to be written. See
+ * #ApertureViewfinder:video-write-buffer-size.
+ *
+ * Returns: the size of the buffer in bytes
+ * Since: 0.2
+ */
+guint64
+aperture_viewfinder_get_video_write_buffer_size (ApertureViewfinder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), 0);
+  return self->video_write_buffer_size;
+}
 
 
-static void
-aperture_viewfinder_class_init (ApertureViewfinderClass *klass)
+/**
+ * aperture_viewfinder_set_video_sync_interval:
+ * @self: an #ApertureViewfinder
+ * @interval: milliseconds between syncs, or 0
+ *
+ * Sets how often a recording is synced to storage. See
+ * #ApertureViewfinder:video-sync-interval.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_set_video_sync_interval (ApertureViewfinder *self, guint interval)
 {
-  GObjectClass *object_class = G_OBJECT_CLASS (klass);
-  GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
 
-  object_class->finalize = aperture_viewfinder_finalize;
-  object_class->get_property = aperture_viewfinder_get_property;
-  object_class->set_property = aperture_viewfinder_set_property;
-  widget_class->realize = aperture_viewfinder_realize;
-  widget_class->unrealize = aperture_viewfinder_unrealize;
+  if (self->video_sync_interval == interval) {
+    return;
+  }
 
-  /**
-   * ApertureViewfinder:camera:
-   *
-   * The camera that is currently being used.
-   *
-   * Use #ApertureDeviceManager to obtain #ApertureCamera objects.
-   *
-   * To successfully switch cameras, the #ApertureViewfinder must be in the
-   * %APERTURE_VIEWFINDER_STATE_READY state. This is because switching camera
-   * sources would interrupt any picture or video that is being taken.
-   *
-   * Since: 0.1
-   */
-  props [PROP_CAMERA] =
-    g_param_spec_object ("camera",
-                         "Camera",
-                         "The camera to use",
-                         APERTURE_TYPE_CAMERA,
-                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+  self->video_sync_interval = interval;
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_VIDEO_SYNC_INTERVAL]);
+}
 
-  /**
-   * ApertureViewfinder:state:
-   *
-   * What the viewfinder is currently doing.
-   *
-   * The state indicates what the viewfinder is currently doing, or sometimes
-   * that an error occurred. Many operations, like taking a picture or starting
-   * a recording, require that the #ApertureViewfinder be in the
-   * %APERTURE_VIEWFINDER_STATE_READY state.
-   *
-   * Since: 0.1
-   */
-  props [PROP_STATE] =
-    g_param_spec_enum ("state",
-                       "State",
-                       "What the viewfinder is currently doing",
-                       APERTURE_TYPE_VIEWFINDER_STATE,
-                       APERTURE_VIEWFINDER_STATE_LOADING,
-                       G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
 
-  /**
-   * ApertureViewfinder:detect-barcodes:
-   *
-   * Whether the #ApertureViewfinder should detect barcodes.
-   *
-   * When a barcode is detected, the ::barcode-detected signal will be
-   * emitted.
-   *
-   * This only works if barcode detection is enabled. See
-   * aperture_is_barcode_detection_enabled(). If barcode detection is not
-   * available, the value of this property will always be %FALSE, even if you
-   * try to set it to %TRUE.
-   *
-   * Since: 0.1
-   */
-  props [PROP_DETECT_BARCODES] =
-    g_param_spec_boolean ("detect-barcodes",
-                          "Detect barcodes",
-                          "Whether to detect barcodes in the camera feed",
-                          FALSE,
-                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY);
+/**
+ * aperture_viewfinder_get_video_sync_interval:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets how often a recording is synced to storage. See
+ * #ApertureViewfinder:video-sync-interval.
+ *
+ * Returns: milliseconds between syncs, or 0
+ * Since: 0.2
+ */
+guint
+aperture_viewfinder_get_video_sync_interval (ApertureViewfinder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), 0);
+  return self->video_sync_interval;
+}
 
-  g_object_class_install_properties (object_class, N_PROPS, props);
 
-  /**
-   * ApertureViewfinder::barcode-detected:
-   * @self: the #ApertureViewfinder
-   * @barcode_type: the type of barcode
-   * @data: the data encoded in the barcode
-   *
-   * Emitted when a barcode is detected in the camera feed.
-   *
-   * This will only be emitted if #ApertureViewfinder:detect-barcodes is %TRUE.
-   *
-   * Barcodes are only detected when they appear on the feed, not on every
-   * frame when they are visible.
-   *
-   * Since: 0.1
-   */
-  signals[SIGNAL_BARCODE_DETECTED] =
-    g_signal_new ("barcode-detected",
-                  G_TYPE_FROM_CLASS (klass),
-                  G_SIGNAL_RUN_LAST,
-                  0,
-                  NULL, NULL, NULL,
-                  G_TYPE_NONE,
-                  2, APERTURE_TYPE_BARCODE, G_TYPE_STRING);
+/**
+ * aperture_viewfinder_set_video_adaptive_rate:
+ * @self: an #ApertureViewfinder
+ * @adaptive_rate: whether to adapt recordings to the storage
+ *
+ * Sets whether the bitrate and framerate of a recording are lowered while
+ * storage can't keep up. See #ApertureViewfinder:video-adaptive-rate.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_set_video_adaptive_rate (ApertureViewfinder *self, gboolean adaptive_rate)
+{
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+
+  adaptive_rate = !!adaptive_rate;
+  if (self->video_adaptive_rate == adaptive_rate) {
+    return;
+  }
+
+  self->video_adaptive_rate = adaptive_rate;
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_VIDEO_ADAPTIVE_RATE]);
 }
 
 
-static void
-aperture_viewfinder_init (ApertureViewfinder *self)
+/**
+ * aperture_viewfinder_get_video_adaptive_rate:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets whether the bitrate and framerate of a recording are lowered while
+ * storage can't keep up. See #ApertureViewfinder:video-adaptive-rate.
+ *
+ * Returns: whether recordings adapt to the storage
+ * Since: 0.2
+ */
+gboolean
+aperture_viewfinder_get_video_adaptive_rate (ApertureViewfinder *self)
 {
-  g_autoptr(ApertureCamera) camera = NULL;
-  GstBus *bus;
-
-  aperture_private_ensure_initialized ();
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), FALSE);
+  return self->video_adaptive_rate;
+}
 
-  self->pipeline = gst_pipeline_new(NULL);
-  self->camerabin = create_element(self, "droidcamsrc");
-  self->vf_csp = create_element(self, "capsfilter");
 
-  self->gtksink = create_element (self, "gtksink");
-  g_object_get (self->gtksink, "widget", &self->sink_widget, NULL);
-  gtk_widget_set_hexpand (self->sink_widget, TRUE);
-  gtk_widget_set_vexpand (self->sink_widget, TRUE);
-  gtk_widget_show (self->sink_widget);
-  gtk_container_add (GTK_CONTAINER (self), self->sink_widget);
-  self->tee = aperture_pipeline_tee_new ();
-  aperture_pipeline_tee_add_branch (self->tee, self->gtksink);
+/**
+ * aperture_viewfinder_set_recording_profile:
+ * @self: an #ApertureViewfinder
+ * @profile: (nullable): the recording profile, or %NULL for the default
+ *
+ * Sets how recorded videos are encoded. @profile is copied, so changing it
+ * afterward has no effect. See #ApertureViewfinder:recording-profile.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_set_recording_profile (ApertureViewfinder *self, const ApertureRecordingProfile *profile)
+{
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
 
-  self->vf_vc = create_element(self, "videoconvert");
+  aperture_recording_profile_free (self->recording_profile);
+  if (profile != NULL) {
+    self->recording_profile = aperture_recording_profile_copy (profile);
+  } else {
+    self->recording_profile = aperture_recording_profile_new ();
+  }
 
-  self->multifilesink = create_element(self, "multifilesink");
-  self->tmp_pic_path = "/tmp/libaperture-tmp.jpg";
-  g_object_set(self->multifilesink, "async", FALSE, "post-messages",
-               TRUE, "location", self->tmp_pic_path, NULL);
-  self->fs_csp = create_element(self, "capsfilter");
-  self->fs_q = create_element(self, "queue");
-  g_object_set (self->fs_q, "leaky", 1, "max-size-buffers", 1, NULL);
+  update_video_encoder (self);
 
-  gst_bin_add_many(GST_BIN(self->pipeline), self->camerabin,
-                   self->vf_csp, self->tee, self->vf_vc,
-                   self->multifilesink, self->fs_csp, self->fs_q,
-                   NULL);
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_RECORDING_PROFILE]);
+}
 
-  gst_element_link_pads(self->camerabin, "vfsrc", self->vf_csp, "sink");
-  gst_element_link_pads(self->camerabin, "imgsrc", self->fs_csp, "sink");
 
-  gst_element_link_many(self->vf_csp, self->vf_vc, self->tee, NULL);
-  gst_element_link_many(self->fs_csp, self->fs_q, self->multifilesink, NULL);
+/**
+ * aperture_viewfinder_get_recording_profile:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets how recorded videos are encoded. See
+ * #ApertureViewfinder:recording-profile.
+ *
+ * Returns: (transfer full): a copy of the recording profile
+ * Since: 0.2
+ */
+ApertureRecordingProfile *
+aperture_viewfinder_get_recording_profile (ApertureViewfinder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), NULL);
+  return aperture_recording_profile_copy (self->recording_profile);
+}
 
-  bus = gst_pipeline_get_bus (GST_PIPELINE (self->pipeline));
-  gst_bus_add_watch (bus, on_bus_message_async, self);
-  gst_object_unref (bus);
 
-  self->camera = NULL;
-  self->devices = aperture_device_manager_get_instance ();
+/**
+ * aperture_viewfinder_set_proxy_profile:
+ * @self: an #ApertureViewfinder
+ * @profile: (nullable): the proxy profile, or %NULL for the default
+ *
+ * Sets how the proxies of recorded videos are encoded. @profile is copied,
+ * so changing it afterward has no effect. See
+ * #ApertureViewfinder:proxy-profile.
+ *
+ * Since: 0.2
+ */
+void
+aperture_viewfinder_set_proxy_profile (ApertureViewfinder *self, const ApertureRecordingProfile *profile)
+{
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
 
-  if (aperture_device_manager_get_num_cameras (self->devices) > 0) {
-    set_state (self, APERTURE_VIEWFINDER_STATE_READY);
-    camera = aperture_device_manager_get_camera (self->devices, 0);
-    aperture_viewfinder_set_camera (self, camera, NULL);
+  aperture_recording_profile_free (self->proxy_profile);
+  if (profile != NULL) {
+    self->proxy_profile = aperture_recording_profile_copy (profile);
   } else {
-    set_state (self, APERTURE_VIEWFINDER_STATE_NO_CAMERAS);
+    self->proxy_profile = aperture_recording_profile_new ();
+    aperture_recording_profile_set_resolution (self->proxy_profile, 640, 0);
+    aperture_recording_profile_set_bitrate (self->proxy_profile, 1000);
   }
+
+  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_PROXY_PROFILE]);
 }
 
 
-/* PUBLIC */
+/**
+ * aperture_viewfinder_get_proxy_profile:
+ * @self: an #ApertureViewfinder
+ *
+ * Gets how the proxies of recorded videos are encoded. See
+ * #ApertureViewfinder:proxy-profile.
+ *
+ * Returns: (transfer full): a copy of the proxy profile
+ * Since: 0.2
+ */
+ApertureRecordingProfile *
+aperture_viewfinder_get_proxy_profile (ApertureViewfinder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), NULL);
+  return aperture_recording_profile_copy (self->proxy_profile);
+}
 
 
 /**
- * aperture_viewfinder_new:
+ * aperture_viewfinder_start_recording_to_file:
+ * @self: an #ApertureViewfinder
+ * @file: file path to save the video to
+ * @error: a location for a #GError, or %NULL
  *
- * Creates a new #ApertureViewfinder.
+ * Starts recording a video. The video will be saved to @file, in the format
+ * set by #ApertureViewfinder:video-container. If
+ * #ApertureViewfinder:video-preroll is set, the video starts a little
+ * before this is called. To know when the video actually starts, use
+ * aperture_viewfinder_start_recording_async() instead.
+ *
+ * The file is written from a worker thread, so slow storage doesn't hold
+ * up the camera until #ApertureViewfinder:video-write-buffer-size fills up.
+ * Use aperture_viewfinder_get_recording_stats() to see how it is keeping
+ * up. If writing fails, the recording ends, and the error is reported by
+ * aperture_viewfinder_stop_recording_async().
+ *
+ * If neither the camera nor an installed software encoder can encode the
+ * codec of #ApertureViewfinder:recording-profile, this fails with
+ * %G_IO_ERROR_NOT_SUPPORTED.
+ *
+ * Call aperture_viewfinder_stop_recording_async() to stop recording.
  *
- * Returns: (transfer full): a new #ApertureViewfinder
  * Since: 0.1
  */
-ApertureViewfinder *
-aperture_viewfinder_new (void)
+void
+aperture_viewfinder_start_recording_to_file (ApertureViewfinder *self, const char *file, GError **error)
 {
-  return g_object_new (APERTURE_TYPE_VIEWFINDER, NULL);
+  GError *err = NULL;
+
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+  g_return_if_fail (file != NULL);
+
+  set_error_if_not_ready (self, &err);
+  get_current_operation (self, &err);
+  set_error_if_cant_encode (self, &err);
+  if (err) {
+    g_propagate_error (error, err);
+    return;
+  }
+
+  if (self->standby != NULL) {
+    start_recording (self, self->standby, file);
+  } else {
+    start_recording (self, aperture_pipeline_recorder_new (self->video_container, aperture_recording_profile_get_codec (self->recording_profile)), file);
+  }
 }
 
 
 /**
- * aperture_viewfinder_set_camera:
+ * aperture_viewfinder_start_recording_with_proxy:
  * @self: an #ApertureViewfinder
- * @camera: a camera index
+ * @file: file path to save the video to
+ * @proxy_file: file path to save the proxy to
  * @error: a location for a #GError, or %NULL
  *
- * Sets the camera that the #ApertureViewfinder will use. See
- * #ApertureViewfinder:camera.
+ * Like aperture_viewfinder_start_recording_to_file(), but also records a
+ * small copy of the video to @proxy_file, encoded with
+ * #ApertureViewfinder:proxy-profile, so it doesn't have to be transcoded
+ * afterwards.
  *
- * Since: 0.1
+ * The proxy is made from the viewfinder's frames rather than from the
+ * recording, so the camera only has to produce one stream. It doesn't
+ * include any #ApertureViewfinder:video-preroll, and if the device can't
+ * keep up with encoding it, frames are dropped from the proxy rather than
+ * from the recording. If the proxy fails, the recording carries on
+ * without it.
+ *
+ * aperture_viewfinder_stop_recording_async() finishes once both files are
+ * complete.
+ *
+ * If there is no software encoder for the proxy profile's codec, this
+ * fails with %G_IO_ERROR_NOT_SUPPORTED. If the recording itself can't be
+ * started, no proxy is made either.
+ *
+ * Returns: %TRUE if the recording was started, %FALSE if @error was set
+ *
+ * Since: 0.2
  */
-void
-aperture_viewfinder_set_camera (ApertureViewfinder *self, ApertureCamera *camera, GError **error)
+gboolean
+aperture_viewfinder_start_recording_with_proxy (ApertureViewfinder  *self,
+                                                const char          *file,
+                                                const char          *proxy_file,
+                                                GError             **error)
 {
-  g_autoptr(GstElement) droidcam = NULL;
+  /* a proxy that falls behind drops frames, rather than holding up the
+   * viewfinder */
+  AperturePipelineTeeBranchPolicy policy = {
+    .threading = APERTURE_PIPELINE_TEE_THREADING_DEDICATED,
+    .drop_policy = APERTURE_PIPELINE_TEE_DROP_OLDEST,
+    .max_buffers = 5,
+  };
+  AperturePipelineRecorder *recorder;
   GError *err = NULL;
-  int idx = 0;
 
-  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
-  g_return_if_fail (camera == NULL || APERTURE_IS_CAMERA (camera));
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), FALSE);
+  g_return_val_if_fail (file != NULL, FALSE);
+  g_return_val_if_fail (proxy_file != NULL, FALSE);
 
-  get_current_operation (self, &err);
   set_error_if_not_ready (self, &err);
+  get_current_operation (self, &err);
   if (err) {
     g_propagate_error (error, err);
-    return;
+    return FALSE;
   }
 
-  if (self->camera == camera) {
-    return;
+  if (!aperture_pipeline_encoder_can_encode (aperture_recording_profile_get_codec (self->proxy_profile))) {
+    g_set_error (error,
+                 G_IO_ERROR,
+                 G_IO_ERROR_NOT_SUPPORTED,
+                 "No software encoder is installed for the proxy profile's codec");
+    return FALSE;
   }
 
-  g_set_object (&self->camera, camera);
+  /* only add the proxy once the recording it belongs to has started */
+  aperture_viewfinder_start_recording_to_file (self, file, &err);
+  if (err) {
+    g_propagate_error (error, err);
+    return FALSE;
+  }
 
-  /* Must change camerabin to NULL and back to PLAYING for the change to take
-   * effect */
-  gst_element_set_state (self->pipeline, GST_STATE_NULL);
+  self->proxy = aperture_pipeline_proxy_new (self->proxy_profile, self->video_container);
+  recorder = aperture_pipeline_proxy_get_recorder (self->proxy);
+  aperture_pipeline_recorder_set_fragment_duration (recorder, self->video_fragment_duration * GST_MSECOND);
+  aperture_pipeline_recorder_set_faststart (recorder, self->video_faststart);
+  aperture_pipeline_recorder_set_max_queued_bytes (recorder, self->video_write_buffer_size);
+  aperture_pipeline_recorder_set_sync_interval (recorder, self->video_sync_interval * GST_MSECOND);
+  aperture_pipeline_recorder_set_location (recorder, proxy_file);
 
-  if (camera != NULL) {
-    idx = aperture_camera_get_source_element(camera);
+  aperture_pipeline_tee_add_branch_full (self->tee, GST_ELEMENT (self->proxy), &policy);
+  return TRUE;
+}
 
-    g_object_set(self->camerabin, "camera-device", idx, NULL);
-  }
 
-  if (gtk_widget_get_realized (GTK_WIDGET (self->sink_widget))) {
-    gst_element_set_state (self->pipeline, GST_STATE_PLAYING);
+/* Runs in the main context once the cancellable of
+ * aperture_viewfinder_start_recording_async() is cancelled. The recording
+ * itself carries on. */
+static gboolean
+on_start_video_cancelled (GCancellable *cancellable, gpointer user_data)
+{
+  GTask *task = G_TASK (user_data);
+  ApertureViewfinder *self = APERTURE_VIEWFINDER (g_task_get_source_object (task));
+
+  if (self->task_start_video == task) {
+    /* the source is being dispatched, so it goes away by itself */
+    self->start_video_cancel_source = 0;
+    g_task_return_error_if_cancelled (task);
+    end_start_video_task (self);
   }
 
-  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_CAMERA]);
+  return G_SOURCE_REMOVE;
 }
 
 
 /**
- * aperture_viewfinder_get_camera:
+ * aperture_viewfinder_start_recording_async:
  * @self: an #ApertureViewfinder
+ * @file: file path to save the video to
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: a #GAsyncReadyCallback to execute upon completion
+ * @user_data: closure data for @callback
  *
- * Gets the camera that the #ApertureViewfinder is currently using. See
- * #ApertureViewfinder:camera.
+ * Like aperture_viewfinder_start_recording_to_file(), but @callback is
+ * called once the recording has actually started, which is when the first
+ * keyframe has gone into the file. Get the result, and how long that took,
+ * with aperture_viewfinder_start_recording_finish().
  *
- * Returns: (transfer none): the current camera
- * Since: 0.1
+ * The recording branch is set up ahead of time, so starting a recording
+ * only has to open the file and start the camera's video.
+ *
+ * Cancelling @cancellable makes this fail with %G_IO_ERROR_CANCELLED right
+ * away, but only stops waiting; the recording continues until
+ * aperture_viewfinder_stop_recording_async() is called. Stopping it before
+ * it has started makes this fail with
+ * %APERTURE_MEDIA_CAPTURE_ERROR_INTERRUPTED.
+ *
+ * Since: 0.2
  */
-ApertureCamera *
-aperture_viewfinder_get_camera (ApertureViewfinder *self)
+void
+aperture_viewfinder_start_recording_async (ApertureViewfinder  *self,
+                                           const char          *file,
+                                           GCancellable        *cancellable,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data)
 {
-  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), NULL);
-  return self->camera;
+  GTask *task = NULL;
+  GError *err = NULL;
+
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+  g_return_if_fail (file != NULL);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, aperture_viewfinder_start_recording_async);
+
+  aperture_viewfinder_start_recording_to_file (self, file, &err);
+  if (err) {
+    g_task_return_error (task, err);
+    g_object_unref (task);
+    return;
+  }
+
+  /* returns once the first keyframe is in; see on_recording_started() */
+  self->task_start_video = task;
+
+  if (cancellable != NULL) {
+    GSource *source = g_cancellable_source_new (cancellable);
+
+    g_task_attach_source (task, source, (GSourceFunc) on_start_video_cancelled);
+    self->start_video_cancel_source = g_source_get_id (source);
+    g_source_unref (source);
+  }
 }
 
 
 /**
- * aperture_viewfinder_get_state:
+ * aperture_viewfinder_start_recording_finish:
  * @self: an #ApertureViewfinder
+ * @result: a #GAsyncResult provided to callback
+ * @latency: (out) (optional): return location for the time it took for the
+ * recording to start
+ * @error: a location for a #GError, or %NULL
  *
- * Gets the state of the #ApertureViewfinder. See #ApertureViewfinder:state.
+ * Finishes an operation started by aperture_viewfinder_start_recording_async().
  *
- * Returns: the viewfinder's state
- * Since: 0.1
+ * Returns: %TRUE if the recording started, otherwise %FALSE
+ * Since: 0.2
  */
-ApertureViewfinderState
-aperture_viewfinder_get_state (ApertureViewfinder *self)
+gboolean
+aperture_viewfinder_start_recording_finish (ApertureViewfinder  *self,
+                                            GAsyncResult        *result,
+                                            GstClockTime        *latency,
+                                            GError             **error)
 {
-  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), 0);
-  return self->state;
+  g_autofree GstClockTime *start_latency = NULL;
+
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), FALSE);
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  start_latency = g_task_propagate_pointer (G_TASK (result), error);
+  if (start_latency == NULL) {
+    return FALSE;
+  }
+
+  if (latency != NULL) {
+    *latency = *start_latency;
+  }
+  return TRUE;
 }
 
 
 /**
- * aperture_viewfinder_set_detect_barcodes:
+ * aperture_viewfinder_start_recording_segments:
  * @self: an #ApertureViewfinder
- * @detect_barcodes: %TRUE to detect barcodes, otherwise %FALSE
+ * @location_format: a printf-style format for the file paths
+ * @error: a location for a #GError, or %NULL
  *
- * Sets whether the #ApertureViewfinder should look for barcodes in its camera
- * feed. See #ApertureViewfinder:detect-barcodes.
+ * Starts recording a video that is split into several files, in the format
+ * set by #ApertureViewfinder:video-container. A new file is started when
+ * the current one reaches #ApertureViewfinder:video-segment-duration or
+ * #ApertureViewfinder:video-segment-size.
  *
- * Before calling this function, use aperture_is_barcode_detection_enabled()
- * to make sure the barcode detection feature is enabled.
+ * @location_format must contain one integer conversion, such as
+ * `"video-%05d.mp4"`, which is replaced by the number of the segment,
+ * starting at 0.
  *
- * Since: 0.1
+ * Each file starts with a keyframe, so it can be played on its own, and
+ * there are no frames missing between files. When a file is complete,
+ * #ApertureViewfinder::segment-closed is emitted, so it can be uploaded
+ * while the recording continues.
+ *
+ * Call aperture_viewfinder_stop_recording_async() to stop recording.
+ *
+ * Since: 0.2
  */
 void
-aperture_viewfinder_set_detect_barcodes (ApertureViewfinder *self, gboolean detect_barcodes)
+aperture_viewfinder_start_recording_segments (ApertureViewfinder *self, const char *location_format, GError **error)
 {
+  GError *err = NULL;
+  AperturePipelineRecorder *recorder;
+
   g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
-  detect_barcodes = !!detect_barcodes;
-  g_return_if_fail (!detect_barcodes || aperture_is_barcode_detection_enabled ());
+  g_return_if_fail (location_format != NULL);
 
-  if (aperture_viewfinder_get_detect_barcodes (self) == detect_barcodes) {
+  set_error_if_not_ready (self, &err);
+  get_current_operation (self, &err);
+  set_error_if_cant_encode (self, &err);
+  if (err) {
+    g_propagate_error (error, err);
     return;
   }
 
-  if (detect_barcodes) {
-    self->branch_zbar = create_zbar_bin ();
-    aperture_pipeline_tee_add_branch (self->tee, GST_ELEMENT (self->branch_zbar));
-  } else {
-    aperture_pipeline_tee_remove_branch (self->tee, GST_ELEMENT (self->branch_zbar));
-    self->branch_zbar = NULL;
-  }
-
-  g_object_notify_by_pspec (G_OBJECT (self), props[PROP_DETECT_BARCODES]);
+  recorder = aperture_pipeline_recorder_new_segmented (self->video_container, aperture_recording_profile_get_codec (self->recording_profile));
+  aperture_pipeline_recorder_set_max_segment (recorder,
+                                              self->video_segment_duration * GST_MSECOND,
+                                              self->video_segment_size);
+  start_recording (self, recorder, location_format);
 }
 
 
 /**
- * aperture_viewfinder_get_detect_barcodes:
- * @self: an #ApertureViewfinder
+ * ApertureRecordingChunkFunc:
+ * @viewfinder: the #ApertureViewfinder
+ * @chunk: the next part of the video
+ * @user_data: the user data passed to
+ * aperture_viewfinder_start_recording_with_callback()
  *
- * Gets whether the #ApertureViewfinder is looking for barcodes in its camera
- * feed.
+ * Receives a streamed recording, one chunk at a time. See
+ * aperture_viewfinder_start_recording_with_callback().
  *
- * Returns: %TRUE if the viewfinder is looking for barcodes, otherwise %FALSE
- * Since: 0.1
+ * This is called on a worker thread, not the main thread.
+ *
+ * Returns: %TRUE to continue, or %FALSE to abort the recording
+ * Since: 0.2
  */
-gboolean
-aperture_viewfinder_get_detect_barcodes (ApertureViewfinder *self)
+
+
+typedef struct {
+  ApertureViewfinder *viewfinder;
+  ApertureRecordingChunkFunc func;
+  gpointer user_data;
+  GDestroyNotify destroy;
+} RecordingCallback;
+
+
+static void
+recording_callback_free (RecordingCallback *callback)
 {
-  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), FALSE);
-  return self->branch_zbar != NULL;
+  if (callback->destroy != NULL) {
+    callback->destroy (callback->user_data);
+  }
+  g_free (callback);
+}
+
+
+static gboolean
+recording_callback_chunk (GBytes *chunk, gpointer user_data, GError **error)
+{
+  RecordingCallback *callback = user_data;
+
+  if (!callback->func (callback->viewfinder, chunk, callback->user_data)) {
+    g_set_error (error,
+                 APERTURE_MEDIA_CAPTURE_ERROR,
+                 APERTURE_MEDIA_CAPTURE_ERROR_INTERRUPTED,
+                 "The recording was aborted by its callback");
+    return FALSE;
+  }
+
+  return TRUE;
 }
 
 
 /**
- * aperture_viewfinder_take_picture_async:
+ * aperture_viewfinder_start_recording_to_stream:
  * @self: an #ApertureViewfinder
- * @cancellable: (nullable): a #GCancellable
- * @callback: a #GAsyncReadyCallback to execute upon completion
- * @user_data: closure data for @callback
+ * @stream: the stream to write the video to
+ * @error: a location for a #GError, or %NULL
  *
- * Takes a picture.
+ * Starts recording a video, and writes it to @stream as it is recorded, in
+ * the format set by #ApertureViewfinder:video-container. There is no
+ * temporary file, so @stream can be a socket or a pipe.
  *
- * This may take a while. The resolution might be changed temporarily,
- * autofocusing might take place, etc. Basically everything you'd expect
- * to happen when you click the photo button in a camera app.
+ * The video is written in a form that doesn't need seeking: a fragmented
+ * MP4, with fragments of #ApertureViewfinder:video-fragment-duration (or one
+ * second if that is 0), or a streamable Matroska file.
+ * #ApertureViewfinder:video-faststart does not apply.
  *
- * When the picture has been taken, @callback will be called. Use
- * aperture_viewfinder_take_picture_finish() to get the picture as a
- * #GdkPixbuf.
+ * The video is written from a worker thread, so @stream must not be used by
+ * anything else until the recording is done. If @stream can't keep up, up to
+ * #ApertureViewfinder:video-write-buffer-size bytes wait for it; after
+ * that, the recording is held up and the camera drops video frames. See
+ * aperture_viewfinder_get_recording_backlog().
  *
- * Since: 0.1
+ * If writing fails, the recording ends, and the error is reported by
+ * aperture_viewfinder_stop_recording_async(). @stream is not closed.
+ *
+ * Call aperture_viewfinder_stop_recording_async() to stop recording. It
+ * completes once everything has been written to @stream.
+ *
+ * Since: 0.2
  */
 void
-aperture_viewfinder_take_picture_async (ApertureViewfinder *self,
-                                        GCancellable *cancellable,
-                                        GAsyncReadyCallback callback,
-                                        gpointer user_data)
+aperture_viewfinder_start_recording_to_stream (ApertureViewfinder *self, GOutputStream *stream, GError **error)
 {
-  GTask *task = NULL;
   GError *err = NULL;
 
   g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
-  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
-
-  /* Set up task */
-  task = g_task_new (self, cancellable, callback, user_data);
-  g_task_set_source_tag (task, aperture_viewfinder_take_picture_async);
+  g_return_if_fail (G_IS_OUTPUT_STREAM (stream));
 
   set_error_if_not_ready (self, &err);
   get_current_operation (self, &err);
+  set_error_if_cant_encode (self, &err);
   if (err) {
-    g_task_return_error (task, err);
-    g_object_unref (task);
+    g_propagate_error (error, err);
     return;
   }
 
-  self->task_take_picture = task;
-
-  /* Start the picture taking process */
-  g_object_set (self->camerabin, "mode", 1, NULL);
-  g_signal_emit_by_name (self->camerabin, "start-capture", NULL);
+  start_recording (self,
+                   aperture_pipeline_recorder_new_for_stream (self->video_container,
+                                                              aperture_recording_profile_get_codec (self->recording_profile),
+                                                              stream),
+                   NULL);
 }
 
 
 /**
- * aperture_viewfinder_take_picture_finish:
+ * aperture_viewfinder_start_recording_with_callback:
  * @self: an #ApertureViewfinder
- * @result: a #GAsyncResult provided to callback
+ * @func: (scope notified) (closure user_data) (destroy destroy): the
+ * function to call with each chunk of the video
+ * @user_data: user data for @func
+ * @destroy: (nullable): called on @user_data once the recording is done
  * @error: a location for a #GError, or %NULL
  *
- * Finishes an operation started by
- * aperture_viewfinder_take_picture_async().
+ * Like aperture_viewfinder_start_recording_to_stream(), but hands the video
+ * to @func, one chunk at a time, in order. @func is called on a worker
+ * thread. The chunks can be kept after @func returns by taking a reference.
  *
- * Returns: (transfer full): the image that was taken, or %NULL if there was an
- * error
- * Since: 0.1
+ * If @func returns %FALSE, the recording ends, and
+ * aperture_viewfinder_stop_recording_async() reports
+ * %APERTURE_MEDIA_CAPTURE_ERROR_INTERRUPTED.
+ *
+ * Since: 0.2
  */
-GdkPixbuf *
-aperture_viewfinder_take_picture_finish (ApertureViewfinder *self,
-                                         GAsyncResult *result,
-                                         GError **error)
+void
+aperture_viewfinder_start_recording_with_callback (ApertureViewfinder         *self,
+                                                   ApertureRecordingChunkFunc  func,
+                                                   gpointer                    user_data,
+                                                   GDestroyNotify              destroy,
+                                                   GError                    **error)
 {
-  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), NULL);
-  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+  GError *err = NULL;
+  RecordingCallback *callback;
 
-  return g_task_propagate_pointer (G_TASK (result), error);
+  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
+  g_return_if_fail (func != NULL);
+
+  set_error_if_not_ready (self, &err);
+  get_current_operation (self, &err);
+  set_error_if_cant_encode (self, &err);
+  if (err) {
+    if (destroy != NULL) {
+      destroy (user_data);
+    }
+    g_propagate_error (error, err);
+    return;
+  }
+
+  callback = g_new0 (RecordingCallback, 1);
+  callback->viewfinder = self;
+  callback->func = func;
+  callback->user_data = user_data;
+  callback->destroy = destroy;
+
+  start_recording (self,
+                   aperture_pipeline_recorder_new_for_func (self->video_container,
+                                                            aperture_recording_profile_get_codec (self->recording_profile),
+                                                            recording_callback_chunk,
+                                                            callback,
+                                                            (GDestroyNotify) recording_callback_free),
+                   NULL);
 }
 
 
 /**
- * aperture_viewfinder_start_recording_to_file:
+ * aperture_viewfinder_get_recording_backlog:
  * @self: an #ApertureViewfinder
- * @file: file path to save the video to
- * @error: a location for a #GError, or %NULL
- *
- * Starts recording a video. The video will be saved to @file.
  *
- * Call aperture_viewfinder_stop_recording_async() to stop recording.
+ * Gets how much of the recording is waiting to be written. When this
+ * approaches #ApertureViewfinder:video-write-buffer-size, the storage or
+ * the consumer is not keeping up, and the recording is about to lose
+ * frames.
  *
- * Since: 0.1
+ * Returns: the number of bytes waiting, or 0 if there is no recording
+ * Since: 0.2
  */
-void
-aperture_viewfinder_start_recording_to_file (ApertureViewfinder *self, const char *file, GError **error)
+guint64
+aperture_viewfinder_get_recording_backlog (ApertureViewfinder *self)
 {
-  GError *err = NULL;
-  GstCaps *caps;
+  AperturePipelineRecorderWriterStats stats = { 0 };
 
-  g_return_if_fail (APERTURE_IS_VIEWFINDER (self));
-  g_return_if_fail (file != NULL);
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), 0);
 
-  set_error_if_not_ready (self, &err);
-  get_current_operation (self, &err);
-  if (err) {
-    g_propagate_error (error, err);
-    return;
+  if (self->recorder != NULL) {
+    aperture_pipeline_recorder_get_writer_stats (self->recorder, &stats);
   }
 
-  self->recording_video = TRUE;
+  return stats.queued_bytes;
+}
 
-  self->filesink = create_element(self, "filesink");
-  g_object_set(self->filesink, "location", file, NULL);
 
-  gst_bin_add (GST_BIN (self->pipeline), self->filesink);
+/**
+ * ApertureRecordingStats:
+ * @backlog: bytes waiting to be written
+ * @max_backlog: the most bytes that have been waiting at once
+ * @bytes_written: bytes written so far
+ * @blocked_time: how long the recording has been held up because
+ * #ApertureViewfinder:video-write-buffer-size was full
+ * @write_latency_p50: the median time a write to the file took
+ * @write_latency_p95: the 95th percentile of the time a write took
+ * @write_latency_p99: the 99th percentile of the time a write took
+ * @write_latency_max: the longest a write took
+ * @sync_latency_max: the longest a sync to storage took
+ *
+ * How well the storage is keeping up with a recording. See
+ * aperture_viewfinder_get_recording_stats().
+ *
+ * The percentiles are of the latest 1024 writes. The latencies are 0 for a
+ * streamed recording, since it isn't written to a file.
+ *
+ * Since: 0.2
+ */
 
-  caps = gst_caps_from_string("video/x-h264, framerate=30/1");
-  gst_element_link_pads_filtered(self->camerabin, "vidsrc", self->filesink, "sink", caps);
-  gst_caps_unref(caps);
 
-  g_object_set (self->camerabin, "mode", 2, NULL);
-  gst_element_set_state (self->filesink, GST_STATE_PLAYING);
+/**
+ * aperture_viewfinder_get_recording_stats:
+ * @self: an #ApertureViewfinder
+ * @stats: (out caller-allocates): return location for the stats
+ *
+ * Gets how well the storage is keeping up with the recording in progress.
+ * For a recording from aperture_viewfinder_start_recording_segments(), the
+ * stats are all 0.
+ *
+ * Returns: %TRUE if @stats was filled in, or %FALSE if there is no
+ * recording
+ * Since: 0.2
+ */
+gboolean
+aperture_viewfinder_get_recording_stats (ApertureViewfinder *self, ApertureRecordingStats *stats)
+{
+  AperturePipelineRecorderWriterStats writer_stats;
 
-  g_signal_emit_by_name (self->camerabin, "start-capture");
+  g_return_val_if_fail (APERTURE_IS_VIEWFINDER (self), FALSE);
+  g_return_val_if_fail (stats != NULL, FALSE);
+
+  if (self->recorder == NULL) {
+    return FALSE;
+  }
+
+  aperture_pipeline_recorder_get_writer_stats (self->recorder, &writer_stats);
+
+  stats->backlog = writer_stats.queued_bytes;
+  stats->max_backlog = writer_stats.max_queued_bytes;
+  stats->bytes_written = writer_stats.written_bytes;
+  stats->blocked_time = writer_stats.blocked_time;
+  stats->write_latency_p50 = writer_stats.write_latency_p50;
+  stats->write_latency_p95 = writer_stats.write_latency_p95;
+  stats->write_latency_p99 = writer_stats.write_latency_p99;
+  stats->write_latency_max = writer_stats.write_latency_max;
+  stats->sync_latency_max = writer_stats.sync_latency_max;
+
+  return TRUE;
 }
 
 
@@ -919,7 +3842,12 @@ aperture_viewfinder_start_recording_to_file (ApertureViewfinder *self, const cha
  * @callback: a #GAsyncReadyCallback to execute upon completion
  * @user_data: closure data for @callback
  *
- * Stop recording video. @callback will be called when this is complete.
+ * Stop recording video. @callback will be called when this is complete,
+ * which is once the video file has been finished and closed, or everything
+ * has been written to the stream.
+ *
+ * If the recording already ended because it could not be written, this
+ * reports that error.
  *
  * Since: 0.1
  */
@@ -938,6 +3866,13 @@ aperture_viewfinder_stop_recording_async (ApertureViewfinder *self,
   task = g_task_new (self, cancellable, callback, user_data);
   g_task_set_source_tag (task, aperture_viewfinder_stop_recording_async);
 
+  /* The recording already ended because of an error */
+  if (!self->recording_video && self->recording_error != NULL) {
+    g_task_return_error (task, g_steal_pointer (&self->recording_error));
+    g_object_unref (task);
+    return;
+  }
+
   /* Make sure there's an ongoing recording and that we're not already
    * stopping it*/
   if (!self->recording_video) {
@@ -945,18 +3880,26 @@ aperture_viewfinder_stop_recording_async (ApertureViewfinder *self,
                              APERTURE_MEDIA_CAPTURE_ERROR,
                              APERTURE_MEDIA_CAPTURE_ERROR_NO_RECORDING_TO_STOP,
                              "There is no recording to stop");
+    g_object_unref (task);
+    return;
   }
   if (self->task_take_video) {
     g_task_return_new_error (task,
                              APERTURE_MEDIA_CAPTURE_ERROR,
                              APERTURE_MEDIA_CAPTURE_ERROR_OPERATION_IN_PROGRESS,
                              "Operation in progress: Stop recording");
+    g_object_unref (task);
+    return;
   }
 
   self->task_take_video = task;
 
-  g_signal_emit_by_name (self->camerabin, "stop-capture");
-  gst_element_set_state (self->filesink, GST_STATE_NULL);
+  stop_video_capture (self);
+  /* the task returns once the files are complete; see on_recording_done() */
+  aperture_pipeline_recorder_finish (self->recorder);
+  if (self->proxy != NULL) {
+    aperture_pipeline_recorder_finish (aperture_pipeline_proxy_get_recorder (self->proxy));
+  }
 }
 
 
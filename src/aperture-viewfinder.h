@@ -26,9 +26,12 @@
 #endif
 
 #include <gtk/gtk.h>
+#include <gst/video/video.h>
 
 #include "aperture-camera.h"
 #include "aperture-enums.h"
+#include "aperture-recording-profile.h"
+#include "aperture-utils.h"
 
 
 G_BEGIN_DECLS
@@ -41,6 +44,11 @@ typedef enum {
   APERTURE_VIEWFINDER_STATE_ERROR,
 } ApertureViewfinderState;
 
+typedef enum {
+  APERTURE_VIDEO_CONTAINER_MP4,
+  APERTURE_VIDEO_CONTAINER_MATROSKA,
+} ApertureVideoContainer;
+
 typedef enum {
   APERTURE_MEDIA_CAPTURE_ERROR_OPERATION_IN_PROGRESS,
   APERTURE_MEDIA_CAPTURE_ERROR_NO_RECORDING_TO_STOP,
@@ -54,6 +62,28 @@ typedef enum {
 G_DECLARE_FINAL_TYPE (ApertureViewfinder, aperture_viewfinder, APERTURE, VIEWFINDER, GtkBin)
 
 
+typedef void (*ApertureFrameTapFunc) (ApertureViewfinder *viewfinder,
+                                      GstSample          *sample,
+                                      GstVideoFrame      *frame,
+                                      gpointer            user_data);
+
+typedef gboolean (*ApertureRecordingChunkFunc) (ApertureViewfinder *viewfinder,
+                                                GBytes             *chunk,
+                                                gpointer            user_data);
+
+typedef struct {
+  guint64 backlog;
+  guint64 max_backlog;
+  guint64 bytes_written;
+  GstClockTime blocked_time;
+  GstClockTime write_latency_p50;
+  GstClockTime write_latency_p95;
+  GstClockTime write_latency_p99;
+  GstClockTime write_latency_max;
+  GstClockTime sync_latency_max;
+} ApertureRecordingStats;
+
+
 ApertureViewfinder      *aperture_viewfinder_new                     (void);
 void                     aperture_viewfinder_set_camera              (ApertureViewfinder *self,
                                                                       ApertureCamera     *camera,
@@ -63,6 +93,27 @@ ApertureViewfinderState  aperture_viewfinder_get_state               (ApertureVi
 void                     aperture_viewfinder_set_detect_barcodes     (ApertureViewfinder *self,
                                                                       gboolean            detect_barcodes);
 gboolean                 aperture_viewfinder_get_detect_barcodes     (ApertureViewfinder *self);
+void                     aperture_viewfinder_set_barcode_types       (ApertureViewfinder    *self,
+                                                                      const ApertureBarcode *types,
+                                                                      guint                  n_types);
+ApertureBarcode         *aperture_viewfinder_get_barcode_types       (ApertureViewfinder *self,
+                                                                      guint              *n_types);
+void                     aperture_viewfinder_set_barcode_roi         (ApertureViewfinder *self,
+                                                                      const GdkRectangle *roi);
+gboolean                 aperture_viewfinder_get_barcode_roi         (ApertureViewfinder *self,
+                                                                      GdkRectangle       *roi);
+void                     aperture_viewfinder_set_barcode_scale       (ApertureViewfinder *self,
+                                                                      double              scale);
+double                   aperture_viewfinder_get_barcode_scale       (ApertureViewfinder *self);
+
+guint                    aperture_viewfinder_add_frame_tap           (ApertureViewfinder  *self,
+                                                                      GstCaps             *caps,
+                                                                      guint                max_buffers,
+                                                                      ApertureFrameTapFunc func,
+                                                                      gpointer             user_data,
+                                                                      GDestroyNotify       destroy);
+void                     aperture_viewfinder_remove_frame_tap        (ApertureViewfinder  *self,
+                                                                      guint                tap_id);
 
 void                     aperture_viewfinder_take_picture_async          (ApertureViewfinder *self,
                                                                           GCancellable *cancellable,
@@ -71,10 +122,78 @@ void                     aperture_viewfinder_take_picture_async          (Apertu
 GdkPixbuf               *aperture_viewfinder_take_picture_finish         (ApertureViewfinder *self,
                                                                           GAsyncResult *result,
                                                                           GError **error);
-
+void                     aperture_viewfinder_take_picture_with_barcodes_async  (ApertureViewfinder  *self,
+                                                                                GCancellable        *cancellable,
+                                                                                GAsyncReadyCallback  callback,
+                                                                                gpointer             user_data);
+GdkPixbuf               *aperture_viewfinder_take_picture_with_barcodes_finish (ApertureViewfinder  *self,
+                                                                                GAsyncResult        *result,
+                                                                                GPtrArray          **barcodes,
+                                                                                GError             **error);
+
+void                     aperture_viewfinder_set_video_container         (ApertureViewfinder     *self,
+                                                                          ApertureVideoContainer  container);
+ApertureVideoContainer   aperture_viewfinder_get_video_container         (ApertureViewfinder     *self);
+void                     aperture_viewfinder_set_video_fragment_duration (ApertureViewfinder     *self,
+                                                                          guint                   duration);
+guint                    aperture_viewfinder_get_video_fragment_duration (ApertureViewfinder     *self);
+void                     aperture_viewfinder_set_video_faststart         (ApertureViewfinder     *self,
+                                                                          gboolean                faststart);
+gboolean                 aperture_viewfinder_get_video_faststart         (ApertureViewfinder     *self);
+void                     aperture_viewfinder_set_video_segment_duration  (ApertureViewfinder     *self,
+                                                                          guint                   duration);
+guint                    aperture_viewfinder_get_video_segment_duration  (ApertureViewfinder     *self);
+void                     aperture_viewfinder_set_video_segment_size      (ApertureViewfinder     *self,
+                                                                          guint64                 size);
+guint64                  aperture_viewfinder_get_video_segment_size      (ApertureViewfinder     *self);
+void                     aperture_viewfinder_set_video_preroll           (ApertureViewfinder     *self,
+                                                                          guint                   preroll);
+guint                    aperture_viewfinder_get_video_preroll           (ApertureViewfinder     *self);
+void                     aperture_viewfinder_set_video_write_buffer_size (ApertureViewfinder     *self,
+                                                                          guint64                 size);
+guint64                  aperture_viewfinder_get_video_write_buffer_size (ApertureViewfinder     *self);
+void                     aperture_viewfinder_set_video_sync_interval     (ApertureViewfinder     *self,
+                                                                          guint                   interval);
+guint                    aperture_viewfinder_get_video_sync_interval     (ApertureViewfinder     *self);
+void                     aperture_viewfinder_set_video_adaptive_rate     (ApertureViewfinder     *self,
+                                                                          gboolean                adaptive_rate);
+gboolean                 aperture_viewfinder_get_video_adaptive_rate     (ApertureViewfinder     *self);
+void                     aperture_viewfinder_set_recording_profile       (ApertureViewfinder             *self,
+                                                                          const ApertureRecordingProfile *profile);
+ApertureRecordingProfile *aperture_viewfinder_get_recording_profile      (ApertureViewfinder             *self);
+void                     aperture_viewfinder_set_proxy_profile           (ApertureViewfinder             *self,
+                                                                          const ApertureRecordingProfile *profile);
+ApertureRecordingProfile *aperture_viewfinder_get_proxy_profile          (ApertureViewfinder             *self);
 void                     aperture_viewfinder_start_recording_to_file     (ApertureViewfinder *self,
                                                                           const char *file,
                                                                           GError **error);
+gboolean                 aperture_viewfinder_start_recording_with_proxy  (ApertureViewfinder  *self,
+                                                                          const char          *file,
+                                                                          const char          *proxy_file,
+                                                                          GError             **error);
+void                     aperture_viewfinder_start_recording_async       (ApertureViewfinder  *self,
+                                                                          const char          *file,
+                                                                          GCancellable        *cancellable,
+                                                                          GAsyncReadyCallback  callback,
+                                                                          gpointer             user_data);
+gboolean                 aperture_viewfinder_start_recording_finish      (ApertureViewfinder  *self,
+                                                                          GAsyncResult        *result,
+                                                                          GstClockTime        *latency,
+                                                                          GError             **error);
+void                     aperture_viewfinder_start_recording_segments    (ApertureViewfinder *self,
+                                                                          const char *location_format,
+                                                                          GError **error);
+void                     aperture_viewfinder_start_recording_to_stream   (ApertureViewfinder *self,
+                                                                          GOutputStream *stream,
+                                                                          GError **error);
+void                     aperture_viewfinder_start_recording_with_callback (ApertureViewfinder         *self,
+                                                                            ApertureRecordingChunkFunc  func,
+                                                                            gpointer                    user_data,
+                                                                            GDestroyNotify              destroy,
+                                                                            GError                    **error);
+guint64                  aperture_viewfinder_get_recording_backlog       (ApertureViewfinder *self);
+gboolean                 aperture_viewfinder_get_recording_stats         (ApertureViewfinder     *self,
+                                                                          ApertureRecordingStats *stats);
 void                     aperture_viewfinder_stop_recording_async        (ApertureViewfinder *self,
                                                                           GCancellable *cancellable,
                                                                           GAsyncReadyCallback callback,
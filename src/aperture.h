@@ -28,9 +28,12 @@
 #define _LIBAPERTURE_INSIDE
 
 
+#include "aperture-barcode-result.h"
+#include "aperture-barcode-scan.h"
 #include "aperture-build-info.h"
 #include "aperture-device-manager.h"
 #include "aperture-enums.h"
+#include "aperture-recording-profile.h"
 #include "aperture-utils.h"
 #include "aperture-viewfinder.h"
 
@@ -0,0 +1,154 @@
+/* aperture-barcode-backend-zbar.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <zbar.h>
+
+#include "private/aperture-barcode-result-private.h"
+#include "aperture-barcode-backend.h"
+
+
+/* Decodes barcodes with the zbar library. */
+
+
+#define TYPE_BIT(type) (1u << (type))
+
+
+/* The zbar symbology for each #ApertureBarcode */
+static const zbar_symbol_type_t zbar_types[] = {
+  [APERTURE_BARCODE_UNKNOWN] = ZBAR_NONE,
+  [APERTURE_BARCODE_COMPOSITE] = ZBAR_COMPOSITE,
+  [APERTURE_BARCODE_EAN2] = ZBAR_EAN2,
+  [APERTURE_BARCODE_EAN5] = ZBAR_EAN5,
+  [APERTURE_BARCODE_EAN8] = ZBAR_EAN8,
+  [APERTURE_BARCODE_EAN13] = ZBAR_EAN13,
+  [APERTURE_BARCODE_UPCA] = ZBAR_UPCA,
+  [APERTURE_BARCODE_UPCE] = ZBAR_UPCE,
+  [APERTURE_BARCODE_ISBN10] = ZBAR_ISBN10,
+  [APERTURE_BARCODE_ISBN13] = ZBAR_ISBN13,
+  [APERTURE_BARCODE_I25] = ZBAR_I25,
+  [APERTURE_BARCODE_DATABAR] = ZBAR_DATABAR,
+  [APERTURE_BARCODE_DATABAR_EXP] = ZBAR_DATABAR_EXP,
+  [APERTURE_BARCODE_CODABAR] = ZBAR_CODABAR,
+  [APERTURE_BARCODE_CODE39] = ZBAR_CODE39,
+  [APERTURE_BARCODE_CODE93] = ZBAR_CODE93,
+  [APERTURE_BARCODE_CODE128] = ZBAR_CODE128,
+  [APERTURE_BARCODE_PDF417] = ZBAR_PDF417,
+  [APERTURE_BARCODE_QR] = ZBAR_QRCODE,
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (zbar_types) == APERTURE_BARCODE_N_TYPES);
+
+
+static gpointer
+zbar_backend_create (void)
+{
+  zbar_image_scanner_t *scanner = zbar_image_scanner_create ();
+
+  zbar_image_scanner_set_config (scanner, ZBAR_NONE, ZBAR_CFG_ENABLE, 1);
+  return scanner;
+}
+
+
+static void
+zbar_backend_destroy (gpointer scanner)
+{
+  zbar_image_scanner_destroy (scanner);
+}
+
+
+static void
+zbar_backend_set_barcode_types (gpointer scanner, guint32 barcode_types)
+{
+  guint32 enable = barcode_types;
+  int i;
+
+  if (barcode_types == 0) {
+    zbar_image_scanner_set_config (scanner, ZBAR_NONE, ZBAR_CFG_ENABLE, 1);
+    return;
+  }
+
+  /* UPC-A and ISBNs are found by the EAN-13 decoder */
+  if (enable & (TYPE_BIT (APERTURE_BARCODE_UPCA)
+                | TYPE_BIT (APERTURE_BARCODE_ISBN10)
+                | TYPE_BIT (APERTURE_BARCODE_ISBN13))) {
+    enable |= TYPE_BIT (APERTURE_BARCODE_EAN13);
+  }
+
+  zbar_image_scanner_set_config (scanner, ZBAR_NONE, ZBAR_CFG_ENABLE, 0);
+
+  for (i = APERTURE_BARCODE_UNKNOWN + 1; i < (int) G_N_ELEMENTS (zbar_types); i ++) {
+    if (enable & TYPE_BIT (i)) {
+      zbar_image_scanner_set_config (scanner, zbar_types[i], ZBAR_CFG_ENABLE, 1);
+    }
+  }
+}
+
+
+static void
+zbar_backend_decode (gpointer      scanner,
+                     const guint8 *data,
+                     int           width,
+                     int           height,
+                     GstClockTime  timestamp,
+                     GPtrArray    *results)
+{
+  zbar_image_t *image;
+  const zbar_symbol_t *zsymbol;
+
+  image = zbar_image_create ();
+  zbar_image_set_format (image, zbar_fourcc ('Y', '8', '0', '0'));
+  zbar_image_set_size (image, width, height);
+  zbar_image_set_data (image, data, (gsize) width * height, NULL);
+
+  zbar_scan_image (scanner, image);
+
+  for (zsymbol = zbar_image_first_symbol (image); zsymbol != NULL; zsymbol = zbar_symbol_next (zsymbol)) {
+    ApertureBarcode type = aperture_barcode_type_from_string (zbar_get_symbol_name (zbar_symbol_get_type (zsymbol)));
+    ApertureBarcodeResult *result;
+    guint n_points = zbar_symbol_get_loc_size (zsymbol);
+    g_autofree GdkPoint *points = g_new (GdkPoint, n_points);
+    guint i;
+
+    result = aperture_barcode_result_new (type,
+                                          zbar_symbol_get_data (zsymbol),
+                                          zbar_symbol_get_quality (zsymbol),
+                                          timestamp);
+
+    for (i = 0; i < n_points; i ++) {
+      points[i].x = zbar_symbol_get_loc_x (zsymbol, i);
+      points[i].y = zbar_symbol_get_loc_y (zsymbol, i);
+    }
+    aperture_barcode_result_set_polygon (result, points, n_points);
+
+    g_ptr_array_add (results, result);
+  }
+
+  zbar_image_destroy (image);
+}
+
+
+const ApertureBarcodeBackend aperture_barcode_backend_zbar = {
+  .name = "zbar",
+  .create = zbar_backend_create,
+  .destroy = zbar_backend_destroy,
+  .set_barcode_types = zbar_backend_set_barcode_types,
+  .decode = zbar_backend_decode,
+};
@@ -0,0 +1,243 @@
+/* aperture-barcode-backend-zxing.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <string.h>
+#include <ZXing/ZXingC.h>
+
+#include "private/aperture-barcode-result-private.h"
+#include "aperture-barcode-backend.h"
+
+
+/* Decodes barcodes with ZXing-C++, through its C API. */
+
+
+#define TYPE_BIT(type) (1u << (type))
+
+
+typedef struct {
+  ZXing_ReaderOptions *options;
+  guint32 barcode_types;
+} Scanner;
+
+
+/* The ZXing format that finds each #ApertureBarcode, or
+ * ZXing_BarcodeFormat_None if ZXing can't read it. ZXing reports ISBNs as
+ * EAN-13, so they are told apart by their prefix; see barcode_type(). It
+ * reports add-on symbols as part of the main code. */
+static const ZXing_BarcodeFormat zxing_formats[] = {
+  [APERTURE_BARCODE_UNKNOWN] = ZXing_BarcodeFormat_None,
+  [APERTURE_BARCODE_COMPOSITE] = ZXing_BarcodeFormat_None,
+  [APERTURE_BARCODE_EAN2] = ZXing_BarcodeFormat_None,
+  [APERTURE_BARCODE_EAN5] = ZXing_BarcodeFormat_None,
+  [APERTURE_BARCODE_EAN8] = ZXing_BarcodeFormat_EAN8,
+  [APERTURE_BARCODE_EAN13] = ZXing_BarcodeFormat_EAN13,
+  [APERTURE_BARCODE_UPCA] = ZXing_BarcodeFormat_UPCA,
+  [APERTURE_BARCODE_UPCE] = ZXing_BarcodeFormat_UPCE,
+  [APERTURE_BARCODE_ISBN10] = ZXing_BarcodeFormat_EAN13,
+  [APERTURE_BARCODE_ISBN13] = ZXing_BarcodeFormat_EAN13,
+  [APERTURE_BARCODE_I25] = ZXing_BarcodeFormat_ITF,
+  [APERTURE_BARCODE_DATABAR] = ZXing_BarcodeFormat_DataBar,
+  [APERTURE_BARCODE_DATABAR_EXP] = ZXing_BarcodeFormat_DataBarExpanded,
+  [APERTURE_BARCODE_CODABAR] = ZXing_BarcodeFormat_Codabar,
+  [APERTURE_BARCODE_CODE39] = ZXing_BarcodeFormat_Code39,
+  [APERTURE_BARCODE_CODE93] = ZXing_BarcodeFormat_Code93,
+  [APERTURE_BARCODE_CODE128] = ZXing_BarcodeFormat_Code128,
+  [APERTURE_BARCODE_PDF417] = ZXing_BarcodeFormat_PDF417,
+  [APERTURE_BARCODE_QR] = ZXing_BarcodeFormat_QRCode,
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (zxing_formats) == APERTURE_BARCODE_N_TYPES);
+
+
+static ApertureBarcode
+barcode_type (Scanner *scanner, ZXing_BarcodeFormat format, const char *text)
+{
+  int i;
+
+  /* Bookland EAN-13s are ISBNs. Only call them that when asked for ISBNs,
+   * like zbar does, which prefers ISBN-10 where there is one: only 978
+   * has a 10-digit form. */
+  if (format == ZXing_BarcodeFormat_EAN13
+      && (scanner->barcode_types & TYPE_BIT (APERTURE_BARCODE_ISBN10))
+      && g_str_has_prefix (text, "978")
+      && strlen (text) == 13) {
+    return APERTURE_BARCODE_ISBN10;
+  }
+
+  if (format == ZXing_BarcodeFormat_EAN13
+      && (scanner->barcode_types & TYPE_BIT (APERTURE_BARCODE_ISBN13))
+      && (g_str_has_prefix (text, "978") || g_str_has_prefix (text, "979"))) {
+    return APERTURE_BARCODE_ISBN13;
+  }
+
+  for (i = APERTURE_BARCODE_UNKNOWN + 1; i < (int) G_N_ELEMENTS (zxing_formats); i ++) {
+    if (zxing_formats[i] == format) {
+      return i;
+    }
+  }
+
+  return APERTURE_BARCODE_UNKNOWN;
+}
+
+
+/* Turns a 978 EAN-13 into the ISBN-10 it encodes, like zbar reports it:
+ * the nine digits after the prefix, and a new check digit */
+static char *
+isbn10_from_ean13 (const char *text)
+{
+  char *isbn = g_strndup (text + 3, 10);
+  int sum = 0;
+  int check;
+  int i;
+
+  for (i = 0; i < 9; i ++) {
+    sum += (10 - i) * (isbn[i] - '0');
+  }
+
+  check = (11 - sum % 11) % 11;
+  isbn[9] = check == 10 ? 'X' : '0' + check;
+
+  return isbn;
+}
+
+
+static gpointer
+zxing_backend_create (void)
+{
+  Scanner *scanner = g_new0 (Scanner, 1);
+
+  scanner->options = ZXing_ReaderOptions_new ();
+  /* video frames are often small and blurry */
+  ZXing_ReaderOptions_setTryHarder (scanner->options, true);
+  ZXing_ReaderOptions_setTryRotate (scanner->options, true);
+
+  return scanner;
+}
+
+
+static void
+zxing_backend_destroy (gpointer user_data)
+{
+  Scanner *scanner = user_data;
+
+  ZXing_ReaderOptions_delete (scanner->options);
+  g_free (scanner);
+}
+
+
+static void
+zxing_backend_set_barcode_types (gpointer user_data, guint32 barcode_types)
+{
+  Scanner *scanner = user_data;
+  ZXing_BarcodeFormats formats = ZXing_BarcodeFormat_None;
+  int i;
+
+  scanner->barcode_types = barcode_types;
+
+  for (i = APERTURE_BARCODE_UNKNOWN + 1; i < (int) G_N_ELEMENTS (zxing_formats); i ++) {
+    if (barcode_types & TYPE_BIT (i)) {
+      formats |= zxing_formats[i];
+    }
+  }
+
+  /* None means every format. If none of the types asked for can be read by
+   * ZXing, the decoder throws away whatever is found. */
+  ZXing_ReaderOptions_setFormats (scanner->options, formats);
+}
+
+
+static void
+zxing_backend_decode (gpointer      user_data,
+                      const guint8 *data,
+                      int           width,
+                      int           height,
+                      GstClockTime  timestamp,
+                      GPtrArray    *results)
+{
+  Scanner *scanner = user_data;
+  ZXing_ImageView *image;
+  ZXing_Barcodes *barcodes;
+  int i, n;
+
+  image = ZXing_ImageView_new (data, width, height, ZXing_ImageFormat_Lum, width, 1);
+  if (image == NULL) {
+    return;
+  }
+
+  barcodes = ZXing_ReadBarcodes (image, scanner->options);
+  ZXing_ImageView_delete (image);
+
+  if (barcodes == NULL) {
+    char *error = ZXing_LastErrorMsg ();
+    g_warning ("ZXing failed to decode a frame: %s", error);
+    ZXing_free (error);
+    return;
+  }
+
+  n = ZXing_Barcodes_size (barcodes);
+  for (i = 0; i < n; i ++) {
+    const ZXing_Barcode *barcode = ZXing_Barcodes_at (barcodes, i);
+    ZXing_Position position;
+    ApertureBarcodeResult *result;
+    ApertureBarcode type;
+    g_autofree char *isbn10 = NULL;
+    GdkPoint points[4];
+    char *text;
+
+    if (!ZXing_Barcode_isValid (barcode)) {
+      continue;
+    }
+
+    text = ZXing_Barcode_text (barcode);
+    position = ZXing_Barcode_position (barcode);
+
+    type = barcode_type (scanner, ZXing_Barcode_format (barcode), text);
+    if (type == APERTURE_BARCODE_ISBN10) {
+      isbn10 = isbn10_from_ean13 (text);
+    }
+
+    /* ZXing has no quality score; it either reads a code or doesn't */
+    result = aperture_barcode_result_new (type,
+                                          isbn10 != NULL ? isbn10 : text,
+                                          1,
+                                          timestamp);
+
+    points[0] = (GdkPoint) { position.topLeft.x, position.topLeft.y };
+    points[1] = (GdkPoint) { position.topRight.x, position.topRight.y };
+    points[2] = (GdkPoint) { position.bottomRight.x, position.bottomRight.y };
+    points[3] = (GdkPoint) { position.bottomLeft.x, position.bottomLeft.y };
+    aperture_barcode_result_set_polygon (result, points, G_N_ELEMENTS (points));
+
+    g_ptr_array_add (results, result);
+    ZXing_free (text);
+  }
+
+  ZXing_Barcodes_delete (barcodes);
+}
+
+
+const ApertureBarcodeBackend aperture_barcode_backend_zxing = {
+  .name = "zxing",
+  .create = zxing_backend_create,
+  .destroy = zxing_backend_destroy,
+  .set_barcode_types = zxing_backend_set_barcode_types,
+  .decode = zxing_backend_decode,
+};
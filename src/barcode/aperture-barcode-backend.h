@@ -0,0 +1,67 @@
+/* aperture-barcode-backend.h
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#pragma once
+
+
+#include <gst/gst.h>
+
+#include "aperture-barcode-result.h"
+
+
+G_BEGIN_DECLS
+
+
+/* A library that can find barcodes in grayscale images. Each
+ * #ApertureBarcodeDecoder has a scanner from one backend, created with
+ * create() and freed with destroy(). Scanners are only ever used from one
+ * thread at a time. */
+typedef struct {
+  const char *name;
+
+  gpointer (*create)            (void);
+  void     (*destroy)           (gpointer      scanner);
+  /* barcode_types is a mask of ApertureBarcodes, or 0 for all types.
+   * Backends may find more types than asked for; the decoder filters them
+   * out. */
+  void     (*set_barcode_types) (gpointer      scanner,
+                                 guint32       barcode_types);
+  /* data is tightly packed, one byte per pixel. Adds an
+   * ApertureBarcodeResult to results for each code found. */
+  void     (*decode)            (gpointer      scanner,
+                                 const guint8 *data,
+                                 int           width,
+                                 int           height,
+                                 GstClockTime  timestamp,
+                                 GPtrArray    *results);
+} ApertureBarcodeBackend;
+
+
+#ifdef HAVE_ZBAR
+extern const ApertureBarcodeBackend aperture_barcode_backend_zbar;
+#endif
+
+#ifdef HAVE_ZXING
+extern const ApertureBarcodeBackend aperture_barcode_backend_zxing;
+#endif
+
+
+G_END_DECLS
@@ -0,0 +1,353 @@
+/* aperture-barcode-decoder.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <string.h>
+
+#include "aperture-barcode-backend.h"
+#include "aperture-barcode-decoder.h"
+
+
+/* Decodes barcodes in single grayscale images, with one of the barcode
+ * libraries Aperture was built against (its "backends").
+ *
+ * A decoder is not thread safe, but it is cheap enough to have one per
+ * thread. It keeps its scanner and a scratch buffer between images, so
+ * that decoding many images in a row doesn't allocate much. */
+
+
+#define TYPE_BIT(type) (1u << (type))
+
+
+/* In order of preference: the first one is the default */
+static const ApertureBarcodeBackend *backends[] = {
+#ifdef HAVE_ZBAR
+  &aperture_barcode_backend_zbar,
+#endif
+#ifdef HAVE_ZXING
+  &aperture_barcode_backend_zxing,
+#endif
+  NULL,
+};
+
+
+struct _ApertureBarcodeDecoder
+{
+  const ApertureBarcodeBackend *backend;
+  gpointer scanner;
+  guint32 barcode_types;
+  guint8 *scratch;
+  gsize scratch_size;
+};
+
+
+static const ApertureBarcodeBackend *
+find_backend (const char *name)
+{
+  int i;
+
+  for (i = 0; backends[i] != NULL; i ++) {
+    if (g_str_equal (backends[i]->name, name)) {
+      return backends[i];
+    }
+  }
+
+  return NULL;
+}
+
+
+/* Converts an image to one byte of luma per pixel, like the frames the
+ * viewfinder decodes. Transparent parts are put on white, the way most image
+ * viewers show them. */
+static guint8 *
+pixbuf_to_gray (GdkPixbuf *pixbuf)
+{
+  int width = gdk_pixbuf_get_width (pixbuf);
+  int height = gdk_pixbuf_get_height (pixbuf);
+  int rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  int n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+  gboolean has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+  const guint8 *pixels = gdk_pixbuf_read_pixels (pixbuf);
+  guint8 *gray = g_malloc ((gsize) width * height);
+  int x, y;
+
+  for (y = 0; y < height; y ++) {
+    const guint8 *row = pixels + (gsize) y * rowstride;
+    guint8 *out = gray + (gsize) y * width;
+
+    for (x = 0; x < width; x ++) {
+      const guint8 *p = row + x * n_channels;
+      guint value = (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+
+      if (has_alpha) {
+        value = (value * p[3] + 255 * (255 - p[3])) / 255;
+      }
+
+      out[x] = value;
+    }
+  }
+
+  return gray;
+}
+
+
+/* PUBLIC */
+
+
+/**
+ * PRIVATE:aperture_barcode_decoder_list_backends:
+ *
+ * Lists the barcode libraries Aperture was built against, starting with the
+ * one it prefers.
+ *
+ * Returns: (transfer full): a %NULL-terminated array of backend names
+ */
+GStrv
+aperture_barcode_decoder_list_backends (void)
+{
+  GStrv names = g_new0 (char *, G_N_ELEMENTS (backends));
+  int i;
+
+  for (i = 0; backends[i] != NULL; i ++) {
+    names[i] = g_strdup (backends[i]->name);
+  }
+
+  return names;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_decoder_has_backend:
+ * @name: the name of a backend, such as "zbar" or "zxing"
+ *
+ * Checks whether Aperture was built against a barcode library.
+ *
+ * Returns: %TRUE if decoders can use the @name backend
+ */
+gboolean
+aperture_barcode_decoder_has_backend (const char *name)
+{
+  g_return_val_if_fail (name != NULL, FALSE);
+  return find_backend (name) != NULL;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_decoder_get_default_backend:
+ *
+ * Gets the backend that decoders use when none is given. This is the one
+ * named by the `APERTURE_BARCODE_BACKEND` environment variable, if it is
+ * available, or else the first one in
+ * aperture_barcode_decoder_list_backends().
+ *
+ * Returns: (nullable): the name of the default backend, or %NULL if
+ * Aperture was built without any barcode library
+ */
+const char *
+aperture_barcode_decoder_get_default_backend (void)
+{
+  const char *env = g_getenv ("APERTURE_BARCODE_BACKEND");
+
+  if (env != NULL && find_backend (env) != NULL) {
+    return env;
+  }
+
+  return backends[0] ? backends[0]->name : NULL;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_decoder_new:
+ * @backend: (nullable): the name of the backend to use, or %NULL for the
+ * default one
+ *
+ * Creates a new #ApertureBarcodeDecoder, which looks for all types of
+ * barcode.
+ *
+ * Returns: (transfer full) (nullable): a new #ApertureBarcodeDecoder, or
+ * %NULL if the backend is not available
+ */
+ApertureBarcodeDecoder *
+aperture_barcode_decoder_new (const char *backend)
+{
+  ApertureBarcodeDecoder *self;
+  const ApertureBarcodeBackend *impl;
+
+  if (backend == NULL) {
+    backend = aperture_barcode_decoder_get_default_backend ();
+    if (backend == NULL) {
+      return NULL;
+    }
+  }
+
+  impl = find_backend (backend);
+  if (impl == NULL) {
+    return NULL;
+  }
+
+  self = g_new0 (ApertureBarcodeDecoder, 1);
+  self->backend = impl;
+  self->scanner = impl->create ();
+
+  return self;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_decoder_free:
+ * @self: an #ApertureBarcodeDecoder
+ *
+ * Frees an #ApertureBarcodeDecoder.
+ */
+void
+aperture_barcode_decoder_free (ApertureBarcodeDecoder *self)
+{
+  if (self == NULL) {
+    return;
+  }
+
+  self->backend->destroy (self->scanner);
+  g_free (self->scratch);
+  g_free (self);
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_decoder_get_backend:
+ * @self: an #ApertureBarcodeDecoder
+ *
+ * Gets the name of the backend @self decodes with.
+ *
+ * Returns: the name of the backend
+ */
+const char *
+aperture_barcode_decoder_get_backend (ApertureBarcodeDecoder *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  return self->backend->name;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_decoder_set_barcode_types:
+ * @self: an #ApertureBarcodeDecoder
+ * @barcode_types: a mask with the bit `1 << type` set for each
+ * #ApertureBarcode to look for, or 0 for all types
+ *
+ * Enables only the symbologies in @barcode_types.
+ */
+void
+aperture_barcode_decoder_set_barcode_types (ApertureBarcodeDecoder *self, guint32 barcode_types)
+{
+  g_return_if_fail (self != NULL);
+
+  self->barcode_types = barcode_types;
+  self->backend->set_barcode_types (self->scanner, barcode_types);
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_decoder_decode:
+ * @self: an #ApertureBarcodeDecoder
+ * @data: the pixels of a grayscale image, one byte per pixel
+ * @width: the width of the image
+ * @height: the height of the image
+ * @stride: the number of bytes from one row to the next
+ * @timestamp: the timestamp to give the results
+ *
+ * Looks for barcodes in an image.
+ *
+ * Returns: (transfer full) (element-type ApertureBarcodeResult): the codes
+ * found, with their outlines in pixels of the image
+ */
+GPtrArray *
+aperture_barcode_decoder_decode (ApertureBarcodeDecoder *self,
+                                 const guint8           *data,
+                                 int                     width,
+                                 int                     height,
+                                 int                     stride,
+                                 GstClockTime            timestamp)
+{
+  GPtrArray *results;
+  guint i;
+  int y;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (data != NULL, NULL);
+  g_return_val_if_fail (stride >= width, NULL);
+
+  results = g_ptr_array_new_with_free_func ((GDestroyNotify) aperture_barcode_result_unref);
+
+  /* backends want tightly packed rows */
+  if (stride != width) {
+    if (self->scratch_size < (gsize) width * height) {
+      self->scratch_size = (gsize) width * height;
+      self->scratch = g_realloc (self->scratch, self->scratch_size);
+    }
+
+    for (y = 0; y < height; y ++) {
+      memcpy (self->scratch + y * width, data + y * stride, width);
+    }
+    data = self->scratch;
+  }
+
+  self->backend->decode (self->scanner, data, width, height, timestamp, results);
+
+  /* drop types that were only enabled to find another one */
+  if (self->barcode_types != 0) {
+    for (i = results->len; i > 0; i --) {
+      ApertureBarcodeResult *result = g_ptr_array_index (results, i - 1);
+
+      if (!(self->barcode_types & TYPE_BIT (aperture_barcode_result_get_barcode_type (result)))) {
+        g_ptr_array_remove_index (results, i - 1);
+      }
+    }
+  }
+
+  return results;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_decoder_decode_pixbuf:
+ * @self: an #ApertureBarcodeDecoder
+ * @pixbuf: an image
+ *
+ * Looks for barcodes in a #GdkPixbuf, such as a picture loaded from a file
+ * or taken with an #ApertureViewfinder.
+ *
+ * Returns: (transfer full) (element-type ApertureBarcodeResult): the codes
+ * found, with their outlines in pixels of the image and no timestamp
+ */
+GPtrArray *
+aperture_barcode_decoder_decode_pixbuf (ApertureBarcodeDecoder *self, GdkPixbuf *pixbuf)
+{
+  g_autofree guint8 *gray = NULL;
+  int width, height;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (GDK_IS_PIXBUF (pixbuf), NULL);
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+  gray = pixbuf_to_gray (pixbuf);
+
+  return aperture_barcode_decoder_decode (self, gray, width, height, width, GST_CLOCK_TIME_NONE);
+}
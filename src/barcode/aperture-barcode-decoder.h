@@ -0,0 +1,60 @@
+/* aperture-barcode-decoder.h
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#pragma once
+
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gst/gst.h>
+
+#include "aperture-barcode-result.h"
+
+
+G_BEGIN_DECLS
+
+
+typedef struct _ApertureBarcodeDecoder ApertureBarcodeDecoder;
+
+
+GStrv                   aperture_barcode_decoder_list_backends       (void);
+gboolean                aperture_barcode_decoder_has_backend         (const char             *name);
+const char             *aperture_barcode_decoder_get_default_backend (void);
+
+ApertureBarcodeDecoder *aperture_barcode_decoder_new                 (const char             *backend);
+void                    aperture_barcode_decoder_free                (ApertureBarcodeDecoder *self);
+
+const char             *aperture_barcode_decoder_get_backend         (ApertureBarcodeDecoder *self);
+
+void                    aperture_barcode_decoder_set_barcode_types   (ApertureBarcodeDecoder *self,
+                                                                      guint32                 barcode_types);
+GPtrArray              *aperture_barcode_decoder_decode              (ApertureBarcodeDecoder *self,
+                                                                      const guint8           *data,
+                                                                      int                     width,
+                                                                      int                     height,
+                                                                      int                     stride,
+                                                                      GstClockTime            timestamp);
+GPtrArray              *aperture_barcode_decoder_decode_pixbuf       (ApertureBarcodeDecoder *self,
+                                                                      GdkPixbuf              *pixbuf);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ApertureBarcodeDecoder, aperture_barcode_decoder_free)
+
+
+G_END_DECLS
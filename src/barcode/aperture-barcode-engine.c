@@ -0,0 +1,484 @@
+/* aperture-barcode-engine.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include "aperture-barcode-decoder.h"
+#include "aperture-barcode-engine.h"
+
+
+/* Decodes barcodes in grayscale frames on a pool of threads.
+ *
+ * Each thread has its own #ApertureBarcodeDecoder. Frames wait for a free
+ * thread in a short queue, and when that queue is full the oldest waiting
+ * frame is dropped, since a newer frame is more useful than an old one.
+ *
+ * Threads finish their frames in any order, so results are held back until
+ * every frame submitted before them is decoded, and then reported in the
+ * order the frames were submitted. Telling codes seen before apart from new
+ * ones is left to the caller; see #ApertureBarcodeTracker. */
+
+
+typedef struct {
+  GstBuffer *buffer;
+  GstVideoInfo info;
+  GstClockTime timestamp;
+
+  gboolean done;
+  /* set when the engine is flushed while the frame is being decoded */
+  gboolean flushed;
+  /* ApertureBarcodeResults, in scan coordinates */
+  GPtrArray *symbols;
+} Frame;
+
+typedef struct {
+  ApertureBarcodeEngine *engine;
+  GThread *thread;
+  ApertureBarcodeDecoder *decoder;
+  guint config_serial;
+} Worker;
+
+struct _ApertureBarcodeEngine
+{
+  GObject parent_instance;
+
+  ApertureBarcodeEngineFunc func;
+  gpointer user_data;
+
+  char *backend;
+  guint n_threads;
+  Worker *workers;
+
+  GMutex lock;
+  GCond cond;
+  gboolean stopping;
+  /* frames waiting for a thread, oldest first */
+  GQueue pending;
+  /* every frame that has not been reported yet, in submission order */
+  GQueue in_flight;
+  ApertureBarcodeEngineStats stats;
+  /* bumped whenever the threads need to reconfigure their decoders */
+  guint config_serial;
+  guint32 barcode_types;
+
+  /* Serializes reporting, so results from different threads come out in
+   * order. Also protects the field below. Always taken before the lock. */
+  GMutex emit_lock;
+  GstClockTime last_timestamp;
+};
+
+G_DEFINE_TYPE (ApertureBarcodeEngine, aperture_barcode_engine, G_TYPE_OBJECT)
+
+
+static void
+frame_free (Frame *frame)
+{
+  g_clear_pointer (&frame->buffer, gst_buffer_unref);
+  g_ptr_array_unref (frame->symbols);
+  g_free (frame);
+}
+
+
+static void
+decode_frame (Worker *worker, Frame *frame)
+{
+  GstVideoFrame video_frame;
+
+  if (!gst_video_frame_map (&video_frame, &frame->info, frame->buffer, GST_MAP_READ)) {
+    return;
+  }
+
+  g_ptr_array_unref (frame->symbols);
+  frame->symbols = aperture_barcode_decoder_decode (worker->decoder,
+                                                    GST_VIDEO_FRAME_PLANE_DATA (&video_frame, 0),
+                                                    GST_VIDEO_FRAME_WIDTH (&video_frame),
+                                                    GST_VIDEO_FRAME_HEIGHT (&video_frame),
+                                                    GST_VIDEO_FRAME_PLANE_STRIDE (&video_frame, 0),
+                                                    frame->timestamp);
+
+  gst_video_frame_unmap (&video_frame);
+}
+
+
+/* Reports the symbols in @frame. Must be called with the emit lock held. */
+static void
+report_frame (ApertureBarcodeEngine *self, Frame *frame)
+{
+  /* the same frame, or one from before the last one reported */
+  if (GST_CLOCK_TIME_IS_VALID (frame->timestamp)
+      && GST_CLOCK_TIME_IS_VALID (self->last_timestamp)
+      && frame->timestamp <= self->last_timestamp) {
+    return;
+  }
+  self->last_timestamp = frame->timestamp;
+
+  if (frame->symbols->len > 0) {
+    self->func (frame->timestamp, frame->symbols, self->user_data);
+  }
+}
+
+
+static gpointer
+worker_thread_func (gpointer user_data)
+{
+  Worker *worker = user_data;
+  ApertureBarcodeEngine *self = worker->engine;
+
+  g_mutex_lock (&self->lock);
+
+  while (!self->stopping) {
+    g_autoptr(GQueue) ready = NULL;
+    Frame *frame;
+    guint config_serial;
+    guint32 barcode_types;
+
+    frame = g_queue_pop_head (&self->pending);
+    if (frame == NULL) {
+      g_cond_wait (&self->cond, &self->lock);
+      continue;
+    }
+
+    config_serial = self->config_serial;
+    barcode_types = self->barcode_types;
+
+    g_mutex_unlock (&self->lock);
+
+    if (worker->config_serial != config_serial) {
+      aperture_barcode_decoder_set_barcode_types (worker->decoder, barcode_types);
+      worker->config_serial = config_serial;
+    }
+
+    decode_frame (worker, frame);
+    g_clear_pointer (&frame->buffer, gst_buffer_unref);
+
+    g_mutex_lock (&self->emit_lock);
+    g_mutex_lock (&self->lock);
+
+    self->stats.decoded ++;
+
+    if (frame->flushed) {
+      frame_free (frame);
+    } else {
+      frame->done = TRUE;
+    }
+
+    /* collect every frame that no earlier frame is still holding back.
+     * Nothing is reported anymore once the engine is being finalized. */
+    ready = g_queue_new ();
+    while (!self->stopping
+           && !g_queue_is_empty (&self->in_flight)
+           && ((Frame *) g_queue_peek_head (&self->in_flight))->done) {
+      g_queue_push_tail (ready, g_queue_pop_head (&self->in_flight));
+    }
+
+    g_mutex_unlock (&self->lock);
+
+    while ((frame = g_queue_pop_head (ready))) {
+      report_frame (self, frame);
+      frame_free (frame);
+    }
+
+    g_mutex_unlock (&self->emit_lock);
+    g_mutex_lock (&self->lock);
+  }
+
+  g_mutex_unlock (&self->lock);
+
+  return NULL;
+}
+
+
+/* VFUNCS */
+
+
+static void
+aperture_barcode_engine_finalize (GObject *object)
+{
+  ApertureBarcodeEngine *self = APERTURE_BARCODE_ENGINE (object);
+  guint i;
+
+  g_mutex_lock (&self->lock);
+  self->stopping = TRUE;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  for (i = 0; i < self->n_threads; i ++) {
+    g_thread_join (self->workers[i].thread);
+    aperture_barcode_decoder_free (self->workers[i].decoder);
+  }
+  g_free (self->workers);
+  g_free (self->backend);
+
+  /* pending frames are also in in_flight */
+  g_queue_clear (&self->pending);
+  g_queue_clear_full (&self->in_flight, (GDestroyNotify) frame_free);
+
+  g_mutex_clear (&self->emit_lock);
+  g_cond_clear (&self->cond);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (aperture_barcode_engine_parent_class)->finalize (object);
+}
+
+
+/* INIT */
+
+
+static void
+aperture_barcode_engine_class_init (ApertureBarcodeEngineClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = aperture_barcode_engine_finalize;
+}
+
+
+static void
+aperture_barcode_engine_init (ApertureBarcodeEngine *self)
+{
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  g_mutex_init (&self->emit_lock);
+  g_queue_init (&self->pending);
+  g_queue_init (&self->in_flight);
+  self->last_timestamp = GST_CLOCK_TIME_NONE;
+  /* make every thread configure its decoder before the first frame */
+  self->config_serial = 1;
+}
+
+
+/* PUBLIC */
+
+
+/**
+ * PRIVATE:aperture_barcode_engine_new:
+ * @n_threads: the number of decoder threads, or 0 to pick one based on the
+ * number of processors
+ * @backend: (nullable): the barcode library to decode with, or %NULL for
+ * the default one
+ * @func: (scope notified): function to call with the new codes in each
+ * frame
+ * @user_data: user data for @func
+ *
+ * Creates a new #ApertureBarcodeEngine.
+ *
+ * @func is called from the decoder threads, one call at a time, in the
+ * order the frames were submitted, with all the codes found in a frame.
+ * Frames without codes are not reported. Positions are in pixels of the
+ * submitted frames. It is never called after the engine is
+ * finalized.
+ *
+ * Returns: (transfer full): a new #ApertureBarcodeEngine
+ */
+ApertureBarcodeEngine *
+aperture_barcode_engine_new (guint                     n_threads,
+                             const char               *backend,
+                             ApertureBarcodeEngineFunc func,
+                             gpointer                  user_data)
+{
+  ApertureBarcodeEngine *self;
+  guint i;
+
+  g_return_val_if_fail (backend == NULL || aperture_barcode_decoder_has_backend (backend), NULL);
+  g_return_val_if_fail (func != NULL, NULL);
+
+  if (backend == NULL) {
+    backend = aperture_barcode_decoder_get_default_backend ();
+  }
+
+  if (n_threads == 0) {
+    /* leave the rest of the processors to the camera and the UI */
+    n_threads = CLAMP (g_get_num_processors () / 2, 1, 4);
+  }
+
+  self = g_object_new (APERTURE_TYPE_BARCODE_ENGINE, NULL);
+  self->func = func;
+  self->user_data = user_data;
+  self->backend = g_strdup (backend);
+  self->n_threads = n_threads;
+  self->workers = g_new0 (Worker, n_threads);
+
+  for (i = 0; i < n_threads; i ++) {
+    Worker *worker = &self->workers[i];
+
+    worker->engine = self;
+    worker->decoder = aperture_barcode_decoder_new (self->backend);
+    worker->thread = g_thread_new ("aperture-barcode", worker_thread_func, worker);
+  }
+
+  return self;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_engine_get_backend:
+ * @self: an #ApertureBarcodeEngine
+ *
+ * Gets the name of the barcode library the threads decode with.
+ *
+ * Returns: the name of the backend
+ */
+const char *
+aperture_barcode_engine_get_backend (ApertureBarcodeEngine *self)
+{
+  g_return_val_if_fail (APERTURE_IS_BARCODE_ENGINE (self), NULL);
+  return self->backend;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_engine_get_n_threads:
+ * @self: an #ApertureBarcodeEngine
+ *
+ * Gets the number of decoder threads.
+ *
+ * Returns: the number of threads
+ */
+guint
+aperture_barcode_engine_get_n_threads (ApertureBarcodeEngine *self)
+{
+  g_return_val_if_fail (APERTURE_IS_BARCODE_ENGINE (self), 0);
+  return self->n_threads;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_engine_submit:
+ * @self: an #ApertureBarcodeEngine
+ * @buffer: a GRAY8 frame
+ * @info: the video info of @buffer
+ *
+ * Queues a frame to be decoded. This never blocks: if all threads are busy
+ * and enough frames are already waiting, the oldest waiting frame is
+ * dropped.
+ */
+void
+aperture_barcode_engine_submit (ApertureBarcodeEngine *self,
+                                GstBuffer             *buffer,
+                                const GstVideoInfo    *info)
+{
+  Frame *frame;
+
+  g_return_if_fail (APERTURE_IS_BARCODE_ENGINE (self));
+  g_return_if_fail (GST_IS_BUFFER (buffer));
+  g_return_if_fail (GST_VIDEO_INFO_FORMAT (info) == GST_VIDEO_FORMAT_GRAY8);
+
+  frame = g_new0 (Frame, 1);
+  frame->buffer = gst_buffer_ref (buffer);
+  frame->info = *info;
+  frame->timestamp = GST_BUFFER_PTS (buffer);
+  frame->symbols = g_ptr_array_new_with_free_func ((GDestroyNotify) aperture_barcode_result_unref);
+
+  g_mutex_lock (&self->lock);
+
+  self->stats.submitted ++;
+
+  if (g_queue_get_length (&self->pending) >= self->n_threads) {
+    Frame *oldest = g_queue_pop_head (&self->pending);
+
+    g_queue_remove (&self->in_flight, oldest);
+    frame_free (oldest);
+    self->stats.dropped ++;
+  }
+
+  g_queue_push_tail (&self->pending, frame);
+  g_queue_push_tail (&self->in_flight, frame);
+  g_cond_signal (&self->cond);
+
+  g_mutex_unlock (&self->lock);
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_engine_flush:
+ * @self: an #ApertureBarcodeEngine
+ *
+ * Drops all frames that have not been reported yet.
+ */
+void
+aperture_barcode_engine_flush (ApertureBarcodeEngine *self)
+{
+  Frame *frame;
+
+  g_return_if_fail (APERTURE_IS_BARCODE_ENGINE (self));
+
+  g_mutex_lock (&self->emit_lock);
+  g_mutex_lock (&self->lock);
+
+  while ((frame = g_queue_pop_head (&self->pending))) {
+    g_queue_remove (&self->in_flight, frame);
+    frame_free (frame);
+  }
+
+  while ((frame = g_queue_pop_head (&self->in_flight))) {
+    if (!frame->done) {
+      /* still being decoded; the thread will free it */
+      frame->flushed = TRUE;
+    } else {
+      frame_free (frame);
+    }
+  }
+
+  self->last_timestamp = GST_CLOCK_TIME_NONE;
+
+  g_mutex_unlock (&self->lock);
+  g_mutex_unlock (&self->emit_lock);
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_engine_get_stats:
+ * @self: an #ApertureBarcodeEngine
+ * @stats: (out caller-allocates): return location for the statistics
+ *
+ * Gets statistics about the frames the engine has handled so far.
+ */
+void
+aperture_barcode_engine_get_stats (ApertureBarcodeEngine *self, ApertureBarcodeEngineStats *stats)
+{
+  g_return_if_fail (APERTURE_IS_BARCODE_ENGINE (self));
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&self->lock);
+  *stats = self->stats;
+  g_mutex_unlock (&self->lock);
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_engine_set_barcode_types:
+ * @self: an #ApertureBarcodeEngine
+ * @barcode_types: a mask with a bit set for each #ApertureBarcode to look
+ * for, or 0 for all of them
+ *
+ * Restricts decoding to some types of barcodes. Every type that is not
+ * needed saves some time on each frame.
+ */
+void
+aperture_barcode_engine_set_barcode_types (ApertureBarcodeEngine *self, guint32 barcode_types)
+{
+  g_return_if_fail (APERTURE_IS_BARCODE_ENGINE (self));
+
+  g_mutex_lock (&self->lock);
+  if (self->barcode_types != barcode_types) {
+    self->barcode_types = barcode_types;
+    self->config_serial ++;
+  }
+  g_mutex_unlock (&self->lock);
+}
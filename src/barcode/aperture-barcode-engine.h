@@ -0,0 +1,67 @@
+/* aperture-barcode-engine.h
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#pragma once
+
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "aperture-barcode-result.h"
+
+
+G_BEGIN_DECLS
+
+
+typedef void (*ApertureBarcodeEngineFunc) (GstClockTime  timestamp,
+                                           GPtrArray    *results,
+                                           gpointer      user_data);
+
+typedef struct {
+  guint submitted;
+  /* frames dropped because all decoders were busy */
+  guint dropped;
+  guint decoded;
+} ApertureBarcodeEngineStats;
+
+
+#define APERTURE_TYPE_BARCODE_ENGINE (aperture_barcode_engine_get_type())
+G_DECLARE_FINAL_TYPE (ApertureBarcodeEngine, aperture_barcode_engine, APERTURE, BARCODE_ENGINE, GObject)
+
+
+ApertureBarcodeEngine *aperture_barcode_engine_new               (guint                       n_threads,
+                                                                  const char                 *backend,
+                                                                  ApertureBarcodeEngineFunc   func,
+                                                                  gpointer                    user_data);
+
+const char            *aperture_barcode_engine_get_backend       (ApertureBarcodeEngine      *self);
+guint                  aperture_barcode_engine_get_n_threads     (ApertureBarcodeEngine      *self);
+void                   aperture_barcode_engine_set_barcode_types (ApertureBarcodeEngine      *self,
+                                                                  guint32                     barcode_types);
+void                   aperture_barcode_engine_submit            (ApertureBarcodeEngine      *self,
+                                                                  GstBuffer                  *buffer,
+                                                                  const GstVideoInfo         *info);
+void                   aperture_barcode_engine_flush             (ApertureBarcodeEngine      *self);
+void                   aperture_barcode_engine_get_stats         (ApertureBarcodeEngine      *self,
+                                                                  ApertureBarcodeEngineStats *stats);
+
+
+G_END_DECLS
@@ -0,0 +1,540 @@
+/* aperture-barcode-tracker.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <string.h>
+
+#include "aperture-barcode-tracker.h"
+
+
+/* Keeps track of the barcodes in view across frames.
+ *
+ * Each code is identified by its type and data. A code is new the first
+ * time it is decoded; after that, decoding it again only tells the tracker
+ * that it is still there, and where. Once a code has not been seen for
+ * lost_timeout, it is lost.
+ *
+ * Decoding a code that is already known is wasted work, so the tracker also
+ * remembers a small grid of samples (a signature) of the region each code was
+ * last found in. As long as that region still looks the same in new frames,
+ * the code is assumed to still be there, and the region is blanked out
+ * before the frame is decoded. When the region changes, for example because
+ * the camera moved, it is left alone, and the code has to be decoded again
+ * to be kept.
+ *
+ * All coordinates are in pixels of the frames given to the decoder. The
+ * tracker is not thread safe. */
+
+
+/* Number of samples in each direction in a signature */
+#define SIGNATURE_SIZE 8
+/* Mean absolute difference between signatures, out of 255, under which a
+ * region counts as unchanged */
+#define SIGNATURE_THRESHOLD 12
+/* Difference between the darkest and lightest sample a signature needs to
+ * be worth comparing. Flat regions look the same whether or not a code is
+ * in them. */
+#define SIGNATURE_CONTRAST 64
+/* Pixels added around the outline of a code, so that blanking the region
+ * doesn't leave the edges of the code for the decoder to find */
+#define REGION_MARGIN 4
+
+
+typedef struct {
+  ApertureBarcodeResult *result;
+  gint64 last_seen;
+
+  gboolean has_region;
+  GstVideoRectangle region;
+
+  /* set when the region changed, and a new signature has to be taken from
+   * the next frame */
+  gboolean needs_signature;
+  gboolean has_signature;
+  guint8 signature[SIGNATURE_SIZE * SIGNATURE_SIZE];
+  guint8 fill;
+} Entry;
+
+
+struct _ApertureBarcodeTracker
+{
+  gint64 lost_timeout;
+  /* "type:data" to Entry */
+  GHashTable *entries;
+};
+
+
+static void
+entry_free (Entry *entry)
+{
+  aperture_barcode_result_unref (entry->result);
+  g_free (entry);
+}
+
+
+static char *
+make_key (ApertureBarcodeResult *result)
+{
+  return g_strdup_printf ("%d:%s",
+                          aperture_barcode_result_get_barcode_type (result),
+                          aperture_barcode_result_get_data (result));
+}
+
+
+/* Gets the bounding box of a code's outline, with a margin. Returns %FALSE if
+ * the outline is not known. */
+static gboolean
+get_region (ApertureBarcodeResult *result, GstVideoRectangle *region)
+{
+  GdkRectangle box;
+  int margin;
+
+  if (!aperture_barcode_result_get_bounding_box (result, &box)) {
+    return FALSE;
+  }
+
+  margin = REGION_MARGIN + MAX (box.width, box.height) / 8;
+
+  region->x = box.x - margin;
+  region->y = box.y - margin;
+  region->w = box.width + 2 * margin;
+  region->h = box.height + 2 * margin;
+  return TRUE;
+}
+
+
+static gboolean
+region_contains (const GstVideoRectangle *outer, const GstVideoRectangle *inner)
+{
+  return inner->x >= outer->x
+      && inner->y >= outer->y
+      && inner->x + inner->w <= outer->x + outer->w
+      && inner->y + inner->h <= outer->y + outer->h;
+}
+
+
+static gboolean
+region_intersects (const GstVideoRectangle *a, const GstVideoRectangle *b)
+{
+  return a->x < b->x + b->w
+      && b->x < a->x + a->w
+      && a->y < b->y + b->h
+      && b->y < a->y + a->h;
+}
+
+
+static void
+region_union (GstVideoRectangle *dest, const GstVideoRectangle *other)
+{
+  int x2 = MAX (dest->x + dest->w, other->x + other->w);
+  int y2 = MAX (dest->y + dest->h, other->y + other->h);
+
+  dest->x = MIN (dest->x, other->x);
+  dest->y = MIN (dest->y, other->y);
+  dest->w = x2 - dest->x;
+  dest->h = y2 - dest->y;
+}
+
+
+/* Samples a grid from @region of a GRAY8 frame into @signature, and returns
+ * the difference between its darkest and lightest sample. @fill is set to
+ * the mean of the samples. */
+static int
+take_signature (const GstVideoRectangle *region,
+                const GstVideoInfo      *info,
+                const guint8            *data,
+                guint8                  *signature,
+                guint8                  *fill)
+{
+  int stride = GST_VIDEO_INFO_PLANE_STRIDE (info, 0);
+  int min = 255, max = 0;
+  guint total = 0;
+  int i, j;
+
+  for (j = 0; j < SIGNATURE_SIZE; j ++) {
+    int y = region->y + (2 * j + 1) * region->h / (2 * SIGNATURE_SIZE);
+
+    for (i = 0; i < SIGNATURE_SIZE; i ++) {
+      int x = region->x + (2 * i + 1) * region->w / (2 * SIGNATURE_SIZE);
+      int value = data[y * stride + x];
+
+      signature[j * SIGNATURE_SIZE + i] = value;
+      min = MIN (min, value);
+      max = MAX (max, value);
+      total += value;
+    }
+  }
+
+  *fill = total / (SIGNATURE_SIZE * SIGNATURE_SIZE);
+  return max - min;
+}
+
+
+static void
+fill_region (const GstVideoRectangle *region,
+             const GstVideoInfo      *info,
+             guint8                  *data,
+             guint8                   fill)
+{
+  int stride = GST_VIDEO_INFO_PLANE_STRIDE (info, 0);
+  int y;
+
+  for (y = region->y; y < region->y + region->h; y ++) {
+    memset (data + y * stride + region->x, fill, region->w);
+  }
+}
+
+
+/* PUBLIC */
+
+
+/**
+ * PRIVATE:aperture_barcode_tracker_new:
+ * @lost_timeout: how long a code must be out of sight before it is lost, in
+ * microseconds
+ *
+ * Creates a new #ApertureBarcodeTracker.
+ *
+ * Returns: (transfer full): a new #ApertureBarcodeTracker
+ */
+ApertureBarcodeTracker *
+aperture_barcode_tracker_new (gint64 lost_timeout)
+{
+  ApertureBarcodeTracker *self = g_new0 (ApertureBarcodeTracker, 1);
+
+  self->lost_timeout = lost_timeout;
+  self->entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) entry_free);
+
+  return self;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_tracker_free:
+ * @self: an #ApertureBarcodeTracker
+ *
+ * Frees an #ApertureBarcodeTracker.
+ */
+void
+aperture_barcode_tracker_free (ApertureBarcodeTracker *self)
+{
+  if (self == NULL) {
+    return;
+  }
+
+  g_hash_table_unref (self->entries);
+  g_free (self);
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_tracker_update:
+ * @self: an #ApertureBarcodeTracker
+ * @results: (element-type ApertureBarcodeResult): the codes decoded in a
+ * frame, with their outlines in pixels of that frame, if known
+ * @now: the current monotonic time
+ *
+ * Tells the tracker which codes were decoded in a frame. Codes that are
+ * already tracked are marked as seen and their regions are updated.
+ *
+ * The tracker only looks at the outlines of @results during this call, so
+ * they can be modified afterwards.
+ *
+ * Returns: (transfer full) (element-type ApertureBarcodeResult): the codes
+ * in @results that were not tracked yet
+ */
+GPtrArray *
+aperture_barcode_tracker_update (ApertureBarcodeTracker *self,
+                                 GPtrArray              *results,
+                                 gint64                  now)
+{
+  GPtrArray *new_results;
+  guint i;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (results != NULL, NULL);
+
+  new_results = g_ptr_array_new_with_free_func ((GDestroyNotify) aperture_barcode_result_unref);
+
+  for (i = 0; i < results->len; i ++) {
+    ApertureBarcodeResult *result = g_ptr_array_index (results, i);
+    g_autofree char *key = make_key (result);
+    GstVideoRectangle region;
+    gboolean has_region;
+    Entry *entry;
+
+    has_region = get_region (result, &region);
+    entry = g_hash_table_lookup (self->entries, key);
+
+    if (entry == NULL) {
+      entry = g_new0 (Entry, 1);
+      g_hash_table_insert (self->entries, g_steal_pointer (&key), entry);
+      g_ptr_array_add (new_results, aperture_barcode_result_ref (result));
+    } else {
+      aperture_barcode_result_unref (entry->result);
+    }
+
+    entry->result = aperture_barcode_result_ref (result);
+    entry->last_seen = now;
+
+    if (!has_region) {
+      continue;
+    }
+
+    if (entry->has_region && region_contains (&entry->region, &region)) {
+      /* decoders often only report part of the outline of a linear code, so
+       * the region is built up from several sightings */
+      entry->needs_signature = !entry->has_signature;
+    } else {
+      if (entry->has_region && region_intersects (&entry->region, &region)) {
+        region_union (&entry->region, &region);
+      } else {
+        entry->region = region;
+      }
+      entry->has_region = TRUE;
+      entry->needs_signature = TRUE;
+      entry->has_signature = FALSE;
+    }
+  }
+
+  return new_results;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_tracker_hold:
+ * @self: an #ApertureBarcodeTracker
+ * @duration: how long to hold the tracked codes for, in microseconds
+ *
+ * Delays losing any of the tracked codes by @duration. Use this when a
+ * frame is known to be identical to the previous one, so it isn't looked at:
+ * it says nothing about whether the codes are still there, so the time it
+ * covers shouldn't count towards losing them either.
+ */
+void
+aperture_barcode_tracker_hold (ApertureBarcodeTracker *self, gint64 duration)
+{
+  GHashTableIter iter;
+  Entry *entry;
+
+  g_return_if_fail (self != NULL);
+
+  g_hash_table_iter_init (&iter, self->entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry)) {
+    entry->last_seen += duration;
+  }
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_tracker_has_regions:
+ * @self: an #ApertureBarcodeTracker
+ *
+ * Gets whether the tracker knows where any of its codes are, which is when
+ * aperture_barcode_tracker_mask_frame() has anything to do.
+ *
+ * Returns: %TRUE if any tracked code has a region
+ */
+gboolean
+aperture_barcode_tracker_has_regions (ApertureBarcodeTracker *self)
+{
+  GHashTableIter iter;
+  Entry *entry;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  g_hash_table_iter_init (&iter, self->entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry)) {
+    if (entry->has_region) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_tracker_mask_frame:
+ * @self: an #ApertureBarcodeTracker
+ * @info: the format of the frame, which must be GRAY8
+ * @data: the pixels of the frame
+ * @now: the current monotonic time
+ *
+ * Checks which tracked codes are still where they were last found in a
+ * frame that is about to be decoded. Those codes are marked as seen, and
+ * their regions are blanked out in @data so the decoder skips them.
+ *
+ * Returns: the number of regions that were blanked out
+ */
+guint
+aperture_barcode_tracker_mask_frame (ApertureBarcodeTracker *self,
+                                     const GstVideoInfo     *info,
+                                     guint8                 *data,
+                                     gint64                  now)
+{
+  GstVideoRectangle frame;
+  GHashTableIter iter;
+  Entry *entry;
+  guint masked = 0;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (GST_VIDEO_INFO_FORMAT (info) == GST_VIDEO_FORMAT_GRAY8, 0);
+
+  frame.x = 0;
+  frame.y = 0;
+  frame.w = GST_VIDEO_INFO_WIDTH (info);
+  frame.h = GST_VIDEO_INFO_HEIGHT (info);
+
+  g_hash_table_iter_init (&iter, self->entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry)) {
+    guint8 signature[SIGNATURE_SIZE * SIGNATURE_SIZE];
+    guint8 fill;
+    guint difference = 0;
+    int i;
+
+    if (!entry->has_region) {
+      continue;
+    }
+
+    if (!region_contains (&frame, &entry->region)) {
+      /* clip it to the frame */
+      int x2 = MIN (entry->region.x + entry->region.w, frame.w);
+      int y2 = MIN (entry->region.y + entry->region.h, frame.h);
+
+      entry->region.x = MAX (entry->region.x, 0);
+      entry->region.y = MAX (entry->region.y, 0);
+      entry->region.w = x2 - entry->region.x;
+      entry->region.h = y2 - entry->region.y;
+    }
+
+    /* too small to sample */
+    if (entry->region.w < SIGNATURE_SIZE || entry->region.h < SIGNATURE_SIZE) {
+      entry->has_region = FALSE;
+      entry->has_signature = FALSE;
+      continue;
+    }
+
+    if (entry->needs_signature) {
+      int contrast = take_signature (&entry->region, info, data, entry->signature, &entry->fill);
+
+      entry->needs_signature = FALSE;
+      entry->has_signature = contrast >= SIGNATURE_CONTRAST;
+    }
+
+    if (!entry->has_signature) {
+      continue;
+    }
+
+    take_signature (&entry->region, info, data, signature, &fill);
+    for (i = 0; i < SIGNATURE_SIZE * SIGNATURE_SIZE; i ++) {
+      difference += ABS (signature[i] - entry->signature[i]);
+    }
+
+    if (difference / (SIGNATURE_SIZE * SIGNATURE_SIZE) > SIGNATURE_THRESHOLD) {
+      /* something changed; let the decoder have another look */
+      entry->has_signature = FALSE;
+      continue;
+    }
+
+    entry->last_seen = now;
+    fill_region (&entry->region, info, data, entry->fill);
+    masked ++;
+  }
+
+  return masked;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_tracker_expire:
+ * @self: an #ApertureBarcodeTracker
+ * @now: the current monotonic time
+ *
+ * Stops tracking the codes that have not been seen for longer than the lost
+ * timeout.
+ *
+ * Returns: (transfer full) (element-type ApertureBarcodeResult) (nullable):
+ * the last results of the codes that were lost, or %NULL if none were
+ */
+GPtrArray *
+aperture_barcode_tracker_expire (ApertureBarcodeTracker *self, gint64 now)
+{
+  GPtrArray *lost = NULL;
+  GHashTableIter iter;
+  Entry *entry;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_hash_table_iter_init (&iter, self->entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry)) {
+    if (now - entry->last_seen <= self->lost_timeout) {
+      continue;
+    }
+
+    if (lost == NULL) {
+      lost = g_ptr_array_new_with_free_func ((GDestroyNotify) aperture_barcode_result_unref);
+    }
+    g_ptr_array_add (lost, aperture_barcode_result_ref (entry->result));
+    g_hash_table_iter_remove (&iter);
+  }
+
+  return lost;
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_tracker_forget_regions:
+ * @self: an #ApertureBarcodeTracker
+ *
+ * Forgets where the tracked codes are, but keeps tracking them. Use this
+ * when the frames given to the decoder change size, which makes the regions
+ * meaningless.
+ */
+void
+aperture_barcode_tracker_forget_regions (ApertureBarcodeTracker *self)
+{
+  GHashTableIter iter;
+  Entry *entry;
+
+  g_return_if_fail (self != NULL);
+
+  g_hash_table_iter_init (&iter, self->entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry)) {
+    entry->has_region = FALSE;
+    entry->needs_signature = FALSE;
+    entry->has_signature = FALSE;
+  }
+}
+
+
+/**
+ * PRIVATE:aperture_barcode_tracker_clear:
+ * @self: an #ApertureBarcodeTracker
+ *
+ * Stops tracking all codes, without reporting them as lost.
+ */
+void
+aperture_barcode_tracker_clear (ApertureBarcodeTracker *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_hash_table_remove_all (self->entries);
+}
@@ -0,0 +1,58 @@
+/* aperture-barcode-tracker.h
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#pragma once
+
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "aperture-barcode-result.h"
+
+
+G_BEGIN_DECLS
+
+
+typedef struct _ApertureBarcodeTracker ApertureBarcodeTracker;
+
+
+ApertureBarcodeTracker *aperture_barcode_tracker_new             (gint64                  lost_timeout);
+void                    aperture_barcode_tracker_free            (ApertureBarcodeTracker *self);
+
+GPtrArray              *aperture_barcode_tracker_update          (ApertureBarcodeTracker *self,
+                                                                  GPtrArray              *results,
+                                                                  gint64                  now);
+void                    aperture_barcode_tracker_hold            (ApertureBarcodeTracker *self,
+                                                                  gint64                  duration);
+gboolean                aperture_barcode_tracker_has_regions     (ApertureBarcodeTracker *self);
+guint                   aperture_barcode_tracker_mask_frame      (ApertureBarcodeTracker *self,
+                                                                  const GstVideoInfo     *info,
+                                                                  guint8                 *data,
+                                                                  gint64                  now);
+GPtrArray              *aperture_barcode_tracker_expire          (ApertureBarcodeTracker *self,
+                                                                  gint64                  now);
+void                    aperture_barcode_tracker_forget_regions  (ApertureBarcodeTracker *self);
+void                    aperture_barcode_tracker_clear           (ApertureBarcodeTracker *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ApertureBarcodeTracker, aperture_barcode_tracker_free)
+
+
+G_END_DECLS
@@ -0,0 +1,1075 @@
+/* aperture-pipeline-barcode.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#ifdef HAVE_BARCODE_DECODER
+#include "barcode/aperture-barcode-decoder.h"
+#include "barcode/aperture-barcode-engine.h"
+#endif
+#include "barcode/aperture-barcode-tracker.h"
+#include "private/aperture-barcode-result-private.h"
+#include "aperture-pipeline-barcode.h"
+
+
+/* The barcode scanning branch of the viewfinder.
+ *
+ * ZBar only looks at luma, so rather than converting whole frames to a
+ * full-color format, the branch crops each frame to the region of interest,
+ * keeps only the Y plane (GRAY8) and optionally scales it down before
+ * scanning:
+ *
+ *   videocrop ! videoconvert ! videoscale ! capsfilter ! zbar ! fakesink
+ *
+ * When Aperture is built against a barcode library (zbar or ZXing-C++), the
+ * zbar element is replaced by an #ApertureBarcodeEngine, which decodes frames
+ * on a pool of threads instead of on the streaming thread, with the library
+ * picked by aperture_pipeline_barcode_set_backend().
+ *
+ * Either way, the decoded codes go through an #ApertureBarcodeTracker, and
+ * the bin posts one "barcodes" element message per frame in which new codes
+ * were found, rather than one message per code. It has these fields:
+ *
+ *  - "timestamp" (guint64): the PTS of the frame
+ *  - "running-time" (guint64): the running time of the frame
+ *  - "results" (GPtrArray of #ApertureBarcodeResult): the new codes, with
+ *    positions in pixels of the frames entering the bin, if known
+ *
+ * When codes have not been seen for LOST_TIMEOUT, it posts a "barcodes-lost"
+ * message with a "results" field holding the last result of each of them.
+ *
+ * With the engine, the tracker also knows where the codes are, and blanks out
+ * the regions that still hold a code it already knows before a frame is
+ * decoded, so the decoders only spend time on the rest of the frame.
+ *
+ * The crop and output size depend on the size of the incoming frames, so
+ * they are recalculated whenever the caps change.
+ *
+ * Scanning is also the expensive part, so a scheduler in front of it
+ * decides which frames are worth scanning. It compares a sparse grid of
+ * samples from each frame with the previous one:
+ *
+ *  - frames identical to the previous one are never scanned, since they
+ *    would give the same result;
+ *  - while the scene is still, only every idle_interval-th frame is scanned;
+ *  - when there is motion, or the frame has enough sharp edges to possibly
+ *    contain a code, every frame is scanned for a while. */
+
+
+/* Distance in pixels between samples, in both directions */
+#define SAMPLE_STEP 8
+/* Mean absolute difference between samples, out of 255, that counts as
+ * motion */
+#define MOTION_THRESHOLD 6
+/* Difference between horizontally adjacent samples that counts as an edge */
+#define EDGE_THRESHOLD 64
+/* Percentage of edges among samples above which a frame might contain a
+ * code */
+#define EDGE_DENSITY_THRESHOLD 15
+/* Number of frames to keep scanning every frame for after motion or a
+ * possible code */
+#define ACTIVE_FRAMES 15
+#define DEFAULT_IDLE_INTERVAL 5
+/* How long a code must be out of sight before it is lost, in microseconds */
+#define LOST_TIMEOUT G_USEC_PER_SEC
+
+
+struct _AperturePipelineBarcode
+{
+  GstBin parent_instance;
+
+  GstElement *videocrop;
+  GstElement *capsfilter;
+  /* NULL when the engine is used */
+  GstElement *zbar;
+
+  /* Protects the fields below, which are also used on the streaming thread */
+  GMutex lock;
+  gboolean has_roi;
+  GstVideoRectangle roi;
+  double scale;
+  int width;
+  int height;
+  /* the part of the frame that is scanned, and its size after scaling */
+  GstVideoRectangle crop;
+  int out_width;
+  int out_height;
+  GstSegment segment;
+
+  /* Scheduler state, also protected by the lock */
+  GstVideoInfo scan_info;
+  guint idle_interval;
+  guint8 *samples;
+  gsize n_samples;
+  gboolean has_samples;
+  guint active_frames;
+  guint frames_since_scan;
+  gint64 change_time;
+  gint64 last_frame_time;
+  AperturePipelineBarcodeStats stats;
+
+  ApertureBarcodeTracker *tracker;
+
+  guint n_threads;
+  /* NULL for the default backend */
+  char *backend;
+  /* one bit per ApertureBarcode, or 0 for all */
+  guint32 barcode_types;
+#ifdef HAVE_BARCODE_DECODER
+  /* created when the first frame is scanned */
+  ApertureBarcodeEngine *engine;
+#else
+  /* results from the zbar element for the frame it is working on */
+  GPtrArray *pending_results;
+  GstClockTime pending_timestamp;
+  GstClockTime pending_running_time;
+#endif
+};
+
+G_DEFINE_TYPE (AperturePipelineBarcode, aperture_pipeline_barcode, GST_TYPE_BIN)
+
+
+/* Recalculates the crop and the output size from the current settings and
+ * frame size. Must be called with the lock held. */
+static void
+update_geometry (AperturePipelineBarcode *self)
+{
+  GstVideoRectangle full = { 0, 0, self->width, self->height };
+  GstVideoRectangle roi = full;
+  g_autoptr(GstCaps) caps = NULL;
+  int out_width, out_height;
+
+  /* no caps yet */
+  if (self->width <= 0 || self->height <= 0) {
+    return;
+  }
+
+  if (self->has_roi) {
+    roi.x = CLAMP (self->roi.x, 0, self->width - 1);
+    roi.y = CLAMP (self->roi.y, 0, self->height - 1);
+    roi.w = CLAMP (self->roi.w, 1, self->width - roi.x);
+    roi.h = CLAMP (self->roi.h, 1, self->height - roi.y);
+  }
+
+  g_object_set (self->videocrop,
+                "left", roi.x,
+                "top", roi.y,
+                "right", self->width - (roi.x + roi.w),
+                "bottom", self->height - (roi.y + roi.h),
+                NULL);
+
+  out_width = MAX (1, (int) (roi.w * self->scale + 0.5));
+  out_height = MAX (1, (int) (roi.h * self->scale + 0.5));
+
+  self->crop = roi;
+  self->out_width = out_width;
+  self->out_height = out_height;
+
+  caps = gst_caps_new_simple ("video/x-raw",
+                              "format", G_TYPE_STRING, "GRAY8",
+                              "width", G_TYPE_INT, out_width,
+                              "height", G_TYPE_INT, out_height,
+                              NULL);
+  g_object_set (self->capsfilter, "caps", caps, NULL);
+
+  /* the tracked regions were in the old scan coordinates */
+  aperture_barcode_tracker_forget_regions (self->tracker);
+}
+
+
+/* Watches for new caps on the way in, to learn the frame size */
+static GstPadProbeReturn
+caps_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AperturePipelineBarcode *self = APERTURE_PIPELINE_BARCODE (user_data);
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstVideoInfo video_info;
+  GstCaps *caps;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  gst_event_parse_caps (event, &caps);
+  if (!gst_video_info_from_caps (&video_info, caps)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  g_mutex_lock (&self->lock);
+  self->width = GST_VIDEO_INFO_WIDTH (&video_info);
+  self->height = GST_VIDEO_INFO_HEIGHT (&video_info);
+  update_geometry (self);
+  g_mutex_unlock (&self->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+
+/* Takes a sparse grid of samples from a GRAY8 frame into @samples, and
+ * compares it with the samples already there. Returns whether the frame is
+ * identical, and the mean difference and edge density. */
+static gboolean
+sample_frame (guint8       *samples,
+              GstVideoInfo *info,
+              const guint8 *data,
+              int          *difference,
+              int          *edge_density)
+{
+  int width = GST_VIDEO_INFO_WIDTH (info);
+  int height = GST_VIDEO_INFO_HEIGHT (info);
+  int stride = GST_VIDEO_INFO_PLANE_STRIDE (info, 0);
+  guint64 total_difference = 0;
+  guint n = 0, edges = 0;
+  int x, y;
+
+  for (y = SAMPLE_STEP / 2; y < height; y += SAMPLE_STEP) {
+    const guint8 *row = data + y * stride;
+    int prev = -1;
+
+    for (x = SAMPLE_STEP / 2; x < width; x += SAMPLE_STEP) {
+      int value = row[x];
+
+      total_difference += ABS (value - samples[n]);
+      samples[n] = value;
+      n ++;
+
+      if (prev >= 0 && ABS (value - prev) > EDGE_THRESHOLD) {
+        edges ++;
+      }
+      prev = value;
+    }
+  }
+
+  if (n == 0) {
+    *difference = 0;
+    *edge_density = 0;
+    return FALSE;
+  }
+
+  *difference = total_difference / n;
+  *edge_density = edges * 100 / n;
+  return total_difference == 0;
+}
+
+
+/* Must be called with the lock held */
+static void
+reset_samples (AperturePipelineBarcode *self)
+{
+  int width = GST_VIDEO_INFO_WIDTH (&self->scan_info);
+  int height = GST_VIDEO_INFO_HEIGHT (&self->scan_info);
+
+  g_clear_pointer (&self->samples, g_free);
+  self->n_samples = ((width + SAMPLE_STEP / 2 - 1) / SAMPLE_STEP)
+                  * ((height + SAMPLE_STEP / 2 - 1) / SAMPLE_STEP);
+  self->samples = g_malloc0 (MAX (self->n_samples, 1));
+  self->has_samples = FALSE;
+  self->change_time = g_get_monotonic_time ();
+}
+
+
+/* Updates the statistics when codes are found */
+static void
+record_detection (AperturePipelineBarcode *self, guint n_codes)
+{
+  g_mutex_lock (&self->lock);
+
+  self->stats.detections += n_codes;
+
+  /* only the first detection after a change counts towards the latency */
+  if (self->change_time != 0) {
+    self->stats.last_latency = (g_get_monotonic_time () - self->change_time) * GST_USECOND;
+    self->stats.max_latency = MAX (self->stats.max_latency, self->stats.last_latency);
+    self->change_time = 0;
+
+    g_debug ("Barcode detected %" GST_TIME_FORMAT " after the scene changed",
+             GST_TIME_ARGS (self->stats.last_latency));
+  }
+
+  g_mutex_unlock (&self->lock);
+}
+
+
+/* Posts the "barcodes" message for a frame */
+static void
+post_results (AperturePipelineBarcode *self,
+              GstClockTime             timestamp,
+              GstClockTime             running_time,
+              GPtrArray               *results)
+{
+  GstStructure *structure;
+
+  structure = gst_structure_new ("barcodes",
+                                 "timestamp", G_TYPE_UINT64, timestamp,
+                                 "running-time", G_TYPE_UINT64, running_time,
+                                 "results", G_TYPE_PTR_ARRAY, results,
+                                 NULL);
+  gst_element_post_message (GST_ELEMENT (self), gst_message_new_element (GST_OBJECT (self), structure));
+}
+
+
+/* Posts the "barcodes-lost" message */
+static void
+post_lost (AperturePipelineBarcode *self, GPtrArray *lost)
+{
+  GstStructure *structure;
+
+  structure = gst_structure_new ("barcodes-lost",
+                                 "results", G_TYPE_PTR_ARRAY, lost,
+                                 NULL);
+  gst_element_post_message (GST_ELEMENT (self), gst_message_new_element (GST_OBJECT (self), structure));
+}
+
+
+/* Passes the codes decoded in a frame through the tracker. Returns the ones
+ * that are new. Must be called with the lock held. */
+static GPtrArray *
+track_results (AperturePipelineBarcode *self, GPtrArray *results)
+{
+  GPtrArray *new_results;
+
+  new_results = aperture_barcode_tracker_update (self->tracker, results, g_get_monotonic_time ());
+  self->stats.duplicates += results->len - new_results->len;
+
+  return new_results;
+}
+
+
+/* Blanks out the regions of a frame that still hold a tracked code, before
+ * it is scanned. Returns the buffer to scan, which replaces the one in
+ * @info. Must be called with the lock held. */
+static GstBuffer *
+mask_tracked_regions (AperturePipelineBarcode *self, GstPadProbeInfo *info, gint64 now)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstMapInfo map;
+
+  if (!aperture_barcode_tracker_has_regions (self->tracker)) {
+    return buffer;
+  }
+
+  buffer = gst_buffer_make_writable (buffer);
+  GST_PAD_PROBE_INFO_DATA (info) = buffer;
+
+  if (gst_buffer_map (buffer, &map, GST_MAP_READWRITE)) {
+    self->stats.skipped_regions += aperture_barcode_tracker_mask_frame (self->tracker, &self->scan_info, map.data, now);
+    gst_buffer_unmap (buffer, &map);
+  }
+
+  return buffer;
+}
+
+
+#ifdef HAVE_BARCODE_DECODER
+/* Detaches the engine, keeping its statistics. The caller must unref the
+ * returned engine after releasing the lock, since its threads might be
+ * waiting for the lock. Must be called with the lock held. */
+static ApertureBarcodeEngine *
+steal_engine (AperturePipelineBarcode *self)
+{
+  ApertureBarcodeEngineStats engine_stats;
+
+  if (self->engine == NULL) {
+    return NULL;
+  }
+
+  aperture_barcode_engine_get_stats (self->engine, &engine_stats);
+  self->stats.decoded += engine_stats.decoded;
+  self->stats.dropped += engine_stats.dropped;
+
+  return g_steal_pointer (&self->engine);
+}
+
+
+/* Called by the engine, on one of its threads */
+static void
+on_barcode_decoded (GstClockTime timestamp, GPtrArray *results, gpointer user_data)
+{
+  AperturePipelineBarcode *self = APERTURE_PIPELINE_BARCODE (user_data);
+  g_autoptr(GPtrArray) new_results = NULL;
+  g_autoptr(GPtrArray) mapped_results = NULL;
+  GstClockTime running_time;
+  guint i, j;
+
+  g_mutex_lock (&self->lock);
+
+  /* the tracker wants the positions in scan coordinates, like the regions
+   * it blanks out */
+  new_results = track_results (self, results);
+
+  running_time = gst_segment_to_running_time (&self->segment, GST_FORMAT_TIME, timestamp);
+
+  /* The engine reports positions in the cropped and scaled frames it was
+   * given. The tracker keeps those results, so the ones that are posted
+   * are copies mapped back to the original frames. */
+  mapped_results = g_ptr_array_new_with_free_func ((GDestroyNotify) aperture_barcode_result_unref);
+  for (i = 0; i < new_results->len; i ++) {
+    ApertureBarcodeResult *result = aperture_barcode_result_copy (g_ptr_array_index (new_results, i));
+    guint n_points;
+    const GdkPoint *points = aperture_barcode_result_get_polygon (result, &n_points);
+    g_autofree GdkPoint *mapped = g_new (GdkPoint, n_points);
+
+    for (j = 0; j < n_points; j ++) {
+      mapped[j].x = self->crop.x + points[j].x * self->crop.w / MAX (self->out_width, 1);
+      mapped[j].y = self->crop.y + points[j].y * self->crop.h / MAX (self->out_height, 1);
+    }
+
+    aperture_barcode_result_set_polygon (result, mapped, n_points);
+    g_ptr_array_add (mapped_results, result);
+  }
+
+  g_mutex_unlock (&self->lock);
+
+  if (mapped_results->len > 0) {
+    record_detection (self, mapped_results->len);
+    post_results (self, timestamp, running_time, mapped_results);
+  }
+}
+#endif
+
+
+/* Hands a frame that the scheduler picked to the scanner */
+static GstPadProbeReturn
+scan_frame (AperturePipelineBarcode *self, GstBuffer *buffer)
+{
+#ifdef HAVE_BARCODE_DECODER
+  g_autoptr(ApertureBarcodeEngine) engine = NULL;
+  GstVideoInfo info;
+
+  g_mutex_lock (&self->lock);
+  if (self->engine == NULL) {
+    self->engine = aperture_barcode_engine_new (self->n_threads, self->backend, on_barcode_decoded, self);
+    aperture_barcode_engine_set_barcode_types (self->engine, self->barcode_types);
+  }
+  engine = g_object_ref (self->engine);
+  info = self->scan_info;
+  g_mutex_unlock (&self->lock);
+
+  aperture_barcode_engine_submit (engine, buffer, &info);
+
+  /* the engine keeps its own reference to the buffer */
+  return GST_PAD_PROBE_DROP;
+#else
+  /* let it through to the zbar element */
+  return GST_PAD_PROBE_OK;
+#endif
+}
+
+
+/* Decides whether a frame should be scanned. Must be called with the lock
+ * held. */
+static gboolean
+schedule_frame (AperturePipelineBarcode *self, GstBuffer *buffer, gint64 now)
+{
+  GstMapInfo map;
+  gboolean identical, busy, scan;
+  int difference, edge_density;
+
+  if (self->idle_interval == 0 || self->samples == NULL
+      || !gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+    self->stats.scanned ++;
+    return TRUE;
+  }
+
+  identical = sample_frame (self->samples, &self->scan_info, map.data, &difference, &edge_density);
+  gst_buffer_unmap (buffer, &map);
+
+  if (!self->has_samples) {
+    /* nothing to compare the first frame with */
+    self->has_samples = TRUE;
+    identical = FALSE;
+    busy = TRUE;
+  } else {
+    busy = difference >= MOTION_THRESHOLD || edge_density >= EDGE_DENSITY_THRESHOLD;
+  }
+
+  if (difference >= MOTION_THRESHOLD && self->active_frames == 0) {
+    /* the scene started changing; detection latency is measured from here */
+    self->change_time = now;
+  }
+
+  if (busy) {
+    self->active_frames = ACTIVE_FRAMES;
+  }
+
+  self->frames_since_scan ++;
+
+  if (identical) {
+    scan = FALSE;
+    self->stats.skipped_identical ++;
+    /* nothing to learn about the codes from this frame */
+    aperture_barcode_tracker_hold (self->tracker, now - self->last_frame_time);
+  } else if (self->active_frames > 0 || self->frames_since_scan >= self->idle_interval) {
+    scan = TRUE;
+    self->stats.scanned ++;
+    self->frames_since_scan = 0;
+  } else {
+    scan = FALSE;
+    self->stats.skipped_idle ++;
+  }
+
+  if (self->active_frames > 0) {
+    self->active_frames --;
+  }
+
+  return scan;
+}
+
+
+/* Decides which frames get scanned. Sits right after the capsfilter, so it
+ * looks at the already cropped and scaled grayscale frames. */
+static GstPadProbeReturn
+schedule_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AperturePipelineBarcode *self = APERTURE_PIPELINE_BARCODE (user_data);
+  g_autoptr(GPtrArray) lost = NULL;
+  GstBuffer *buffer;
+  gboolean scan;
+  gint64 now;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    GstCaps *caps;
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS) {
+      gst_event_parse_caps (event, &caps);
+
+      g_mutex_lock (&self->lock);
+      if (gst_video_info_from_caps (&self->scan_info, caps)) {
+        reset_samples (self);
+      }
+      g_mutex_unlock (&self->lock);
+    } else if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT) {
+      g_mutex_lock (&self->lock);
+      gst_event_copy_segment (event, &self->segment);
+      g_mutex_unlock (&self->lock);
+    }
+
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  now = g_get_monotonic_time ();
+
+  g_mutex_lock (&self->lock);
+
+  self->stats.frames ++;
+
+  scan = schedule_frame (self, buffer, now);
+  self->last_frame_time = now;
+  if (scan) {
+    buffer = mask_tracked_regions (self, info, now);
+  }
+
+  lost = aperture_barcode_tracker_expire (self->tracker, now);
+  if (lost != NULL) {
+    self->stats.lost += lost->len;
+  }
+
+  g_mutex_unlock (&self->lock);
+
+  if (lost != NULL) {
+    post_lost (self, lost);
+  }
+
+  return scan ? scan_frame (self, buffer) : GST_PAD_PROBE_DROP;
+}
+
+
+/* VFUNCS */
+
+
+static void
+aperture_pipeline_barcode_handle_message (GstBin *bin, GstMessage *message)
+{
+  AperturePipelineBarcode *self = APERTURE_PIPELINE_BARCODE (bin);
+
+#ifndef HAVE_BARCODE_DECODER
+  /* The zbar element posts a message per code. Collect them, and post them
+   * together once the element is done with the frame; see
+   * zbar_done_probe(). */
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ELEMENT
+      && GST_MESSAGE_SRC (message) == GST_OBJECT (self->zbar)
+      && gst_message_has_name (message, "barcode")) {
+    const GstStructure *structure = gst_message_get_structure (message);
+    guint64 timestamp = GST_CLOCK_TIME_NONE, running_time = GST_CLOCK_TIME_NONE;
+    int quality = 0;
+    ApertureBarcodeResult *result;
+    ApertureBarcode type;
+    gboolean wanted;
+
+    /* The element can't be told which types to look for, so at least drop
+     * the ones nobody asked for */
+    type = aperture_barcode_type_from_string (gst_structure_get_string (structure, "type"));
+    g_mutex_lock (&self->lock);
+    wanted = self->barcode_types == 0 || (self->barcode_types & (1u << type));
+    g_mutex_unlock (&self->lock);
+
+    if (!wanted) {
+      gst_message_unref (message);
+      return;
+    }
+
+    gst_structure_get_uint64 (structure, "timestamp", &timestamp);
+    gst_structure_get_uint64 (structure, "running-time", &running_time);
+    gst_structure_get_int (structure, "quality", &quality);
+
+    result = aperture_barcode_result_new (type,
+                                          gst_structure_get_string (structure, "symbol"),
+                                          quality,
+                                          timestamp);
+
+    g_mutex_lock (&self->lock);
+    g_ptr_array_add (self->pending_results, result);
+    self->pending_timestamp = timestamp;
+    self->pending_running_time = running_time;
+    g_mutex_unlock (&self->lock);
+
+    gst_message_unref (message);
+    return;
+  }
+#endif
+
+  GST_BIN_CLASS (aperture_pipeline_barcode_parent_class)->handle_message (bin, message);
+}
+
+
+#ifndef HAVE_BARCODE_DECODER
+/* Posts the new codes the zbar element found in a frame, once it is done
+ * with it */
+static GstPadProbeReturn
+zbar_done_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AperturePipelineBarcode *self = APERTURE_PIPELINE_BARCODE (user_data);
+  g_autoptr(GPtrArray) new_results = NULL;
+  GstClockTime timestamp = GST_CLOCK_TIME_NONE;
+  GstClockTime running_time = GST_CLOCK_TIME_NONE;
+
+  g_mutex_lock (&self->lock);
+  if (self->pending_results->len > 0) {
+    new_results = track_results (self, self->pending_results);
+    g_ptr_array_set_size (self->pending_results, 0);
+    timestamp = self->pending_timestamp;
+    running_time = self->pending_running_time;
+  }
+  g_mutex_unlock (&self->lock);
+
+  if (new_results != NULL && new_results->len > 0) {
+    record_detection (self, new_results->len);
+    post_results (self, timestamp, running_time, new_results);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+#endif
+
+
+static GstStateChangeReturn
+aperture_pipeline_barcode_change_state (GstElement *element, GstStateChange transition)
+{
+  AperturePipelineBarcode *self = APERTURE_PIPELINE_BARCODE (element);
+  GstStateChangeReturn ret;
+#ifdef HAVE_BARCODE_DECODER
+  g_autoptr(ApertureBarcodeEngine) engine = NULL;
+#endif
+
+  ret = GST_ELEMENT_CLASS (aperture_pipeline_barcode_parent_class)->change_state (element, transition);
+
+  if (transition == GST_STATE_CHANGE_PAUSED_TO_READY) {
+    g_mutex_lock (&self->lock);
+#ifdef HAVE_BARCODE_DECODER
+    /* stop the decoder threads while the branch is not running */
+    engine = steal_engine (self);
+#endif
+    /* codes seen before the branch stopped are not reported as lost */
+    aperture_barcode_tracker_clear (self->tracker);
+    g_mutex_unlock (&self->lock);
+  }
+
+  return ret;
+}
+
+
+static void
+aperture_pipeline_barcode_finalize (GObject *object)
+{
+  AperturePipelineBarcode *self = APERTURE_PIPELINE_BARCODE (object);
+
+#ifdef HAVE_BARCODE_DECODER
+  g_clear_object (&self->engine);
+#else
+  g_ptr_array_unref (self->pending_results);
+#endif
+  aperture_barcode_tracker_free (self->tracker);
+  g_free (self->samples);
+  g_free (self->backend);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (aperture_pipeline_barcode_parent_class)->finalize (object);
+}
+
+
+/* INIT */
+
+
+static void
+aperture_pipeline_barcode_class_init (AperturePipelineBarcodeClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBinClass *bin_class = GST_BIN_CLASS (klass);
+
+  object_class->finalize = aperture_pipeline_barcode_finalize;
+  element_class->change_state = aperture_pipeline_barcode_change_state;
+  bin_class->handle_message = aperture_pipeline_barcode_handle_message;
+}
+
+
+static void
+aperture_pipeline_barcode_init (AperturePipelineBarcode *self)
+{
+  g_autoptr(GstCaps) caps = NULL;
+  g_autoptr(GstPad) pad = NULL;
+  g_autoptr(GstPad) scan_pad = NULL;
+#ifndef HAVE_BARCODE_DECODER
+  g_autoptr(GstPad) zbar_pad = NULL;
+#endif
+  GstPad *ghost_pad;
+
+  GstElement *videoconvert;
+  GstElement *videoscale;
+  GstElement *fakesink;
+
+  g_mutex_init (&self->lock);
+  self->scale = 1.0;
+  self->idle_interval = DEFAULT_IDLE_INTERVAL;
+  gst_video_info_init (&self->scan_info);
+  gst_segment_init (&self->segment, GST_FORMAT_TIME);
+  self->tracker = aperture_barcode_tracker_new (LOST_TIMEOUT);
+
+  self->videocrop = gst_element_factory_make ("videocrop", NULL);
+  videoconvert = gst_element_factory_make ("videoconvert", NULL);
+  videoscale = gst_element_factory_make ("videoscale", NULL);
+  self->capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  fakesink = gst_element_factory_make ("fakesink", NULL);
+
+  caps = gst_caps_from_string ("video/x-raw, format=GRAY8");
+  g_object_set (self->capsfilter, "caps", caps, NULL);
+  g_object_set (fakesink, "sync", FALSE, NULL);
+
+  gst_bin_add_many (GST_BIN (self), self->videocrop, videoconvert, videoscale,
+                    self->capsfilter, fakesink, NULL);
+  gst_element_link_many (self->videocrop, videoconvert, videoscale,
+                         self->capsfilter, NULL);
+
+#ifdef HAVE_BARCODE_DECODER
+  /* scanned frames go to the engine, and nothing reaches the sink */
+  gst_element_link (self->capsfilter, fakesink);
+#else
+  self->zbar = gst_element_factory_make ("zbar", NULL);
+  /* the tracker needs to hear about codes on every frame they are in, to
+   * know they are still there */
+  g_object_set (self->zbar, "cache", FALSE, NULL);
+  gst_bin_add (GST_BIN (self), self->zbar);
+  gst_element_link_many (self->capsfilter, self->zbar, fakesink, NULL);
+
+  self->pending_results = g_ptr_array_new_with_free_func ((GDestroyNotify) aperture_barcode_result_unref);
+  zbar_pad = gst_element_get_static_pad (self->zbar, "src");
+  gst_pad_add_probe (zbar_pad, GST_PAD_PROBE_TYPE_BUFFER, zbar_done_probe, self, NULL);
+#endif
+
+  scan_pad = gst_element_get_static_pad (self->capsfilter, "src");
+  gst_pad_add_probe (scan_pad,
+                     GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                     schedule_probe, self, NULL);
+
+  pad = gst_element_get_static_pad (self->videocrop, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, caps_probe, self, NULL);
+  ghost_pad = gst_ghost_pad_new ("sink", pad);
+  gst_pad_set_active (ghost_pad, TRUE);
+  gst_element_add_pad (GST_ELEMENT (self), ghost_pad);
+}
+
+
+/* PUBLIC */
+
+
+/**
+ * PRIVATE:aperture_pipeline_barcode_new:
+ *
+ * Creates a new #AperturePipelineBarcode.
+ *
+ * Returns: (transfer full): a new #AperturePipelineBarcode
+ */
+AperturePipelineBarcode *
+aperture_pipeline_barcode_new (void)
+{
+  return g_object_new (APERTURE_TYPE_PIPELINE_BARCODE, NULL);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_barcode_set_roi:
+ * @self: an #AperturePipelineBarcode
+ * @roi: (nullable): the region to scan, in pixels of the incoming frames,
+ * or %NULL to scan whole frames
+ *
+ * Restricts scanning to a region of the frame. Parts of @roi outside the
+ * frame are ignored.
+ */
+void
+aperture_pipeline_barcode_set_roi (AperturePipelineBarcode *self, const GstVideoRectangle *roi)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_BARCODE (self));
+
+  g_mutex_lock (&self->lock);
+  self->has_roi = roi != NULL && roi->w > 0 && roi->h > 0;
+  if (self->has_roi) {
+    self->roi = *roi;
+  }
+  update_geometry (self);
+  g_mutex_unlock (&self->lock);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_barcode_get_roi:
+ * @self: an #AperturePipelineBarcode
+ * @roi: (out caller-allocates): return location for the region
+ *
+ * Gets the region set with aperture_pipeline_barcode_set_roi().
+ *
+ * Returns: %TRUE if a region is set, %FALSE if whole frames are scanned
+ */
+gboolean
+aperture_pipeline_barcode_get_roi (AperturePipelineBarcode *self, GstVideoRectangle *roi)
+{
+  gboolean has_roi;
+
+  g_return_val_if_fail (APERTURE_IS_PIPELINE_BARCODE (self), FALSE);
+  g_return_val_if_fail (roi != NULL, FALSE);
+
+  g_mutex_lock (&self->lock);
+  has_roi = self->has_roi;
+  *roi = self->roi;
+  g_mutex_unlock (&self->lock);
+
+  return has_roi;
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_barcode_set_scale:
+ * @self: an #AperturePipelineBarcode
+ * @scale: the factor to scale the region of interest by before scanning,
+ * between 0 (exclusive) and 1
+ *
+ * Scales frames down before scanning them. Scanning time is roughly
+ * proportional to the number of pixels, but codes that end up too small
+ * will no longer be detected.
+ */
+void
+aperture_pipeline_barcode_set_scale (AperturePipelineBarcode *self, double scale)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_BARCODE (self));
+  g_return_if_fail (scale > 0 && scale <= 1);
+
+  g_mutex_lock (&self->lock);
+  self->scale = scale;
+  update_geometry (self);
+  g_mutex_unlock (&self->lock);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_barcode_get_scale:
+ * @self: an #AperturePipelineBarcode
+ *
+ * Gets the scale set with aperture_pipeline_barcode_set_scale().
+ *
+ * Returns: the scale factor
+ */
+double
+aperture_pipeline_barcode_get_scale (AperturePipelineBarcode *self)
+{
+  double scale;
+
+  g_return_val_if_fail (APERTURE_IS_PIPELINE_BARCODE (self), 1.0);
+
+  g_mutex_lock (&self->lock);
+  scale = self->scale;
+  g_mutex_unlock (&self->lock);
+
+  return scale;
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_barcode_set_idle_interval:
+ * @self: an #AperturePipelineBarcode
+ * @idle_interval: scan one in this many frames while the scene is still, or
+ * 0 to scan every frame regardless of its content
+ *
+ * Sets how often frames are scanned while nothing is happening in the scene.
+ * Frames are always scanned while there is motion or something that looks
+ * like it could be a code, and never when they are identical to the previous
+ * frame, unless @idle_interval is 0.
+ */
+void
+aperture_pipeline_barcode_set_idle_interval (AperturePipelineBarcode *self, guint idle_interval)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_BARCODE (self));
+
+  g_mutex_lock (&self->lock);
+  self->idle_interval = idle_interval;
+  g_mutex_unlock (&self->lock);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_barcode_get_stats:
+ * @self: an #AperturePipelineBarcode
+ * @stats: (out caller-allocates): return location for the statistics
+ *
+ * Gets statistics about the frames that have been scanned or skipped, and
+ * about how long it took to find codes, since the branch was created.
+ */
+void
+aperture_pipeline_barcode_get_stats (AperturePipelineBarcode *self, AperturePipelineBarcodeStats *stats)
+{
+#ifdef HAVE_BARCODE_DECODER
+  g_autoptr(ApertureBarcodeEngine) engine = NULL;
+  ApertureBarcodeEngineStats engine_stats = { 0 };
+#endif
+
+  g_return_if_fail (APERTURE_IS_PIPELINE_BARCODE (self));
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&self->lock);
+  *stats = self->stats;
+#ifdef HAVE_BARCODE_DECODER
+  engine = self->engine ? g_object_ref (self->engine) : NULL;
+#endif
+  g_mutex_unlock (&self->lock);
+
+#ifdef HAVE_BARCODE_DECODER
+  if (engine != NULL) {
+    aperture_barcode_engine_get_stats (engine, &engine_stats);
+  }
+  /* add the current engine to the ones already stopped */
+  stats->decoded += engine_stats.decoded;
+  stats->dropped += engine_stats.dropped;
+#else
+  /* the zbar element decodes every frame it gets */
+  stats->decoded = stats->scanned;
+#endif
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_barcode_set_n_threads:
+ * @self: an #AperturePipelineBarcode
+ * @n_threads: the number of threads to decode frames on, or 0 to pick a
+ * number based on the number of processors
+ *
+ * Sets how many frames can be decoded at the same time. This only has an
+ * effect if Aperture was built against a barcode library; otherwise, frames
+ * are always decoded by the zbar element, one at a time.
+ */
+void
+aperture_pipeline_barcode_set_n_threads (AperturePipelineBarcode *self, guint n_threads)
+{
+#ifdef HAVE_BARCODE_DECODER
+  g_autoptr(ApertureBarcodeEngine) engine = NULL;
+#endif
+
+  g_return_if_fail (APERTURE_IS_PIPELINE_BARCODE (self));
+
+  g_mutex_lock (&self->lock);
+  self->n_threads = n_threads;
+#ifdef HAVE_BARCODE_DECODER
+  /* the next frame starts a new engine with the new number of threads */
+  engine = steal_engine (self);
+#endif
+  g_mutex_unlock (&self->lock);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_barcode_set_backend:
+ * @self: an #AperturePipelineBarcode
+ * @backend: (nullable): the name of a barcode library, as listed by
+ * aperture_barcode_decoder_list_backends(), or %NULL for the default one
+ *
+ * Picks the library that decodes frames. Unknown backends are ignored with
+ * a warning. This has no effect if Aperture was built without any barcode
+ * library, since frames are then decoded by the zbar element.
+ */
+void
+aperture_pipeline_barcode_set_backend (AperturePipelineBarcode *self, const char *backend)
+{
+#ifdef HAVE_BARCODE_DECODER
+  g_autoptr(ApertureBarcodeEngine) engine = NULL;
+#endif
+
+  g_return_if_fail (APERTURE_IS_PIPELINE_BARCODE (self));
+
+#ifdef HAVE_BARCODE_DECODER
+  if (backend != NULL && !aperture_barcode_decoder_has_backend (backend)) {
+    g_warning ("Aperture was not built with the %s barcode backend", backend);
+    return;
+  }
+#endif
+
+  g_mutex_lock (&self->lock);
+  g_free (self->backend);
+  self->backend = g_strdup (backend);
+#ifdef HAVE_BARCODE_DECODER
+  /* the next frame starts a new engine with the new backend */
+  engine = steal_engine (self);
+#endif
+  g_mutex_unlock (&self->lock);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_barcode_set_barcode_types:
+ * @self: an #AperturePipelineBarcode
+ * @barcode_types: a mask with the bit `1 << type` set for each
+ * #ApertureBarcode to look for, or 0 for all types
+ *
+ * Restricts scanning to some types of barcodes. With a barcode library, the
+ * decoders skip the other types entirely, which makes each frame cheaper to
+ * scan; with the zbar element, other types are only filtered out of the
+ * results.
+ */
+void
+aperture_pipeline_barcode_set_barcode_types (AperturePipelineBarcode *self, guint32 barcode_types)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_BARCODE (self));
+
+  g_mutex_lock (&self->lock);
+  self->barcode_types = barcode_types;
+#ifdef HAVE_BARCODE_DECODER
+  if (self->engine != NULL) {
+    aperture_barcode_engine_set_barcode_types (self->engine, barcode_types);
+  }
+#endif
+  g_mutex_unlock (&self->lock);
+}
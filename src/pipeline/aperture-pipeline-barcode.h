@@ -0,0 +1,78 @@
+/* aperture-pipeline-barcode.h
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#pragma once
+
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+
+G_BEGIN_DECLS
+
+
+typedef struct {
+  guint frames;
+  guint scanned;
+  guint decoded;
+  /* frames dropped because all decoder threads were busy */
+  guint dropped;
+  guint skipped_identical;
+  guint skipped_idle;
+  /* regions of scanned frames left out because they still held a tracked
+   * code */
+  guint skipped_regions;
+  guint detections;
+  /* codes decoded again while they were already tracked */
+  guint duplicates;
+  guint lost;
+  /* time from the last change in the scene to the first detection after it */
+  GstClockTime last_latency;
+  GstClockTime max_latency;
+} AperturePipelineBarcodeStats;
+
+
+#define APERTURE_TYPE_PIPELINE_BARCODE (aperture_pipeline_barcode_get_type())
+G_DECLARE_FINAL_TYPE (AperturePipelineBarcode, aperture_pipeline_barcode, APERTURE, PIPELINE_BARCODE, GstBin)
+
+
+AperturePipelineBarcode *aperture_pipeline_barcode_new               (void);
+
+void                     aperture_pipeline_barcode_set_roi           (AperturePipelineBarcode      *self,
+                                                                      const GstVideoRectangle      *roi);
+gboolean                 aperture_pipeline_barcode_get_roi           (AperturePipelineBarcode      *self,
+                                                                      GstVideoRectangle            *roi);
+void                     aperture_pipeline_barcode_set_scale         (AperturePipelineBarcode      *self,
+                                                                      double                        scale);
+double                   aperture_pipeline_barcode_get_scale         (AperturePipelineBarcode      *self);
+void                     aperture_pipeline_barcode_set_idle_interval (AperturePipelineBarcode      *self,
+                                                                      guint                         idle_interval);
+void                     aperture_pipeline_barcode_set_n_threads     (AperturePipelineBarcode      *self,
+                                                                      guint                         n_threads);
+void                     aperture_pipeline_barcode_set_backend       (AperturePipelineBarcode      *self,
+                                                                      const char                   *backend);
+void                     aperture_pipeline_barcode_set_barcode_types (AperturePipelineBarcode      *self,
+                                                                      guint32                       barcode_types);
+void                     aperture_pipeline_barcode_get_stats         (AperturePipelineBarcode      *self,
+                                                                      AperturePipelineBarcodeStats *stats);
+
+
+G_END_DECLS
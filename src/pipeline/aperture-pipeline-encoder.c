@@ -0,0 +1,476 @@
+/* aperture-pipeline-encoder.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+
+#include "aperture-pipeline-encoder.h"
+
+
+/* Turns the camera's video into the encoded stream the recording branches
+ * take, following a recording profile.
+ *
+ * Most cameras encode video themselves. Then this is just a capsfilter
+ * asking for the profile's codec, framerate and resolution; the camera's
+ * encoder picks its own bitrate and keyframe interval.
+ *
+ * Otherwise the camera hands out raw video, and the bin encodes it in
+ * software:
+ *
+ *   capsfilter ! videoconvert ! queue ! x264enc|x265enc ! capsfilter
+ *
+ * The encoder is set up for a live source: it uses every core, doesn't
+ * look ahead or reorder frames, and uses a fast preset, so it keeps up
+ * with the camera and adds as little latency as possible. The leaky queue
+ * drops frames rather than holding up the camera if it still can't.
+ *
+ * A software encoder can also be throttled, when whatever is taking the
+ * video can't keep up. Each throttle level lowers the bitrate a bit more,
+ * and the higher ones also drop frames before they reach the encoder. The
+ * frames are dropped rather than renegotiating the framerate, since the
+ * muxers downstream can't take new caps in the middle of a file. The
+ * camera's own encoder can't be throttled. */
+
+
+typedef struct {
+  guint bitrate_percent;
+  guint framerate_divisor;
+} ThrottleLevel;
+
+static const ThrottleLevel throttle_levels[] = {
+  { 100, 1 },
+  { 75, 1 },
+  { 50, 1 },
+  { 50, 2 },
+  { 35, 2 },
+  { 25, 3 },
+};
+
+
+struct _AperturePipelineEncoder
+{
+  GstBin parent_instance;
+
+  gboolean software;
+  ApertureRecordingProfile *profile;
+
+  GstElement *encoder;
+  /* the profile's bitrate, or the encoder's default, and framerate */
+  guint bitrate;
+  guint framerate;
+  guint throttle;
+
+  /* Protected by the object lock. The least time between frames, or 0 to
+   * keep them all. */
+  GstClockTime frame_interval;
+  /* the earliest the next frame may be; accessed from the streaming thread */
+  GstClockTime next_pts;
+};
+
+G_DEFINE_TYPE (AperturePipelineEncoder, aperture_pipeline_encoder, GST_TYPE_BIN)
+
+
+static const char *
+get_encoder_name (ApertureVideoCodec codec)
+{
+  switch (codec) {
+  case APERTURE_VIDEO_CODEC_H264:
+    return "x264enc";
+  case APERTURE_VIDEO_CODEC_H265:
+    return "x265enc";
+  default:
+    g_assert_not_reached ();
+  }
+}
+
+
+/* Caps for the framerate and resolution of the profile, on top of @caps */
+static GstCaps *
+create_caps (const ApertureRecordingProfile *profile, const char *media_type)
+{
+  GstCaps *caps = gst_caps_new_simple (media_type,
+                                       "framerate", GST_TYPE_FRACTION, aperture_recording_profile_get_framerate (profile), 1,
+                                       NULL);
+  guint width, height;
+
+  aperture_recording_profile_get_resolution (profile, &width, &height);
+  if (width > 0) {
+    gst_caps_set_simple (caps, "width", G_TYPE_INT, (int) width, NULL);
+  }
+  if (height > 0) {
+    gst_caps_set_simple (caps, "height", G_TYPE_INT, (int) height, NULL);
+  }
+
+  return caps;
+}
+
+
+static GstElement *
+create_software_encoder (const ApertureRecordingProfile *profile)
+{
+  ApertureVideoCodec codec = aperture_recording_profile_get_codec (profile);
+  GstElement *encoder = gst_element_factory_make (get_encoder_name (codec), NULL);
+  guint bitrate = aperture_recording_profile_get_bitrate (profile);
+  guint keyframe_interval = aperture_recording_profile_get_keyframe_interval (profile);
+  gboolean constant = aperture_recording_profile_get_rate_control (profile) == APERTURE_RATE_CONTROL_CONSTANT;
+  g_autofree char *options = NULL;
+
+  if (keyframe_interval == 0) {
+    keyframe_interval = aperture_recording_profile_get_framerate (profile);
+  }
+
+  gst_util_set_object_arg (G_OBJECT (encoder), "speed-preset", "superfast");
+  gst_util_set_object_arg (G_OBJECT (encoder), "tune", "zerolatency");
+  g_object_set (encoder, "key-int-max", keyframe_interval, NULL);
+  if (bitrate > 0) {
+    g_object_set (encoder, "bitrate", bitrate, NULL);
+  }
+
+  switch (codec) {
+  case APERTURE_VIDEO_CODEC_H264:
+    /* threads=0 is one per core. In "qual" mode, the bitrate is the
+     * peak, not the target. */
+    g_object_set (encoder, "threads", 0, NULL);
+    gst_util_set_object_arg (G_OBJECT (encoder), "pass", constant ? "cbr" : "qual");
+    break;
+
+  case APERTURE_VIDEO_CODEC_H265:
+    /* x265 uses every core by default, and only knows average bitrate, so
+     * constant bitrate is done with the VBV */
+    if (constant && bitrate > 0) {
+      options = g_strdup_printf ("vbv-maxrate=%u:vbv-bufsize=%u", bitrate, bitrate);
+      g_object_set (encoder, "option-string", options, NULL);
+    }
+    break;
+
+  default:
+    g_assert_not_reached ();
+  }
+
+  return encoder;
+}
+
+
+/* Drops frames that come too soon after the last one, when the encoder is
+ * throttled */
+static GstPadProbeReturn
+frame_interval_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AperturePipelineEncoder *self = APERTURE_PIPELINE_ENCODER (user_data);
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+  GstClockTime interval;
+
+  GST_OBJECT_LOCK (self);
+  interval = self->frame_interval;
+  GST_OBJECT_UNLOCK (self);
+
+  if (interval == 0 || !GST_CLOCK_TIME_IS_VALID (pts)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  /* frames never arrive exactly on time, so allow a quarter of the
+   * interval either way */
+  if (GST_CLOCK_TIME_IS_VALID (self->next_pts) && pts + interval / 4 < self->next_pts) {
+    return GST_PAD_PROBE_DROP;
+  }
+
+  self->next_pts = pts + interval;
+  return GST_PAD_PROBE_OK;
+}
+
+
+/* VFUNCS */
+
+
+static void
+aperture_pipeline_encoder_finalize (GObject *object)
+{
+  AperturePipelineEncoder *self = APERTURE_PIPELINE_ENCODER (object);
+
+  g_clear_pointer (&self->profile, aperture_recording_profile_free);
+
+  G_OBJECT_CLASS (aperture_pipeline_encoder_parent_class)->finalize (object);
+}
+
+
+/* INIT */
+
+
+static void
+aperture_pipeline_encoder_class_init (AperturePipelineEncoderClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = aperture_pipeline_encoder_finalize;
+}
+
+
+static void
+aperture_pipeline_encoder_init (AperturePipelineEncoder *self)
+{
+  self->next_pts = GST_CLOCK_TIME_NONE;
+}
+
+
+/* PUBLIC */
+
+
+/**
+ * PRIVATE:aperture_pipeline_encoder_new:
+ * @profile: the recording profile
+ * @software: whether to encode in software, or to ask the camera for
+ * encoded video
+ *
+ * Creates a new #AperturePipelineEncoder. With @software, the encoder for
+ * the profile's codec must be installed; see
+ * aperture_pipeline_encoder_can_encode().
+ *
+ * Returns: (transfer full): a new #AperturePipelineEncoder
+ */
+AperturePipelineEncoder *
+aperture_pipeline_encoder_new (const ApertureRecordingProfile *profile, gboolean software)
+{
+  AperturePipelineEncoder *self;
+  ApertureVideoCodec codec;
+  g_autoptr(GstCaps) codec_caps = NULL;
+  g_autoptr(GstCaps) caps = NULL;
+  g_autoptr(GstPad) sinkpad = NULL;
+  g_autoptr(GstPad) srcpad = NULL;
+  GstElement *capsfilter;
+  GstElement *first;
+  GstElement *last;
+  GstPad *ghost_pad;
+
+  g_return_val_if_fail (profile != NULL, NULL);
+
+  self = g_object_new (APERTURE_TYPE_PIPELINE_ENCODER, NULL);
+  self->software = software;
+  self->profile = aperture_recording_profile_copy (profile);
+  self->framerate = aperture_recording_profile_get_framerate (profile);
+  self->bitrate = aperture_recording_profile_get_bitrate (profile);
+
+  codec = aperture_recording_profile_get_codec (profile);
+  codec_caps = aperture_pipeline_encoder_get_codec_caps (codec);
+
+  if (software) {
+    GstElement *convert = gst_element_factory_make ("videoconvert", NULL);
+    GstElement *queue = gst_element_factory_make ("queue", NULL);
+    GstElement *encoder = create_software_encoder (profile);
+    g_autoptr(GstPad) encoder_pad = gst_element_get_static_pad (encoder, "sink");
+
+    caps = create_caps (profile, "video/x-raw");
+    first = gst_element_factory_make ("capsfilter", NULL);
+    g_object_set (first, "caps", caps, NULL);
+
+    /* leaky downstream, so a slow encoder drops frames instead of stalling
+     * the camera */
+    g_object_set (queue, "leaky", 2, "max-size-buffers", 2, "max-size-bytes", 0, "max-size-time", (guint64) 0, NULL);
+
+    last = gst_element_factory_make ("capsfilter", NULL);
+    g_object_set (last, "caps", codec_caps, NULL);
+
+    gst_bin_add_many (GST_BIN (self), first, convert, queue, encoder, last, NULL);
+    gst_element_link_many (first, convert, queue, encoder, last, NULL);
+
+    self->encoder = encoder;
+    if (self->bitrate == 0) {
+      g_object_get (encoder, "bitrate", &self->bitrate, NULL);
+    }
+    gst_pad_add_probe (encoder_pad, GST_PAD_PROBE_TYPE_BUFFER, frame_interval_probe, self, NULL);
+  } else {
+    caps = create_caps (profile, gst_structure_get_name (gst_caps_get_structure (codec_caps, 0)));
+    capsfilter = gst_element_factory_make ("capsfilter", NULL);
+    g_object_set (capsfilter, "caps", caps, NULL);
+
+    gst_bin_add (GST_BIN (self), capsfilter);
+    first = last = capsfilter;
+  }
+
+  sinkpad = gst_element_get_static_pad (first, "sink");
+  ghost_pad = gst_ghost_pad_new ("sink", sinkpad);
+  gst_pad_set_active (ghost_pad, TRUE);
+  gst_element_add_pad (GST_ELEMENT (self), ghost_pad);
+
+  srcpad = gst_element_get_static_pad (last, "src");
+  ghost_pad = gst_ghost_pad_new ("src", srcpad);
+  gst_pad_set_active (ghost_pad, TRUE);
+  gst_element_add_pad (GST_ELEMENT (self), ghost_pad);
+
+  return self;
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_encoder_get_codec_caps:
+ * @codec: a codec
+ *
+ * Gets the caps of video encoded with @codec, e.g. to check whether the
+ * camera can produce it.
+ *
+ * Returns: (transfer full): the caps for @codec
+ */
+GstCaps *
+aperture_pipeline_encoder_get_codec_caps (ApertureVideoCodec codec)
+{
+  switch (codec) {
+  case APERTURE_VIDEO_CODEC_H264:
+    return gst_caps_new_empty_simple ("video/x-h264");
+  case APERTURE_VIDEO_CODEC_H265:
+    return gst_caps_new_empty_simple ("video/x-h265");
+  default:
+    g_assert_not_reached ();
+  }
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_encoder_can_encode:
+ * @codec: a codec
+ *
+ * Checks whether the software encoder for @codec is installed.
+ *
+ * Returns: %TRUE if video can be encoded with @codec in software
+ */
+gboolean
+aperture_pipeline_encoder_can_encode (ApertureVideoCodec codec)
+{
+  g_autoptr(GstElementFactory) factory = gst_element_factory_find (get_encoder_name (codec));
+  return factory != NULL;
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_encoder_get_software:
+ * @self: an #AperturePipelineEncoder
+ *
+ * Gets whether @self encodes in software.
+ *
+ * Returns: %TRUE if the video is encoded in software, %FALSE if the camera
+ * encodes it
+ */
+gboolean
+aperture_pipeline_encoder_get_software (AperturePipelineEncoder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_PIPELINE_ENCODER (self), FALSE);
+  return self->software;
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_encoder_get_max_throttle:
+ * @self: an #AperturePipelineEncoder
+ *
+ * Gets the highest throttle level, which gives the lowest bitrate and
+ * framerate. The camera's encoder can't be throttled, so this is 0 unless
+ * @self encodes in software.
+ *
+ * Returns: the highest throttle level
+ */
+guint
+aperture_pipeline_encoder_get_max_throttle (AperturePipelineEncoder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_PIPELINE_ENCODER (self), 0);
+  return self->software ? G_N_ELEMENTS (throttle_levels) - 1 : 0;
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_encoder_set_throttle:
+ * @self: an #AperturePipelineEncoder
+ * @throttle: the throttle level, from 0 (the recording profile) up to
+ * aperture_pipeline_encoder_get_max_throttle()
+ *
+ * Lowers the bitrate and framerate from those of the recording profile, or
+ * restores them. This can be done while the video is flowing. The
+ * framerate changes from the next frame on; x264enc also reconfigures for
+ * the new bitrate right away, but x265enc may not until it restarts.
+ */
+void
+aperture_pipeline_encoder_set_throttle (AperturePipelineEncoder *self, guint throttle)
+{
+  const ThrottleLevel *level;
+
+  g_return_if_fail (APERTURE_IS_PIPELINE_ENCODER (self));
+  g_return_if_fail (throttle <= aperture_pipeline_encoder_get_max_throttle (self));
+
+  if (self->throttle == throttle) {
+    return;
+  }
+
+  self->throttle = throttle;
+  level = &throttle_levels[throttle];
+
+  g_object_set (self->encoder, "bitrate", self->bitrate * level->bitrate_percent / 100, NULL);
+
+  GST_OBJECT_LOCK (self);
+  if (level->framerate_divisor > 1) {
+    self->frame_interval = gst_util_uint64_scale_int (GST_SECOND, level->framerate_divisor, self->framerate);
+  } else {
+    self->frame_interval = 0;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_encoder_get_throttle:
+ * @self: an #AperturePipelineEncoder
+ *
+ * Gets the throttle level. See aperture_pipeline_encoder_set_throttle().
+ *
+ * Returns: the throttle level, or 0 if the encoder isn't throttled
+ */
+guint
+aperture_pipeline_encoder_get_throttle (AperturePipelineEncoder *self)
+{
+  g_return_val_if_fail (APERTURE_IS_PIPELINE_ENCODER (self), 0);
+  return self->throttle;
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_encoder_get_effective_profile:
+ * @self: an #AperturePipelineEncoder
+ *
+ * Gets the recording profile @self was created with, but with the bitrate
+ * and framerate it is producing at its current throttle level. If the
+ * camera encodes the video, that is just the profile.
+ *
+ * Returns: (transfer full): the effective recording profile
+ */
+ApertureRecordingProfile *
+aperture_pipeline_encoder_get_effective_profile (AperturePipelineEncoder *self)
+{
+  ApertureRecordingProfile *profile;
+  const ThrottleLevel *level;
+
+  g_return_val_if_fail (APERTURE_IS_PIPELINE_ENCODER (self), NULL);
+
+  profile = aperture_recording_profile_copy (self->profile);
+  if (self->throttle == 0) {
+    return profile;
+  }
+
+  level = &throttle_levels[self->throttle];
+  aperture_recording_profile_set_bitrate (profile, self->bitrate * level->bitrate_percent / 100);
+  aperture_recording_profile_set_framerate (profile, MAX (self->framerate / level->framerate_divisor, 1));
+
+  return profile;
+}
@@ -0,0 +1,52 @@
+/* aperture-pipeline-encoder.h
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+
+#pragma once
+
+
+#include <gst/gst.h>
+
+#include "aperture-recording-profile.h"
+
+
+G_BEGIN_DECLS
+
+
+#define APERTURE_TYPE_PIPELINE_ENCODER (aperture_pipeline_encoder_get_type())
+G_DECLARE_FINAL_TYPE (AperturePipelineEncoder, aperture_pipeline_encoder, APERTURE, PIPELINE_ENCODER, GstBin)
+
+
+AperturePipelineEncoder *aperture_pipeline_encoder_new              (const ApertureRecordingProfile *profile,
+                                                                     gboolean                        software);
+
+GstCaps                 *aperture_pipeline_encoder_get_codec_caps   (ApertureVideoCodec              codec);
+gboolean                 aperture_pipeline_encoder_can_encode       (ApertureVideoCodec              codec);
+gboolean                 aperture_pipeline_encoder_get_software     (AperturePipelineEncoder        *self);
+
+guint                    aperture_pipeline_encoder_get_max_throttle (AperturePipelineEncoder        *self);
+void                     aperture_pipeline_encoder_set_throttle     (AperturePipelineEncoder        *self,
+                                                                     guint                           throttle);
+guint                    aperture_pipeline_encoder_get_throttle     (AperturePipelineEncoder        *self);
+ApertureRecordingProfile *aperture_pipeline_encoder_get_effective_profile (AperturePipelineEncoder  *self);
+
+
+G_END_DECLS
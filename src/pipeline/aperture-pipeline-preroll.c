@@ -0,0 +1,397 @@
+/* aperture-pipeline-preroll.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <gst/video/video.h>
+
+#include "aperture-pipeline-preroll.h"
+
+
+/* Keeps the last few seconds of encoded video in memory, so a recording
+ * can include what happened before it was started.
+ *
+ * The bin is a single identity element. While it is buffering, a probe on
+ * the identity's sink pad takes every buffer and keeps it in a ring instead
+ * of letting it through. The ring always starts with a keyframe, and whole
+ * GOPs are dropped from the front as it grows past the maximum duration,
+ * so it can be muxed on its own.
+ *
+ * aperture_pipeline_preroll_start() switches it to live. The next buffer
+ * that arrives pushes the whole ring downstream first, then goes through
+ * itself, so the recording continues without a gap. If the ring is empty,
+ * the first live buffer is held back until a keyframe comes along.
+ * aperture_pipeline_preroll_stop() goes back to buffering. */
+
+
+struct _AperturePipelinePreroll
+{
+  GstBin parent_instance;
+
+  GstElement *identity;
+  GstPad *sinkpad;
+  GstPad *srcpad;
+
+  /* Protects everything below; the ring is filled from the streaming
+   * thread */
+  GMutex lock;
+  /* GstBuffers, oldest first */
+  GQueue ring;
+  guint64 ring_bytes;
+  GstClockTime max_duration;
+
+  gboolean live;
+  /* live, but nothing has been pushed since the last start */
+  gboolean waiting_for_keyframe;
+  gboolean requested_keyframe;
+  gint64 start_time;
+  GstClockTime start_latency;
+};
+
+G_DEFINE_TYPE (AperturePipelinePreroll, aperture_pipeline_preroll, GST_TYPE_BIN)
+
+
+static gboolean
+is_keyframe (GstBuffer *buffer)
+{
+  return !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+}
+
+
+/* Must be called with the lock held */
+static void
+clear_ring (AperturePipelinePreroll *self)
+{
+  g_queue_clear_full (&self->ring, (GDestroyNotify) gst_buffer_unref);
+  self->ring_bytes = 0;
+}
+
+
+/* Drops the oldest GOP as long as the rest still covers the maximum
+ * duration. Must be called with the lock held. */
+static void
+trim_ring (AperturePipelinePreroll *self)
+{
+  GstBuffer *newest = g_queue_peek_tail (&self->ring);
+  GstClockTime newest_ts;
+
+  if (newest == NULL) {
+    return;
+  }
+
+  newest_ts = GST_BUFFER_DTS_OR_PTS (newest);
+  if (!GST_CLOCK_TIME_IS_VALID (newest_ts)) {
+    return;
+  }
+
+  while (TRUE) {
+    GList *next_gop = self->ring.head->next;
+    GstClockTime next_gop_ts;
+    GstBuffer *buffer;
+
+    while (next_gop != NULL && !is_keyframe (next_gop->data)) {
+      next_gop = next_gop->next;
+    }
+    if (next_gop == NULL) {
+      return;
+    }
+
+    next_gop_ts = GST_BUFFER_DTS_OR_PTS (GST_BUFFER (next_gop->data));
+    if (GST_CLOCK_TIME_IS_VALID (next_gop_ts) && newest_ts - next_gop_ts < self->max_duration) {
+      return;
+    }
+
+    while (self->ring.head != next_gop) {
+      buffer = g_queue_pop_head (&self->ring);
+      self->ring_bytes -= gst_buffer_get_size (buffer);
+      gst_buffer_unref (buffer);
+    }
+  }
+}
+
+
+static GstPadProbeReturn
+buffer_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AperturePipelinePreroll *self = APERTURE_PIPELINE_PREROLL (user_data);
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GQueue flush = G_QUEUE_INIT;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  g_mutex_lock (&self->lock);
+
+  if (!self->live) {
+    /* the ring has to start with a keyframe */
+    if (!g_queue_is_empty (&self->ring) || is_keyframe (buffer)) {
+      g_queue_push_tail (&self->ring, gst_buffer_ref (buffer));
+      self->ring_bytes += gst_buffer_get_size (buffer);
+      trim_ring (self);
+    }
+    g_mutex_unlock (&self->lock);
+    return GST_PAD_PROBE_DROP;
+  }
+
+  if (!self->waiting_for_keyframe) {
+    g_mutex_unlock (&self->lock);
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (g_queue_is_empty (&self->ring) && !is_keyframe (buffer)) {
+    gboolean request = !self->requested_keyframe;
+
+    self->requested_keyframe = TRUE;
+    g_mutex_unlock (&self->lock);
+
+    if (request) {
+      gst_pad_push_event (pad, gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, TRUE, 0));
+    }
+    return GST_PAD_PROBE_DROP;
+  }
+
+  /* take the ring, so the lock isn't held while pushing */
+  flush = self->ring;
+  g_queue_init (&self->ring);
+  self->ring_bytes = 0;
+  self->waiting_for_keyframe = FALSE;
+  g_mutex_unlock (&self->lock);
+
+  while (!g_queue_is_empty (&flush)) {
+    GstBuffer *old = g_queue_pop_head (&flush);
+
+    if (ret == GST_FLOW_OK) {
+      ret = gst_pad_push (self->srcpad, old);
+    } else {
+      gst_buffer_unref (old);
+    }
+  }
+
+  g_mutex_lock (&self->lock);
+  self->start_latency = (g_get_monotonic_time () - self->start_time) * GST_USECOND;
+  g_mutex_unlock (&self->lock);
+
+  /* if pushing the ring failed, pushing this buffer fails the same way and
+   * reports the error upstream */
+  return GST_PAD_PROBE_OK;
+}
+
+
+/* VFUNCS */
+
+
+static GstStateChangeReturn
+aperture_pipeline_preroll_change_state (GstElement *element, GstStateChange transition)
+{
+  AperturePipelinePreroll *self = APERTURE_PIPELINE_PREROLL (element);
+  GstStateChangeReturn ret;
+
+  ret = GST_ELEMENT_CLASS (aperture_pipeline_preroll_parent_class)->change_state (element, transition);
+
+  /* Video from before the pipeline stopped would have timestamps that
+   * don't fit with the new stream */
+  if (transition == GST_STATE_CHANGE_PAUSED_TO_READY) {
+    g_mutex_lock (&self->lock);
+    clear_ring (self);
+    g_mutex_unlock (&self->lock);
+  }
+
+  return ret;
+}
+
+
+static void
+aperture_pipeline_preroll_finalize (GObject *object)
+{
+  AperturePipelinePreroll *self = APERTURE_PIPELINE_PREROLL (object);
+
+  clear_ring (self);
+  g_mutex_clear (&self->lock);
+  gst_object_unref (self->sinkpad);
+  gst_object_unref (self->srcpad);
+
+  G_OBJECT_CLASS (aperture_pipeline_preroll_parent_class)->finalize (object);
+}
+
+
+/* INIT */
+
+
+static void
+aperture_pipeline_preroll_class_init (AperturePipelinePrerollClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  object_class->finalize = aperture_pipeline_preroll_finalize;
+  element_class->change_state = aperture_pipeline_preroll_change_state;
+}
+
+
+static void
+aperture_pipeline_preroll_init (AperturePipelinePreroll *self)
+{
+  GstPad *ghost_pad;
+
+  g_mutex_init (&self->lock);
+  g_queue_init (&self->ring);
+  self->max_duration = 5 * GST_SECOND;
+  self->start_latency = GST_CLOCK_TIME_NONE;
+
+  self->identity = gst_element_factory_make ("identity", NULL);
+  gst_bin_add (GST_BIN (self), self->identity);
+
+  self->sinkpad = gst_element_get_static_pad (self->identity, "sink");
+  gst_pad_add_probe (self->sinkpad, GST_PAD_PROBE_TYPE_BUFFER, buffer_probe, self, NULL);
+  ghost_pad = gst_ghost_pad_new ("sink", self->sinkpad);
+  gst_pad_set_active (ghost_pad, TRUE);
+  gst_element_add_pad (GST_ELEMENT (self), ghost_pad);
+
+  self->srcpad = gst_element_get_static_pad (self->identity, "src");
+  ghost_pad = gst_ghost_pad_new ("src", self->srcpad);
+  gst_pad_set_active (ghost_pad, TRUE);
+  gst_element_add_pad (GST_ELEMENT (self), ghost_pad);
+}
+
+
+/* PUBLIC */
+
+
+/**
+ * PRIVATE:aperture_pipeline_preroll_new:
+ *
+ * Creates a new #AperturePipelinePreroll, which starts out buffering.
+ *
+ * Returns: (transfer full): a new #AperturePipelinePreroll
+ */
+AperturePipelinePreroll *
+aperture_pipeline_preroll_new (void)
+{
+  return g_object_new (APERTURE_TYPE_PIPELINE_PREROLL, NULL);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_preroll_set_max_duration:
+ * @self: an #AperturePipelinePreroll
+ * @duration: how much video to keep
+ *
+ * Sets how much video to keep in the ring. Since the ring is trimmed a GOP
+ * at a time, it holds between @duration and @duration plus one keyframe
+ * interval.
+ */
+void
+aperture_pipeline_preroll_set_max_duration (AperturePipelinePreroll *self, GstClockTime duration)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_PREROLL (self));
+  g_return_if_fail (GST_CLOCK_TIME_IS_VALID (duration));
+
+  g_mutex_lock (&self->lock);
+  self->max_duration = duration;
+  trim_ring (self);
+  g_mutex_unlock (&self->lock);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_preroll_start:
+ * @self: an #AperturePipelinePreroll
+ *
+ * Lets video through, starting with the contents of the ring. Link the
+ * source pad before calling this.
+ */
+void
+aperture_pipeline_preroll_start (AperturePipelinePreroll *self)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_PREROLL (self));
+
+  g_mutex_lock (&self->lock);
+  if (!self->live) {
+    self->live = TRUE;
+    self->waiting_for_keyframe = TRUE;
+    self->requested_keyframe = FALSE;
+    self->start_time = g_get_monotonic_time ();
+    self->start_latency = GST_CLOCK_TIME_NONE;
+  }
+  g_mutex_unlock (&self->lock);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_preroll_stop:
+ * @self: an #AperturePipelinePreroll
+ *
+ * Stops letting video through, and starts filling the ring again. Once this
+ * returns, nothing more is pushed out of the source pad, so it can be
+ * unlinked. If a buffer, or the ring, is being pushed downstream, this
+ * waits for that to finish, so don't call it while downstream is blocked.
+ */
+void
+aperture_pipeline_preroll_stop (AperturePipelinePreroll *self)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_PREROLL (self));
+
+  g_mutex_lock (&self->lock);
+  self->live = FALSE;
+  self->waiting_for_keyframe = FALSE;
+  g_mutex_unlock (&self->lock);
+
+  /* The probe, and the identity pushing whatever it let through, run with
+   * the sink pad's stream lock held. Any buffer that comes after this goes
+   * into the ring. */
+  GST_PAD_STREAM_LOCK (self->sinkpad);
+  GST_PAD_STREAM_UNLOCK (self->sinkpad);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_preroll_get_stats:
+ * @self: an #AperturePipelinePreroll
+ * @stats: (out caller-allocates): return location for the stats
+ *
+ * Gets how much video is in the ring, how much memory it uses, and how long
+ * the last start took.
+ */
+void
+aperture_pipeline_preroll_get_stats (AperturePipelinePreroll *self, AperturePipelinePrerollStats *stats)
+{
+  GstBuffer *oldest;
+  GstBuffer *newest;
+
+  g_return_if_fail (APERTURE_IS_PIPELINE_PREROLL (self));
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&self->lock);
+
+  oldest = g_queue_peek_head (&self->ring);
+  newest = g_queue_peek_tail (&self->ring);
+
+  stats->duration = 0;
+  if (oldest != NULL
+      && GST_CLOCK_TIME_IS_VALID (GST_BUFFER_DTS_OR_PTS (oldest))
+      && GST_CLOCK_TIME_IS_VALID (GST_BUFFER_DTS_OR_PTS (newest))) {
+    stats->duration = GST_BUFFER_DTS_OR_PTS (newest) - GST_BUFFER_DTS_OR_PTS (oldest);
+    if (GST_BUFFER_DURATION_IS_VALID (newest)) {
+      stats->duration += GST_BUFFER_DURATION (newest);
+    }
+  }
+  stats->bytes = self->ring_bytes;
+  stats->n_buffers = g_queue_get_length (&self->ring);
+  stats->start_latency = self->start_latency;
+
+  g_mutex_unlock (&self->lock);
+}
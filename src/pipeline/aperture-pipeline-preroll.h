@@ -0,0 +1,57 @@
+/* aperture-pipeline-preroll.h
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#pragma once
+
+
+#include <gst/gst.h>
+
+
+G_BEGIN_DECLS
+
+
+typedef struct {
+  /* the span of video in the ring, and the memory it takes up */
+  GstClockTime duration;
+  guint64 bytes;
+  guint n_buffers;
+
+  /* how long the last aperture_pipeline_preroll_start() took to hand the
+   * ring downstream, or GST_CLOCK_TIME_NONE if it hasn't yet */
+  GstClockTime start_latency;
+} AperturePipelinePrerollStats;
+
+
+#define APERTURE_TYPE_PIPELINE_PREROLL (aperture_pipeline_preroll_get_type())
+G_DECLARE_FINAL_TYPE (AperturePipelinePreroll, aperture_pipeline_preroll, APERTURE, PIPELINE_PREROLL, GstBin)
+
+
+AperturePipelinePreroll *aperture_pipeline_preroll_new              (void);
+
+void                     aperture_pipeline_preroll_set_max_duration (AperturePipelinePreroll      *self,
+                                                                     GstClockTime                  duration);
+void                     aperture_pipeline_preroll_start            (AperturePipelinePreroll      *self);
+void                     aperture_pipeline_preroll_stop             (AperturePipelinePreroll      *self);
+void                     aperture_pipeline_preroll_get_stats        (AperturePipelinePreroll      *self,
+                                                                     AperturePipelinePrerollStats *stats);
+
+
+G_END_DECLS
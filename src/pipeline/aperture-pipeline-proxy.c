@@ -0,0 +1,130 @@
+/* aperture-pipeline-proxy.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include "aperture-pipeline-encoder.h"
+#include "aperture-pipeline-proxy.h"
+
+
+/* A small copy of a recording, for quick review and upload, made while
+ * the full-quality file is recorded rather than transcoded from it
+ * afterwards.
+ *
+ * The proxy hangs off the viewfinder's tee, so it shares the frames the
+ * viewfinder already has instead of asking the camera for a second
+ * stream:
+ *
+ *   videoconvert ! videoscale ! videorate ! AperturePipelineEncoder ! AperturePipelineRecorder
+ *
+ * The frames are scaled to the proxy profile's resolution, keeping the
+ * aspect ratio if only the width or the height is set, brought to its
+ * framerate, and always encoded in software. The recorder works just like
+ * the full-quality one: set its location, and finish it with
+ * aperture_pipeline_recorder_finish(). Its messages come from the recorder
+ * inside the bin. */
+
+
+struct _AperturePipelineProxy
+{
+  GstBin parent_instance;
+
+  AperturePipelineRecorder *recorder;
+};
+
+G_DEFINE_TYPE (AperturePipelineProxy, aperture_pipeline_proxy, GST_TYPE_BIN)
+
+
+/* INIT */
+
+
+static void
+aperture_pipeline_proxy_class_init (AperturePipelineProxyClass *klass)
+{
+}
+
+
+static void
+aperture_pipeline_proxy_init (AperturePipelineProxy *self)
+{
+}
+
+
+/* PUBLIC */
+
+
+/**
+ * PRIVATE:aperture_pipeline_proxy_new:
+ * @profile: the recording profile of the proxy
+ * @container: the container to write the proxy in
+ *
+ * Creates a new #AperturePipelineProxy, which takes raw video. The
+ * software encoder for the profile's codec must be installed; see
+ * aperture_pipeline_encoder_can_encode().
+ *
+ * Returns: (transfer full): a new #AperturePipelineProxy
+ */
+AperturePipelineProxy *
+aperture_pipeline_proxy_new (const ApertureRecordingProfile *profile, ApertureVideoContainer container)
+{
+  AperturePipelineProxy *self;
+  g_autoptr(GstPad) pad = NULL;
+  GstElement *convert;
+  GstElement *scale;
+  GstElement *rate;
+  AperturePipelineEncoder *encoder;
+  GstPad *ghost_pad;
+
+  g_return_val_if_fail (profile != NULL, NULL);
+
+  self = g_object_new (APERTURE_TYPE_PIPELINE_PROXY, NULL);
+
+  convert = gst_element_factory_make ("videoconvert", NULL);
+  scale = gst_element_factory_make ("videoscale", NULL);
+  rate = gst_element_factory_make ("videorate", NULL);
+  encoder = aperture_pipeline_encoder_new (profile, TRUE);
+  self->recorder = aperture_pipeline_recorder_new (container, aperture_recording_profile_get_codec (profile));
+
+  gst_bin_add_many (GST_BIN (self), convert, scale, rate, GST_ELEMENT (encoder), GST_ELEMENT (self->recorder), NULL);
+  gst_element_link_many (convert, scale, rate, GST_ELEMENT (encoder), GST_ELEMENT (self->recorder), NULL);
+
+  pad = gst_element_get_static_pad (convert, "sink");
+  ghost_pad = gst_ghost_pad_new ("sink", pad);
+  gst_pad_set_active (ghost_pad, TRUE);
+  gst_element_add_pad (GST_ELEMENT (self), ghost_pad);
+
+  return self;
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_proxy_get_recorder:
+ * @self: an #AperturePipelineProxy
+ *
+ * Gets the recorder that writes the proxy, to set its location and finish
+ * it.
+ *
+ * Returns: (transfer none): the proxy's #AperturePipelineRecorder
+ */
+AperturePipelineRecorder *
+aperture_pipeline_proxy_get_recorder (AperturePipelineProxy *self)
+{
+  g_return_val_if_fail (APERTURE_IS_PIPELINE_PROXY (self), NULL);
+  return self->recorder;
+}
@@ -0,0 +1,43 @@
+/* aperture-pipeline-proxy.h
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#pragma once
+
+
+#include <gst/gst.h>
+
+#include "aperture-pipeline-recorder.h"
+
+
+G_BEGIN_DECLS
+
+
+#define APERTURE_TYPE_PIPELINE_PROXY (aperture_pipeline_proxy_get_type())
+G_DECLARE_FINAL_TYPE (AperturePipelineProxy, aperture_pipeline_proxy, APERTURE, PIPELINE_PROXY, GstBin)
+
+
+AperturePipelineProxy    *aperture_pipeline_proxy_new          (const ApertureRecordingProfile *profile,
+                                                                ApertureVideoContainer          container);
+
+AperturePipelineRecorder *aperture_pipeline_proxy_get_recorder (AperturePipelineProxy          *self);
+
+
+G_END_DECLS
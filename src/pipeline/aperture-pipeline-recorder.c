@@ -0,0 +1,1457 @@
+/* aperture-pipeline-recorder.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#ifdef HAVE_FALLOCATE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <gst/app/app.h>
+#include <gst/video/video.h>
+
+#include "aperture-pipeline-recorder.h"
+
+
+/* The video recording branch of the viewfinder.
+ *
+ * The camera hands out an H.264 elementary stream, which is not something a
+ * video player can seek in, or even open reliably. The branch puts it in a
+ * container on its way to the file:
+ *
+ *   h264parse|h265parse ! mp4mux|matroskamux ! appsink
+ *
+ * The container is written in fragments (moof boxes in MP4, clusters in
+ * Matroska) of about the fragment duration. The file isn't written on the
+ * streaming thread, where a slow write would hold up the whole camera;
+ * the appsink puts the container in a bounded queue, and a writer thread
+ * gathers it into large, block-aligned writes. The file is preallocated
+ * ahead of the writes, and synced every sync interval. A partial block is
+ * written once it is half a second old, so if the application crashes,
+ * everything up to the last complete fragment that was written can still
+ * be played. The writer keeps track of how long writes and syncs take,
+ * which shows up in the writer stats along with the queue's high-water
+ * mark.
+ *
+ * With faststart, a fragmented MP4 is rewritten into a regular one with the
+ * index at the front when the recording finishes, which some players and
+ * editors prefer. The muxer seeks back to do that, and the writer follows
+ * it.
+ *
+ * A segmented recorder puts the muxer in a splitmuxsink instead, which
+ * starts a new file whenever the current one reaches the maximum segment
+ * duration or size. Segments are cut at keyframes, and splitmuxsink asks
+ * the encoder for one when a segment is due, so every file starts with a
+ * keyframe and no frames are lost between them. The segments are written
+ * by an unbuffered filesink, not the writer thread. Each time a file is
+ * closed, the bin posts a "segment-closed" element message with a
+ * "location" (string) and a "running-time" (guint64) field.
+ *
+ * A streaming recorder has no file. The muxer writes a streamable
+ * container, and the writer thread hands it to a GOutputStream or a
+ * callback instead.
+ *
+ * When the queue is full, the streaming thread waits for the writer, which
+ * holds the recording up rather than dropping parts of the container. The
+ * time spent waiting shows up in the writer stats.
+ *
+ * A file recorder can be held: it is built, linked and playing, but its
+ * file is not opened until aperture_pipeline_recorder_release() gives it a
+ * location. That way all of the setup is done before the recording is
+ * started, and starting it only opens the file.
+ *
+ * Every recording starts on a keyframe. Delta frames before the first one
+ * are dropped, and the encoder is asked for a keyframe. When the first
+ * keyframe goes into the muxer, the bin posts a "recording-started" element
+ * message with a "latency" (guint64) field, the time since the recording
+ * was started.
+ *
+ * To stop, call aperture_pipeline_recorder_finish() rather than just
+ * removing the branch, so that the muxer can finish the file. When the file
+ * is complete, the bin posts a "recording-done" element message, with a
+ * "location" (string) field, instead of an EOS message. For a segmented
+ * recorder, that is the location format, and the last file has already
+ * been reported by its "segment-closed" message. */
+
+
+#define DEFAULT_FRAGMENT_DURATION GST_SECOND
+#define DEFAULT_MAX_QUEUED_BYTES (4 * 1024 * 1024)
+#define DEFAULT_SYNC_INTERVAL GST_SECOND
+
+/* Writes to the file are this big, and start at multiples of it */
+#define WRITE_BLOCK_SIZE (1024 * 1024)
+/* How far ahead of the writes the file is allocated */
+#define PREALLOCATE_SIZE (32 * 1024 * 1024)
+/* How long a partial block may wait before it is written anyway */
+#define MAX_WRITE_DELAY (500 * G_TIME_SPAN_MILLISECOND)
+/* How many of the latest writes the latency percentiles are taken from */
+#define N_LATENCY_SAMPLES 1024
+
+
+typedef enum {
+  OUTPUT_FILE,
+  OUTPUT_SEGMENTS,
+  OUTPUT_STREAM,
+} RecorderOutput;
+
+
+typedef struct {
+  GBytes *data;
+  /* where in the file it goes, or -1 if it follows the previous chunk */
+  gint64 offset;
+} Chunk;
+
+
+struct _AperturePipelineRecorder
+{
+  GstBin parent_instance;
+
+  ApertureVideoContainer container;
+  GstClockTime fragment_duration;
+  gboolean faststart;
+
+  GstElement *parse;
+  GstElement *mux;
+  /* the appsink, or the splitmuxsink of a segmented recorder */
+  GstElement *sink;
+  RecorderOutput output;
+  char *location;
+
+  /* Streaming output. The chunk func is called on the writer thread. */
+  AperturePipelineRecorderChunkFunc chunk_func;
+  gpointer chunk_data;
+  GDestroyNotify chunk_destroy;
+  GOutputStream *stream;
+  GCancellable *cancellable;
+  GThread *writer;
+
+  /* where the muxer wants the next chunk to go, or -1; accessed from the
+   * streaming thread */
+  gint64 next_offset;
+
+  /* File output, accessed from the writer thread once the file is open.
+   * The block gathers chunks until it reaches the next block boundary. */
+  int fd;
+  GByteArray *block;
+  guint64 block_offset;
+  gint64 block_time;
+  guint64 file_size;
+  guint64 allocated;
+  gint64 last_sync;
+
+  /* Protects the chunk queue and the writer stats */
+  GMutex queue_lock;
+  GCond queue_cond;
+  GQueue chunks;
+  guint64 max_queued_bytes;
+  GstClockTime sync_interval;
+  gboolean eos;
+  /* the writer failed or the branch is shutting down; chunks are dropped */
+  gboolean flushing;
+  AperturePipelineRecorderWriterStats writer_stats;
+  /* a ring of the latest write latencies */
+  GstClockTime write_latencies[N_LATENCY_SAMPLES];
+
+  /* set once the branch is finishing, so buffers that come after the EOS
+   * are dropped; accessed from the streaming thread */
+  gint finishing;
+
+  /* the file isn't opened until the recorder is released */
+  gboolean held;
+  /* Protected by the object lock. When the recording was started, in
+   * monotonic time, and whether it has reached a keyframe yet. */
+  gint64 start_time;
+  gboolean started;
+  gboolean requested_keyframe;
+};
+
+G_DEFINE_TYPE (AperturePipelineRecorder, aperture_pipeline_recorder, GST_TYPE_BIN)
+
+
+/* Applies the fragment duration and faststart settings to the muxer */
+static void
+configure_mux (AperturePipelineRecorder *self)
+{
+  switch (self->container) {
+  case APERTURE_VIDEO_CONTAINER_MP4:
+    {
+      guint fragment_ms = self->fragment_duration / GST_MSECOND;
+      gboolean has_fragment_mode = g_object_class_find_property (G_OBJECT_GET_CLASS (self->mux), "fragment-mode") != NULL;
+
+      if (self->output == OUTPUT_STREAM) {
+        /* a stream can't be seeked back into, so it has to be fragmented,
+         * and there is no finishing it into a regular MP4 */
+        g_object_set (self->mux,
+                      "fragment-duration", fragment_ms > 0 ? fragment_ms : (guint) (DEFAULT_FRAGMENT_DURATION / GST_MSECOND),
+                      "streamable", TRUE,
+                      NULL);
+        break;
+      }
+
+      g_object_set (self->mux, "fragment-duration", fragment_ms, NULL);
+
+      if (fragment_ms == 0) {
+        /* a regular MP4, which is only playable once it is finished */
+        g_object_set (self->mux, "faststart", self->faststart, NULL);
+      } else if (has_fragment_mode) {
+        /* GStreamer 1.20 can turn the fragments into a regular MP4 at the
+         * end, without a separate remux */
+        gst_util_set_object_arg (G_OBJECT (self->mux), "fragment-mode",
+                                 self->faststart ? "first-moov-then-finalise" : "dash-or-mss");
+      } else if (self->faststart) {
+        g_debug ("mp4mux can't finalize fragmented files; faststart is ignored");
+      }
+    }
+    break;
+
+  case APERTURE_VIDEO_CONTAINER_MATROSKA:
+    /* Clusters are Matroska's fragments. The index is written at the end
+     * either way, and players find it through the seek head, so there is
+     * nothing to do for faststart. A stream just doesn't get an index. */
+    g_object_set (self->mux, "streamable", self->output == OUTPUT_STREAM, NULL);
+    if (self->fragment_duration > 0) {
+      g_object_set (self->mux,
+                    "min-cluster-duration", (gint64) MIN (self->fragment_duration, 500 * GST_MSECOND),
+                    "max-cluster-duration", (gint64) self->fragment_duration,
+                    NULL);
+    }
+    break;
+
+  default:
+    g_assert_not_reached ();
+  }
+}
+
+
+static GstPadProbeReturn
+drop_after_finish_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AperturePipelineRecorder *self = APERTURE_PIPELINE_RECORDER (user_data);
+
+  if (g_atomic_int_get (&self->finishing)) {
+    return GST_PAD_PROBE_DROP;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+
+/* Holds the recording back until a keyframe, so the file starts with
+ * something decodable, and reports when it gets there */
+static GstPadProbeReturn
+keyframe_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AperturePipelineRecorder *self = APERTURE_PIPELINE_RECORDER (user_data);
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime latency = GST_CLOCK_TIME_NONE;
+  gboolean request;
+
+  if (buffer == NULL) {
+    buffer = gst_buffer_list_get (GST_PAD_PROBE_INFO_BUFFER_LIST (info), 0);
+  }
+
+  GST_OBJECT_LOCK (self);
+
+  if (self->started) {
+    GST_OBJECT_UNLOCK (self);
+    return GST_PAD_PROBE_OK;
+  }
+
+  /* nothing should arrive while the file is closed, but it can't go
+   * anywhere if it does */
+  if (self->held) {
+    GST_OBJECT_UNLOCK (self);
+    return GST_PAD_PROBE_DROP;
+  }
+
+  if (buffer != NULL && GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    request = !self->requested_keyframe;
+    self->requested_keyframe = TRUE;
+    GST_OBJECT_UNLOCK (self);
+
+    if (request) {
+      gst_pad_push_event (pad, gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, TRUE, 0));
+    }
+    return GST_PAD_PROBE_DROP;
+  }
+
+  self->started = TRUE;
+  if (self->start_time != 0) {
+    latency = (g_get_monotonic_time () - self->start_time) * GST_USECOND;
+  }
+
+  GST_OBJECT_UNLOCK (self);
+
+  gst_element_post_message (GST_ELEMENT (self),
+                            gst_message_new_element (GST_OBJECT (self),
+                                                     gst_structure_new ("recording-started",
+                                                                        "latency", G_TYPE_UINT64, latency,
+                                                                        NULL)));
+
+  return GST_PAD_PROBE_OK;
+}
+
+
+/* Ends the stream once nothing is flowing into the branch, so the EOS
+ * doesn't race with a buffer */
+static GstPadProbeReturn
+finish_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AperturePipelineRecorder *self = APERTURE_PIPELINE_RECORDER (user_data);
+  g_autoptr(GstPad) parse_pad = gst_element_get_static_pad (self->parse, "sink");
+
+  gst_pad_send_event (parse_pad, gst_event_new_eos ());
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+
+static void
+unmap_and_unref (gpointer user_data)
+{
+  GstMapInfo *map = user_data;
+  GstBuffer *buffer = map->user_data[0];
+
+  gst_buffer_unmap (buffer, map);
+  gst_buffer_unref (buffer);
+  g_free (map);
+}
+
+
+static void
+chunk_free (Chunk *chunk)
+{
+  g_bytes_unref (chunk->data);
+  g_free (chunk);
+}
+
+
+/* The muxer goes back to fill in headers by sending a new byte segment
+ * before the data. The probe runs on the streaming thread, in order with
+ * the buffers, so the next chunk is the one that goes there. */
+static GstPadProbeReturn
+segment_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AperturePipelineRecorder *self = APERTURE_PIPELINE_RECORDER (user_data);
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  const GstSegment *segment;
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT) {
+    gst_event_parse_segment (event, &segment);
+    if (segment->format == GST_FORMAT_BYTES) {
+      self->next_offset = segment->start;
+    }
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+
+/* An appsink doesn't answer the SEEKING query, so the muxer would think it
+ * can't go back to fill in headers. The writer thread follows the byte
+ * segments, so a file can be seeked in. */
+static GstPadProbeReturn
+seeking_query_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  GstQuery *query = GST_PAD_PROBE_INFO_QUERY (info);
+  GstFormat format;
+
+  if (GST_QUERY_TYPE (query) != GST_QUERY_SEEKING) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  gst_query_parse_seeking (query, &format, NULL, NULL, NULL);
+  if (format != GST_FORMAT_BYTES) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  gst_query_set_seeking (query, GST_FORMAT_BYTES, TRUE, 0, -1);
+  return GST_PAD_PROBE_HANDLED;
+}
+
+
+/* Called on the streaming thread with each chunk of the container. Waits
+ * for room in the queue, which is where the backpressure comes from. */
+static GstFlowReturn
+on_new_sample (GstAppSink *appsink, gpointer user_data)
+{
+  AperturePipelineRecorder *self = APERTURE_PIPELINE_RECORDER (user_data);
+  g_autoptr(GstSample) sample = gst_app_sink_pull_sample (appsink);
+  GstBuffer *buffer;
+  GstMapInfo *map;
+  Chunk *chunk;
+  gsize size;
+  gint64 wait_start;
+
+  if (sample == NULL) {
+    return GST_FLOW_FLUSHING;
+  }
+
+  buffer = gst_sample_get_buffer (sample);
+  map = g_new0 (GstMapInfo, 1);
+  if (!gst_buffer_map (buffer, map, GST_MAP_READ)) {
+    g_free (map);
+    return GST_FLOW_ERROR;
+  }
+  map->user_data[0] = gst_buffer_ref (buffer);
+  size = map->size;
+
+  chunk = g_new0 (Chunk, 1);
+  chunk->data = g_bytes_new_with_free_func (map->data, map->size, unmap_and_unref, map);
+  chunk->offset = self->next_offset;
+  self->next_offset = -1;
+
+  g_mutex_lock (&self->queue_lock);
+
+  wait_start = g_get_monotonic_time ();
+  while (!self->flushing
+         && !g_queue_is_empty (&self->chunks)
+         && self->writer_stats.queued_bytes + size > self->max_queued_bytes) {
+    g_cond_wait (&self->queue_cond, &self->queue_lock);
+  }
+  self->writer_stats.blocked_time += (g_get_monotonic_time () - wait_start) * GST_USECOND;
+
+  if (self->flushing) {
+    g_mutex_unlock (&self->queue_lock);
+    chunk_free (chunk);
+    return GST_FLOW_OK;
+  }
+
+  g_queue_push_tail (&self->chunks, chunk);
+  self->writer_stats.queued_bytes += size;
+  self->writer_stats.max_queued_bytes = MAX (self->writer_stats.max_queued_bytes,
+                                             self->writer_stats.queued_bytes);
+  g_cond_broadcast (&self->queue_cond);
+
+  g_mutex_unlock (&self->queue_lock);
+
+  return GST_FLOW_OK;
+}
+
+
+static void
+on_eos (GstAppSink *appsink, gpointer user_data)
+{
+  AperturePipelineRecorder *self = APERTURE_PIPELINE_RECORDER (user_data);
+
+  g_mutex_lock (&self->queue_lock);
+  self->eos = TRUE;
+  g_cond_broadcast (&self->queue_cond);
+  g_mutex_unlock (&self->queue_lock);
+}
+
+
+static gboolean
+write_to_stream (GBytes *chunk, gpointer user_data, GError **error)
+{
+  AperturePipelineRecorder *self = APERTURE_PIPELINE_RECORDER (user_data);
+  gsize size;
+  gconstpointer data = g_bytes_get_data (chunk, &size);
+
+  return g_output_stream_write_all (self->stream, data, size, NULL, self->cancellable, error);
+}
+
+
+static void
+set_error_from_errno (GError **error, int saved_errno, const char *action, const char *location)
+{
+  g_set_error (error,
+               G_IO_ERROR,
+               g_io_error_from_errno (saved_errno),
+               "Could not %s %s: %s",
+               action, location, g_strerror (saved_errno));
+}
+
+
+static gboolean
+open_file (AperturePipelineRecorder *self, GError **error)
+{
+  g_assert (self->fd < 0);
+
+  self->fd = g_open (self->location, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (self->fd < 0) {
+    set_error_from_errno (error, errno, "open", self->location);
+    return FALSE;
+  }
+
+  self->block = g_byte_array_sized_new (WRITE_BLOCK_SIZE);
+  self->block_offset = 0;
+  self->file_size = 0;
+  self->allocated = 0;
+  self->last_sync = g_get_monotonic_time ();
+
+  return TRUE;
+}
+
+
+static void
+record_latency (AperturePipelineRecorder *self, gint64 start, gboolean sync)
+{
+  GstClockTime latency = (g_get_monotonic_time () - start) * GST_USECOND;
+
+  g_mutex_lock (&self->queue_lock);
+  if (sync) {
+    self->writer_stats.n_syncs ++;
+    self->writer_stats.sync_latency_max = MAX (self->writer_stats.sync_latency_max, latency);
+  } else {
+    self->write_latencies[self->writer_stats.n_writes % N_LATENCY_SAMPLES] = latency;
+    self->writer_stats.n_writes ++;
+    self->writer_stats.write_latency_max = MAX (self->writer_stats.write_latency_max, latency);
+  }
+  g_mutex_unlock (&self->queue_lock);
+}
+
+
+/* Allocates the file ahead of the writes, so the filesystem can lay it out
+ * in one piece and doesn't have to find room in the middle of a write.
+ * The file keeps its size, so after a crash it ends where the last write
+ * did rather than in a run of zeros. */
+static void
+preallocate (AperturePipelineRecorder *self, guint64 end)
+{
+#ifdef HAVE_FALLOCATE
+  guint64 new_end = end + PREALLOCATE_SIZE;
+
+  if (end <= self->allocated) {
+    return;
+  }
+
+  if (fallocate (self->fd, FALLOC_FL_KEEP_SIZE, self->allocated, new_end - self->allocated) == 0) {
+    self->allocated = new_end;
+  } else {
+    g_debug ("Could not preallocate %s: %s", self->location, g_strerror (errno));
+    /* the filesystem doesn't support it; don't try again */
+    self->allocated = G_MAXUINT64;
+  }
+#endif
+}
+
+
+static gboolean
+write_block (AperturePipelineRecorder *self, GError **error)
+{
+  const guint8 *data = self->block->data;
+  gsize remaining = self->block->len;
+  guint64 offset = self->block_offset;
+
+  if (remaining == 0) {
+    return TRUE;
+  }
+
+  preallocate (self, offset + remaining);
+
+  while (remaining > 0) {
+    gint64 start = g_get_monotonic_time ();
+    gssize written = pwrite (self->fd, data, remaining, offset);
+
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      set_error_from_errno (error, errno, "write", self->location);
+      return FALSE;
+    }
+
+    record_latency (self, start, FALSE);
+    data += written;
+    remaining -= written;
+    offset += written;
+  }
+
+  self->file_size = MAX (self->file_size, offset);
+  self->block_offset = offset;
+  g_byte_array_set_size (self->block, 0);
+
+  return TRUE;
+}
+
+
+static gboolean
+sync_file (AperturePipelineRecorder *self, GError **error)
+{
+  gint64 start = g_get_monotonic_time ();
+
+  if (fdatasync (self->fd) < 0) {
+    set_error_from_errno (error, errno, "sync", self->location);
+    return FALSE;
+  }
+
+  record_latency (self, start, TRUE);
+  self->last_sync = g_get_monotonic_time ();
+
+  return TRUE;
+}
+
+
+static gboolean
+write_to_file (AperturePipelineRecorder *self, Chunk *chunk, GError **error)
+{
+  gsize size;
+  const guint8 *data = g_bytes_get_data (chunk->data, &size);
+  GstClockTime sync_interval;
+  gint64 now;
+
+  if (self->fd < 0) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_CLOSED, "The recording has no file");
+    return FALSE;
+  }
+
+  if (chunk->offset >= 0 && (guint64) chunk->offset != self->block_offset + self->block->len) {
+    if (!write_block (self, error)) {
+      return FALSE;
+    }
+    self->block_offset = chunk->offset;
+  }
+
+  while (size > 0) {
+    /* only fill the block up to the next boundary, so that writes line up
+     * again after a seek or a partial block */
+    gsize room = WRITE_BLOCK_SIZE - (self->block_offset + self->block->len) % WRITE_BLOCK_SIZE;
+    gsize length = MIN (room, size);
+
+    if (self->block->len == 0) {
+      self->block_time = g_get_monotonic_time ();
+    }
+
+    g_byte_array_append (self->block, data, length);
+    data += length;
+    size -= length;
+
+    if (length == room && !write_block (self, error)) {
+      return FALSE;
+    }
+  }
+
+  /* don't keep finished fragments in memory for long, or a crash would
+   * lose them */
+  now = g_get_monotonic_time ();
+  if (self->block->len > 0
+      && now - self->block_time >= MAX_WRITE_DELAY
+      && !write_block (self, error)) {
+    return FALSE;
+  }
+
+  g_mutex_lock (&self->queue_lock);
+  sync_interval = self->sync_interval;
+  g_mutex_unlock (&self->queue_lock);
+
+  if (sync_interval > 0 && (GstClockTime) (now - self->last_sync) * GST_USECOND >= sync_interval) {
+    return write_block (self, error) && sync_file (self, error);
+  }
+
+  return TRUE;
+}
+
+
+/* Closes the file. If the recording is finished, everything is written and
+ * synced; otherwise, whatever is in the block is written if possible. */
+static gboolean
+close_file (AperturePipelineRecorder *self, gboolean finish, GError **error)
+{
+  gboolean ok = TRUE;
+
+  if (self->fd < 0) {
+    return TRUE;
+  }
+
+  if (finish) {
+    ok = write_block (self, error) && sync_file (self, error);
+  } else {
+    write_block (self, NULL);
+  }
+
+#ifdef HAVE_FALLOCATE
+  /* give back the space that was allocated but never written */
+  if (self->allocated > self->file_size && ftruncate (self->fd, self->file_size) < 0) {
+    g_debug ("Could not truncate %s: %s", self->location, g_strerror (errno));
+  }
+#endif
+
+  close (self->fd);
+  self->fd = -1;
+  g_clear_pointer (&self->block, g_byte_array_unref);
+
+  return ok;
+}
+
+
+static gboolean
+write_chunk (AperturePipelineRecorder *self, Chunk *chunk, GError **error)
+{
+  if (self->output == OUTPUT_FILE) {
+    return write_to_file (self, chunk, error);
+  }
+
+  /* the muxer is set up so a stream never has to seek */
+  return self->chunk_func (chunk->data, self->chunk_data, error);
+}
+
+
+/* When the partial block has to be written by, in monotonic time, or -1 if
+ * there is nothing waiting. Called from the writer thread. */
+static gint64
+get_block_deadline (AperturePipelineRecorder *self)
+{
+  if (self->output != OUTPUT_FILE || self->block == NULL || self->block->len == 0) {
+    return -1;
+  }
+
+  return self->block_time + MAX_WRITE_DELAY;
+}
+
+
+/* Called with the queue lock held, after the writer has failed */
+static void
+drop_queued_chunks (AperturePipelineRecorder *self)
+{
+  /* drop the rest, and don't hold up the streaming thread */
+  self->flushing = TRUE;
+  g_queue_clear_full (&self->chunks, (GDestroyNotify) chunk_free);
+  self->writer_stats.queued_bytes = 0;
+  g_cond_broadcast (&self->queue_cond);
+}
+
+
+/* Writes the queued chunks to the file, or hands them to the chunk func,
+ * until the end of the stream or until the branch shuts down */
+static gpointer
+writer_thread (gpointer user_data)
+{
+  AperturePipelineRecorder *self = APERTURE_PIPELINE_RECORDER (user_data);
+  g_autoptr(GError) error = NULL;
+  gboolean finished;
+
+  g_mutex_lock (&self->queue_lock);
+
+  while (TRUE) {
+    Chunk *chunk;
+    gsize size;
+    gboolean ok;
+
+    while (!self->flushing && !self->eos && g_queue_is_empty (&self->chunks)) {
+      gint64 deadline = get_block_deadline (self);
+
+      if (deadline < 0) {
+        g_cond_wait (&self->queue_cond, &self->queue_lock);
+      } else if (!g_cond_wait_until (&self->queue_cond, &self->queue_lock, deadline)) {
+        /* nothing came in to fill the block, so write what there is, even
+         * if the video has stopped coming */
+        g_mutex_unlock (&self->queue_lock);
+        ok = write_block (self, &error);
+        g_mutex_lock (&self->queue_lock);
+
+        if (!ok) {
+          drop_queued_chunks (self);
+        }
+      }
+    }
+
+    if (self->flushing || g_queue_is_empty (&self->chunks)) {
+      break;
+    }
+
+    chunk = g_queue_pop_head (&self->chunks);
+    size = g_bytes_get_size (chunk->data);
+
+    g_mutex_unlock (&self->queue_lock);
+    ok = write_chunk (self, chunk, &error);
+    chunk_free (chunk);
+    g_mutex_lock (&self->queue_lock);
+
+    self->writer_stats.queued_bytes -= size;
+    self->writer_stats.written_bytes += size;
+    g_cond_broadcast (&self->queue_cond);
+
+    if (!ok) {
+      drop_queued_chunks (self);
+      break;
+    }
+  }
+
+  finished = self->eos && !self->flushing;
+
+  g_mutex_unlock (&self->queue_lock);
+
+  if (self->output == OUTPUT_FILE) {
+    finished = close_file (self, finished, finished ? &error : NULL) && finished;
+  } else if (finished && self->stream != NULL) {
+    g_output_stream_flush (self->stream, self->cancellable, NULL);
+  }
+
+  if (error != NULL) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      gst_element_post_message (GST_ELEMENT (self),
+                                gst_message_new_error (GST_OBJECT (self), error, "Could not write the recording"));
+    }
+  } else if (finished) {
+    GstStructure *structure = gst_structure_new_empty ("recording-done");
+
+    if (self->location != NULL) {
+      gst_structure_set (structure, "location", G_TYPE_STRING, self->location, NULL);
+    }
+    gst_element_post_message (GST_ELEMENT (self),
+                              gst_message_new_element (GST_OBJECT (self), structure));
+  }
+
+  return NULL;
+}
+
+
+static void
+start_writer (AperturePipelineRecorder *self)
+{
+  g_mutex_lock (&self->queue_lock);
+  self->flushing = FALSE;
+  self->eos = FALSE;
+  g_mutex_unlock (&self->queue_lock);
+
+  self->next_offset = -1;
+  g_cancellable_reset (self->cancellable);
+  self->writer = g_thread_new ("aperture-recorder-writer", writer_thread, self);
+}
+
+
+static void
+stop_writer (AperturePipelineRecorder *self)
+{
+  if (self->writer == NULL) {
+    return;
+  }
+
+  /* wake up the streaming thread and the writer, and interrupt a blocking
+   * write */
+  g_mutex_lock (&self->queue_lock);
+  self->flushing = TRUE;
+  g_cond_broadcast (&self->queue_cond);
+  g_mutex_unlock (&self->queue_lock);
+  g_cancellable_cancel (self->cancellable);
+
+  g_thread_join (self->writer);
+  self->writer = NULL;
+
+  g_mutex_lock (&self->queue_lock);
+  g_queue_clear_full (&self->chunks, (GDestroyNotify) chunk_free);
+  self->writer_stats.queued_bytes = 0;
+  g_mutex_unlock (&self->queue_lock);
+}
+
+
+static AperturePipelineRecorder *
+create_recorder (ApertureVideoContainer container, ApertureVideoCodec codec, RecorderOutput output)
+{
+  AperturePipelineRecorder *self = g_object_new (APERTURE_TYPE_PIPELINE_RECORDER, NULL);
+  g_autoptr(GstPad) pad = NULL;
+  GstElement *filesink;
+  GstPad *ghost_pad;
+  GstAppSinkCallbacks callbacks = {
+    .eos = on_eos,
+    .new_sample = on_new_sample,
+  };
+
+  self->container = container;
+  self->output = output;
+
+  switch (codec) {
+  case APERTURE_VIDEO_CODEC_H264:
+    self->parse = gst_element_factory_make ("h264parse", NULL);
+    break;
+  case APERTURE_VIDEO_CODEC_H265:
+    self->parse = gst_element_factory_make ("h265parse", NULL);
+    break;
+  default:
+    g_assert_not_reached ();
+  }
+  /* repeat the parameter sets at every keyframe, so the file is decodable
+   * wherever the recording starts */
+  g_object_set (self->parse, "config-interval", -1, NULL);
+  switch (container) {
+  case APERTURE_VIDEO_CONTAINER_MP4:
+    self->mux = gst_element_factory_make ("mp4mux", NULL);
+    break;
+  case APERTURE_VIDEO_CONTAINER_MATROSKA:
+    self->mux = gst_element_factory_make ("matroskamux", NULL);
+    break;
+  default:
+    g_assert_not_reached ();
+  }
+  configure_mux (self);
+
+  if (output == OUTPUT_SEGMENTS) {
+    filesink = gst_element_factory_make ("filesink", NULL);
+    /* write fragments out as soon as they are complete, so they survive a
+     * crash */
+    g_object_set (filesink, "buffer-mode", 2, "sync", FALSE, "async", FALSE, NULL);
+
+    self->sink = gst_element_factory_make ("splitmuxsink", NULL);
+    g_object_set (self->sink,
+                  "muxer", self->mux,
+                  "sink", filesink,
+                  "send-keyframe-requests", TRUE,
+                  "async-finalize", FALSE,
+                  NULL);
+
+    gst_bin_add_many (GST_BIN (self), self->parse, self->sink, NULL);
+    gst_element_link (self->parse, self->sink);
+  } else {
+    self->sink = gst_element_factory_make ("appsink", NULL);
+    g_object_set (self->sink, "sync", FALSE, "async", FALSE, NULL);
+    gst_app_sink_set_callbacks (GST_APP_SINK (self->sink), &callbacks, self, NULL);
+
+    pad = gst_element_get_static_pad (self->sink, "sink");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, segment_probe, self, NULL);
+    if (output == OUTPUT_FILE) {
+      gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM, seeking_query_probe, self, NULL);
+    }
+    g_clear_object (&pad);
+
+    gst_bin_add_many (GST_BIN (self), self->parse, self->mux, self->sink, NULL);
+    gst_element_link_many (self->parse, self->mux, self->sink, NULL);
+  }
+
+  pad = gst_element_get_static_pad (self->parse, "sink");
+  ghost_pad = gst_ghost_pad_new ("sink", pad);
+  gst_pad_add_probe (ghost_pad,
+                     GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+                     drop_after_finish_probe, self, NULL);
+  gst_pad_add_probe (ghost_pad,
+                     GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+                     keyframe_probe, self, NULL);
+  gst_pad_set_active (ghost_pad, TRUE);
+  gst_element_add_pad (GST_ELEMENT (self), ghost_pad);
+
+  return self;
+}
+
+
+/* VFUNCS */
+
+
+static void
+aperture_pipeline_recorder_handle_message (GstBin *bin, GstMessage *message)
+{
+  AperturePipelineRecorder *self = APERTURE_PIPELINE_RECORDER (bin);
+
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ELEMENT
+      && GST_MESSAGE_SRC (message) == GST_OBJECT (self->sink)
+      && gst_message_has_name (message, "splitmuxsink-fragment-closed")) {
+    const GstStructure *structure = gst_message_get_structure (message);
+    const char *location;
+    GstClockTime running_time = GST_CLOCK_TIME_NONE;
+
+    location = gst_structure_get_string (structure, "location");
+    gst_structure_get_uint64 (structure, "running-time", &running_time);
+
+    gst_element_post_message (GST_ELEMENT (self),
+                              gst_message_new_element (GST_OBJECT (self),
+                                                       gst_structure_new ("segment-closed",
+                                                                          "location", G_TYPE_STRING, location,
+                                                                          "running-time", G_TYPE_UINT64, running_time,
+                                                                          NULL)));
+    gst_message_unref (message);
+    return;
+  }
+
+  /* The writer thread says when the recording is done, once it has
+   * written everything */
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_EOS
+      && GST_MESSAGE_SRC (message) == GST_OBJECT (self->sink)
+      && self->output != OUTPUT_SEGMENTS) {
+    gst_message_unref (message);
+    return;
+  }
+
+  /* The last segment is complete. Say so, rather than letting the EOS
+   * through, since the rest of the pipeline keeps running. */
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_EOS
+      && GST_MESSAGE_SRC (message) == GST_OBJECT (self->sink)) {
+    g_autofree char *location = NULL;
+
+    g_object_get (self->sink, "location", &location, NULL);
+
+    gst_message_unref (message);
+    gst_element_post_message (GST_ELEMENT (self),
+                              gst_message_new_element (GST_OBJECT (self),
+                                                       gst_structure_new ("recording-done",
+                                                                          "location", G_TYPE_STRING, location,
+                                                                          NULL)));
+    return;
+  }
+
+  GST_BIN_CLASS (aperture_pipeline_recorder_parent_class)->handle_message (bin, message);
+}
+
+
+static GstStateChangeReturn
+aperture_pipeline_recorder_change_state (GstElement *element, GstStateChange transition)
+{
+  AperturePipelineRecorder *self = APERTURE_PIPELINE_RECORDER (element);
+  GstStateChangeReturn ret;
+
+  /* a held recorder starts, and opens its file, when it is released
+   * instead */
+  if (transition == GST_STATE_CHANGE_READY_TO_PAUSED) {
+    g_autoptr(GError) error = NULL;
+    gboolean held;
+
+    GST_OBJECT_LOCK (self);
+    held = self->held;
+    if (!held && self->start_time == 0) {
+      self->start_time = g_get_monotonic_time ();
+    }
+    GST_OBJECT_UNLOCK (self);
+
+    if (self->output == OUTPUT_FILE && !held && self->fd < 0 && !open_file (self, &error)) {
+      gst_element_post_message (element,
+                                gst_message_new_error (GST_OBJECT (self), error, "Could not start the recording"));
+      return GST_STATE_CHANGE_FAILURE;
+    }
+  }
+
+  if (self->output != OUTPUT_SEGMENTS) {
+    if (transition == GST_STATE_CHANGE_READY_TO_PAUSED) {
+      start_writer (self);
+    } else if (transition == GST_STATE_CHANGE_PAUSED_TO_READY) {
+      /* the streaming thread might be waiting for room in the queue, and
+       * has to be woken up before the pads can be deactivated */
+      stop_writer (self);
+    }
+  }
+
+  ret = GST_ELEMENT_CLASS (aperture_pipeline_recorder_parent_class)->change_state (element, transition);
+
+  if (ret == GST_STATE_CHANGE_FAILURE
+      && transition == GST_STATE_CHANGE_READY_TO_PAUSED
+      && self->output != OUTPUT_SEGMENTS) {
+    stop_writer (self);
+  }
+
+  return ret;
+}
+
+
+static void
+aperture_pipeline_recorder_finalize (GObject *object)
+{
+  AperturePipelineRecorder *self = APERTURE_PIPELINE_RECORDER (object);
+
+  g_assert (self->writer == NULL);
+
+  if (self->chunk_destroy != NULL) {
+    self->chunk_destroy (self->chunk_data);
+  }
+  g_clear_object (&self->stream);
+  g_clear_object (&self->cancellable);
+  g_free (self->location);
+  g_mutex_clear (&self->queue_lock);
+  g_cond_clear (&self->queue_cond);
+
+  G_OBJECT_CLASS (aperture_pipeline_recorder_parent_class)->finalize (object);
+}
+
+
+/* INIT */
+
+
+static void
+aperture_pipeline_recorder_class_init (AperturePipelineRecorderClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBinClass *bin_class = GST_BIN_CLASS (klass);
+
+  object_class->finalize = aperture_pipeline_recorder_finalize;
+  element_class->change_state = aperture_pipeline_recorder_change_state;
+  bin_class->handle_message = aperture_pipeline_recorder_handle_message;
+}
+
+
+static void
+aperture_pipeline_recorder_init (AperturePipelineRecorder *self)
+{
+  self->fragment_duration = DEFAULT_FRAGMENT_DURATION;
+  self->max_queued_bytes = DEFAULT_MAX_QUEUED_BYTES;
+  self->sync_interval = DEFAULT_SYNC_INTERVAL;
+  self->fd = -1;
+  self->cancellable = g_cancellable_new ();
+  g_mutex_init (&self->queue_lock);
+  g_cond_init (&self->queue_cond);
+  g_queue_init (&self->chunks);
+}
+
+
+/* PUBLIC */
+
+
+/**
+ * PRIVATE:aperture_pipeline_recorder_new:
+ * @container: the container to write the video in
+ * @codec: the codec of the video that goes in
+ *
+ * Creates a new #AperturePipelineRecorder, which takes H.264 video.
+ *
+ * Returns: (transfer full): a new #AperturePipelineRecorder
+ */
+AperturePipelineRecorder *
+aperture_pipeline_recorder_new (ApertureVideoContainer container, ApertureVideoCodec codec)
+{
+  return create_recorder (container, codec, OUTPUT_FILE);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_recorder_new_segmented:
+ * @container: the container to write the video in
+ * @codec: the codec of the video that goes in
+ *
+ * Creates a new #AperturePipelineRecorder that splits the video into
+ * several files. See aperture_pipeline_recorder_set_max_segment().
+ *
+ * The location is a printf-style format with one integer conversion, such
+ * as "video-%05d.mp4", which is replaced by the index of the segment.
+ *
+ * Returns: (transfer full): a new #AperturePipelineRecorder
+ */
+AperturePipelineRecorder *
+aperture_pipeline_recorder_new_segmented (ApertureVideoContainer container, ApertureVideoCodec codec)
+{
+  return create_recorder (container, codec, OUTPUT_SEGMENTS);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_recorder_new_for_stream:
+ * @container: the container to write the video in
+ * @codec: the codec of the video that goes in
+ * @stream: the stream to write to
+ *
+ * Creates a new #AperturePipelineRecorder that writes the video to
+ * @stream, from a thread of its own. The container is written in a form
+ * that doesn't need to seek, so @stream can be a pipe or a socket.
+ *
+ * Returns: (transfer full): a new #AperturePipelineRecorder
+ */
+AperturePipelineRecorder *
+aperture_pipeline_recorder_new_for_stream (ApertureVideoContainer container, ApertureVideoCodec codec, GOutputStream *stream)
+{
+  AperturePipelineRecorder *self;
+
+  g_return_val_if_fail (G_IS_OUTPUT_STREAM (stream), NULL);
+
+  self = create_recorder (container, codec, OUTPUT_STREAM);
+  self->stream = g_object_ref (stream);
+  self->chunk_func = write_to_stream;
+  self->chunk_data = self;
+
+  return self;
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_recorder_new_for_func:
+ * @container: the container to write the video in
+ * @codec: the codec of the video that goes in
+ * @func: (scope notified) (closure user_data) (destroy destroy): the
+ * function to call with each chunk of the video
+ * @user_data: user data for @func
+ * @destroy: (nullable): called on @user_data once the recorder is destroyed
+ *
+ * Like aperture_pipeline_recorder_new_for_stream(), but hands the chunks to
+ * @func instead. @func is called from a thread of the recorder's own. If it
+ * returns %FALSE, the rest of the video is dropped and the error is posted
+ * on the bus.
+ *
+ * Returns: (transfer full): a new #AperturePipelineRecorder
+ */
+AperturePipelineRecorder *
+aperture_pipeline_recorder_new_for_func (ApertureVideoContainer            container,
+                                         ApertureVideoCodec                codec,
+                                         AperturePipelineRecorderChunkFunc func,
+                                         gpointer                          user_data,
+                                         GDestroyNotify                    destroy)
+{
+  AperturePipelineRecorder *self;
+
+  g_return_val_if_fail (func != NULL, NULL);
+
+  self = create_recorder (container, codec, OUTPUT_STREAM);
+  self->chunk_func = func;
+  self->chunk_data = user_data;
+  self->chunk_destroy = destroy;
+
+  return self;
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_recorder_set_location:
+ * @self: an #AperturePipelineRecorder
+ * @location: the path of the file to write
+ *
+ * Sets the file to record to. This must be done before the branch starts.
+ */
+void
+aperture_pipeline_recorder_set_location (AperturePipelineRecorder *self, const char *location)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_RECORDER (self));
+  g_return_if_fail (location != NULL);
+  g_return_if_fail (self->output != OUTPUT_STREAM);
+
+  if (self->output == OUTPUT_SEGMENTS) {
+    g_object_set (self->sink, "location", location, NULL);
+  } else {
+    g_free (self->location);
+    self->location = g_strdup (location);
+  }
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_recorder_set_fragment_duration:
+ * @self: an #AperturePipelineRecorder
+ * @duration: the length of a fragment, or 0 to write an unfragmented file
+ *
+ * Sets how much video goes in each fragment of the file. A crash loses at
+ * most this much video, but shorter fragments make the file slightly
+ * bigger. This must be done before the branch starts.
+ */
+void
+aperture_pipeline_recorder_set_fragment_duration (AperturePipelineRecorder *self, GstClockTime duration)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_RECORDER (self));
+
+  self->fragment_duration = duration;
+  configure_mux (self);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_recorder_set_faststart:
+ * @self: an #AperturePipelineRecorder
+ * @faststart: whether to put the index at the front of the file
+ *
+ * Sets whether an MP4 file is rewritten into a regular, unfragmented MP4
+ * with the index at the front when the recording finishes. This has no
+ * effect on Matroska files. This must be done before the branch starts.
+ */
+void
+aperture_pipeline_recorder_set_faststart (AperturePipelineRecorder *self, gboolean faststart)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_RECORDER (self));
+
+  self->faststart = faststart;
+  configure_mux (self);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_recorder_set_max_segment:
+ * @self: a segmented #AperturePipelineRecorder
+ * @duration: the maximum length of a segment, or 0 for no limit
+ * @size: the maximum size of a segment in bytes, or 0 for no limit
+ *
+ * Sets when to start a new file. A segment is closed at the first keyframe
+ * after either limit is reached, so it may be a little longer or bigger
+ * than this. This must be done before the branch starts.
+ */
+void
+aperture_pipeline_recorder_set_max_segment (AperturePipelineRecorder *self,
+                                            GstClockTime              duration,
+                                            guint64                   size)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_RECORDER (self));
+  g_return_if_fail (self->output == OUTPUT_SEGMENTS);
+
+  g_object_set (self->sink,
+                "max-size-time", (guint64) duration,
+                "max-size-bytes", size,
+                NULL);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_recorder_hold:
+ * @self: an #AperturePipelineRecorder from aperture_pipeline_recorder_new()
+ *
+ * Keeps the file closed, so the recorder can be linked and set to PLAYING
+ * before it is known where to record to. Call this before adding it to the
+ * pipeline. Nothing is recorded until aperture_pipeline_recorder_release().
+ */
+void
+aperture_pipeline_recorder_hold (AperturePipelineRecorder *self)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_RECORDER (self));
+  g_return_if_fail (self->output == OUTPUT_FILE);
+
+  GST_OBJECT_LOCK (self);
+  self->held = TRUE;
+  GST_OBJECT_UNLOCK (self);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_recorder_release:
+ * @self: a held #AperturePipelineRecorder
+ * @location: the file to record to
+ *
+ * Opens @location and starts recording to it. If the file can't be opened,
+ * an error is posted on the bus.
+ */
+void
+aperture_pipeline_recorder_release (AperturePipelineRecorder *self, const char *location)
+{
+  g_autoptr(GError) error = NULL;
+
+  g_return_if_fail (APERTURE_IS_PIPELINE_RECORDER (self));
+  g_return_if_fail (self->held);
+  g_return_if_fail (location != NULL);
+
+  g_free (self->location);
+  self->location = g_strdup (location);
+
+  /* the writer only touches the file once chunks come through, which they
+   * don't until the recorder is no longer held */
+  if (!open_file (self, &error)) {
+    gst_element_post_message (GST_ELEMENT (self),
+                              gst_message_new_error (GST_OBJECT (self), error, "Could not start the recording"));
+    return;
+  }
+
+  GST_OBJECT_LOCK (self);
+  self->held = FALSE;
+  self->start_time = g_get_monotonic_time ();
+  GST_OBJECT_UNLOCK (self);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_recorder_set_max_queued_bytes:
+ * @self: an #AperturePipelineRecorder
+ * @max_bytes: how many bytes may wait for the writer
+ *
+ * Sets how much of the video can wait to be written. Once this much is
+ * waiting, the recording is held up until the writer catches up. This has
+ * no effect on a segmented recorder.
+ */
+void
+aperture_pipeline_recorder_set_max_queued_bytes (AperturePipelineRecorder *self, guint64 max_bytes)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_RECORDER (self));
+
+  g_mutex_lock (&self->queue_lock);
+  self->max_queued_bytes = max_bytes;
+  g_cond_broadcast (&self->queue_cond);
+  g_mutex_unlock (&self->queue_lock);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_recorder_set_sync_interval:
+ * @self: an #AperturePipelineRecorder
+ * @interval: how often to sync the file, or 0 to only sync it at the end
+ *
+ * Sets how often the file is synced to storage. Syncing more often means
+ * less of the recording is lost if the system crashes, but it costs write
+ * bandwidth. This only applies to a recorder from
+ * aperture_pipeline_recorder_new().
+ */
+void
+aperture_pipeline_recorder_set_sync_interval (AperturePipelineRecorder *self, GstClockTime interval)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_RECORDER (self));
+
+  g_mutex_lock (&self->queue_lock);
+  self->sync_interval = interval;
+  g_mutex_unlock (&self->queue_lock);
+}
+
+
+static int
+compare_clock_time (gconstpointer a, gconstpointer b)
+{
+  GstClockTime time_a = *(const GstClockTime *) a;
+  GstClockTime time_b = *(const GstClockTime *) b;
+
+  return time_a < time_b ? -1 : time_a > time_b;
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_recorder_get_writer_stats:
+ * @self: an #AperturePipelineRecorder
+ * @stats: (out caller-allocates): return location for the stats
+ *
+ * Gets how far the writer is behind, how long the recording has been held
+ * up waiting for it, and how long writes to the file take. A segmented
+ * recorder has no writer, so its stats are all 0.
+ */
+void
+aperture_pipeline_recorder_get_writer_stats (AperturePipelineRecorder *self, AperturePipelineRecorderWriterStats *stats)
+{
+  GstClockTime latencies[N_LATENCY_SAMPLES];
+  guint n;
+
+  g_return_if_fail (APERTURE_IS_PIPELINE_RECORDER (self));
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&self->queue_lock);
+  *stats = self->writer_stats;
+  n = MIN (stats->n_writes, N_LATENCY_SAMPLES);
+  memcpy (latencies, self->write_latencies, n * sizeof (GstClockTime));
+  g_mutex_unlock (&self->queue_lock);
+
+  if (n == 0) {
+    return;
+  }
+
+  qsort (latencies, n, sizeof (GstClockTime), compare_clock_time);
+  stats->write_latency_p50 = latencies[(n - 1) * 50 / 100];
+  stats->write_latency_p95 = latencies[(n - 1) * 95 / 100];
+  stats->write_latency_p99 = latencies[(n - 1) * 99 / 100];
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_recorder_finish:
+ * @self: an #AperturePipelineRecorder
+ *
+ * Ends the recording. Video that arrives afterwards is dropped. The bin
+ * posts a "recording-done" message once the file is complete, or once
+ * everything has been written to the stream.
+ */
+void
+aperture_pipeline_recorder_finish (AperturePipelineRecorder *self)
+{
+  g_autoptr(GstPad) pad = NULL;
+
+  g_return_if_fail (APERTURE_IS_PIPELINE_RECORDER (self));
+
+  if (!g_atomic_int_compare_and_exchange (&self->finishing, FALSE, TRUE)) {
+    return;
+  }
+
+  pad = gst_element_get_static_pad (GST_ELEMENT (self), "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_IDLE, finish_probe,
+                     gst_object_ref (self), gst_object_unref);
+}
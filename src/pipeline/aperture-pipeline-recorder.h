@@ -0,0 +1,97 @@
+/* aperture-pipeline-recorder.h
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#pragma once
+
+
+#include <gio/gio.h>
+#include <gst/gst.h>
+
+#include "aperture-viewfinder.h"
+
+
+G_BEGIN_DECLS
+
+
+typedef gboolean (*AperturePipelineRecorderChunkFunc) (GBytes   *chunk,
+                                                       gpointer  user_data,
+                                                       GError  **error);
+
+
+typedef struct {
+  /* bytes waiting for the writer, and the most there have been */
+  guint64 queued_bytes;
+  guint64 max_queued_bytes;
+  guint64 written_bytes;
+  /* how long the recording has been held up by a full queue */
+  GstClockTime blocked_time;
+
+  /* Writes to the file and syncs of it; 0 for a stream. The percentiles
+   * are of the latest 1024 writes, the maximums of all of them. */
+  guint n_writes;
+  guint n_syncs;
+  GstClockTime write_latency_p50;
+  GstClockTime write_latency_p95;
+  GstClockTime write_latency_p99;
+  GstClockTime write_latency_max;
+  GstClockTime sync_latency_max;
+} AperturePipelineRecorderWriterStats;
+
+
+#define APERTURE_TYPE_PIPELINE_RECORDER (aperture_pipeline_recorder_get_type())
+G_DECLARE_FINAL_TYPE (AperturePipelineRecorder, aperture_pipeline_recorder, APERTURE, PIPELINE_RECORDER, GstBin)
+
+
+AperturePipelineRecorder *aperture_pipeline_recorder_new                   (ApertureVideoContainer    container,
+                                                                            ApertureVideoCodec        codec);
+AperturePipelineRecorder *aperture_pipeline_recorder_new_segmented         (ApertureVideoContainer    container,
+                                                                            ApertureVideoCodec        codec);
+AperturePipelineRecorder *aperture_pipeline_recorder_new_for_stream        (ApertureVideoContainer    container,
+                                                                            ApertureVideoCodec        codec,
+                                                                            GOutputStream            *stream);
+AperturePipelineRecorder *aperture_pipeline_recorder_new_for_func          (ApertureVideoContainer            container,
+                                                                            ApertureVideoCodec                codec,
+                                                                            AperturePipelineRecorderChunkFunc func,
+                                                                            gpointer                          user_data,
+                                                                            GDestroyNotify                    destroy);
+
+void                      aperture_pipeline_recorder_set_location          (AperturePipelineRecorder *self,
+                                                                            const char               *location);
+void                      aperture_pipeline_recorder_set_fragment_duration (AperturePipelineRecorder *self,
+                                                                            GstClockTime              duration);
+void                      aperture_pipeline_recorder_set_faststart         (AperturePipelineRecorder *self,
+                                                                            gboolean                  faststart);
+void                      aperture_pipeline_recorder_set_max_segment       (AperturePipelineRecorder *self,
+                                                                            GstClockTime              duration,
+                                                                            guint64                   size);
+void                      aperture_pipeline_recorder_hold                  (AperturePipelineRecorder *self);
+void                      aperture_pipeline_recorder_release               (AperturePipelineRecorder *self,
+                                                                            const char               *location);
+void                      aperture_pipeline_recorder_set_max_queued_bytes  (AperturePipelineRecorder *self,
+                                                                            guint64                   max_bytes);
+void                      aperture_pipeline_recorder_set_sync_interval     (AperturePipelineRecorder *self,
+                                                                            GstClockTime              interval);
+void                      aperture_pipeline_recorder_get_writer_stats      (AperturePipelineRecorder            *self,
+                                                                            AperturePipelineRecorderWriterStats *stats);
+void                      aperture_pipeline_recorder_finish                (AperturePipelineRecorder *self);
+
+
+G_END_DECLS
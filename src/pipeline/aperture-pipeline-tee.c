@@ -27,42 +27,472 @@ struct _AperturePipelineTee
   GstBin parent_instance;
 
   GstElement *tee;
-  GHashTable *queues;
+  GHashTable *branches;
+
+  /* Branches with APERTURE_PIPELINE_TEE_THREADING_SHARED hang off this tee,
+   * which is itself a dedicated branch of the main tee. Created on demand. */
+  GstElement *shared_tee;
+  struct _TeeBranch *shared;
+  /* how many shared branches there are, counting ones in uncommitted
+   * transactions; the worker goes away once this drops to 0 */
+  guint n_shared;
+  /* The worker has been prepared, but no commit has linked it yet. The
+   * first transaction with a shared branch to be committed links it, so it
+   * doesn't belong to whichever transaction happened to create it. */
+  gboolean shared_pending;
+
+  /* Protects the decimation state of the branches and the stall stats */
+  GMutex lock;
+  GstClockTime last_stall;
 };
 
 G_DEFINE_TYPE (AperturePipelineTee, aperture_pipeline_tee, GST_TYPE_BIN)
 
 
-/* Used for transferring data into a pad probe */
-typedef struct {
+/* Bookkeeping for a single branch. Owned by the branches table until the
+ * branch is removed, then by the teardown function. */
+typedef struct _TeeBranch {
   AperturePipelineTee *self;
+  AperturePipelineTeeThreading threading;
   GstElement *branch;
+
+  /* The tee the branch is linked to, and its queue. Shared and inline
+   * branches don't have a queue of their own. */
+  GstElement *source_tee;
   GstElement *queue;
+
+  /* NULL until the branch is linked. Holds a reference to the request pad
+   * until the branch is torn down. */
   GstPad *tee_pad;
-} RemoveBranchProbeData;
+
+  /* Accessed from the streaming thread, so use atomics */
+  gint leaky;
+  gint overruns;
+  gint dropped;
+
+  /* Decimation state, protected by self->lock */
+  gulong decimate_probe_id;
+  guint every_nth_frame;
+  GstClockTime min_frame_interval;
+  guint64 frame_count;
+  GstClockTime next_pts;
+  guint decimated;
+} TeeBranch;
+
+
+struct _AperturePipelineTeeTransaction
+{
+  /* one for the caller until it's committed, then one per pending probe */
+  gint ref_count;
+
+  AperturePipelineTee *self;
+  GPtrArray *add;
+  GPtrArray *remove;
+
+  /* The shared worker's tee, if the transaction changes any shared
+   * branches. Set when it's committed. */
+  GstElement *shared_tee;
+};
 
 
 static void
-pad_probe_async_func (GstElement *element, gpointer user_data)
+tee_branch_free (TeeBranch *data)
 {
-  RemoveBranchProbeData *probe = user_data;
+  g_clear_object (&data->tee_pad);
+  g_free (data);
+}
+
 
-  gst_element_release_request_pad (probe->self->tee, probe->tee_pad);
+static void
+apply_queue_policy (TeeBranch *data, const AperturePipelineTeeBranchPolicy *policy)
+{
+  if (data->queue == NULL) {
+    return;
+  }
 
-  gst_element_set_state (probe->branch, GST_STATE_NULL);
-  gst_element_set_state (probe->queue, GST_STATE_NULL);
+  /* The enum values match GstQueueLeaky */
+  g_object_set (data->queue,
+                "leaky", policy->drop_policy,
+                "max-size-buffers", policy->max_buffers,
+                "max-size-bytes", policy->max_bytes,
+                "max-size-time", policy->max_time,
+                NULL);
 
-  gst_bin_remove (GST_BIN (probe->self), probe->queue);
-  gst_bin_remove (GST_BIN (probe->self), probe->branch);
+  g_atomic_int_set (&data->leaky, policy->drop_policy != APERTURE_PIPELINE_TEE_DROP_NONE);
 }
 
 
+/* Runs on the tee's src pad for every buffer, before the buffer is pushed
+ * into the branch's queue. Dropping it here means the branch never sees
+ * frames it doesn't want. */
 static GstPadProbeReturn
-pad_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+decimate_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
 {
-  RemoveBranchProbeData *probe = user_data;
+  TeeBranch *data = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+  GstClockTime tolerance = 0;
+  gboolean keep = TRUE;
+
+  g_mutex_lock (&data->self->lock);
+
+  if (data->every_nth_frame > 1) {
+    keep = (data->frame_count % data->every_nth_frame) == 0;
+    data->frame_count ++;
+  }
+
+  if (keep && data->min_frame_interval > 0 && GST_CLOCK_TIME_IS_VALID (pts)) {
+    /* allow for timestamps being rounded, so that e.g. every third frame of
+     * a 30 fps stream is accepted for a 10 fps limit */
+    if (GST_BUFFER_DURATION_IS_VALID (buffer)) {
+      tolerance = GST_BUFFER_DURATION (buffer) / 2;
+    }
+
+    if (GST_CLOCK_TIME_IS_VALID (data->next_pts)
+        && pts + tolerance < data->next_pts
+        && data->next_pts - pts <= data->min_frame_interval + tolerance) {
+      keep = FALSE;
+    } else if (GST_CLOCK_TIME_IS_VALID (data->next_pts)
+               && pts + tolerance >= data->next_pts
+               && pts < data->next_pts + data->min_frame_interval) {
+      /* step from the previous deadline, not from @pts, so the rate doesn't
+       * drift downward */
+      data->next_pts += data->min_frame_interval;
+    } else {
+      /* first frame, or the stream jumped (gap, or timestamps restarted) */
+      data->next_pts = pts + data->min_frame_interval;
+    }
+  }
+
+  if (!keep) {
+    data->decimated ++;
+  }
+
+  g_mutex_unlock (&data->self->lock);
+
+  return keep ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+
+/* Installs or removes the decimation probe, depending on the branch's
+ * settings. Must be called with self->lock held. */
+static void
+update_decimate_probe (TeeBranch *data)
+{
+  gboolean decimate = data->every_nth_frame > 1 || data->min_frame_interval > 0;
+
+  if (data->tee_pad == NULL) {
+    return;
+  }
+
+  /* Only pay for the probe on branches that actually want fewer frames */
+  if (decimate && data->decimate_probe_id == 0) {
+    data->decimate_probe_id = gst_pad_add_probe (data->tee_pad,
+                                                 GST_PAD_PROBE_TYPE_BUFFER,
+                                                 decimate_probe,
+                                                 data,
+                                                 NULL);
+  } else if (!decimate && data->decimate_probe_id != 0) {
+    gst_pad_remove_probe (data->tee_pad, data->decimate_probe_id);
+    data->decimate_probe_id = 0;
+  }
+}
+
+
+static void
+apply_decimation_policy (TeeBranch *data, const AperturePipelineTeeBranchPolicy *policy)
+{
+  g_mutex_lock (&data->self->lock);
+
+  data->every_nth_frame = policy->every_nth_frame;
+  data->min_frame_interval = policy->min_frame_interval;
+  data->frame_count = 0;
+  data->next_pts = GST_CLOCK_TIME_NONE;
+  update_decimate_probe (data);
+
+  g_mutex_unlock (&data->self->lock);
+}
 
-  gst_element_call_async (probe->self->tee, pad_probe_async_func, user_data, g_free);
+
+/* Emitted by the queue, on the tee's streaming thread, whenever a buffer
+ * arrives and the queue is full. For leaky queues, that means a buffer is
+ * about to be dropped. */
+static void
+on_queue_overrun (GstElement *queue, TeeBranch *data)
+{
+  g_atomic_int_inc (&data->overruns);
+
+  if (g_atomic_int_get (&data->leaky)) {
+    g_atomic_int_inc (&data->dropped);
+  }
+}
+
+
+static TeeBranch *
+lookup_branch (AperturePipelineTee *self, GstElement *branch)
+{
+  return g_hash_table_lookup (self->branches, branch);
+}
+
+
+/* Creates the queue for a branch (if it gets one) and puts everything into
+ * the bin. Nothing is linked to a tee yet, so this doesn't touch the
+ * stream. */
+static TeeBranch *
+prepare_branch (AperturePipelineTee *self,
+                GstElement *branch,
+                const AperturePipelineTeeBranchPolicy *policy)
+{
+  TeeBranch *data = g_new0 (TeeBranch, 1);
+
+  data->self = self;
+  data->threading = policy->threading;
+  data->branch = branch;
+
+  if (policy->threading == APERTURE_PIPELINE_TEE_THREADING_SHARED) {
+    data->source_tee = self->shared_tee;
+  } else {
+    data->source_tee = self->tee;
+  }
+
+  if (policy->threading == APERTURE_PIPELINE_TEE_THREADING_DEDICATED) {
+    data->queue = gst_element_factory_make ("queue", NULL);
+    g_signal_connect (data->queue, "overrun", G_CALLBACK (on_queue_overrun), data);
+    gst_bin_add (GST_BIN (self), data->queue);
+  }
+
+  apply_queue_policy (data, policy);
+  apply_decimation_policy (data, policy);
+
+  gst_bin_add (GST_BIN (self), branch);
+  if (data->queue != NULL) {
+    gst_element_link (data->queue, branch);
+  }
+
+  return data;
+}
+
+
+/* Creates the shared worker: a tee behind a single queue, which shared
+ * branches are linked to instead of getting a queue each. */
+static TeeBranch *
+prepare_shared_worker (AperturePipelineTee *self)
+{
+  AperturePipelineTeeBranchPolicy policy = APERTURE_PIPELINE_TEE_BRANCH_POLICY_INIT;
+
+  /* all shared branches wait on the slowest one, so don't let a backlog
+   * build up behind it */
+  policy.drop_policy = APERTURE_PIPELINE_TEE_DROP_OLDEST;
+  policy.max_buffers = 2;
+  policy.max_bytes = 0;
+  policy.max_time = 0;
+
+  self->shared_tee = gst_element_factory_make ("tee", NULL);
+  g_object_set (self->shared_tee, "allow-not-linked", TRUE, NULL);
+
+  self->shared = prepare_branch (self, self->shared_tee, &policy);
+  return self->shared;
+}
+
+
+/* Destroys a branch that was prepared but never linked */
+static void
+discard_prepared_branch (TeeBranch *data)
+{
+  AperturePipelineTee *self = data->self;
+
+  gst_bin_remove (GST_BIN (self), data->branch);
+  if (data->queue != NULL) {
+    gst_bin_remove (GST_BIN (self), data->queue);
+  }
+  tee_branch_free (data);
+}
+
+
+/* Brings a prepared branch to the bin's state. It isn't linked yet, so no
+ * data reaches it until the transaction is applied. */
+static void
+sync_branch_state (TeeBranch *data)
+{
+  if (data->queue != NULL) {
+    gst_element_sync_state_with_parent (data->queue);
+  }
+  gst_element_sync_state_with_parent (data->branch);
+}
+
+
+/* Connects a prepared branch to its tee. Called while that tee is idle. */
+static void
+link_branch (TeeBranch *data)
+{
+  AperturePipelineTee *self = data->self;
+  g_autoptr(GstPad) sink_pad = NULL;
+  GstPad *tee_pad;
+
+  sink_pad = gst_element_get_static_pad (data->queue ? data->queue : data->branch, "sink");
+
+  tee_pad = gst_element_get_request_pad (data->source_tee, "src_%u");
+  gst_pad_link (tee_pad, sink_pad);
+
+  g_mutex_lock (&self->lock);
+  data->tee_pad = tee_pad;
+  update_decimate_probe (data);
+  g_mutex_unlock (&self->lock);
+}
+
+
+/* Disconnects a branch from its tee. Called while that tee is idle, so its
+ * decimation probe can't be running. */
+static void
+unlink_branch (TeeBranch *data)
+{
+  AperturePipelineTee *self = data->self;
+
+  g_mutex_lock (&self->lock);
+  if (data->decimate_probe_id != 0) {
+    gst_pad_remove_probe (data->tee_pad, data->decimate_probe_id);
+    data->decimate_probe_id = 0;
+  }
+  g_mutex_unlock (&self->lock);
+
+  gst_element_release_request_pad (data->source_tee, data->tee_pad);
+}
+
+
+/* Shuts down branches that have been unlinked. This is done outside the pad
+ * probe, so the stream doesn't have to wait for it. */
+static void
+teardown_branches_async_func (GstElement *element, gpointer user_data)
+{
+  GPtrArray *branches = user_data;
+  guint i;
+
+  for (i = 0; i < branches->len; i ++) {
+    TeeBranch *data = g_ptr_array_index (branches, i);
+
+    gst_element_set_state (data->branch, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (data->self), data->branch);
+
+    if (data->queue != NULL) {
+      gst_element_set_state (data->queue, GST_STATE_NULL);
+      gst_bin_remove (GST_BIN (data->self), data->queue);
+    }
+
+    tee_branch_free (data);
+  }
+}
+
+
+static AperturePipelineTeeTransaction *
+transaction_ref (AperturePipelineTeeTransaction *transaction)
+{
+  g_atomic_int_inc (&transaction->ref_count);
+  return transaction;
+}
+
+
+static void
+transaction_unref (AperturePipelineTeeTransaction *transaction)
+{
+  if (!g_atomic_int_dec_and_test (&transaction->ref_count)) {
+    return;
+  }
+
+  g_object_unref (transaction->self);
+  g_ptr_array_unref (transaction->add);
+  g_ptr_array_unref (transaction->remove);
+  g_free (transaction);
+}
+
+
+/* Links and unlinks either the shared branches of a transaction or all the
+ * others. Removals go first, so a branch's pads are free for a new one. */
+static void
+apply_changes (AperturePipelineTeeTransaction *transaction, gboolean shared)
+{
+  guint i;
+
+  for (i = 0; i < transaction->remove->len; i ++) {
+    TeeBranch *data = g_ptr_array_index (transaction->remove, i);
+    if ((data->threading == APERTURE_PIPELINE_TEE_THREADING_SHARED) == shared) {
+      unlink_branch (data);
+    }
+  }
+
+  for (i = 0; i < transaction->add->len; i ++) {
+    TeeBranch *data = g_ptr_array_index (transaction->add, i);
+    if ((data->threading == APERTURE_PIPELINE_TEE_THREADING_SHARED) == shared) {
+      link_branch (data);
+    }
+  }
+}
+
+
+/* Shuts the removed branches down, once they are unlinked from every tee
+ * that could push into them */
+static void
+teardown_removed_branches (AperturePipelineTeeTransaction *transaction)
+{
+  if (transaction->remove->len == 0) {
+    return;
+  }
+
+  gst_element_call_async (transaction->self->tee,
+                          teardown_branches_async_func,
+                          g_ptr_array_ref (transaction->remove),
+                          (GDestroyNotify) g_ptr_array_unref);
+}
+
+
+/* The second half of a transaction that changes shared branches. The
+ * shared tee is fed by the worker's own streaming thread, not the main
+ * tee's, so this is an IDLE probe on its sink pad. */
+static GstPadProbeReturn
+shared_transaction_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AperturePipelineTeeTransaction *transaction = user_data;
+
+  apply_changes (transaction, TRUE);
+  teardown_removed_branches (transaction);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+
+/* Applies a transaction. The probe is an IDLE probe on the tee's sink pad,
+ * so no data is flowing through the tee--into any branch--while this runs,
+ * and the whole transaction costs the stream a single stall. Shared
+ * branches are changed afterward, once the shared tee is idle too. */
+static GstPadProbeReturn
+transaction_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  AperturePipelineTeeTransaction *transaction = user_data;
+  AperturePipelineTee *self = transaction->self;
+  gint64 start = g_get_monotonic_time ();
+  GstClockTime stall;
+
+  apply_changes (transaction, FALSE);
+
+  stall = (g_get_monotonic_time () - start) * GST_USECOND;
+
+  g_mutex_lock (&self->lock);
+  self->last_stall = stall;
+  g_mutex_unlock (&self->lock);
+
+  g_debug ("Tee transaction (+%u, -%u branches) stalled the stream for %" GST_TIME_FORMAT,
+           transaction->add->len, transaction->remove->len, GST_TIME_ARGS (stall));
+
+  if (transaction->shared_tee != NULL) {
+    g_autoptr(GstPad) shared_pad = gst_element_get_static_pad (transaction->shared_tee, "sink");
+
+    gst_pad_add_probe (shared_pad,
+                       GST_PAD_PROBE_TYPE_IDLE,
+                       shared_transaction_probe,
+                       transaction_ref (transaction),
+                       (GDestroyNotify) transaction_unref);
+  } else {
+    teardown_removed_branches (transaction);
+  }
 
   return GST_PAD_PROBE_REMOVE;
 }
@@ -76,7 +506,9 @@ aperture_pipeline_tee_finalize (GObject *object)
 {
   AperturePipelineTee *self = APERTURE_PIPELINE_TEE (object);
 
-  g_hash_table_unref (self->queues);
+  g_hash_table_unref (self->branches);
+  g_clear_pointer (&self->shared, tee_branch_free);
+  g_mutex_clear (&self->lock);
 
   G_OBJECT_CLASS (aperture_pipeline_tee_parent_class)->finalize (object);
 }
@@ -100,7 +532,9 @@ aperture_pipeline_tee_init (AperturePipelineTee *self)
   g_autoptr(GstPad) pad = NULL;
   GstPad *ghost_pad;
 
-  self->queues = g_hash_table_new (NULL, NULL);
+  self->branches = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) tee_branch_free);
+  g_mutex_init (&self->lock);
+  self->last_stall = GST_CLOCK_TIME_NONE;
 
   self->tee = gst_element_factory_make ("tee", NULL);
   gst_bin_add (GST_BIN (self), self->tee);
@@ -134,33 +568,73 @@ aperture_pipeline_tee_new (void)
  * @self: an #AperturePipelineTee
  * @branch: (transfer full): an element to add to the tee
  *
+ * Adds an element to the tee, using the default queue limits. See
+ * aperture_pipeline_tee_add_branch_full().
+ */
+void
+aperture_pipeline_tee_add_branch (AperturePipelineTee *self, GstElement *branch)
+{
+  aperture_pipeline_tee_add_branch_full (self, branch, NULL);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_tee_add_branch_full:
+ * @self: an #AperturePipelineTee
+ * @branch: (transfer full): an element to add to the tee
+ * @policy: (nullable): the queue policy for the branch, or %NULL for the
+ * defaults
+ *
  * Adds an element to the tee.
  *
  * A queue will be inserted between the tee and the element, and element states
- * are synced automatically.
+ * are synced automatically. @policy controls how much data that queue may
+ * hold and what happens when the branch can't keep up: with
+ * %APERTURE_PIPELINE_TEE_DROP_NONE, a full queue blocks the tee (and thus
+ * every other branch), otherwise buffers are dropped from the branch.
+ * A limit of 0 disables that limit.
+ *
+ * @policy can also ask for fewer frames than the tee receives: only every
+ * @policy->every_nth_frame frame, and/or at most one frame per
+ * @policy->min_frame_interval (for example, `GST_SECOND / 5` for 5 fps).
+ * Unwanted frames are dropped at the tee's src pad, so they never enter the
+ * branch's queue.
+ *
+ * @policy->threading decides which thread runs the branch:
+ *
+ * - %APERTURE_PIPELINE_TEE_THREADING_DEDICATED: the branch gets its own queue
+ *   and streaming thread. This is the default, and the right choice for
+ *   anything slow or anything that syncs to the clock, like video sinks.
+ * - %APERTURE_PIPELINE_TEE_THREADING_SHARED: the branch runs on a single
+ *   worker thread shared with all other shared branches, behind one queue.
+ *   Use this for several light branches, to save threads and context
+ *   switches. The queue fields of @policy are ignored; see
+ *   aperture_pipeline_tee_set_shared_policy().
+ * - %APERTURE_PIPELINE_TEE_THREADING_INLINE: the branch runs directly on the
+ *   tee's upstream streaming thread, with no queue. Only use this for
+ *   branches that are cheap and never block (no clock sync, no preroll), or
+ *   every other branch will wait on it. The queue fields of @policy are
+ *   ignored.
+ *
+ * While the pipeline is running, the branch isn't linked until the tee is
+ * idle, between two buffers, so this may return before it receives any
+ * data. See aperture_pipeline_tee_commit().
+ *
+ * To add or remove several branches at once, use a transaction instead. See
+ * aperture_pipeline_tee_begin().
  */
 void
-aperture_pipeline_tee_add_branch (AperturePipelineTee *self, GstElement *branch)
+aperture_pipeline_tee_add_branch_full (AperturePipelineTee *self,
+                                       GstElement *branch,
+                                       const AperturePipelineTeeBranchPolicy *policy)
 {
-  GstElement *queue;
-  g_autoptr(GstPad) tee_pad = NULL;
-  g_autoptr(GstPad) queue_pad = NULL;
+  AperturePipelineTeeTransaction *transaction;
 
   g_return_if_fail (APERTURE_IS_PIPELINE_TEE (self));
-  g_return_if_fail (GST_IS_ELEMENT (branch));
-
-  queue = gst_element_factory_make ("queue", NULL);
-  g_hash_table_insert (self->queues, branch, queue);
-
-  gst_bin_add_many (GST_BIN (self), queue, branch, NULL);
-  gst_element_link (queue, branch);
 
-  tee_pad = gst_element_get_request_pad (self->tee, "src_%u");
-  queue_pad = gst_element_get_static_pad (queue, "sink");
-  gst_pad_link (tee_pad, queue_pad);
-
-  gst_element_sync_state_with_parent (queue);
-  gst_element_sync_state_with_parent (branch);
+  transaction = aperture_pipeline_tee_begin (self);
+  aperture_pipeline_tee_transaction_add_branch (transaction, branch, policy);
+  aperture_pipeline_tee_commit (transaction);
 }
 
 
@@ -170,29 +644,402 @@ aperture_pipeline_tee_add_branch (AperturePipelineTee *self, GstElement *branch)
  * @branch: the element to remove
  *
  * Removes an element from the tee.
+ *
+ * While the pipeline is running, this is asynchronous: the branch is
+ * unlinked once the tee is idle, and then set to %GST_STATE_NULL and
+ * removed from the bin on another thread. It may still receive a buffer
+ * or two after this returns, and must not be reused until it has left the
+ * bin. Once the last %APERTURE_PIPELINE_TEE_THREADING_SHARED branch is
+ * removed, the shared worker is removed as well.
  */
 void
 aperture_pipeline_tee_remove_branch (AperturePipelineTee *self, GstElement *branch)
 {
-  GstElement *queue;
-  RemoveBranchProbeData *data;
-  g_autoptr(GstPad) tee_pad = NULL;
-  g_autoptr(GstPad) queue_pad = NULL;
+  AperturePipelineTeeTransaction *transaction;
 
   g_return_if_fail (APERTURE_IS_PIPELINE_TEE (self));
+
+  transaction = aperture_pipeline_tee_begin (self);
+  aperture_pipeline_tee_transaction_remove_branch (transaction, branch);
+  aperture_pipeline_tee_commit (transaction);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_tee_begin:
+ * @self: an #AperturePipelineTee
+ *
+ * Starts a transaction, which adds and removes several branches at once.
+ *
+ * Adding or removing a branch briefly stops the stream, since the tee must
+ * not push data while its pads are changed. A transaction applies all of its
+ * changes during a single stop, instead of one per branch.
+ *
+ * Queue up changes with aperture_pipeline_tee_transaction_add_branch() and
+ * aperture_pipeline_tee_transaction_remove_branch(), then apply them with
+ * aperture_pipeline_tee_commit(), or discard them with
+ * aperture_pipeline_tee_abort(). One of the two must be called.
+ *
+ * Returns: (transfer full): a new transaction
+ */
+AperturePipelineTeeTransaction *
+aperture_pipeline_tee_begin (AperturePipelineTee *self)
+{
+  AperturePipelineTeeTransaction *transaction;
+
+  g_return_val_if_fail (APERTURE_IS_PIPELINE_TEE (self), NULL);
+
+  transaction = g_new0 (AperturePipelineTeeTransaction, 1);
+  transaction->ref_count = 1;
+  transaction->self = g_object_ref (self);
+  transaction->add = g_ptr_array_new ();
+  transaction->remove = g_ptr_array_new ();
+
+  return transaction;
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_tee_transaction_add_branch:
+ * @transaction: a transaction from aperture_pipeline_tee_begin()
+ * @branch: (transfer full): an element to add to the tee
+ * @policy: (nullable): the queue policy for the branch, or %NULL for the
+ * defaults
+ *
+ * Queues @branch to be added when @transaction is committed. See
+ * aperture_pipeline_tee_add_branch_full().
+ */
+void
+aperture_pipeline_tee_transaction_add_branch (AperturePipelineTeeTransaction *transaction,
+                                              GstElement *branch,
+                                              const AperturePipelineTeeBranchPolicy *policy)
+{
+  AperturePipelineTeeBranchPolicy default_policy = APERTURE_PIPELINE_TEE_BRANCH_POLICY_INIT;
+  AperturePipelineTee *self;
+  TeeBranch *data;
+
+  g_return_if_fail (transaction != NULL);
   g_return_if_fail (GST_IS_ELEMENT (branch));
-  g_return_if_fail (g_hash_table_contains (self->queues, branch));
 
-  queue = g_hash_table_lookup (self->queues, branch);
-  g_hash_table_remove (self->queues, branch);
+  self = transaction->self;
+  g_return_if_fail (!g_hash_table_contains (self->branches, branch));
 
-  queue_pad = gst_element_get_static_pad (queue, "sink");
-  tee_pad = gst_pad_get_peer (queue_pad);
+  if (policy == NULL) {
+    policy = &default_policy;
+  }
 
-  data = g_new (RemoveBranchProbeData, 1);
-  data->self = self;
-  data->queue = queue;
-  data->branch = branch;
-  data->tee_pad = tee_pad;
-  gst_pad_add_probe (tee_pad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM, pad_probe, data, NULL);
+  if (policy->threading == APERTURE_PIPELINE_TEE_THREADING_SHARED && self->shared == NULL) {
+    /* linked by the first commit that needs it; see
+     * aperture_pipeline_tee_commit() */
+    prepare_shared_worker (self);
+    self->shared_pending = TRUE;
+  }
+
+  data = prepare_branch (self, branch, policy);
+  g_hash_table_insert (self->branches, branch, data);
+  g_ptr_array_add (transaction->add, data);
+
+  if (data->threading == APERTURE_PIPELINE_TEE_THREADING_SHARED) {
+    self->n_shared ++;
+  }
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_tee_transaction_remove_branch:
+ * @transaction: a transaction from aperture_pipeline_tee_begin()
+ * @branch: the element to remove
+ *
+ * Queues @branch to be removed when @transaction is committed. @branch must
+ * not have been added by the same transaction.
+ */
+void
+aperture_pipeline_tee_transaction_remove_branch (AperturePipelineTeeTransaction *transaction,
+                                                 GstElement *branch)
+{
+  AperturePipelineTee *self;
+  TeeBranch *data;
+
+  g_return_if_fail (transaction != NULL);
+  g_return_if_fail (GST_IS_ELEMENT (branch));
+
+  self = transaction->self;
+  data = lookup_branch (self, branch);
+  g_return_if_fail (data != NULL);
+  g_return_if_fail (!g_ptr_array_find (transaction->add, data, NULL));
+
+  g_hash_table_steal (self->branches, branch);
+  g_ptr_array_add (transaction->remove, data);
+
+  if (data->threading == APERTURE_PIPELINE_TEE_THREADING_SHARED) {
+    self->n_shared --;
+  }
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_tee_commit:
+ * @transaction: (transfer full): a transaction from
+ * aperture_pipeline_tee_begin()
+ *
+ * Applies all the changes in @transaction at once.
+ *
+ * The changes are made as soon as the tee is idle--immediately, if the
+ * pipeline isn't running, otherwise between two buffers, on the streaming
+ * thread. So while the pipeline is running, this returns before the
+ * changes are made. Shared branches are changed once the shared worker is
+ * idle as well. Removed branches are shut down afterward, without holding
+ * up the stream.
+ */
+void
+aperture_pipeline_tee_commit (AperturePipelineTeeTransaction *transaction)
+{
+  AperturePipelineTee *self;
+  g_autoptr(GstPad) pad = NULL;
+  guint i;
+
+  g_return_if_fail (transaction != NULL);
+
+  self = transaction->self;
+
+  /* The last shared branch is going away, so the worker can go too. It is
+   * unlinked from the main tee along with the dedicated branches; its queue
+   * may still be pushing into the shared tee, which the second half of the
+   * transaction waits for. */
+  if (self->shared != NULL && self->n_shared == 0) {
+    g_ptr_array_add (transaction->remove, self->shared);
+    self->shared = NULL;
+    self->shared_tee = NULL;
+  }
+
+  for (i = 0; i < transaction->remove->len; i ++) {
+    TeeBranch *data = g_ptr_array_index (transaction->remove, i);
+    if (data->threading == APERTURE_PIPELINE_TEE_THREADING_SHARED) {
+      transaction->shared_tee = data->source_tee;
+    }
+  }
+
+  /* The worker is linked to the main tee in the first half of the
+   * transaction, before its shared branches are linked to it in the
+   * second */
+  if (self->shared_pending) {
+    for (i = 0; i < transaction->add->len; i ++) {
+      TeeBranch *data = g_ptr_array_index (transaction->add, i);
+      if (data->threading == APERTURE_PIPELINE_TEE_THREADING_SHARED) {
+        g_ptr_array_insert (transaction->add, 0, self->shared);
+        self->shared_pending = FALSE;
+        break;
+      }
+    }
+  }
+
+  /* New branches are started before they are linked, so the probe only has
+   * to connect pads */
+  for (i = 0; i < transaction->add->len; i ++) {
+    TeeBranch *data = g_ptr_array_index (transaction->add, i);
+    if (data->threading == APERTURE_PIPELINE_TEE_THREADING_SHARED) {
+      transaction->shared_tee = data->source_tee;
+    }
+    sync_branch_state (data);
+  }
+
+  pad = gst_element_get_static_pad (self->tee, "sink");
+  gst_pad_add_probe (pad,
+                     GST_PAD_PROBE_TYPE_IDLE,
+                     transaction_probe,
+                     transaction,
+                     (GDestroyNotify) transaction_unref);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_tee_abort:
+ * @transaction: (transfer full): a transaction from
+ * aperture_pipeline_tee_begin()
+ *
+ * Discards @transaction without applying it. Branches it would have added
+ * are removed from the tee's bin and destroyed; branches it would have
+ * removed stay where they are. The shared worker is only removed if no
+ * other branch, committed or not, uses it.
+ */
+void
+aperture_pipeline_tee_abort (AperturePipelineTeeTransaction *transaction)
+{
+  AperturePipelineTee *self;
+  guint i;
+
+  g_return_if_fail (transaction != NULL);
+
+  self = transaction->self;
+
+  for (i = 0; i < transaction->remove->len; i ++) {
+    TeeBranch *data = g_ptr_array_index (transaction->remove, i);
+
+    g_hash_table_insert (self->branches, data->branch, data);
+    if (data->threading == APERTURE_PIPELINE_TEE_THREADING_SHARED) {
+      self->n_shared ++;
+    }
+  }
+
+  /* nothing was linked or started yet, so they can go right away */
+  for (i = 0; i < transaction->add->len; i ++) {
+    TeeBranch *data = g_ptr_array_index (transaction->add, i);
+
+    g_hash_table_steal (self->branches, data->branch);
+    if (data->threading == APERTURE_PIPELINE_TEE_THREADING_SHARED) {
+      self->n_shared --;
+    }
+    discard_prepared_branch (data);
+  }
+
+  /* Other transactions may still have shared branches that use the worker.
+   * If not, it goes away: right now if nothing has linked it, otherwise
+   * with an empty transaction, which unlinks it like any other branch. */
+  if (self->shared != NULL && self->n_shared == 0) {
+    if (self->shared_pending) {
+      discard_prepared_branch (self->shared);
+      self->shared = NULL;
+      self->shared_tee = NULL;
+      self->shared_pending = FALSE;
+    } else {
+      aperture_pipeline_tee_commit (aperture_pipeline_tee_begin (self));
+    }
+  }
+
+  transaction_unref (transaction);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_tee_get_last_stall:
+ * @self: an #AperturePipelineTee
+ *
+ * Gets how long the stream was held up by the most recent transaction
+ * (including single aperture_pipeline_tee_add_branch() and
+ * aperture_pipeline_tee_remove_branch() calls).
+ *
+ * Returns: the duration of the last stall, or %GST_CLOCK_TIME_NONE if no
+ * transaction has been applied yet
+ */
+GstClockTime
+aperture_pipeline_tee_get_last_stall (AperturePipelineTee *self)
+{
+  GstClockTime stall;
+
+  g_return_val_if_fail (APERTURE_IS_PIPELINE_TEE (self), GST_CLOCK_TIME_NONE);
+
+  g_mutex_lock (&self->lock);
+  stall = self->last_stall;
+  g_mutex_unlock (&self->lock);
+
+  return stall;
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_tee_set_branch_policy:
+ * @self: an #AperturePipelineTee
+ * @branch: a branch of the tee
+ * @policy: the new queue policy
+ *
+ * Changes the queue and decimation policy of a branch. This can be done
+ * while the pipeline is running. The threading policy can't be changed once
+ * a branch is added.
+ */
+void
+aperture_pipeline_tee_set_branch_policy (AperturePipelineTee *self,
+                                         GstElement *branch,
+                                         const AperturePipelineTeeBranchPolicy *policy)
+{
+  TeeBranch *data;
+
+  g_return_if_fail (APERTURE_IS_PIPELINE_TEE (self));
+  g_return_if_fail (policy != NULL);
+
+  data = lookup_branch (self, branch);
+  g_return_if_fail (data != NULL);
+  g_return_if_fail (policy->threading == data->threading);
+
+  apply_queue_policy (data, policy);
+  apply_decimation_policy (data, policy);
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_tee_set_shared_policy:
+ * @self: an #AperturePipelineTee
+ * @policy: the new queue policy
+ *
+ * Changes the queue policy of the worker that runs all
+ * %APERTURE_PIPELINE_TEE_THREADING_SHARED branches. Only the queue fields of
+ * @policy are used. By default, the shared worker keeps at most two frames
+ * and drops the oldest.
+ *
+ * Does nothing if no shared branch has been added yet.
+ */
+void
+aperture_pipeline_tee_set_shared_policy (AperturePipelineTee *self,
+                                         const AperturePipelineTeeBranchPolicy *policy)
+{
+  g_return_if_fail (APERTURE_IS_PIPELINE_TEE (self));
+  g_return_if_fail (policy != NULL);
+
+  if (self->shared != NULL) {
+    apply_queue_policy (self->shared, policy);
+  }
+}
+
+
+/**
+ * PRIVATE:aperture_pipeline_tee_get_branch_stats:
+ * @self: an #AperturePipelineTee
+ * @branch: a branch of the tee
+ * @stats: (out caller-allocates): return location for the statistics
+ *
+ * Gets the current fill level of a branch's queue, and how often it has
+ * overflowed since the branch was added. For branches that drop buffers,
+ * @stats->dropped counts the buffers that never reached the branch.
+ * @stats->decimated counts the frames skipped because of the branch's
+ * decimation settings.
+ *
+ * Shared branches report the level and counters of the shared worker's
+ * queue. Inline branches have no queue, so only @stats->decimated is
+ * meaningful for them.
+ */
+void
+aperture_pipeline_tee_get_branch_stats (AperturePipelineTee *self,
+                                        GstElement *branch,
+                                        AperturePipelineTeeBranchStats *stats)
+{
+  TeeBranch *data;
+
+  g_return_if_fail (APERTURE_IS_PIPELINE_TEE (self));
+  g_return_if_fail (stats != NULL);
+
+  data = lookup_branch (self, branch);
+  g_return_if_fail (data != NULL);
+
+  g_mutex_lock (&self->lock);
+  stats->decimated = data->decimated;
+  g_mutex_unlock (&self->lock);
+
+  if (data->threading == APERTURE_PIPELINE_TEE_THREADING_SHARED) {
+    data = self->shared;
+  } else if (data->threading == APERTURE_PIPELINE_TEE_THREADING_INLINE) {
+    stats->level_buffers = 0;
+    stats->level_bytes = 0;
+    stats->level_time = 0;
+    stats->overruns = 0;
+    stats->dropped = 0;
+    return;
+  }
+
+  g_object_get (data->queue,
+                "current-level-buffers", &stats->level_buffers,
+                "current-level-bytes", &stats->level_bytes,
+                "current-level-time", &stats->level_time,
+                NULL);
+
+  stats->overruns = (guint) g_atomic_int_get (&data->overruns);
+  stats->dropped = (guint) g_atomic_int_get (&data->dropped);
 }
@@ -28,14 +28,82 @@
 G_BEGIN_DECLS
 
 
+typedef enum {
+  APERTURE_PIPELINE_TEE_DROP_NONE,
+  APERTURE_PIPELINE_TEE_DROP_NEWEST,
+  APERTURE_PIPELINE_TEE_DROP_OLDEST,
+} AperturePipelineTeeDropPolicy;
+
+typedef enum {
+  APERTURE_PIPELINE_TEE_THREADING_DEDICATED,
+  APERTURE_PIPELINE_TEE_THREADING_SHARED,
+  APERTURE_PIPELINE_TEE_THREADING_INLINE,
+} AperturePipelineTeeThreading;
+
+typedef struct {
+  AperturePipelineTeeThreading threading;
+
+  AperturePipelineTeeDropPolicy drop_policy;
+  guint max_buffers;
+  guint max_bytes;
+  GstClockTime max_time;
+
+  guint every_nth_frame;
+  GstClockTime min_frame_interval;
+} AperturePipelineTeeBranchPolicy;
+
+typedef struct {
+  guint level_buffers;
+  guint level_bytes;
+  GstClockTime level_time;
+  guint overruns;
+  guint dropped;
+  guint decimated;
+} AperturePipelineTeeBranchStats;
+
+/* A thread per branch, the same limits as a default GstQueue, and no
+ * decimation */
+#define APERTURE_PIPELINE_TEE_BRANCH_POLICY_INIT \
+  { APERTURE_PIPELINE_TEE_THREADING_DEDICATED, \
+    APERTURE_PIPELINE_TEE_DROP_NONE, 200, 10 * 1024 * 1024, GST_SECOND, \
+    0, 0 }
+
+
+typedef struct _AperturePipelineTeeTransaction AperturePipelineTeeTransaction;
+
+
 #define APERTURE_TYPE_PIPELINE_TEE (aperture_pipeline_tee_get_type())
 G_DECLARE_FINAL_TYPE (AperturePipelineTee, aperture_pipeline_tee, APERTURE, PIPELINE_TEE, GstBin)
 
 
 AperturePipelineTee *aperture_pipeline_tee_new ();
 
-void aperture_pipeline_tee_add_branch (AperturePipelineTee *self, GstElement *branch);
-void aperture_pipeline_tee_remove_branch (AperturePipelineTee *self, GstElement *branch);
+void aperture_pipeline_tee_add_branch        (AperturePipelineTee                   *self,
+                                              GstElement                            *branch);
+void aperture_pipeline_tee_add_branch_full   (AperturePipelineTee                   *self,
+                                              GstElement                            *branch,
+                                              const AperturePipelineTeeBranchPolicy *policy);
+void aperture_pipeline_tee_remove_branch     (AperturePipelineTee                   *self,
+                                              GstElement                            *branch);
+
+void aperture_pipeline_tee_set_branch_policy (AperturePipelineTee                   *self,
+                                              GstElement                            *branch,
+                                              const AperturePipelineTeeBranchPolicy *policy);
+void aperture_pipeline_tee_get_branch_stats  (AperturePipelineTee                   *self,
+                                              GstElement                            *branch,
+                                              AperturePipelineTeeBranchStats        *stats);
+void aperture_pipeline_tee_set_shared_policy (AperturePipelineTee                   *self,
+                                              const AperturePipelineTeeBranchPolicy *policy);
+GstClockTime aperture_pipeline_tee_get_last_stall (AperturePipelineTee *self);
+
+AperturePipelineTeeTransaction *aperture_pipeline_tee_begin (AperturePipelineTee *self);
+void aperture_pipeline_tee_transaction_add_branch    (AperturePipelineTeeTransaction        *transaction,
+                                                      GstElement                            *branch,
+                                                      const AperturePipelineTeeBranchPolicy *policy);
+void aperture_pipeline_tee_transaction_remove_branch (AperturePipelineTeeTransaction        *transaction,
+                                                      GstElement                            *branch);
+void aperture_pipeline_tee_commit                    (AperturePipelineTeeTransaction        *transaction);
+void aperture_pipeline_tee_abort                     (AperturePipelineTeeTransaction        *transaction);
 
 
 G_END_DECLS
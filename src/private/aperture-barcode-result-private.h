@@ -0,0 +1,42 @@
+/* aperture-barcode-result-private.h
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#pragma once
+
+#include "aperture-barcode-result.h"
+
+
+G_BEGIN_DECLS
+
+
+ApertureBarcodeResult *aperture_barcode_result_new         (ApertureBarcode        barcode_type,
+                                                            const char            *data,
+                                                            int                    quality,
+                                                            GstClockTime           timestamp);
+ApertureBarcodeResult *aperture_barcode_result_copy        (ApertureBarcodeResult *self);
+void                   aperture_barcode_result_set_polygon (ApertureBarcodeResult *self,
+                                                            const GdkPoint        *points,
+                                                            guint                  n_points);
+void                   aperture_barcode_result_set_latency (ApertureBarcodeResult *self,
+                                                            GstClockTime           latency);
+
+
+G_END_DECLS
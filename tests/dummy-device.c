@@ -19,6 +19,8 @@
  */
 
 
+#include <math.h>
+#include <string.h>
 #include <gtk/gtk.h>
 #include <gst/app/app.h>
 
@@ -30,6 +32,8 @@ struct _DummyDevice
   GstDevice parent_instance;
 
   gchar *image;
+  gboolean has_motion;
+  DummyDeviceMotion motion;
 };
 
 G_DEFINE_TYPE (DummyDevice, dummy_device, GST_TYPE_DEVICE)
@@ -83,6 +87,197 @@ create_image_source (const gchar *image)
 }
 
 
+/* A source of GRAY8 frames in which the image moves across the frame,
+ * turned and blurred, for testing how well barcodes are detected in
+ * something more like real video. */
+
+#define MOTION_WIDTH 1280
+#define MOTION_HEIGHT 720
+#define MOTION_FPS 30
+/* the light gray of a desk or a wall */
+#define MOTION_BACKGROUND 0xd0
+
+typedef struct {
+  DummyDeviceMotion motion;
+  /* the image, motion.size pixels square, one byte per pixel */
+  guint8 *image;
+  guint64 n_frames;
+} MotionSource;
+
+
+static void
+motion_source_free (MotionSource *source)
+{
+  g_free (source->image);
+  g_free (source);
+}
+
+
+/* Box blurs one line of @len pixels, @step bytes apart, @radius pixels to
+ * each side. Pixels past the ends of the line are left out. */
+static void
+blur_line (guint8 *line, int len, int step, int radius, guint *prefix)
+{
+  int i;
+
+  prefix[0] = 0;
+  for (i = 0; i < len; i ++) {
+    prefix[i + 1] = prefix[i] + line[i * step];
+  }
+
+  for (i = 0; i < len; i ++) {
+    int lo = MAX (i - radius, 0);
+    int hi = MIN (i + radius + 1, len);
+
+    line[i * step] = (prefix[hi] - prefix[lo]) / (hi - lo);
+  }
+}
+
+
+static void
+blur_rect (guint8 *frame, int x0, int y0, int x1, int y1, int rx, int ry)
+{
+  g_autofree guint *prefix = g_new (guint, MAX (x1 - x0, y1 - y0) + 1);
+  int x, y;
+
+  if (rx > 0) {
+    for (y = y0; y < y1; y ++) {
+      blur_line (frame + y * MOTION_WIDTH + x0, x1 - x0, 1, rx, prefix);
+    }
+  }
+
+  if (ry > 0) {
+    for (x = x0; x < x1; x ++) {
+      blur_line (frame + y0 * MOTION_WIDTH + x, y1 - y0, MOTION_WIDTH, ry, prefix);
+    }
+  }
+}
+
+
+static void
+render_motion_frame (MotionSource *source, guint8 *frame)
+{
+  const DummyDeviceMotion *motion = &source->motion;
+  const int size = motion->size;
+  /* the code fits in this square however it is turned */
+  const int extent = ceil (size * G_SQRT2);
+  double t = (double) source->n_frames / MOTION_FPS;
+  double ca = cos (motion->rotation * G_PI / 180);
+  double sa = sin (motion->rotation * G_PI / 180);
+  double travel = MAX (MOTION_WIDTH - extent, 0);
+  double pos, cx, cy;
+  /* things moving during the exposure, which is about half of a frame */
+  int smear = motion->speed / MOTION_FPS / 4;
+  int x0, y0, x1, y1;
+  int x, y;
+
+  /* back and forth across the frame */
+  pos = travel > 0 ? fmod (motion->speed * t, 2 * travel) : 0;
+  if (pos > travel) {
+    pos = 2 * travel - pos;
+  }
+  cx = extent / 2.0 + pos;
+  cy = MOTION_HEIGHT / 2.0;
+
+  memset (frame, MOTION_BACKGROUND, MOTION_WIDTH * MOTION_HEIGHT);
+
+  x0 = MAX (cx - extent / 2.0, 0);
+  y0 = MAX (cy - extent / 2.0, 0);
+  x1 = MIN (cx + extent / 2.0, MOTION_WIDTH);
+  y1 = MIN (cy + extent / 2.0, MOTION_HEIGHT);
+
+  for (y = y0; y < y1; y ++) {
+    for (x = x0; x < x1; x ++) {
+      double dx = x + 0.5 - cx;
+      double dy = y + 0.5 - cy;
+      int u = floor (ca * dx + sa * dy + size / 2.0);
+      int v = floor (-sa * dx + ca * dy + size / 2.0);
+
+      if (u >= 0 && u < size && v >= 0 && v < size) {
+        frame[y * MOTION_WIDTH + x] = source->image[v * size + u];
+      }
+    }
+  }
+
+  x0 = MAX (x0 - motion->blur - smear, 0);
+  y0 = MAX (y0 - motion->blur, 0);
+  x1 = MIN (x1 + motion->blur + smear, MOTION_WIDTH);
+  y1 = MIN (y1 + motion->blur, MOTION_HEIGHT);
+  blur_rect (frame, x0, y0, x1, y1, motion->blur + smear, motion->blur);
+}
+
+
+static void
+motion_need_data_cb (GstAppSrc *appsrc, guint length, gpointer user_data)
+{
+  MotionSource *source = user_data;
+  GstBuffer *buffer = gst_buffer_new_allocate (NULL, MOTION_WIDTH * MOTION_HEIGHT, NULL);
+  GstMapInfo map;
+
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  render_motion_frame (source, map.data);
+  gst_buffer_unmap (buffer, &map);
+
+  GST_BUFFER_PTS (buffer) = gst_util_uint64_scale (source->n_frames, GST_SECOND, MOTION_FPS);
+  GST_BUFFER_DURATION (buffer) = gst_util_uint64_scale (1, GST_SECOND, MOTION_FPS);
+  source->n_frames ++;
+
+  gst_app_src_push_buffer (appsrc, buffer);
+}
+
+
+static GstElement *
+create_motion_source (const gchar *image, const DummyDeviceMotion *motion)
+{
+  static GstAppSrcCallbacks callbacks = { motion_need_data_cb, NULL, NULL };
+  g_autoptr(GdkPixbuf) pixbuf = NULL;
+  g_autoptr(GdkPixbuf) scaled = NULL;
+  g_autoptr(GstCaps) caps = NULL;
+  GError *error = NULL;
+  MotionSource *source;
+  GstElement *appsrc;
+  const guint8 *pixels;
+  int rowstride, n_channels;
+  int x, y;
+
+  g_assert_cmpint (motion->size, >, 0);
+
+  pixbuf = gdk_pixbuf_new_from_resource (image, &error);
+  g_assert_no_error (error);
+  /* nearest neighbour, to keep the edges of the code sharp */
+  scaled = gdk_pixbuf_scale_simple (pixbuf, motion->size, motion->size, GDK_INTERP_NEAREST);
+  pixels = gdk_pixbuf_read_pixels (scaled);
+  rowstride = gdk_pixbuf_get_rowstride (scaled);
+  n_channels = gdk_pixbuf_get_n_channels (scaled);
+
+  source = g_new0 (MotionSource, 1);
+  source->motion = *motion;
+  source->image = g_malloc (motion->size * motion->size);
+  for (y = 0; y < motion->size; y ++) {
+    for (x = 0; x < motion->size; x ++) {
+      const guint8 *p = pixels + y * rowstride + x * n_channels;
+      source->image[y * motion->size + x] = (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+    }
+  }
+
+  caps = gst_caps_new_simple ("video/x-raw",
+                              "format", G_TYPE_STRING, "GRAY8",
+                              "width", G_TYPE_INT, MOTION_WIDTH,
+                              "height", G_TYPE_INT, MOTION_HEIGHT,
+                              "framerate", GST_TYPE_FRACTION, MOTION_FPS, 1,
+                              NULL);
+
+  appsrc = gst_element_factory_make ("appsrc", NULL);
+  g_object_set (appsrc,
+                "caps", caps,
+                "format", GST_FORMAT_TIME,
+                NULL);
+  gst_app_src_set_callbacks (GST_APP_SRC (appsrc), &callbacks, source, (GDestroyNotify) motion_source_free);
+
+  return appsrc;
+}
+
+
 /* VFUNCS */
 
 
@@ -141,7 +336,9 @@ dummy_device_create_element (GstDevice *device, const char *name)
   g_return_val_if_fail (DUMMY_IS_DEVICE (device), NULL);
   self = DUMMY_DEVICE (device);
 
-  if (self->image) {
+  if (self->image && self->has_motion) {
+    return create_motion_source (self->image, &self->motion);
+  } else if (self->image) {
     return create_image_source (self->image);
   } else {
     element = gst_element_factory_make ("videotestsrc", NULL);
@@ -219,3 +416,24 @@ dummy_device_set_image (DummyDevice *self, const char *image)
   g_clear_pointer (&self->image, g_free);
   self->image = g_strdup (image);
 }
+
+
+/**
+ * PRIVATE:dummy_device_set_motion:
+ * @self: a #DummyDevice
+ * @motion: (nullable): how the image moves, or %NULL for a still image
+ *
+ * Makes the device's image move across a larger frame, rather than fill
+ * the whole frame and stand still. This only has an effect if an image is
+ * set, and only on elements created afterwards.
+ */
+void
+dummy_device_set_motion (DummyDevice *self, const DummyDeviceMotion *motion)
+{
+  g_return_if_fail (DUMMY_IS_DEVICE (self));
+
+  self->has_motion = motion != NULL;
+  if (motion != NULL) {
+    self->motion = *motion;
+  }
+}
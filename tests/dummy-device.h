@@ -27,15 +27,30 @@
 G_BEGIN_DECLS
 
 
+/* How the code in a moving dummy device's picture moves */
+typedef struct {
+  /* width of the code, in pixels of the frame */
+  int size;
+  /* radius of the box blur over the code, in pixels */
+  int blur;
+  /* how far the code is turned, in degrees */
+  double rotation;
+  /* how fast the code moves across the frame, in pixels per second */
+  double speed;
+} DummyDeviceMotion;
+
+
 #define DUMMY_TYPE_DEVICE (dummy_device_get_type())
 
 G_DECLARE_FINAL_TYPE (DummyDevice, dummy_device, DUMMY, DEVICE, GstDevice)
 
 
-DummyDevice *dummy_device_new       (void);
+DummyDevice *dummy_device_new        (void);
 
-const char  *dummy_device_get_image (DummyDevice *self);
-void         dummy_device_set_image (DummyDevice *self,
-                                     const char  *image);
+const char  *dummy_device_get_image  (DummyDevice             *self);
+void         dummy_device_set_image  (DummyDevice             *self,
+                                      const char              *image);
+void         dummy_device_set_motion (DummyDevice             *self,
+                                      const DummyDeviceMotion *motion);
 
 G_END_DECLS
@@ -29,6 +29,11 @@
 void add_barcodes_tests (void);
 void add_camera_tests (void);
 void add_device_manager_tests (void);
+void add_pipeline_encoder_tests (void);
+void add_pipeline_preroll_tests (void);
+void add_pipeline_proxy_tests (void);
+void add_pipeline_recorder_tests (void);
+void add_pipeline_tee_tests (void);
 void add_viewfinder_tests (void);
 
 
@@ -45,6 +50,11 @@ main (int argc, char **argv)
   add_barcodes_tests ();
   add_camera_tests ();
   add_device_manager_tests ();
+  add_pipeline_encoder_tests ();
+  add_pipeline_preroll_tests ();
+  add_pipeline_proxy_tests ();
+  add_pipeline_recorder_tests ();
+  add_pipeline_tee_tests ();
   add_viewfinder_tests ();
 
   return g_test_run ();
@@ -21,7 +21,14 @@
 
 #include <glib.h>
 #include <aperture.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/resource.h>
 
+#include "barcode/aperture-barcode-decoder.h"
+#include "barcode/aperture-barcode-tracker.h"
+#include "pipeline/aperture-pipeline-barcode.h"
+#include "private/aperture-barcode-result-private.h"
 #include "utils.h"
 #include "dummy-device-provider.h"
 
@@ -33,6 +40,9 @@ test_barcodes_enum ()
   g_assert_cmpint (aperture_barcode_type_from_string ("DataBar"), ==, APERTURE_BARCODE_DATABAR);
   g_assert_cmpint (aperture_barcode_type_from_string ("QR-Code"), ==, APERTURE_BARCODE_QR);
   g_assert_cmpint (aperture_barcode_type_from_string ("I2/5"), ==, APERTURE_BARCODE_I25);
+  g_assert_cmpint (aperture_barcode_type_from_string ("ISBN-10"), ==, APERTURE_BARCODE_ISBN10);
+  g_assert_cmpint (aperture_barcode_type_from_string ("ISBN-13"), ==, APERTURE_BARCODE_ISBN13);
+  g_assert_cmpint (aperture_barcode_type_from_string (NULL), ==, APERTURE_BARCODE_UNKNOWN);
   g_assert_cmpint (aperture_barcode_type_from_string ("three zebras walking into a bar"), ==, APERTURE_BARCODE_UNKNOWN);
 }
 
@@ -105,10 +115,1511 @@ test_barcodes_detection ()
 }
 
 
+static void
+test_barcodes_result ()
+{
+  g_autoptr(ApertureBarcodeResult) result = NULL;
+  g_autoptr(ApertureBarcodeResult) copy = NULL;
+  const GdkPoint points[] = { { 10, 20 }, { 50, 18 }, { 52, 60 }, { 8, 58 } };
+  const GdkPoint *polygon;
+  GdkRectangle box;
+  guint n_points;
+
+  result = aperture_barcode_result_new (APERTURE_BARCODE_QR, "hello world", 1, 5 * GST_SECOND);
+
+  g_assert_cmpint (aperture_barcode_result_get_barcode_type (result), ==, APERTURE_BARCODE_QR);
+  g_assert_cmpstr (aperture_barcode_result_get_data (result), ==, "hello world");
+  g_assert_cmpint (aperture_barcode_result_get_quality (result), ==, 1);
+  g_assert_cmpuint (aperture_barcode_result_get_timestamp (result), ==, 5 * GST_SECOND);
+  g_assert_cmpuint (aperture_barcode_result_get_latency (result), ==, GST_CLOCK_TIME_NONE);
+
+  /* no position yet */
+  g_assert_false (aperture_barcode_result_get_bounding_box (result, &box));
+  g_assert_null (aperture_barcode_result_get_polygon (result, &n_points));
+  g_assert_cmpuint (n_points, ==, 0);
+
+  aperture_barcode_result_set_polygon (result, points, G_N_ELEMENTS (points));
+
+  polygon = aperture_barcode_result_get_polygon (result, &n_points);
+  g_assert_cmpuint (n_points, ==, 4);
+  g_assert_cmpint (polygon[2].x, ==, 52);
+
+  g_assert_true (aperture_barcode_result_get_bounding_box (result, &box));
+  g_assert_cmpint (box.x, ==, 8);
+  g_assert_cmpint (box.y, ==, 18);
+  g_assert_cmpint (box.width, ==, 45);
+  g_assert_cmpint (box.height, ==, 43);
+
+  /* a copy can be changed without touching the original */
+  copy = aperture_barcode_result_copy (result);
+  aperture_barcode_result_set_latency (copy, GST_MSECOND);
+  aperture_barcode_result_set_polygon (copy, points, 2);
+  g_assert_cmpstr (aperture_barcode_result_get_data (copy), ==, "hello world");
+  g_assert_cmpuint (aperture_barcode_result_get_latency (copy), ==, GST_MSECOND);
+  g_assert_cmpuint (aperture_barcode_result_get_latency (result), ==, GST_CLOCK_TIME_NONE);
+  aperture_barcode_result_get_polygon (result, &n_points);
+  g_assert_cmpuint (n_points, ==, 4);
+}
+
+
+static void
+barcodes_detected_cb (TestUtilsCallback *cb, GPtrArray *results)
+{
+  ApertureBarcodeResult *result;
+  GdkRectangle box;
+
+  g_assert_cmpuint (results->len, ==, 1);
+  result = g_ptr_array_index (results, 0);
+
+  g_assert_cmpint (aperture_barcode_result_get_barcode_type (result), ==, APERTURE_BARCODE_QR);
+  g_assert_cmpstr (aperture_barcode_result_get_data (result), ==, "hello world");
+  g_assert_true (GST_CLOCK_TIME_IS_VALID (aperture_barcode_result_get_timestamp (result)));
+  g_assert_true (GST_CLOCK_TIME_IS_VALID (aperture_barcode_result_get_latency (result)));
+
+  /* not every decoder knows positions, but if they are there they must be
+   * inside the 100x100 test image */
+  if (aperture_barcode_result_get_bounding_box (result, &box)) {
+    g_assert_cmpint (box.x, >=, 0);
+    g_assert_cmpint (box.y, >=, 0);
+    g_assert_cmpint (box.x + box.width, <=, 100);
+    g_assert_cmpint (box.y + box.height, <=, 100);
+  }
+
+  testutils_callback_call (cb);
+}
+
+
+static void
+test_barcodes_batched ()
+{
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  ApertureViewfinder *viewfinder;
+  GtkWidget *window;
+  TestUtilsCallback detected_callback;
+  DummyDevice *device;
+
+#ifdef BARCODE_TESTS_SKIPPABLE
+  if (!aperture_is_barcode_detection_enabled ()) {
+    g_test_skip ("Skipping test that requires barcode detection, because it is not available");
+    return;
+  }
+#endif
+
+  testutils_callback_init (&detected_callback);
+
+  device = dummy_device_provider_add (provider);
+  dummy_device_set_image (device, "/aperture/helloworld.png");
+
+  viewfinder = aperture_viewfinder_new ();
+  g_signal_connect_swapped (viewfinder, "barcodes-detected", G_CALLBACK (barcodes_detected_cb), &detected_callback);
+  aperture_viewfinder_set_detect_barcodes (viewfinder, TRUE);
+
+  window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET (viewfinder));
+  gtk_widget_show_all (window);
+
+  testutils_callback_assert_called (&detected_callback, 1000);
+
+  gtk_widget_destroy (window);
+}
+
+
+/* Renders the test code at 320x320 in the middle of a larger, camera-sized
+ * frame, and feeds it to @barcode */
+static GstElement *
+create_barcode_pipeline (DummyDevice *device, AperturePipelineBarcode *barcode)
+{
+  GstElement *pipeline = gst_pipeline_new (NULL);
+  g_autoptr(GstCaps) caps = NULL;
+  GstElement *src;
+  GstElement *videoconvert;
+  GstElement *videoscale;
+  GstElement *capsfilter;
+  GstElement *videobox;
+
+  src = gst_device_create_element (GST_DEVICE (device), NULL);
+  videoconvert = gst_element_factory_make ("videoconvert", NULL);
+  videoscale = gst_element_factory_make ("videoscale", NULL);
+  capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  videobox = gst_element_factory_make ("videobox", NULL);
+
+  caps = gst_caps_from_string ("video/x-raw, format=I420, width=320, height=320");
+  g_object_set (capsfilter, "caps", caps, NULL);
+  /* nearest neighbour, to keep the edges of the code sharp */
+  g_object_set (videoscale, "method", 0, NULL);
+  /* pad to 1280x960 with white */
+  g_object_set (videobox,
+                "left", -480, "right", -480,
+                "top", -320, "bottom", -320,
+                "fill", 5,
+                NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), src, videoconvert, videoscale,
+                    capsfilter, videobox, GST_ELEMENT (barcode), NULL);
+  gst_element_link_many (src, videoconvert, videoscale, capsfilter, videobox,
+                         GST_ELEMENT (barcode), NULL);
+
+  return pipeline;
+}
+
+
+static GstPadProbeReturn
+count_buffer_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  g_atomic_int_inc ((int *) user_data);
+  return GST_PAD_PROBE_OK;
+}
+
+
+static int
+count_barcode_messages (GstElement *pipeline)
+{
+  g_autoptr(GstBus) bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  GstMessage *message;
+  int count = 0;
+
+  while ((message = gst_bus_pop_filtered (bus, GST_MESSAGE_ELEMENT))) {
+    if (gst_message_has_name (message, "barcodes")) {
+      count ++;
+    }
+    gst_message_unref (message);
+  }
+
+  return count;
+}
+
+
+static void
+test_barcodes_branch ()
+{
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  g_autoptr(GstElement) pipeline = NULL;
+  g_autoptr(GstBus) bus = NULL;
+  g_autoptr(GstMessage) message = NULL;
+  AperturePipelineBarcode *barcode;
+  GstVideoRectangle roi = { 400, 240, 480, 480 };
+  GstVideoRectangle roi_out;
+  const GstStructure *structure;
+  g_autoptr(GPtrArray) results = NULL;
+  DummyDevice *device;
+
+#ifdef BARCODE_TESTS_SKIPPABLE
+  if (!aperture_is_barcode_detection_enabled ()) {
+    g_test_skip ("Skipping test that requires barcode detection, because it is not available");
+    return;
+  }
+#endif
+
+  device = dummy_device_provider_add (provider);
+  dummy_device_set_image (device, "/aperture/helloworld.png");
+
+  barcode = aperture_pipeline_barcode_new ();
+  aperture_pipeline_barcode_set_roi (barcode, &roi);
+  aperture_pipeline_barcode_set_scale (barcode, 0.5);
+
+  g_assert_true (aperture_pipeline_barcode_get_roi (barcode, &roi_out));
+  g_assert_cmpint (roi_out.x, ==, roi.x);
+  g_assert_cmpint (roi_out.w, ==, roi.w);
+  g_assert_cmpfloat (aperture_pipeline_barcode_get_scale (barcode), ==, 0.5);
+
+  pipeline = create_barcode_pipeline (device, barcode);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  do {
+    g_clear_pointer (&message, gst_message_unref);
+    message = gst_bus_timed_pop_filtered (bus, 5 * GST_SECOND, GST_MESSAGE_ELEMENT | GST_MESSAGE_ERROR);
+    g_assert_nonnull (message);
+    g_assert_cmpint (GST_MESSAGE_TYPE (message), !=, GST_MESSAGE_ERROR);
+  } while (!gst_message_has_name (message, "barcodes"));
+
+  structure = gst_message_get_structure (message);
+  g_assert_true (gst_structure_get (structure, "results", G_TYPE_PTR_ARRAY, &results, NULL));
+  g_assert_cmpuint (results->len, ==, 1);
+  g_assert_cmpstr (aperture_barcode_result_get_data (g_ptr_array_index (results, 0)), ==, "hello world");
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  dummy_device_provider_remove (provider);
+}
+
+
+#define BARCODE_PERF_SECONDS 2
+
+static void
+run_barcode_branch_perf (DummyDevice *device, const char *name, const GstVideoRectangle *roi, double scale)
+{
+  g_autoptr(GstElement) pipeline = NULL;
+  g_autoptr(GstPad) pad = NULL;
+  AperturePipelineBarcode *barcode;
+  struct rusage before, after;
+  int frames = 0;
+  int detected;
+  double cpu;
+
+  barcode = aperture_pipeline_barcode_new ();
+  aperture_pipeline_barcode_set_roi (barcode, roi);
+  aperture_pipeline_barcode_set_scale (barcode, scale);
+  /* the test frames are all identical; scan them anyway */
+  aperture_pipeline_barcode_set_idle_interval (barcode, 0);
+
+  pad = gst_element_get_static_pad (GST_ELEMENT (barcode), "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, count_buffer_cb, &frames, NULL);
+
+  pipeline = create_barcode_pipeline (device, barcode);
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+  getrusage (RUSAGE_SELF, &before);
+  g_atomic_int_set (&frames, 0);
+
+  /* The sink does not sync to the clock, so the branch runs as fast as it
+   * can and the frame count measures its throughput */
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_usleep (BARCODE_PERF_SECONDS * G_USEC_PER_SEC);
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+
+  getrusage (RUSAGE_SELF, &after);
+
+  cpu = (after.ru_utime.tv_sec - before.ru_utime.tv_sec)
+      + (after.ru_stime.tv_sec - before.ru_stime.tv_sec)
+      + (after.ru_utime.tv_usec - before.ru_utime.tv_usec) / 1e6
+      + (after.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1e6;
+
+  detected = count_barcode_messages (pipeline);
+
+  g_assert_cmpint (frames, >, 0);
+  g_test_message ("%-16s %5.1f frames/s, %6.2f ms CPU per frame, %s",
+                  name,
+                  (double) frames / BARCODE_PERF_SECONDS,
+                  cpu * 1000 / frames,
+                  detected > 0 ? "detected" : "NOT detected");
+  g_test_minimized_result (cpu / frames, "%s: %.2f ms CPU per frame", name, cpu * 1000 / frames);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+}
+
+
+static void
+test_barcodes_branch_perf ()
+{
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  GstVideoRectangle roi = { 400, 240, 480, 480 };
+  DummyDevice *device;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Performance tests are only run with -m perf");
+    return;
+  }
+
+#ifdef BARCODE_TESTS_SKIPPABLE
+  if (!aperture_is_barcode_detection_enabled ()) {
+    g_test_skip ("Skipping test that requires barcode detection, because it is not available");
+    return;
+  }
+#endif
+
+  device = dummy_device_provider_add (provider);
+  dummy_device_set_image (device, "/aperture/helloworld.png");
+
+  run_barcode_branch_perf (device, "full frame", NULL, 1.0);
+  run_barcode_branch_perf (device, "full frame, 1/2", NULL, 0.5);
+  run_barcode_branch_perf (device, "full frame, 1/4", NULL, 0.25);
+  run_barcode_branch_perf (device, "ROI", &roi, 1.0);
+  run_barcode_branch_perf (device, "ROI, 1/2", &roi, 0.5);
+
+  dummy_device_provider_remove (provider);
+}
+
+
+static void
+run_scheduler (DummyDevice *device, guint idle_interval, gint64 duration, AperturePipelineBarcodeStats *stats)
+{
+  g_autoptr(GstElement) pipeline = NULL;
+  AperturePipelineBarcode *barcode;
+
+  barcode = aperture_pipeline_barcode_new ();
+  aperture_pipeline_barcode_set_idle_interval (barcode, idle_interval);
+
+  pipeline = create_barcode_pipeline (device, barcode);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_usleep (duration);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  aperture_pipeline_barcode_get_stats (barcode, stats);
+}
+
+
+static void
+test_barcodes_scheduler ()
+{
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  AperturePipelineBarcodeStats stats;
+  DummyDevice *device;
+
+  g_test_summary ("Test that identical frames are only scanned once");
+
+#ifdef BARCODE_TESTS_SKIPPABLE
+  if (!aperture_is_barcode_detection_enabled ()) {
+    g_test_skip ("Skipping test that requires barcode detection, because it is not available");
+    return;
+  }
+#endif
+
+  device = dummy_device_provider_add (provider);
+  dummy_device_set_image (device, "/aperture/helloworld.png");
+
+  run_scheduler (device, 5, G_USEC_PER_SEC / 2, &stats);
+
+  g_assert_cmpuint (stats.frames, >, 1);
+  g_assert_cmpuint (stats.scanned, ==, 1);
+  g_assert_cmpuint (stats.skipped_identical, ==, stats.frames - 1);
+  g_assert_cmpuint (stats.detections, ==, 1);
+  g_assert_cmpuint (stats.last_latency, >, 0);
+
+  dummy_device_provider_remove (provider);
+}
+
+
+static void
+test_barcodes_scheduler_perf ()
+{
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  AperturePipelineBarcodeStats fixed, adaptive;
+  DummyDevice *device;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Performance tests are only run with -m perf");
+    return;
+  }
+
+#ifdef BARCODE_TESTS_SKIPPABLE
+  if (!aperture_is_barcode_detection_enabled ()) {
+    g_test_skip ("Skipping test that requires barcode detection, because it is not available");
+    return;
+  }
+#endif
+
+  device = dummy_device_provider_add (provider);
+  dummy_device_set_image (device, "/aperture/helloworld.png");
+
+  run_scheduler (device, 0, BARCODE_PERF_SECONDS * G_USEC_PER_SEC, &fixed);
+  run_scheduler (device, 5, BARCODE_PERF_SECONDS * G_USEC_PER_SEC, &adaptive);
+
+  g_test_message ("every frame: %6.1f scans/s, latency %" GST_TIME_FORMAT,
+                  (double) fixed.scanned / BARCODE_PERF_SECONDS,
+                  GST_TIME_ARGS (fixed.last_latency));
+  g_test_message ("adaptive:    %6.1f scans/s, latency %" GST_TIME_FORMAT
+                  " (%u identical and %u idle frames skipped)",
+                  (double) adaptive.scanned / BARCODE_PERF_SECONDS,
+                  GST_TIME_ARGS (adaptive.last_latency),
+                  adaptive.skipped_identical, adaptive.skipped_idle);
+  g_test_minimized_result ((double) adaptive.scanned / BARCODE_PERF_SECONDS,
+                           "Adaptive scans per second: %.1f",
+                           (double) adaptive.scanned / BARCODE_PERF_SECONDS);
+  g_test_minimized_result ((double) adaptive.last_latency / GST_SECOND,
+                           "Adaptive detection latency: %" GST_TIME_FORMAT,
+                           GST_TIME_ARGS (adaptive.last_latency));
+
+  dummy_device_provider_remove (provider);
+}
+
+
+static void
+run_threads (DummyDevice *device, guint n_threads, gint64 duration, AperturePipelineBarcodeStats *stats)
+{
+  g_autoptr(GstElement) pipeline = NULL;
+  AperturePipelineBarcode *barcode;
+
+  barcode = aperture_pipeline_barcode_new ();
+  aperture_pipeline_barcode_set_n_threads (barcode, n_threads);
+  /* offer every frame, so the decoders are always busy */
+  aperture_pipeline_barcode_set_idle_interval (barcode, 0);
+
+  pipeline = create_barcode_pipeline (device, barcode);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_usleep (duration);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  aperture_pipeline_barcode_get_stats (barcode, stats);
+}
+
+
+static void
+test_barcodes_threads ()
+{
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  AperturePipelineBarcodeStats stats;
+  DummyDevice *device;
+
+  g_test_summary ("Test that a code seen by several decoder threads is reported once");
+
+#ifdef BARCODE_TESTS_SKIPPABLE
+  if (!aperture_is_barcode_detection_enabled ()) {
+    g_test_skip ("Skipping test that requires barcode detection, because it is not available");
+    return;
+  }
+#endif
+
+  device = dummy_device_provider_add (provider);
+  dummy_device_set_image (device, "/aperture/helloworld.png");
+
+  run_threads (device, 4, G_USEC_PER_SEC / 2, &stats);
+
+  g_assert_cmpuint (stats.decoded, >, 1);
+  g_assert_cmpuint (stats.decoded + stats.dropped, <=, stats.scanned);
+  g_assert_cmpuint (stats.detections, ==, 1);
+
+  dummy_device_provider_remove (provider);
+}
+
+
+static void
+test_barcodes_threads_perf ()
+{
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  const guint n_threads[] = { 1, 2, 4, 8 };
+  double single = 0;
+  DummyDevice *device;
+  guint i;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Performance tests are only run with -m perf");
+    return;
+  }
+
+#ifdef BARCODE_TESTS_SKIPPABLE
+  if (!aperture_is_barcode_detection_enabled ()) {
+    g_test_skip ("Skipping test that requires barcode detection, because it is not available");
+    return;
+  }
+#endif
+
+  device = dummy_device_provider_add (provider);
+  dummy_device_set_image (device, "/aperture/helloworld.png");
+
+  g_test_message ("%u processors available", g_get_num_processors ());
+
+  for (i = 0; i < G_N_ELEMENTS (n_threads); i ++) {
+    AperturePipelineBarcodeStats stats;
+    double rate;
+
+    run_threads (device, n_threads[i], BARCODE_PERF_SECONDS * G_USEC_PER_SEC, &stats);
+    rate = (double) stats.decoded / BARCODE_PERF_SECONDS;
+
+    if (i == 0) {
+      single = rate;
+    }
+
+    g_test_message ("%u threads: %7.1f frames decoded/s (%.2fx), %u dropped",
+                    n_threads[i], rate, single > 0 ? rate / single : 0, stats.dropped);
+    g_test_maximized_result (rate, "%u threads: %.1f frames decoded per second", n_threads[i], rate);
+  }
+
+  dummy_device_provider_remove (provider);
+}
+
+
+static void
+run_types (DummyDevice *device, guint32 barcode_types, gint64 duration, AperturePipelineBarcodeStats *stats)
+{
+  g_autoptr(GstElement) pipeline = NULL;
+  AperturePipelineBarcode *barcode;
+
+  barcode = aperture_pipeline_barcode_new ();
+  aperture_pipeline_barcode_set_n_threads (barcode, 1);
+  aperture_pipeline_barcode_set_idle_interval (barcode, 0);
+  aperture_pipeline_barcode_set_barcode_types (barcode, barcode_types);
+
+  pipeline = create_barcode_pipeline (device, barcode);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_usleep (duration);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  aperture_pipeline_barcode_get_stats (barcode, stats);
+}
+
+
+static void
+test_barcodes_types ()
+{
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  g_autofree ApertureBarcode *types_out = NULL;
+  const ApertureBarcode types[] = { APERTURE_BARCODE_CODE128, APERTURE_BARCODE_QR };
+  ApertureViewfinder *viewfinder;
+  AperturePipelineBarcodeStats stats;
+  DummyDevice *device;
+  guint n_types;
+
+#ifdef BARCODE_TESTS_SKIPPABLE
+  if (!aperture_is_barcode_detection_enabled ()) {
+    g_test_skip ("Skipping test that requires barcode detection, because it is not available");
+    return;
+  }
+#endif
+
+  viewfinder = g_object_ref_sink (aperture_viewfinder_new ());
+
+  g_assert_null (aperture_viewfinder_get_barcode_types (viewfinder, &n_types));
+  g_assert_cmpuint (n_types, ==, 0);
+
+  aperture_viewfinder_set_barcode_types (viewfinder, types, G_N_ELEMENTS (types));
+  types_out = aperture_viewfinder_get_barcode_types (viewfinder, &n_types);
+  g_assert_cmpuint (n_types, ==, 2);
+  g_assert_cmpint (types_out[0], ==, APERTURE_BARCODE_CODE128);
+  g_assert_cmpint (types_out[1], ==, APERTURE_BARCODE_QR);
+
+  g_object_unref (viewfinder);
+
+  device = dummy_device_provider_add (provider);
+  dummy_device_set_image (device, "/aperture/helloworld.png");
+
+  /* the test image is a QR code */
+  run_types (device, 1u << APERTURE_BARCODE_CODE128, G_USEC_PER_SEC / 2, &stats);
+  g_assert_cmpuint (stats.decoded, >, 0);
+  g_assert_cmpuint (stats.detections, ==, 0);
+
+  run_types (device, 1u << APERTURE_BARCODE_QR, G_USEC_PER_SEC / 2, &stats);
+  g_assert_cmpuint (stats.detections, ==, 1);
+
+  dummy_device_provider_remove (provider);
+}
+
+
+static void
+test_barcodes_types_perf ()
+{
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  const struct {
+    const char *name;
+    guint32 types;
+  } profiles[] = {
+    { "all types", 0 },
+    { "QR + CODE-128", (1u << APERTURE_BARCODE_QR) | (1u << APERTURE_BARCODE_CODE128) },
+    { "QR only", 1u << APERTURE_BARCODE_QR },
+    { "EAN/UPC only", (1u << APERTURE_BARCODE_EAN8) | (1u << APERTURE_BARCODE_EAN13)
+                      | (1u << APERTURE_BARCODE_UPCA) | (1u << APERTURE_BARCODE_UPCE) },
+  };
+  DummyDevice *device;
+  guint i;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Performance tests are only run with -m perf");
+    return;
+  }
+
+#ifdef BARCODE_TESTS_SKIPPABLE
+  if (!aperture_is_barcode_detection_enabled ()) {
+    g_test_skip ("Skipping test that requires barcode detection, because it is not available");
+    return;
+  }
+#endif
+
+  device = dummy_device_provider_add (provider);
+  dummy_device_set_image (device, "/aperture/helloworld.png");
+
+  for (i = 0; i < G_N_ELEMENTS (profiles); i ++) {
+    AperturePipelineBarcodeStats stats;
+    double rate;
+
+    run_types (device, profiles[i].types, BARCODE_PERF_SECONDS * G_USEC_PER_SEC, &stats);
+    rate = (double) stats.decoded / BARCODE_PERF_SECONDS;
+
+    g_test_message ("%-14s %7.1f frames decoded/s on one thread", profiles[i].name, rate);
+    g_test_maximized_result (rate, "%s: %.1f frames decoded per second", profiles[i].name, rate);
+  }
+
+  dummy_device_provider_remove (provider);
+}
+
+
+static void
+test_barcodes_tracker ()
+{
+  g_autoptr(ApertureBarcodeTracker) tracker = NULL;
+  g_autoptr(GPtrArray) results = NULL;
+  g_autoptr(GPtrArray) new_results = NULL;
+  g_autoptr(GPtrArray) lost = NULL;
+  g_autofree guint8 *frame = NULL;
+  const GdkPoint points[] = { { 20, 20 }, { 60, 20 }, { 60, 60 }, { 20, 60 } };
+  ApertureBarcodeResult *result;
+  GstVideoInfo info;
+  int x, y;
+
+  g_test_summary ("Test that codes are tracked across frames, and lost when they disappear");
+
+  gst_video_info_set_format (&info, GST_VIDEO_FORMAT_GRAY8, 100, 100);
+  frame = g_malloc0 (GST_VIDEO_INFO_SIZE (&info));
+
+  /* a checkerboard where the code is, and black everywhere else */
+  for (y = 20; y < 60; y ++) {
+    for (x = 20; x < 60; x ++) {
+      frame[y * GST_VIDEO_INFO_PLANE_STRIDE (&info, 0) + x] = ((x / 4 + y / 4) % 2) * 255;
+    }
+  }
+
+  tracker = aperture_barcode_tracker_new (G_USEC_PER_SEC);
+
+  results = g_ptr_array_new_with_free_func ((GDestroyNotify) aperture_barcode_result_unref);
+  result = aperture_barcode_result_new (APERTURE_BARCODE_QR, "hello world", 1, 0);
+  aperture_barcode_result_set_polygon (result, points, G_N_ELEMENTS (points));
+  g_ptr_array_add (results, result);
+
+  /* the first time, the code is new */
+  new_results = aperture_barcode_tracker_update (tracker, results, 0);
+  g_assert_cmpuint (new_results->len, ==, 1);
+  g_clear_pointer (&new_results, g_ptr_array_unref);
+
+  /* the second time, it is not */
+  new_results = aperture_barcode_tracker_update (tracker, results, 100);
+  g_assert_cmpuint (new_results->len, ==, 0);
+
+  /* the region still looks the same, so it is blanked out, and the code
+   * counts as seen */
+  g_assert_true (aperture_barcode_tracker_has_regions (tracker));
+  g_assert_cmpuint (aperture_barcode_tracker_mask_frame (tracker, &info, frame, G_USEC_PER_SEC), ==, 1);
+  g_assert_cmpint (frame[40 * GST_VIDEO_INFO_PLANE_STRIDE (&info, 0) + 40], ==, frame[24 * GST_VIDEO_INFO_PLANE_STRIDE (&info, 0) + 24]);
+  g_assert_null (aperture_barcode_tracker_expire (tracker, 3 * G_USEC_PER_SEC / 2));
+
+  /* now the code is gone */
+  memset (frame, 0, GST_VIDEO_INFO_SIZE (&info));
+  g_assert_cmpuint (aperture_barcode_tracker_mask_frame (tracker, &info, frame, 2 * G_USEC_PER_SEC), ==, 0);
+
+  /* identical frames don't count towards losing it */
+  aperture_barcode_tracker_hold (tracker, G_USEC_PER_SEC);
+  g_assert_null (aperture_barcode_tracker_expire (tracker, 5 * G_USEC_PER_SEC / 2));
+
+  lost = aperture_barcode_tracker_expire (tracker, 7 * G_USEC_PER_SEC / 2);
+  g_assert_nonnull (lost);
+  g_assert_cmpuint (lost->len, ==, 1);
+  g_assert_cmpstr (aperture_barcode_result_get_data (g_ptr_array_index (lost, 0)), ==, "hello world");
+  g_assert_false (aperture_barcode_tracker_has_regions (tracker));
+}
+
+
+static void
+test_barcodes_lost ()
+{
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  g_autoptr(GstElement) pipeline = NULL;
+  g_autoptr(GstBus) bus = NULL;
+  g_autoptr(GstMessage) message = NULL;
+  AperturePipelineBarcode *barcode;
+  AperturePipelineBarcodeStats stats;
+  GstVideoRectangle empty_roi = { 0, 0, 320, 240 };
+  DummyDevice *device;
+
+  g_test_summary ("Test that a code is reported once while it is in view, and lost once it leaves");
+
+#ifdef BARCODE_TESTS_SKIPPABLE
+  if (!aperture_is_barcode_detection_enabled ()) {
+    g_test_skip ("Skipping test that requires barcode detection, because it is not available");
+    return;
+  }
+#endif
+
+  device = dummy_device_provider_add (provider);
+  dummy_device_set_image (device, "/aperture/helloworld.png");
+
+  barcode = aperture_pipeline_barcode_new ();
+  /* scan every frame, so the scene being still doesn't hold the code */
+  aperture_pipeline_barcode_set_idle_interval (barcode, 0);
+
+  pipeline = create_barcode_pipeline (device, barcode);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  do {
+    g_clear_pointer (&message, gst_message_unref);
+    message = gst_bus_timed_pop_filtered (bus, 5 * GST_SECOND, GST_MESSAGE_ELEMENT | GST_MESSAGE_ERROR);
+    g_assert_nonnull (message);
+    g_assert_cmpint (GST_MESSAGE_TYPE (message), !=, GST_MESSAGE_ERROR);
+  } while (!gst_message_has_name (message, "barcodes"));
+
+  /* the code stays in view, so it must not be lost or reported again */
+  g_usleep (2 * G_USEC_PER_SEC);
+  g_assert_cmpint (count_barcode_messages (pipeline), ==, 0);
+
+  /* move the region of interest to the empty part of the frame */
+  aperture_pipeline_barcode_set_roi (barcode, &empty_roi);
+
+  do {
+    g_clear_pointer (&message, gst_message_unref);
+    message = gst_bus_timed_pop_filtered (bus, 5 * GST_SECOND, GST_MESSAGE_ELEMENT | GST_MESSAGE_ERROR);
+    g_assert_nonnull (message);
+    g_assert_cmpint (GST_MESSAGE_TYPE (message), !=, GST_MESSAGE_ERROR);
+  } while (!gst_message_has_name (message, "barcodes-lost"));
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  aperture_pipeline_barcode_get_stats (barcode, &stats);
+  g_assert_cmpuint (stats.detections, ==, 1);
+  g_assert_cmpuint (stats.lost, ==, 1);
+  g_test_message ("Regions skipped: %u of %u scanned frames", stats.skipped_regions, stats.scanned);
+
+  dummy_device_provider_remove (provider);
+}
+
+
+static void
+on_picture_with_barcodes_taken (ApertureViewfinder *source, GAsyncResult *res, TestUtilsCallback *callback)
+{
+  g_autoptr(GError) err = NULL;
+  g_autoptr(GdkPixbuf) pixbuf = NULL;
+  g_autoptr(GPtrArray) barcodes = NULL;
+  ApertureBarcodeResult *result;
+  GdkRectangle box;
+
+  pixbuf = aperture_viewfinder_take_picture_with_barcodes_finish (source, res, &barcodes, &err);
+
+  if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED)) {
+    g_test_skip ("Scanning pictures needs a barcode library");
+    testutils_callback_call (callback);
+    return;
+  }
+
+  g_assert_no_error (err);
+  g_assert_nonnull (pixbuf);
+  g_assert_cmpuint (barcodes->len, ==, 1);
+
+  result = g_ptr_array_index (barcodes, 0);
+  g_assert_cmpint (aperture_barcode_result_get_barcode_type (result), ==, APERTURE_BARCODE_QR);
+  g_assert_cmpstr (aperture_barcode_result_get_data (result), ==, "hello world");
+
+  /* positions are in pixels of the picture */
+  g_assert_true (aperture_barcode_result_get_bounding_box (result, &box));
+  g_assert_cmpint (box.x + box.width, <=, gdk_pixbuf_get_width (pixbuf));
+  g_assert_cmpint (box.y + box.height, <=, gdk_pixbuf_get_height (pixbuf));
+
+  testutils_callback_call (callback);
+}
+
+
+static void
+test_barcodes_picture ()
+{
+  g_autoptr(ApertureDeviceManager) manager = aperture_device_manager_get_instance ();
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  ApertureViewfinder *viewfinder;
+  GtkWidget *window;
+  TestUtilsCallback picture_callback;
+  DummyDevice *device;
+
+  g_test_summary ("Test that barcodes are found in pictures taken at full resolution");
+
+#ifdef BARCODE_TESTS_SKIPPABLE
+  if (!aperture_is_barcode_detection_enabled ()) {
+    g_test_skip ("Skipping test that requires barcode detection, because it is not available");
+    return;
+  }
+#endif
+
+  testutils_callback_init (&picture_callback);
+
+  device = dummy_device_provider_add (provider);
+  dummy_device_set_image (device, "/aperture/helloworld.png");
+  testutils_wait_for_device_change (manager);
+
+  viewfinder = aperture_viewfinder_new ();
+
+  window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET (viewfinder));
+  gtk_widget_show_all (window);
+
+  aperture_viewfinder_take_picture_with_barcodes_async (viewfinder, NULL, (GAsyncReadyCallback) on_picture_with_barcodes_taken, &picture_callback);
+
+  testutils_callback_assert_called (&picture_callback, 2000);
+
+  gtk_widget_destroy (window);
+  dummy_device_provider_remove (provider);
+  testutils_wait_for_device_change (manager);
+}
+
+
+typedef struct {
+  GMainLoop *loop;
+  gboolean finished;
+  GError *error;
+  guint n_images;
+  guint n_codes;
+  guint n_errors;
+} FileScan;
+
+
+static void
+file_scanned_cb (GFile *file, GPtrArray *results, const GError *error, gpointer user_data)
+{
+  FileScan *scan = user_data;
+  g_autofree char *name = g_file_get_basename (file);
+
+  g_assert_false (scan->finished);
+
+  if (error != NULL) {
+    g_assert_null (results);
+    scan->n_errors ++;
+    return;
+  }
+
+  scan->n_images ++;
+  scan->n_codes += results->len;
+
+  if (g_str_has_prefix (name, "helloworld")) {
+    g_assert_cmpuint (results->len, ==, 1);
+    g_assert_cmpint (aperture_barcode_result_get_barcode_type (g_ptr_array_index (results, 0)), ==, APERTURE_BARCODE_QR);
+    g_assert_cmpstr (aperture_barcode_result_get_data (g_ptr_array_index (results, 0)), ==, "hello world");
+  } else {
+    g_assert_cmpuint (results->len, ==, 0);
+  }
+}
+
+
+static void
+files_finished_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  FileScan *scan = user_data;
+
+  aperture_scan_barcodes_in_files_finish (result, &scan->error);
+  scan->finished = TRUE;
+  g_main_loop_quit (scan->loop);
+}
+
+
+/* Scans @files and waits for it to finish. Returns %FALSE if scanning files
+ * is not supported in this build. */
+static gboolean
+run_file_scan (GFile **files, guint n_files, FileScan *scan)
+{
+  memset (scan, 0, sizeof (FileScan));
+  scan->loop = g_main_loop_new (NULL, FALSE);
+
+  aperture_scan_barcodes_in_files_async (files, n_files, file_scanned_cb, scan, NULL, NULL, files_finished_cb, scan);
+  g_main_loop_run (scan->loop);
+  g_main_loop_unref (scan->loop);
+
+  if (g_error_matches (scan->error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED)) {
+    g_clear_error (&scan->error);
+    return FALSE;
+  }
+
+  g_assert_no_error (scan->error);
+  return TRUE;
+}
+
+
+/* Saves one of the test images, scaled to @size pixels square */
+static void
+save_test_image (const char *resource, int size, const char *path)
+{
+  g_autoptr(GdkPixbuf) pixbuf = NULL;
+  g_autoptr(GdkPixbuf) scaled = NULL;
+  g_autoptr(GError) error = NULL;
+
+  pixbuf = gdk_pixbuf_new_from_resource (resource, &error);
+  g_assert_no_error (error);
+
+  /* nearest neighbour, to keep the edges of the code sharp */
+  scaled = gdk_pixbuf_scale_simple (pixbuf, size, size, GDK_INTERP_NEAREST);
+  gdk_pixbuf_save (scaled, path, "png", &error, NULL);
+  g_assert_no_error (error);
+}
+
+
+static void
+remove_tree (const char *path)
+{
+  GDir *dir = g_dir_open (path, 0, NULL);
+  const char *name;
+
+  if (dir != NULL) {
+    while ((name = g_dir_read_name (dir))) {
+      g_autofree char *child = g_build_filename (path, name, NULL);
+      remove_tree (child);
+    }
+    g_dir_close (dir);
+  }
+
+  g_remove (path);
+}
+
+
+static void
+test_barcodes_files ()
+{
+  g_autofree char *dir = NULL;
+  g_autofree char *subdir = NULL;
+  g_autofree char *path = NULL;
+  g_autofree char *not_an_image = NULL;
+  g_autoptr(GFile) dir_file = NULL;
+  g_autoptr(GFile) bad_file = NULL;
+  g_autoptr(GError) error = NULL;
+  GFile *files[2];
+  FileScan scan;
+
+  g_test_summary ("Test that image files and directories can be scanned for barcodes");
+
+  dir = g_dir_make_tmp ("aperture-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  path = g_build_filename (dir, "helloworld.png", NULL);
+  save_test_image ("/aperture/helloworld.png", 400, path);
+  g_clear_pointer (&path, g_free);
+
+  subdir = g_build_filename (dir, "more", NULL);
+  g_assert_cmpint (g_mkdir (subdir, 0700), ==, 0);
+  path = g_build_filename (subdir, "quadrants.png", NULL);
+  save_test_image ("/aperture/quadrants.png", 400, path);
+  g_clear_pointer (&path, g_free);
+
+  /* skipped in directories, since it isn't an image */
+  path = g_build_filename (subdir, "notes.txt", NULL);
+  g_file_set_contents (path, "hello world", -1, &error);
+  g_assert_no_error (error);
+
+  /* but reported when asked for directly */
+  not_an_image = g_build_filename (dir, "not-an-image", NULL);
+  g_file_set_contents (not_an_image, "hello world", -1, &error);
+  g_assert_no_error (error);
+
+  dir_file = g_file_new_for_path (dir);
+  bad_file = g_file_new_for_path (not_an_image);
+  files[0] = dir_file;
+  files[1] = bad_file;
+
+  if (!run_file_scan (files, G_N_ELEMENTS (files), &scan)) {
+    remove_tree (dir);
+    g_test_skip ("Scanning files is not supported without a barcode library");
+    return;
+  }
+
+  /* the not-an-image file is in the directory too, but doesn't look like an
+   * image there */
+  g_assert_cmpuint (scan.n_images, ==, 2);
+  g_assert_cmpuint (scan.n_codes, ==, 1);
+  g_assert_cmpuint (scan.n_errors, ==, 1);
+
+  remove_tree (dir);
+}
+
+
+static void
+test_barcodes_files_perf ()
+{
+  const int sizes[] = { 400, 1600, 3200 };
+  g_autoptr(GError) error = NULL;
+  guint i, j;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Performance tests are only run with -m perf");
+    return;
+  }
+
+  g_test_message ("%u processors available", g_get_num_processors ());
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i ++) {
+    g_autofree char *dir = NULL;
+    g_autoptr(GFile) dir_file = NULL;
+    const guint n_images = 64;
+    FileScan scan;
+    gint64 start;
+    double rate;
+
+    dir = g_dir_make_tmp ("aperture-XXXXXX", &error);
+    g_assert_no_error (error);
+
+    for (j = 0; j < n_images; j ++) {
+      g_autofree char *name = g_strdup_printf ("helloworld-%u.png", j);
+      g_autofree char *path = g_build_filename (dir, name, NULL);
+      save_test_image ("/aperture/helloworld.png", sizes[i], path);
+    }
+
+    dir_file = g_file_new_for_path (dir);
+
+    start = g_get_monotonic_time ();
+    if (!run_file_scan (&dir_file, 1, &scan)) {
+      remove_tree (dir);
+      g_test_skip ("Scanning files is not supported without a barcode library");
+      return;
+    }
+    rate = (double) scan.n_images * G_USEC_PER_SEC / (g_get_monotonic_time () - start);
+
+    g_assert_cmpuint (scan.n_images, ==, n_images);
+    g_assert_cmpuint (scan.n_codes, ==, n_images);
+
+    g_test_maximized_result (rate, "%dx%d: %.1f images per second", sizes[i], sizes[i], rate);
+
+    remove_tree (dir);
+  }
+}
+
+
+typedef enum {
+  CORPUS_CLEAN,
+  CORPUS_LOW_CONTRAST,
+  CORPUS_NOISE,
+  CORPUS_BLUR,
+  CORPUS_DAMAGED,
+} CorpusKind;
+
+static const char * const corpus_names[] = {
+  [CORPUS_CLEAN] = "clean",
+  [CORPUS_LOW_CONTRAST] = "low contrast",
+  [CORPUS_NOISE] = "noise",
+  [CORPUS_BLUR] = "blur",
+  [CORPUS_DAMAGED] = "damaged",
+};
+
+#define CORPUS_WIDTH 640
+#define CORPUS_HEIGHT 480
+#define CORPUS_CODE_SIZE 240
+#define CORPUS_FRAMES 50
+
+
+/* Makes a synthetic GRAY8 viewfinder frame with the hello world code in the
+ * middle, spoiled in one of a few ways that real cameras spoil codes. @seed
+ * varies the noise and the damage from frame to frame. */
+static guint8 *
+make_corpus_frame (CorpusKind kind, guint32 seed)
+{
+  g_autoptr(GdkPixbuf) pixbuf = NULL;
+  g_autoptr(GdkPixbuf) code = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GRand) rand = g_rand_new_with_seed (seed);
+  guint8 *frame = g_malloc (CORPUS_WIDTH * CORPUS_HEIGHT);
+  const int left = (CORPUS_WIDTH - CORPUS_CODE_SIZE) / 2;
+  const int top = (CORPUS_HEIGHT - CORPUS_CODE_SIZE) / 2;
+  const guint8 *pixels;
+  int rowstride, n_channels;
+  int x, y, i;
+
+  pixbuf = gdk_pixbuf_new_from_resource ("/aperture/helloworld.png", &error);
+  g_assert_no_error (error);
+  code = gdk_pixbuf_scale_simple (pixbuf, CORPUS_CODE_SIZE, CORPUS_CODE_SIZE, GDK_INTERP_NEAREST);
+  pixels = gdk_pixbuf_read_pixels (code);
+  rowstride = gdk_pixbuf_get_rowstride (code);
+  n_channels = gdk_pixbuf_get_n_channels (code);
+
+  memset (frame, 0xff, CORPUS_WIDTH * CORPUS_HEIGHT);
+  for (y = 0; y < CORPUS_CODE_SIZE; y ++) {
+    for (x = 0; x < CORPUS_CODE_SIZE; x ++) {
+      frame[(top + y) * CORPUS_WIDTH + left + x] = pixels[y * rowstride + x * n_channels];
+    }
+  }
+
+  switch (kind) {
+  case CORPUS_CLEAN:
+    break;
+
+  case CORPUS_LOW_CONTRAST:
+    /* a dim, washed out picture */
+    for (i = 0; i < CORPUS_WIDTH * CORPUS_HEIGHT; i ++) {
+      frame[i] = 100 + frame[i] * 40 / 255;
+    }
+    break;
+
+  case CORPUS_NOISE:
+    /* sensor noise in a dark room */
+    for (i = 0; i < CORPUS_WIDTH * CORPUS_HEIGHT; i ++) {
+      frame[i] = CLAMP (frame[i] + g_rand_int_range (rand, -60, 61), 0, 255);
+    }
+    break;
+
+  case CORPUS_BLUR:
+    {
+      /* out of focus: a few passes of a box blur */
+      g_autofree guint8 *copy = g_malloc (CORPUS_WIDTH * CORPUS_HEIGHT);
+      int pass;
+
+      for (pass = 0; pass < 3; pass ++) {
+        memcpy (copy, frame, CORPUS_WIDTH * CORPUS_HEIGHT);
+        for (y = 1; y < CORPUS_HEIGHT - 1; y ++) {
+          for (x = 1; x < CORPUS_WIDTH - 1; x ++) {
+            guint sum = 0;
+            int dx, dy;
+
+            for (dy = -1; dy <= 1; dy ++) {
+              for (dx = -1; dx <= 1; dx ++) {
+                sum += copy[(y + dy) * CORPUS_WIDTH + x + dx];
+              }
+            }
+            frame[y * CORPUS_WIDTH + x] = sum / 9;
+          }
+        }
+      }
+    }
+    break;
+
+  case CORPUS_DAMAGED:
+    {
+      /* a smudge over part of the code, somewhere away from the finder
+       * patterns */
+      const int size = CORPUS_CODE_SIZE / 8;
+      int sx = left + CORPUS_CODE_SIZE / 3 + g_rand_int_range (rand, 0, CORPUS_CODE_SIZE / 3 - size);
+      int sy = top + CORPUS_CODE_SIZE / 3 + g_rand_int_range (rand, 0, CORPUS_CODE_SIZE / 3 - size);
+
+      for (y = sy; y < sy + size; y ++) {
+        memset (frame + y * CORPUS_WIDTH + sx, 0x80, size);
+      }
+    }
+    break;
+
+  default:
+    g_assert_not_reached ();
+  }
+
+  return frame;
+}
+
+
+static void
+test_barcodes_backends ()
+{
+  g_auto(GStrv) backends = aperture_barcode_decoder_list_backends ();
+  g_autofree guint8 *frame = make_corpus_frame (CORPUS_CLEAN, 0);
+  int i;
+
+  g_test_summary ("Test that every barcode backend Aperture was built with can decode frames");
+
+  if (backends[0] == NULL) {
+    g_test_skip ("Decoding frames is not supported without a barcode library");
+    return;
+  }
+
+  g_assert_cmpstr (aperture_barcode_decoder_get_default_backend (), !=, NULL);
+  g_assert_true (aperture_barcode_decoder_has_backend (aperture_barcode_decoder_get_default_backend ()));
+  g_assert_false (aperture_barcode_decoder_has_backend ("three zebras"));
+  g_assert_null (aperture_barcode_decoder_new ("three zebras"));
+
+  for (i = 0; backends[i] != NULL; i ++) {
+    g_autoptr(ApertureBarcodeDecoder) decoder = aperture_barcode_decoder_new (backends[i]);
+    g_autoptr(GPtrArray) results = NULL;
+    ApertureBarcodeResult *result;
+
+    g_assert_nonnull (decoder);
+    g_assert_cmpstr (aperture_barcode_decoder_get_backend (decoder), ==, backends[i]);
+
+    results = aperture_barcode_decoder_decode (decoder, frame, CORPUS_WIDTH, CORPUS_HEIGHT, CORPUS_WIDTH, 42);
+    g_assert_cmpuint (results->len, ==, 1);
+    result = g_ptr_array_index (results, 0);
+    g_assert_cmpint (aperture_barcode_result_get_barcode_type (result), ==, APERTURE_BARCODE_QR);
+    g_assert_cmpstr (aperture_barcode_result_get_data (result), ==, "hello world");
+    g_clear_pointer (&results, g_ptr_array_unref);
+
+    /* other types are not reported */
+    aperture_barcode_decoder_set_barcode_types (decoder, 1u << APERTURE_BARCODE_EAN13);
+    results = aperture_barcode_decoder_decode (decoder, frame, CORPUS_WIDTH, CORPUS_HEIGHT, CORPUS_WIDTH, 42);
+    g_assert_cmpuint (results->len, ==, 0);
+  }
+}
+
+
+static void
+test_barcodes_backends_perf ()
+{
+  g_auto(GStrv) backends = aperture_barcode_decoder_list_backends ();
+  guint8 *corpus[G_N_ELEMENTS (corpus_names)][CORPUS_FRAMES];
+  guint i, j, k;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Performance tests are only run with -m perf");
+    return;
+  }
+
+  if (backends[0] == NULL) {
+    g_test_skip ("Decoding frames is not supported without a barcode library");
+    return;
+  }
+
+  for (i = 0; i < G_N_ELEMENTS (corpus_names); i ++) {
+    for (j = 0; j < CORPUS_FRAMES; j ++) {
+      corpus[i][j] = make_corpus_frame (i, j);
+    }
+  }
+
+  for (k = 0; backends[k] != NULL; k ++) {
+    g_autoptr(ApertureBarcodeDecoder) decoder = aperture_barcode_decoder_new (backends[k]);
+
+    for (i = 0; i < G_N_ELEMENTS (corpus_names); i ++) {
+      guint decoded = 0;
+      gint64 total = 0;
+      gint64 worst = 0;
+      double rate, latency;
+
+      for (j = 0; j < CORPUS_FRAMES; j ++) {
+        g_autoptr(GPtrArray) results = NULL;
+        gint64 start = g_get_monotonic_time ();
+        gint64 elapsed;
+
+        results = aperture_barcode_decoder_decode (decoder, corpus[i][j], CORPUS_WIDTH, CORPUS_HEIGHT, CORPUS_WIDTH, j);
+        elapsed = g_get_monotonic_time () - start;
+        total += elapsed;
+        worst = MAX (worst, elapsed);
+
+        if (results->len > 0
+            && g_str_equal (aperture_barcode_result_get_data (g_ptr_array_index (results, 0)), "hello world")) {
+          decoded ++;
+        }
+      }
+
+      rate = 100.0 * decoded / CORPUS_FRAMES;
+      latency = (double) total / CORPUS_FRAMES / 1000;
+
+      g_test_message ("%-6s %-12s %5.1f%% decoded, %6.2f ms/frame (worst %.2f ms)",
+                      backends[k], corpus_names[i], rate, latency, worst / 1000.0);
+      g_test_maximized_result (rate, "%s, %s: %.1f%% of frames decoded", backends[k], corpus_names[i], rate);
+      g_test_minimized_result (latency, "%s, %s: %.2f ms per frame", backends[k], corpus_names[i], latency);
+    }
+  }
+
+  for (i = 0; i < G_N_ELEMENTS (corpus_names); i ++) {
+    for (j = 0; j < CORPUS_FRAMES; j ++) {
+      g_free (corpus[i][j]);
+    }
+  }
+}
+
+
+/* Feeds frames from a moving dummy device to @sink, at the rate a camera
+ * would produce them */
+static GstElement *
+create_motion_pipeline (DummyDevice *device, GstElement *sink)
+{
+  GstElement *pipeline = gst_pipeline_new (NULL);
+  g_autoptr(GstCaps) caps = gst_caps_from_string ("video/x-raw, format=I420");
+  GstElement *src;
+  GstElement *videoconvert;
+  GstElement *capsfilter;
+  GstElement *identity;
+
+  src = gst_device_create_element (GST_DEVICE (device), NULL);
+  videoconvert = gst_element_factory_make ("videoconvert", NULL);
+  capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  identity = gst_element_factory_make ("identity", NULL);
+
+  g_object_set (capsfilter, "caps", caps, NULL);
+  g_object_set (identity, "sync", TRUE, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), src, videoconvert, capsfilter, identity, sink, NULL);
+  gst_element_link_many (src, videoconvert, capsfilter, identity, sink, NULL);
+
+  return pipeline;
+}
+
+
+typedef struct {
+  int detected;
+  gint64 first_detection;
+} MotionRun;
+
+
+static GstBusSyncReply
+motion_bus_cb (GstBus *bus, GstMessage *message, gpointer user_data)
+{
+  MotionRun *run = user_data;
+
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ELEMENT
+      && gst_message_has_name (message, "barcodes")
+      && g_atomic_int_compare_and_exchange (&run->detected, 0, 1)) {
+    run->first_detection = g_get_monotonic_time ();
+  }
+
+  return GST_BUS_PASS;
+}
+
+
+static double
+cpu_seconds (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+       + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+
+/* Plays the moving code for @duration, through a barcode branch if @stats
+ * is given and straight into a fakesink otherwise. Returns the time from the
+ * first frame to the first detection, or -1 if the code was never detected,
+ * and the CPU time used by the whole pipeline. */
+static gint64
+run_motion (DummyDevice                  *device,
+            const DummyDeviceMotion      *motion,
+            gint64                        duration,
+            AperturePipelineBarcodeStats *stats,
+            double                       *cpu)
+{
+  g_autoptr(GstElement) pipeline = NULL;
+  g_autoptr(GstBus) bus = NULL;
+  AperturePipelineBarcode *barcode = NULL;
+  GstElement *sink;
+  MotionRun run = { 0 };
+  gint64 start;
+  double cpu_start;
+
+  if (stats != NULL) {
+    barcode = aperture_pipeline_barcode_new ();
+    sink = GST_ELEMENT (barcode);
+  } else {
+    sink = gst_element_factory_make ("fakesink", NULL);
+  }
+
+  dummy_device_set_motion (device, motion);
+  pipeline = create_motion_pipeline (device, sink);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gst_bus_set_sync_handler (bus, motion_bus_cb, &run, NULL);
+
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+  cpu_start = cpu_seconds ();
+  start = g_get_monotonic_time ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_usleep (duration);
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+  *cpu = cpu_seconds () - cpu_start;
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_bus_set_sync_handler (bus, NULL, NULL, NULL);
+  dummy_device_set_motion (device, NULL);
+
+  if (barcode != NULL) {
+    aperture_pipeline_barcode_get_stats (barcode, stats);
+  }
+
+  return g_atomic_int_get (&run.detected) ? run.first_detection - start : -1;
+}
+
+
+static void
+test_barcodes_motion ()
+{
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  const DummyDeviceMotion motion = { .size = 320, .blur = 1, .rotation = 15, .speed = 200 };
+  AperturePipelineBarcodeStats stats;
+  DummyDevice *device;
+  gint64 first_detection;
+  double cpu;
+
+  g_test_summary ("Test that a code moving across the frame is detected");
+
+#ifdef BARCODE_TESTS_SKIPPABLE
+  if (!aperture_is_barcode_detection_enabled ()) {
+    g_test_skip ("Skipping test that requires barcode detection, because it is not available");
+    return;
+  }
+#endif
+
+  device = dummy_device_provider_add (provider);
+  dummy_device_set_image (device, "/aperture/helloworld.png");
+
+  first_detection = run_motion (device, &motion, 2 * G_USEC_PER_SEC, &stats, &cpu);
+
+  g_assert_cmpint (first_detection, >=, 0);
+  g_assert_cmpint (first_detection, <, 2 * G_USEC_PER_SEC);
+  g_assert_cmpuint (stats.detections, >=, 1);
+
+  dummy_device_provider_remove (provider);
+}
+
+
+static void
+test_barcodes_motion_perf ()
+{
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  static const struct {
+    const char *name;
+    DummyDeviceMotion motion;
+  } scenarios[] = {
+    { "still",             { .size = 320 } },
+    { "small",             { .size = 120 } },
+    { "large",             { .size = 560 } },
+    { "blur 2",            { .size = 320, .blur = 2 } },
+    { "blur 4",            { .size = 320, .blur = 4 } },
+    { "turned 30",         { .size = 320, .rotation = 30 } },
+    { "turned 45",         { .size = 320, .rotation = 45 } },
+    { "100 px/s",          { .size = 320, .speed = 100 } },
+    { "400 px/s",          { .size = 320, .speed = 400 } },
+    { "1000 px/s",         { .size = 320, .speed = 1000 } },
+    { "small, fast, blur", { .size = 160, .blur = 1, .rotation = 20, .speed = 400 } },
+  };
+  DummyDevice *device;
+  guint i;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Performance tests are only run with -m perf");
+    return;
+  }
+
+#ifdef BARCODE_TESTS_SKIPPABLE
+  if (!aperture_is_barcode_detection_enabled ()) {
+    g_test_skip ("Skipping test that requires barcode detection, because it is not available");
+    return;
+  }
+#endif
+
+  device = dummy_device_provider_add (provider);
+  dummy_device_set_image (device, "/aperture/helloworld.png");
+
+  g_test_message ("%-18s %10s %9s %12s %5s", "", "first (ms)", "read (%)", "CPU/frame", "lost");
+
+  for (i = 0; i < G_N_ELEMENTS (scenarios); i ++) {
+    const char *name = scenarios[i].name;
+    AperturePipelineBarcodeStats stats;
+    gint64 first_detection;
+    double cpu, source_cpu, cpu_per_frame;
+    double first_ms, read;
+
+    /* the same run without the branch, to leave out the cost of drawing
+     * the frames */
+    run_motion (device, &scenarios[i].motion, BARCODE_PERF_SECONDS * G_USEC_PER_SEC, NULL, &source_cpu);
+    first_detection = run_motion (device, &scenarios[i].motion, BARCODE_PERF_SECONDS * G_USEC_PER_SEC, &stats, &cpu);
+
+    g_assert_cmpuint (stats.frames, >, 0);
+
+    /* frames in which the code was read, or known to be still there */
+    read = stats.decoded > 0
+         ? 100.0 * MIN (stats.detections + stats.duplicates + stats.skipped_regions, stats.decoded) / stats.decoded
+         : 0;
+    cpu_per_frame = MAX (cpu - source_cpu, 0) * 1000 / stats.frames;
+    first_ms = first_detection >= 0 ? first_detection / 1000.0 : -1;
+
+    g_test_message ("%-18s %10.1f %9.1f %9.2f ms %5u",
+                    name, first_ms, read, cpu_per_frame, stats.lost);
+
+    if (first_detection >= 0) {
+      g_test_minimized_result (first_ms, "%s: first detected after %.1f ms", name, first_ms);
+    }
+    g_test_maximized_result (read, "%s: code read in %.1f%% of decoded frames", name, read);
+    g_test_minimized_result (cpu_per_frame, "%s: %.2f ms CPU per frame", name, cpu_per_frame);
+  }
+
+  dummy_device_provider_remove (provider);
+}
+
+
 void
 add_barcodes_tests ()
 {
   g_test_add_func ("/barcodes/enum", test_barcodes_enum);
   g_test_add_func ("/barcodes/enabled", test_barcodes_enabled);
   g_test_add_func ("/barcodes/detection", test_barcodes_detection);
+  g_test_add_func ("/barcodes/result", test_barcodes_result);
+  g_test_add_func ("/barcodes/batched", test_barcodes_batched);
+  g_test_add_func ("/barcodes/branch", test_barcodes_branch);
+  g_test_add_func ("/barcodes/branch_perf", test_barcodes_branch_perf);
+  g_test_add_func ("/barcodes/scheduler", test_barcodes_scheduler);
+  g_test_add_func ("/barcodes/scheduler_perf", test_barcodes_scheduler_perf);
+  g_test_add_func ("/barcodes/threads", test_barcodes_threads);
+  g_test_add_func ("/barcodes/threads_perf", test_barcodes_threads_perf);
+  g_test_add_func ("/barcodes/types", test_barcodes_types);
+  g_test_add_func ("/barcodes/types_perf", test_barcodes_types_perf);
+  g_test_add_func ("/barcodes/tracker", test_barcodes_tracker);
+  g_test_add_func ("/barcodes/lost", test_barcodes_lost);
+  g_test_add_func ("/barcodes/files", test_barcodes_files);
+  g_test_add_func ("/barcodes/files_perf", test_barcodes_files_perf);
+  g_test_add_func ("/barcodes/picture", test_barcodes_picture);
+  g_test_add_func ("/barcodes/backends", test_barcodes_backends);
+  g_test_add_func ("/barcodes/backends_perf", test_barcodes_backends_perf);
+  g_test_add_func ("/barcodes/motion", test_barcodes_motion);
+  g_test_add_func ("/barcodes/motion_perf", test_barcodes_motion_perf);
 }
@@ -0,0 +1,276 @@
+/* test-pipeline-encoder.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+
+#include <glib.h>
+#include <aperture.h>
+#include <gst/gst.h>
+
+#include "pipeline/aperture-pipeline-encoder.h"
+
+
+/* What came out of the encoder */
+typedef struct {
+  guint count;
+  gboolean first_is_keyframe;
+  /* the most frames from one keyframe to the next */
+  guint max_gop;
+  guint gop;
+} Received;
+
+
+static void
+on_handoff (GstElement *fakesink, GstBuffer *buffer, GstPad *pad, Received *received)
+{
+  gboolean keyframe = !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  if (received->count == 0) {
+    received->first_is_keyframe = keyframe;
+  }
+
+  if (keyframe) {
+    received->gop = 1;
+  } else {
+    received->gop ++;
+  }
+  received->max_gop = MAX (received->max_gop, received->gop);
+  received->count ++;
+}
+
+
+/* Creates videotestsrc ! encoder ! fakesink, with moving test video. The
+ * encoder drops frames when it falls behind, like it would with a camera,
+ * so only a live source gets every frame through. Otherwise the source runs
+ * as fast as it can, which is what the perf test measures. */
+static GstElement *
+create_test_pipeline (AperturePipelineEncoder *encoder, int num_buffers, gboolean live, Received *received)
+{
+  GstElement *pipeline = gst_pipeline_new (NULL);
+  GstElement *src = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+
+  g_object_set (src, "num-buffers", num_buffers, "horizontal-speed", 4, "is-live", live, NULL);
+  g_object_set (sink, "sync", live, NULL);
+  if (received != NULL) {
+    g_object_set (sink, "signal-handoffs", TRUE, NULL);
+    g_signal_connect (sink, "handoff", G_CALLBACK (on_handoff), received);
+  }
+
+  gst_bin_add_many (GST_BIN (pipeline), src, GST_ELEMENT (encoder), sink, NULL);
+  gst_element_link_many (src, GST_ELEMENT (encoder), sink, NULL);
+
+  return pipeline;
+}
+
+
+static void
+wait_for_eos (GstElement *pipeline)
+{
+  g_autoptr(GstBus) bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  g_autoptr(GstMessage) message = NULL;
+
+  message = gst_bus_timed_pop_filtered (bus, 60 * GST_SECOND, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  g_assert_nonnull (message);
+  g_assert_cmpint (GST_MESSAGE_TYPE (message), ==, GST_MESSAGE_EOS);
+}
+
+
+static void
+test_pipeline_encoder_software ()
+{
+  g_autoptr(ApertureRecordingProfile) profile = aperture_recording_profile_new ();
+  AperturePipelineEncoder *encoder;
+  g_autoptr(GstElement) pipeline = NULL;
+  g_autoptr(GstPad) srcpad = NULL;
+  g_autoptr(GstCaps) caps = NULL;
+  GstStructure *structure;
+  Received received = { 0 };
+  int width, fps_n, fps_d;
+
+  g_test_summary ("Test that the software encoder follows the recording profile");
+
+  if (!aperture_pipeline_encoder_can_encode (APERTURE_VIDEO_CODEC_H264)) {
+    g_test_skip ("x264enc is not installed");
+    return;
+  }
+
+  aperture_recording_profile_set_framerate (profile, 15);
+  aperture_recording_profile_set_resolution (profile, 320, 240);
+  aperture_recording_profile_set_keyframe_interval (profile, 10);
+  aperture_recording_profile_set_bitrate (profile, 500);
+  aperture_recording_profile_set_rate_control (profile, APERTURE_RATE_CONTROL_CONSTANT);
+
+  encoder = aperture_pipeline_encoder_new (profile, TRUE);
+  g_assert_true (aperture_pipeline_encoder_get_software (encoder));
+  pipeline = create_test_pipeline (encoder, 45, TRUE, &received);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  wait_for_eos (pipeline);
+
+  srcpad = gst_element_get_static_pad (GST_ELEMENT (encoder), "src");
+  caps = gst_pad_get_current_caps (srcpad);
+  structure = gst_caps_get_structure (caps, 0);
+  g_assert_cmpstr (gst_structure_get_name (structure), ==, "video/x-h264");
+  g_assert_true (gst_structure_get_int (structure, "width", &width));
+  g_assert_cmpint (width, ==, 320);
+  g_assert_true (gst_structure_get_fraction (structure, "framerate", &fps_n, &fps_d));
+  g_assert_cmpint (fps_n, ==, 15);
+  g_assert_cmpint (fps_d, ==, 1);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  /* the live source is slow enough that nothing is dropped, and every
+   * frame comes straight out */
+  g_assert_cmpuint (received.count, ==, 45);
+  g_assert_true (received.first_is_keyframe);
+  g_assert_cmpuint (received.max_gop, <=, 10);
+}
+
+
+static void
+test_pipeline_encoder_throttle ()
+{
+  g_autoptr(ApertureRecordingProfile) profile = aperture_recording_profile_new ();
+  g_autoptr(ApertureRecordingProfile) effective = NULL;
+  AperturePipelineEncoder *encoder;
+  g_autoptr(GstElement) pipeline = NULL;
+  Received received = { 0 };
+  guint max_throttle;
+
+  g_test_summary ("Test that a throttled encoder lowers the bitrate, and then drops frames to lower the framerate");
+
+  if (!aperture_pipeline_encoder_can_encode (APERTURE_VIDEO_CODEC_H264)) {
+    g_test_skip ("x264enc is not installed");
+    return;
+  }
+
+  aperture_recording_profile_set_framerate (profile, 30);
+  aperture_recording_profile_set_resolution (profile, 320, 240);
+  aperture_recording_profile_set_bitrate (profile, 1000);
+
+  encoder = aperture_pipeline_encoder_new (profile, TRUE);
+  max_throttle = aperture_pipeline_encoder_get_max_throttle (encoder);
+  g_assert_cmpuint (max_throttle, >, 0);
+
+  /* the bitrate goes down first, then the framerate too */
+  aperture_pipeline_encoder_set_throttle (encoder, 1);
+  effective = aperture_pipeline_encoder_get_effective_profile (encoder);
+  g_assert_cmpuint (aperture_recording_profile_get_bitrate (effective), <, 1000);
+  g_assert_cmpuint (aperture_recording_profile_get_framerate (effective), ==, 30);
+  g_clear_pointer (&effective, aperture_recording_profile_free);
+
+  aperture_pipeline_encoder_set_throttle (encoder, max_throttle);
+  effective = aperture_pipeline_encoder_get_effective_profile (encoder);
+  g_assert_cmpuint (aperture_recording_profile_get_bitrate (effective), <, 1000);
+  g_assert_cmpuint (aperture_recording_profile_get_framerate (effective), <, 30);
+
+  /* two seconds of video, at the lowered framerate */
+  pipeline = create_test_pipeline (encoder, 60, TRUE, &received);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  wait_for_eos (pipeline);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  g_assert_true (received.first_is_keyframe);
+  g_assert_cmpuint (received.count, >=, 2 * aperture_recording_profile_get_framerate (effective) - 1);
+  g_assert_cmpuint (received.count, <=, 2 * aperture_recording_profile_get_framerate (effective) + 1);
+
+  /* and back */
+  aperture_pipeline_encoder_set_throttle (encoder, 0);
+  g_clear_pointer (&effective, aperture_recording_profile_free);
+  effective = aperture_pipeline_encoder_get_effective_profile (encoder);
+  g_assert_cmpuint (aperture_recording_profile_get_bitrate (effective), ==, 1000);
+  g_assert_cmpuint (aperture_recording_profile_get_framerate (effective), ==, 30);
+}
+
+
+typedef struct {
+  const char *name;
+  ApertureVideoCodec codec;
+  guint width;
+  guint height;
+  guint bitrate;
+  ApertureRateControl rate_control;
+} Profile;
+
+
+static void
+test_pipeline_encoder_perf ()
+{
+  const Profile profiles[] = {
+    { "H.264 720p 4 Mbit/s CBR", APERTURE_VIDEO_CODEC_H264, 1280, 720, 4000, APERTURE_RATE_CONTROL_CONSTANT },
+    { "H.264 1080p 8 Mbit/s VBR", APERTURE_VIDEO_CODEC_H264, 1920, 1080, 8000, APERTURE_RATE_CONTROL_VARIABLE },
+    { "H.265 720p 2 Mbit/s CBR", APERTURE_VIDEO_CODEC_H265, 1280, 720, 2000, APERTURE_RATE_CONTROL_CONSTANT },
+    { "H.265 1080p 4 Mbit/s VBR", APERTURE_VIDEO_CODEC_H265, 1920, 1080, 4000, APERTURE_RATE_CONTROL_VARIABLE },
+  };
+  const int num_buffers = 300;
+  guint i;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Performance tests are only run with -m perf");
+    return;
+  }
+
+  g_test_summary ("Measure how many frames per second the software encoder manages for each profile");
+
+  for (i = 0; i < G_N_ELEMENTS (profiles); i ++) {
+    g_autoptr(ApertureRecordingProfile) profile = aperture_recording_profile_new ();
+    g_autoptr(GstElement) pipeline = NULL;
+    AperturePipelineEncoder *encoder;
+    gint64 start;
+    double seconds;
+
+    if (!aperture_pipeline_encoder_can_encode (profiles[i].codec)) {
+      g_test_message ("%s: the encoder is not installed", profiles[i].name);
+      continue;
+    }
+
+    aperture_recording_profile_set_codec (profile, profiles[i].codec);
+    aperture_recording_profile_set_resolution (profile, profiles[i].width, profiles[i].height);
+    aperture_recording_profile_set_bitrate (profile, profiles[i].bitrate);
+    aperture_recording_profile_set_rate_control (profile, profiles[i].rate_control);
+
+    encoder = aperture_pipeline_encoder_new (profile, TRUE);
+    pipeline = create_test_pipeline (encoder, num_buffers, FALSE, NULL);
+
+    /* don't count the encoder starting up */
+    gst_element_set_state (pipeline, GST_STATE_PAUSED);
+    gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+    start = g_get_monotonic_time ();
+    gst_element_set_state (pipeline, GST_STATE_PLAYING);
+    wait_for_eos (pipeline);
+    seconds = (double) (g_get_monotonic_time () - start) / G_USEC_PER_SEC;
+
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+
+    g_test_maximized_result (num_buffers / seconds, "%s: %.1f frames per second",
+                             profiles[i].name, num_buffers / seconds);
+  }
+}
+
+
+void
+add_pipeline_encoder_tests ()
+{
+  g_test_add_func ("/pipeline-encoder/software", test_pipeline_encoder_software);
+  g_test_add_func ("/pipeline-encoder/throttle", test_pipeline_encoder_throttle);
+  g_test_add_func ("/pipeline-encoder/perf", test_pipeline_encoder_perf);
+}
@@ -0,0 +1,242 @@
+/* test-pipeline-preroll.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <glib.h>
+#include <gst/gst.h>
+
+#include "pipeline/aperture-pipeline-preroll.h"
+
+
+/* What made it out of the ring */
+typedef struct {
+  GMutex lock;
+  guint count;
+  gboolean first_is_keyframe;
+  GstClockTime first_pts;
+  GstClockTime last_pts;
+  /* the largest step between two consecutive buffers */
+  GstClockTime max_step;
+} Received;
+
+
+static void
+on_handoff (GstElement *fakesink, GstBuffer *buffer, GstPad *pad, Received *received)
+{
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+
+  g_mutex_lock (&received->lock);
+
+  if (received->count == 0) {
+    received->first_is_keyframe = !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    received->first_pts = pts;
+  } else if (GST_CLOCK_TIME_IS_VALID (pts) && pts > received->last_pts) {
+    received->max_step = MAX (received->max_step, pts - received->last_pts);
+  }
+
+  received->last_pts = MAX (received->last_pts, pts);
+  received->count ++;
+
+  g_mutex_unlock (&received->lock);
+}
+
+
+static gboolean
+check_encoder (void)
+{
+  g_autoptr(GstElementFactory) factory = gst_element_factory_find ("x264enc");
+
+  if (factory == NULL) {
+    g_test_skip ("x264enc is not installed");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+/* Creates videotestsrc ! x264enc ! preroll ! fakesink. A live source
+ * produces video in real time; otherwise it goes as fast as it can, which
+ * fills the ring quickly. */
+static GstElement *
+create_test_pipeline (AperturePipelinePreroll *preroll, gboolean live, Received *received)
+{
+  GstElement *pipeline = gst_pipeline_new (NULL);
+  GstElement *src = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *enc = gst_element_factory_make ("x264enc", NULL);
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+
+  g_object_set (src, "is-live", live, NULL);
+  /* a keyframe every half second */
+  g_object_set (enc, "key-int-max", 15, "speed-preset", 1, NULL);
+  gst_util_set_object_arg (G_OBJECT (enc), "tune", "zerolatency");
+  /* nothing reaches the sink until the ring is started */
+  g_object_set (sink, "sync", FALSE, "async", FALSE, "signal-handoffs", TRUE, NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (on_handoff), received);
+
+  gst_bin_add_many (GST_BIN (pipeline), src, enc, GST_ELEMENT (preroll), sink, NULL);
+  gst_element_link_many (src, enc, GST_ELEMENT (preroll), sink, NULL);
+
+  return pipeline;
+}
+
+
+static guint
+get_count (Received *received)
+{
+  guint count;
+
+  g_mutex_lock (&received->lock);
+  count = received->count;
+  g_mutex_unlock (&received->lock);
+
+  return count;
+}
+
+
+static void
+test_pipeline_preroll_ring ()
+{
+  AperturePipelinePreroll *preroll = aperture_pipeline_preroll_new ();
+  g_autoptr(GstElement) pipeline = NULL;
+  AperturePipelinePrerollStats stats;
+  Received received = { 0 };
+  GstClockTime start_pts;
+  guint count;
+  int i;
+
+  g_test_summary ("Test that the ring keeps the last few seconds, starting on a keyframe, and hands them on without a gap");
+
+  if (!check_encoder ()) {
+    return;
+  }
+
+  g_mutex_init (&received.lock);
+  aperture_pipeline_preroll_set_max_duration (preroll, GST_SECOND);
+  pipeline = create_test_pipeline (preroll, TRUE, &received);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_usleep (3 * G_USEC_PER_SEC);
+
+  /* nothing gets through while buffering, and the ring holds at least the
+   * maximum duration, but not more than one extra GOP */
+  g_assert_cmpuint (get_count (&received), ==, 0);
+  aperture_pipeline_preroll_get_stats (preroll, &stats);
+  g_assert_cmpuint (stats.duration, >=, GST_SECOND - GST_SECOND / 30);
+  g_assert_cmpuint (stats.duration, <=, GST_SECOND + GST_SECOND / 2 + GST_SECOND / 30);
+  g_assert_cmpuint (stats.bytes, >, 0);
+  g_assert_cmpuint (stats.n_buffers, >=, 30);
+
+  aperture_pipeline_preroll_start (preroll);
+
+  for (i = 0; i < 500 && get_count (&received) < stats.n_buffers + 15; i ++) {
+    g_usleep (10000);
+  }
+
+  g_mutex_lock (&received.lock);
+  g_assert_cmpuint (received.count, >=, stats.n_buffers + 15);
+  g_assert_true (received.first_is_keyframe);
+  /* the recording starts a second before it was started, and continues
+   * frame by frame from there */
+  start_pts = received.first_pts;
+  g_assert_cmpuint (received.last_pts - start_pts, >=, GST_SECOND);
+  g_assert_cmpuint (received.max_step, <=, GST_SECOND / 30 + GST_MSECOND);
+  g_mutex_unlock (&received.lock);
+
+  aperture_pipeline_preroll_get_stats (preroll, &stats);
+  g_assert_true (GST_CLOCK_TIME_IS_VALID (stats.start_latency));
+
+  /* back to buffering */
+  aperture_pipeline_preroll_stop (preroll);
+  count = get_count (&received);
+  g_usleep (G_USEC_PER_SEC / 2);
+  g_assert_cmpuint (get_count (&received), ==, count);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  g_mutex_clear (&received.lock);
+}
+
+
+static void
+test_pipeline_preroll_perf ()
+{
+  const guint durations[] = { 1, 5, 10, 30 };
+  guint i;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Performance tests are only run with -m perf");
+    return;
+  }
+
+  g_test_summary ("Measure the memory use of the ring and how long starting a recording takes");
+
+  if (!check_encoder ()) {
+    return;
+  }
+
+  for (i = 0; i < G_N_ELEMENTS (durations); i ++) {
+    AperturePipelinePreroll *preroll = aperture_pipeline_preroll_new ();
+    g_autoptr(GstElement) pipeline = NULL;
+    AperturePipelinePrerollStats full;
+    AperturePipelinePrerollStats stats;
+    Received received = { 0 };
+    int j;
+
+    g_mutex_init (&received.lock);
+    aperture_pipeline_preroll_set_max_duration (preroll, durations[i] * GST_SECOND);
+    pipeline = create_test_pipeline (preroll, FALSE, &received);
+
+    gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+    /* fill the ring up */
+    for (j = 0; j < 6000; j ++) {
+      aperture_pipeline_preroll_get_stats (preroll, &full);
+      if (full.duration >= durations[i] * GST_SECOND) {
+        break;
+      }
+      g_usleep (10000);
+    }
+
+    aperture_pipeline_preroll_start (preroll);
+    for (j = 0; j < 6000 && get_count (&received) <= full.n_buffers; j ++) {
+      g_usleep (1000);
+    }
+
+    aperture_pipeline_preroll_get_stats (preroll, &stats);
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+
+    g_test_message ("%2u s ring: %" GST_TIME_FORMAT " held in %u buffers, %.1f KiB",
+                    durations[i], GST_TIME_ARGS (full.duration), full.n_buffers,
+                    full.bytes / 1024.0);
+    g_test_minimized_result ((double) stats.start_latency / GST_SECOND,
+                             "Start latency with a %u s ring: %" GST_TIME_FORMAT,
+                             durations[i], GST_TIME_ARGS (stats.start_latency));
+
+    g_mutex_clear (&received.lock);
+  }
+}
+
+
+void
+add_pipeline_preroll_tests ()
+{
+  g_test_add_func ("/pipeline-preroll/ring", test_pipeline_preroll_ring);
+  g_test_add_func ("/pipeline-preroll/perf", test_pipeline_preroll_perf);
+}
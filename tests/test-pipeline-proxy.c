@@ -0,0 +1,290 @@
+/* test-pipeline-proxy.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <glib.h>
+#include <aperture.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "pipeline/aperture-pipeline-encoder.h"
+#include "pipeline/aperture-pipeline-proxy.h"
+#include "pipeline/aperture-pipeline-tee.h"
+
+
+static gboolean
+check_encoder (void)
+{
+  const char *elements[] = { "h264parse", "mp4mux", NULL };
+  int i;
+
+  if (!aperture_pipeline_encoder_can_encode (APERTURE_VIDEO_CODEC_H264)) {
+    g_test_skip ("x264enc is not installed");
+    return FALSE;
+  }
+
+  for (i = 0; elements[i] != NULL; i ++) {
+    g_autoptr(GstElementFactory) factory = gst_element_factory_find (elements[i]);
+    if (factory == NULL) {
+      g_autofree char *message = g_strdup_printf ("%s is not installed", elements[i]);
+      g_test_skip (message);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+
+/* Creates videotestsrc ! capsfilter ! tee, with moving test video at the
+ * given size, like the viewfinder's frames */
+static GstElement *
+create_test_pipeline (AperturePipelineTee *tee, int width, int height, gboolean live, int num_buffers)
+{
+  GstElement *pipeline = gst_pipeline_new (NULL);
+  GstElement *src = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  g_autoptr(GstCaps) caps = gst_caps_new_simple ("video/x-raw",
+                                                 "format", G_TYPE_STRING, "I420",
+                                                 "width", G_TYPE_INT, width,
+                                                 "height", G_TYPE_INT, height,
+                                                 "framerate", GST_TYPE_FRACTION, 30, 1,
+                                                 NULL);
+
+  g_object_set (src, "is-live", live, "num-buffers", num_buffers, "horizontal-speed", 4, NULL);
+  g_object_set (capsfilter, "caps", caps, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), src, capsfilter, GST_ELEMENT (tee), NULL);
+  gst_element_link_many (src, capsfilter, GST_ELEMENT (tee), NULL);
+
+  return pipeline;
+}
+
+
+/* Waits for the proxy's recorder to say the file is complete */
+static void
+wait_for_recording_done (GstElement *pipeline)
+{
+  g_autoptr(GstBus) bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gint64 end = g_get_monotonic_time () + 10 * G_USEC_PER_SEC;
+
+  while (g_get_monotonic_time () < end) {
+    g_autoptr(GstMessage) message = gst_bus_timed_pop_filtered (bus, 100 * GST_MSECOND,
+                                                                GST_MESSAGE_ELEMENT | GST_MESSAGE_ERROR);
+    if (message == NULL) {
+      continue;
+    }
+
+    g_assert_cmpint (GST_MESSAGE_TYPE (message), ==, GST_MESSAGE_ELEMENT);
+    if (gst_message_has_name (message, "recording-done")) {
+      return;
+    }
+  }
+
+  g_assert_not_reached ();
+}
+
+
+static void
+wait_for_eos (GstElement *pipeline)
+{
+  g_autoptr(GstBus) bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  g_autoptr(GstMessage) message = NULL;
+
+  message = gst_bus_timed_pop_filtered (bus, 60 * GST_SECOND, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  g_assert_nonnull (message);
+  g_assert_cmpint (GST_MESSAGE_TYPE (message), ==, GST_MESSAGE_EOS);
+}
+
+
+static void
+test_pipeline_proxy_scaled ()
+{
+  g_autoptr(ApertureRecordingProfile) profile = aperture_recording_profile_new ();
+  AperturePipelineTee *tee = aperture_pipeline_tee_new ();
+  AperturePipelineProxy *proxy;
+  AperturePipelineRecorder *recorder;
+  g_autoptr(GstElement) pipeline = NULL;
+  g_autoptr(GstPad) pad = NULL;
+  g_autoptr(GstCaps) caps = NULL;
+  g_autofree char *dir = g_dir_make_tmp ("aperture-proxy-XXXXXX", NULL);
+  g_autofree char *path = g_build_filename (dir, "proxy.mp4", NULL);
+  g_autofree char *contents = NULL;
+  GstStructure *structure;
+  gsize length;
+  int width, height;
+
+  g_test_summary ("Test that the proxy scales the frames it shares to its profile, keeping the aspect ratio, and writes a file");
+
+  if (!check_encoder ()) {
+    return;
+  }
+
+  /* only the width, so the height follows the video */
+  aperture_recording_profile_set_resolution (profile, 320, 0);
+  aperture_recording_profile_set_bitrate (profile, 500);
+
+  proxy = aperture_pipeline_proxy_new (profile, APERTURE_VIDEO_CONTAINER_MP4);
+  recorder = aperture_pipeline_proxy_get_recorder (proxy);
+  aperture_pipeline_recorder_set_location (recorder, path);
+
+  pipeline = create_test_pipeline (tee, 1280, 720, TRUE, -1);
+  aperture_pipeline_tee_add_branch (tee, GST_ELEMENT (proxy));
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_usleep (G_USEC_PER_SEC);
+
+  pad = gst_element_get_static_pad (GST_ELEMENT (recorder), "sink");
+  caps = gst_pad_get_current_caps (pad);
+  g_assert_nonnull (caps);
+  structure = gst_caps_get_structure (caps, 0);
+  g_assert_true (gst_structure_has_name (structure, "video/x-h264"));
+  g_assert_true (gst_structure_get_int (structure, "width", &width));
+  g_assert_true (gst_structure_get_int (structure, "height", &height));
+  g_assert_cmpint (width, ==, 320);
+  g_assert_cmpint (height, ==, 180);
+
+  aperture_pipeline_recorder_finish (recorder);
+  wait_for_recording_done (pipeline);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  g_assert_true (g_file_get_contents (path, &contents, &length, NULL));
+  g_assert_cmpuint (length, >, 8);
+  g_assert_true (memcmp (contents + 4, "ftyp", 4) == 0);
+
+  g_unlink (path);
+  g_rmdir (dir);
+}
+
+
+typedef enum {
+  STREAM_MASTER = 1 << 0,
+  STREAM_PROXY = 1 << 1,
+} Streams;
+
+
+/* Runs a number of 1080p frames through the tee into the chosen streams,
+ * as fast as they go, and returns the CPU time that took */
+static double
+measure_cpu (Streams streams, const char *dir, int num_buffers)
+{
+  AperturePipelineTee *tee = aperture_pipeline_tee_new ();
+  g_autoptr(GstElement) pipeline = NULL;
+  struct rusage before, after;
+
+  pipeline = create_test_pipeline (tee, 1920, 1080, FALSE, num_buffers);
+
+  if (streams & STREAM_MASTER) {
+    g_autoptr(ApertureRecordingProfile) profile = aperture_recording_profile_new ();
+    GstElement *bin = gst_bin_new (NULL);
+    AperturePipelineEncoder *encoder;
+    GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+    g_autoptr(GstPad) pad = NULL;
+
+    aperture_recording_profile_set_resolution (profile, 1920, 1080);
+    aperture_recording_profile_set_bitrate (profile, 8000);
+    encoder = aperture_pipeline_encoder_new (profile, TRUE);
+    g_object_set (sink, "sync", FALSE, NULL);
+
+    gst_bin_add_many (GST_BIN (bin), GST_ELEMENT (encoder), sink, NULL);
+    gst_element_link (GST_ELEMENT (encoder), sink);
+    pad = gst_element_get_static_pad (GST_ELEMENT (encoder), "sink");
+    gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+
+    aperture_pipeline_tee_add_branch (tee, bin);
+  }
+
+  if (streams & STREAM_PROXY) {
+    g_autoptr(ApertureRecordingProfile) profile = aperture_recording_profile_new ();
+    g_autofree char *path = g_build_filename (dir, "proxy.mp4", NULL);
+    AperturePipelineProxy *proxy;
+
+    aperture_recording_profile_set_resolution (profile, 640, 0);
+    aperture_recording_profile_set_bitrate (profile, 1000);
+    proxy = aperture_pipeline_proxy_new (profile, APERTURE_VIDEO_CONTAINER_MP4);
+    aperture_pipeline_recorder_set_location (aperture_pipeline_proxy_get_recorder (proxy), path);
+
+    aperture_pipeline_tee_add_branch (tee, GST_ELEMENT (proxy));
+  }
+
+  /* don't count the encoders starting up */
+  gst_element_set_state (pipeline, GST_STATE_PAUSED);
+  gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+  getrusage (RUSAGE_SELF, &before);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  wait_for_eos (pipeline);
+  getrusage (RUSAGE_SELF, &after);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  return (after.ru_utime.tv_sec - before.ru_utime.tv_sec)
+       + (after.ru_stime.tv_sec - before.ru_stime.tv_sec)
+       + (after.ru_utime.tv_usec - before.ru_utime.tv_usec) / 1e6
+       + (after.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1e6;
+}
+
+
+static void
+test_pipeline_proxy_perf ()
+{
+  const int num_buffers = 300;
+  const double video_seconds = num_buffers / 30.0;
+  g_autofree char *dir = NULL;
+  g_autofree char *path = NULL;
+  double master, proxy, both;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Performance tests are only run with -m perf");
+    return;
+  }
+
+  g_test_summary ("Measure the CPU cost of encoding each stream, and of both at once");
+
+  if (!check_encoder ()) {
+    return;
+  }
+
+  dir = g_dir_make_tmp ("aperture-proxy-XXXXXX", NULL);
+  path = g_build_filename (dir, "proxy.mp4", NULL);
+
+  master = measure_cpu (STREAM_MASTER, dir, num_buffers);
+  proxy = measure_cpu (STREAM_PROXY, dir, num_buffers);
+  both = measure_cpu (STREAM_MASTER | STREAM_PROXY, dir, num_buffers);
+
+  /* CPU seconds per second of video; 1.0 is a whole core */
+  g_test_minimized_result (master / video_seconds, "1080p master: %.2f CPU s per s of video", master / video_seconds);
+  g_test_minimized_result (proxy / video_seconds, "640 px proxy: %.2f CPU s per s of video", proxy / video_seconds);
+  g_test_minimized_result (both / video_seconds, "Master and proxy: %.2f CPU s per s of video", both / video_seconds);
+  g_test_message ("The proxy adds %.0f%% to the cost of the master", (both - master) * 100 / master);
+
+  g_unlink (path);
+  g_rmdir (dir);
+}
+
+
+void
+add_pipeline_proxy_tests ()
+{
+  g_test_add_func ("/pipeline-proxy/scaled", test_pipeline_proxy_scaled);
+  g_test_add_func ("/pipeline-proxy/perf", test_pipeline_proxy_perf);
+}
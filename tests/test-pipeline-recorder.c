@@ -0,0 +1,599 @@
+/* test-pipeline-recorder.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <glib.h>
+#include <aperture.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
+#include <string.h>
+
+#include "pipeline/aperture-pipeline-recorder.h"
+
+
+/* The recorder takes H.264, like the camera hands out. Encoding it here
+ * needs x264enc, which not every system has. */
+static gboolean
+check_encoder (void)
+{
+  const char *elements[] = { "x264enc", "h264parse", "mp4mux", "matroskamux", NULL };
+  int i;
+
+  for (i = 0; elements[i] != NULL; i ++) {
+    g_autoptr(GstElementFactory) factory = gst_element_factory_find (elements[i]);
+    if (factory == NULL) {
+      g_autofree char *message = g_strdup_printf ("%s is not installed", elements[i]);
+      g_test_skip (message);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+
+static GstElement *
+create_test_pipeline (AperturePipelineRecorder *recorder)
+{
+  GstElement *pipeline = gst_pipeline_new (NULL);
+  GstElement *src = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *enc = gst_element_factory_make ("x264enc", NULL);
+
+  g_object_set (src, "is-live", TRUE, NULL);
+  /* a keyframe every half second, so fragments can be cut on time */
+  g_object_set (enc, "key-int-max", 15, "speed-preset", 1, NULL);
+  gst_util_set_object_arg (G_OBJECT (enc), "tune", "zerolatency");
+
+  gst_bin_add_many (GST_BIN (pipeline), src, enc, GST_ELEMENT (recorder), NULL);
+  gst_element_link_many (src, enc, GST_ELEMENT (recorder), NULL);
+
+  return pipeline;
+}
+
+
+/* Waits for the recorder to say the file is complete */
+static void
+wait_for_recording_done (GstElement *pipeline)
+{
+  g_autoptr(GstBus) bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gint64 end = g_get_monotonic_time () + 10 * G_USEC_PER_SEC;
+
+  while (g_get_monotonic_time () < end) {
+    g_autoptr(GstMessage) message = gst_bus_timed_pop_filtered (bus, 100 * GST_MSECOND,
+                                                                GST_MESSAGE_ELEMENT | GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+    if (message == NULL) {
+      continue;
+    }
+
+    g_assert_cmpint (GST_MESSAGE_TYPE (message), ==, GST_MESSAGE_ELEMENT);
+    if (gst_message_has_name (message, "recording-done")) {
+      return;
+    }
+  }
+
+  g_assert_not_reached ();
+}
+
+
+/* Finds a top-level MP4 box and returns its offset, or -1 */
+static gssize
+find_box (const guint8 *data, gsize length, const char *type)
+{
+  gsize offset = 0;
+
+  while (offset + 8 <= length) {
+    guint64 size = GST_READ_UINT32_BE (data + offset);
+
+    if (size == 1 && offset + 16 <= length) {
+      size = GST_READ_UINT64_BE (data + offset + 8);
+    } else if (size == 0) {
+      size = length - offset;
+    }
+
+    if (memcmp (data + offset + 4, type, 4) == 0) {
+      return offset;
+    }
+
+    if (size < 8) {
+      break;
+    }
+    offset += size;
+  }
+
+  return -1;
+}
+
+
+/* Waits until a top-level box shows up in a file that is being written */
+static gboolean
+wait_for_box (const char *path, const char *type)
+{
+  int i;
+
+  for (i = 0; i < 500; i ++) {
+    g_autofree char *contents = NULL;
+    gsize length;
+
+    if (g_file_get_contents (path, &contents, &length, NULL)
+        && find_box ((guint8 *) contents, length, type) >= 0) {
+      return TRUE;
+    }
+
+    g_usleep (10000);
+  }
+
+  return FALSE;
+}
+
+
+static void
+test_pipeline_recorder_fragmented_mp4 ()
+{
+  AperturePipelineRecorder *recorder;
+  g_autoptr(GstElement) pipeline = NULL;
+  g_autofree char *dir = g_dir_make_tmp ("aperture-recorder-XXXXXX", NULL);
+  g_autofree char *path = g_build_filename (dir, "video.mp4", NULL);
+  g_autofree char *contents = NULL;
+  gsize length;
+
+  g_test_summary ("Test that MP4 recordings are written in fragments that are playable while recording");
+
+  if (!check_encoder ()) {
+    return;
+  }
+
+  recorder = aperture_pipeline_recorder_new (APERTURE_VIDEO_CONTAINER_MP4, APERTURE_VIDEO_CODEC_H264);
+  aperture_pipeline_recorder_set_fragment_duration (recorder, GST_SECOND / 2);
+  aperture_pipeline_recorder_set_location (recorder, path);
+  pipeline = create_test_pipeline (recorder);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  /* the fragments are on disk before the recording stops, so a crash
+   * wouldn't lose them */
+  g_assert_true (wait_for_box (path, "moof"));
+
+  aperture_pipeline_recorder_finish (recorder);
+  wait_for_recording_done (pipeline);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  g_assert_true (g_file_get_contents (path, &contents, &length, NULL));
+  g_assert_cmpint (find_box ((guint8 *) contents, length, "ftyp"), ==, 0);
+  g_assert_cmpint (find_box ((guint8 *) contents, length, "moov"), >, 0);
+  g_assert_cmpint (find_box ((guint8 *) contents, length, "moof"), >, 0);
+
+  g_unlink (path);
+  g_rmdir (dir);
+}
+
+
+static void
+test_pipeline_recorder_faststart ()
+{
+  AperturePipelineRecorder *recorder;
+  g_autoptr(GstElement) pipeline = NULL;
+  g_autoptr(GstElement) mux = NULL;
+  g_autofree char *dir = g_dir_make_tmp ("aperture-recorder-XXXXXX", NULL);
+  g_autofree char *path = g_build_filename (dir, "video.mp4", NULL);
+  g_autofree char *contents = NULL;
+  gssize moov, mdat;
+  gsize length;
+
+  g_test_summary ("Test that a fragmented MP4 with faststart is finalized into a regular MP4");
+
+  if (!check_encoder ()) {
+    return;
+  }
+
+  mux = gst_object_ref_sink (gst_element_factory_make ("mp4mux", NULL));
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (mux), "fragment-mode") == NULL) {
+    g_test_skip ("mp4mux can't finalize fragmented files before GStreamer 1.20");
+    return;
+  }
+
+  recorder = aperture_pipeline_recorder_new (APERTURE_VIDEO_CONTAINER_MP4, APERTURE_VIDEO_CODEC_H264);
+  aperture_pipeline_recorder_set_fragment_duration (recorder, GST_SECOND / 2);
+  aperture_pipeline_recorder_set_faststart (recorder, TRUE);
+  aperture_pipeline_recorder_set_location (recorder, path);
+  pipeline = create_test_pipeline (recorder);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_assert_true (wait_for_box (path, "moov"));
+  g_usleep (G_USEC_PER_SEC);
+
+  aperture_pipeline_recorder_finish (recorder);
+  wait_for_recording_done (pipeline);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  g_assert_true (g_file_get_contents (path, &contents, &length, NULL));
+  moov = find_box ((guint8 *) contents, length, "moov");
+  mdat = find_box ((guint8 *) contents, length, "mdat");
+  g_assert_cmpint (moov, >, 0);
+  g_assert_cmpint (mdat, >, moov);
+  g_assert_cmpint (find_box ((guint8 *) contents, length, "moof"), ==, -1);
+
+  g_unlink (path);
+  g_rmdir (dir);
+}
+
+
+static void
+test_pipeline_recorder_matroska ()
+{
+  AperturePipelineRecorder *recorder;
+  g_autoptr(GstElement) pipeline = NULL;
+  g_autofree char *dir = g_dir_make_tmp ("aperture-recorder-XXXXXX", NULL);
+  g_autofree char *path = g_build_filename (dir, "video.mkv", NULL);
+  g_autofree char *contents = NULL;
+  gsize length;
+  const guint8 ebml_magic[] = { 0x1A, 0x45, 0xDF, 0xA3 };
+
+  g_test_summary ("Test recording to a Matroska file");
+
+  if (!check_encoder ()) {
+    return;
+  }
+
+  recorder = aperture_pipeline_recorder_new (APERTURE_VIDEO_CONTAINER_MATROSKA, APERTURE_VIDEO_CODEC_H264);
+  aperture_pipeline_recorder_set_location (recorder, path);
+  pipeline = create_test_pipeline (recorder);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_usleep (G_USEC_PER_SEC);
+
+  aperture_pipeline_recorder_finish (recorder);
+  wait_for_recording_done (pipeline);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  g_assert_true (g_file_get_contents (path, &contents, &length, NULL));
+  g_assert_cmpuint (length, >, sizeof (ebml_magic));
+  g_assert_cmpmem (contents, sizeof (ebml_magic), ebml_magic, sizeof (ebml_magic));
+
+  g_unlink (path);
+  g_rmdir (dir);
+}
+
+
+static void
+test_pipeline_recorder_segments ()
+{
+  AperturePipelineRecorder *recorder;
+  g_autoptr(GstElement) pipeline = NULL;
+  g_autoptr(GstElementFactory) splitmuxsink = gst_element_factory_find ("splitmuxsink");
+  g_autoptr(GstBus) bus = NULL;
+  g_autoptr(GPtrArray) segments = g_ptr_array_new_with_free_func (g_free);
+  g_autofree char *dir = g_dir_make_tmp ("aperture-recorder-XXXXXX", NULL);
+  g_autofree char *format = g_build_filename (dir, "video-%05d.mp4", NULL);
+  GstClockTime last_running_time = 0;
+  gboolean done = FALSE;
+  gint64 end;
+  guint i;
+
+  g_test_summary ("Test that segmented recordings roll over to a new file that starts on a keyframe");
+
+  if (!check_encoder ()) {
+    return;
+  }
+  if (splitmuxsink == NULL) {
+    g_test_skip ("splitmuxsink is not installed");
+    return;
+  }
+
+  recorder = aperture_pipeline_recorder_new_segmented (APERTURE_VIDEO_CONTAINER_MP4, APERTURE_VIDEO_CODEC_H264);
+  aperture_pipeline_recorder_set_max_segment (recorder, GST_SECOND, 0);
+  aperture_pipeline_recorder_set_location (recorder, format);
+  pipeline = create_test_pipeline (recorder);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_usleep (3500 * G_TIME_SPAN_MILLISECOND);
+  aperture_pipeline_recorder_finish (recorder);
+
+  end = g_get_monotonic_time () + 10 * G_USEC_PER_SEC;
+  while (!done && g_get_monotonic_time () < end) {
+    g_autoptr(GstMessage) message = gst_bus_timed_pop_filtered (bus, 100 * GST_MSECOND,
+                                                                GST_MESSAGE_ELEMENT | GST_MESSAGE_ERROR);
+    const GstStructure *structure;
+    GstClockTime running_time;
+
+    if (message == NULL) {
+      continue;
+    }
+
+    g_assert_cmpint (GST_MESSAGE_TYPE (message), ==, GST_MESSAGE_ELEMENT);
+    structure = gst_message_get_structure (message);
+
+    if (gst_message_has_name (message, "segment-closed")) {
+      /* segments are closed in order, each one later than the last */
+      g_assert_true (gst_structure_get_uint64 (structure, "running-time", &running_time));
+      g_assert_cmpuint (running_time, >, last_running_time);
+      last_running_time = running_time;
+
+      g_ptr_array_add (segments, g_strdup (gst_structure_get_string (structure, "location")));
+    } else if (gst_message_has_name (message, "recording-done")) {
+      done = TRUE;
+    }
+  }
+
+  g_assert_true (done);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  /* 3.5 seconds in 1 second segments, give or take a keyframe */
+  g_assert_cmpuint (segments->len, >=, 3);
+
+  for (i = 0; i < segments->len; i ++) {
+    g_autofree char *expected = g_strdup_printf (format, i);
+    g_autofree char *contents = NULL;
+    gsize length;
+
+    g_assert_cmpstr (segments->pdata[i], ==, expected);
+    g_assert_true (g_file_get_contents (segments->pdata[i], &contents, &length, NULL));
+    g_assert_cmpint (find_box ((guint8 *) contents, length, "ftyp"), ==, 0);
+    g_assert_cmpint (find_box ((guint8 *) contents, length, "moov"), >, 0);
+
+    g_unlink (segments->pdata[i]);
+  }
+
+  g_rmdir (dir);
+}
+
+
+static void
+test_pipeline_recorder_stream ()
+{
+  AperturePipelineRecorder *recorder;
+  g_autoptr(GstElement) pipeline = NULL;
+  g_autoptr(GOutputStream) stream = g_memory_output_stream_new_resizable ();
+  const guint8 *data;
+  gsize length;
+
+  g_test_summary ("Test that recording to a stream writes a fragmented MP4 as it goes");
+
+  if (!check_encoder ()) {
+    return;
+  }
+
+  recorder = aperture_pipeline_recorder_new_for_stream (APERTURE_VIDEO_CONTAINER_MP4, APERTURE_VIDEO_CODEC_H264, stream);
+  /* not possible on a stream, so it's ignored */
+  aperture_pipeline_recorder_set_fragment_duration (recorder, 0);
+  aperture_pipeline_recorder_set_faststart (recorder, TRUE);
+  pipeline = create_test_pipeline (recorder);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_usleep (2 * G_USEC_PER_SEC);
+
+  aperture_pipeline_recorder_finish (recorder);
+  wait_for_recording_done (pipeline);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  data = g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (stream));
+  length = g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (stream));
+  g_assert_cmpint (find_box (data, length, "ftyp"), ==, 0);
+  g_assert_cmpint (find_box (data, length, "moov"), >, 0);
+  g_assert_cmpint (find_box (data, length, "moof"), >, 0);
+}
+
+
+typedef struct {
+  GMutex lock;
+  gsize largest_chunk;
+  guint n_chunks;
+} SlowConsumer;
+
+
+static gboolean
+slow_consumer_func (GBytes *chunk, gpointer user_data, GError **error)
+{
+  SlowConsumer *consumer = user_data;
+
+  g_mutex_lock (&consumer->lock);
+  consumer->largest_chunk = MAX (consumer->largest_chunk, g_bytes_get_size (chunk));
+  consumer->n_chunks ++;
+  g_mutex_unlock (&consumer->lock);
+
+  g_usleep (50000);
+  return TRUE;
+}
+
+
+static void
+test_pipeline_recorder_backpressure ()
+{
+  const guint64 max_queued = 16 * 1024;
+  AperturePipelineRecorder *recorder;
+  g_autoptr(GstElement) pipeline = NULL;
+  AperturePipelineRecorderWriterStats stats;
+  SlowConsumer consumer = { 0 };
+
+  g_test_summary ("Test that a slow consumer holds the recording up instead of letting the queue grow");
+
+  if (!check_encoder ()) {
+    return;
+  }
+
+  g_mutex_init (&consumer.lock);
+  recorder = aperture_pipeline_recorder_new_for_func (APERTURE_VIDEO_CONTAINER_MATROSKA,
+                                                      APERTURE_VIDEO_CODEC_H264,
+                                                      slow_consumer_func, &consumer, NULL);
+  aperture_pipeline_recorder_set_max_queued_bytes (recorder, max_queued);
+  pipeline = create_test_pipeline (recorder);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_usleep (2 * G_USEC_PER_SEC);
+
+  aperture_pipeline_recorder_get_writer_stats (recorder, &stats);
+  g_mutex_lock (&consumer.lock);
+  g_assert_cmpuint (consumer.n_chunks, >, 0);
+  g_assert_cmpuint (stats.blocked_time, >, 0);
+  /* a chunk that doesn't fit is only let in when the queue is empty */
+  g_assert_cmpuint (stats.max_queued_bytes, <=, MAX (max_queued, consumer.largest_chunk));
+  g_mutex_unlock (&consumer.lock);
+
+  /* shutting down doesn't wait for the consumer to catch up */
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  g_mutex_clear (&consumer.lock);
+}
+
+
+static void
+test_pipeline_recorder_held ()
+{
+  AperturePipelineRecorder *recorder;
+  g_autoptr(GstElement) pipeline = NULL;
+  g_autoptr(GstBus) bus = NULL;
+  g_autofree char *dir = g_dir_make_tmp ("aperture-recorder-XXXXXX", NULL);
+  g_autofree char *path = g_build_filename (dir, "video.mp4", NULL);
+  g_autofree char *contents = NULL;
+  GstClockTime latency = GST_CLOCK_TIME_NONE;
+  gboolean started = FALSE;
+  gint64 end;
+  gsize length;
+
+  g_test_summary ("Test that a held recorder stays closed while playing, and starts on a keyframe once released");
+
+  if (!check_encoder ()) {
+    return;
+  }
+
+  recorder = aperture_pipeline_recorder_new (APERTURE_VIDEO_CONTAINER_MP4, APERTURE_VIDEO_CODEC_H264);
+  aperture_pipeline_recorder_hold (recorder);
+  pipeline = create_test_pipeline (recorder);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_usleep (G_USEC_PER_SEC);
+  g_assert_false (g_file_test (path, G_FILE_TEST_EXISTS));
+
+  aperture_pipeline_recorder_release (recorder, path);
+
+  end = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+  while (!started && g_get_monotonic_time () < end) {
+    g_autoptr(GstMessage) message = gst_bus_timed_pop_filtered (bus, 100 * GST_MSECOND,
+                                                                GST_MESSAGE_ELEMENT | GST_MESSAGE_ERROR);
+    if (message == NULL) {
+      continue;
+    }
+
+    g_assert_cmpint (GST_MESSAGE_TYPE (message), ==, GST_MESSAGE_ELEMENT);
+    if (gst_message_has_name (message, "recording-started")) {
+      g_assert_true (gst_structure_get_uint64 (gst_message_get_structure (message), "latency", &latency));
+      started = TRUE;
+    }
+  }
+
+  /* the encoder was asked for a keyframe, so it doesn't take a whole GOP */
+  g_assert_true (started);
+  g_assert_true (GST_CLOCK_TIME_IS_VALID (latency));
+  g_assert_cmpuint (latency, <, GST_SECOND / 2);
+  g_test_message ("Started recording after %" GST_TIME_FORMAT, GST_TIME_ARGS (latency));
+
+  g_usleep (G_USEC_PER_SEC);
+  aperture_pipeline_recorder_finish (recorder);
+  wait_for_recording_done (pipeline);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  g_assert_true (g_file_get_contents (path, &contents, &length, NULL));
+  g_assert_cmpint (find_box ((guint8 *) contents, length, "ftyp"), ==, 0);
+  g_assert_cmpint (find_box ((guint8 *) contents, length, "moof"), >, 0);
+
+  g_unlink (path);
+  g_rmdir (dir);
+}
+
+
+static void
+test_pipeline_recorder_write_behind ()
+{
+  AperturePipelineRecorder *recorder;
+  g_autoptr(GstElement) pipeline = NULL;
+  g_autofree char *dir = g_dir_make_tmp ("aperture-recorder-XXXXXX", NULL);
+  g_autofree char *path = g_build_filename (dir, "video.mp4", NULL);
+  g_autofree char *contents = NULL;
+  AperturePipelineRecorderWriterStats stats;
+  gsize length;
+
+  g_test_summary ("Test that the writer thread syncs the file as it goes, and accounts for every byte and write");
+
+  if (!check_encoder ()) {
+    return;
+  }
+
+  recorder = aperture_pipeline_recorder_new (APERTURE_VIDEO_CONTAINER_MP4, APERTURE_VIDEO_CODEC_H264);
+  aperture_pipeline_recorder_set_fragment_duration (recorder, GST_SECOND / 2);
+  aperture_pipeline_recorder_set_sync_interval (recorder, GST_SECOND / 4);
+  aperture_pipeline_recorder_set_location (recorder, path);
+  pipeline = create_test_pipeline (recorder);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_usleep (2 * G_USEC_PER_SEC);
+
+  /* partial blocks are written after half a second, and synced */
+  aperture_pipeline_recorder_get_writer_stats (recorder, &stats);
+  g_assert_cmpuint (stats.n_writes, >, 0);
+  g_assert_cmpuint (stats.n_syncs, >, 0);
+
+  aperture_pipeline_recorder_finish (recorder);
+  wait_for_recording_done (pipeline);
+  aperture_pipeline_recorder_get_writer_stats (recorder, &stats);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  g_assert_true (g_file_get_contents (path, &contents, &length, NULL));
+  g_assert_cmpint (find_box ((guint8 *) contents, length, "ftyp"), ==, 0);
+  g_assert_cmpint (find_box ((guint8 *) contents, length, "moof"), >, 0);
+
+  /* the muxer seeks back to fill in the header, so the file can be smaller
+   * than what went through the writer, but not bigger; the preallocated
+   * space past the end was given back */
+  g_assert_cmpuint (stats.queued_bytes, ==, 0);
+  g_assert_cmpuint (stats.max_queued_bytes, >, 0);
+  g_assert_cmpuint (length, >, 0);
+  g_assert_cmpuint (length, <=, stats.written_bytes);
+
+  g_assert_cmpuint (stats.write_latency_p50, <=, stats.write_latency_p95);
+  g_assert_cmpuint (stats.write_latency_p95, <=, stats.write_latency_p99);
+  g_assert_cmpuint (stats.write_latency_p99, <=, stats.write_latency_max);
+  g_test_message ("%u writes: p50 %" GST_TIME_FORMAT ", p99 %" GST_TIME_FORMAT ", max %" GST_TIME_FORMAT
+                  "; %u syncs, max %" GST_TIME_FORMAT,
+                  stats.n_writes,
+                  GST_TIME_ARGS (stats.write_latency_p50),
+                  GST_TIME_ARGS (stats.write_latency_p99),
+                  GST_TIME_ARGS (stats.write_latency_max),
+                  stats.n_syncs,
+                  GST_TIME_ARGS (stats.sync_latency_max));
+
+  g_unlink (path);
+  g_rmdir (dir);
+}
+
+
+void
+add_pipeline_recorder_tests ()
+{
+  g_test_add_func ("/pipeline-recorder/fragmented_mp4", test_pipeline_recorder_fragmented_mp4);
+  g_test_add_func ("/pipeline-recorder/faststart", test_pipeline_recorder_faststart);
+  g_test_add_func ("/pipeline-recorder/matroska", test_pipeline_recorder_matroska);
+  g_test_add_func ("/pipeline-recorder/segments", test_pipeline_recorder_segments);
+  g_test_add_func ("/pipeline-recorder/stream", test_pipeline_recorder_stream);
+  g_test_add_func ("/pipeline-recorder/backpressure", test_pipeline_recorder_backpressure);
+  g_test_add_func ("/pipeline-recorder/held", test_pipeline_recorder_held);
+  g_test_add_func ("/pipeline-recorder/write_behind", test_pipeline_recorder_write_behind);
+}
@@ -0,0 +1,524 @@
+/* test-pipeline-tee.c
+ *
+ * Copyright 2020 James Westman <james@flyingpimonster.net>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+
+#include <glib.h>
+#include <gst/gst.h>
+#include <sys/resource.h>
+
+#include "pipeline/aperture-pipeline-tee.h"
+
+
+static GstElement *
+create_test_pipeline (AperturePipelineTee *tee, int num_buffers)
+{
+  GstElement *pipeline = gst_pipeline_new (NULL);
+  GstElement *src = gst_element_factory_make ("videotestsrc", NULL);
+
+  g_object_set (src, "num-buffers", num_buffers, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), src, GST_ELEMENT (tee), NULL);
+  gst_element_link (src, GST_ELEMENT (tee));
+
+  return pipeline;
+}
+
+
+static void
+count_buffer_cb (GstElement *fakesink, GstBuffer *buffer, GstPad *pad, int *count)
+{
+  g_atomic_int_inc (count);
+}
+
+
+/* Creates a branch that does nothing but count buffers */
+static GstElement *
+create_counting_sink (int *count)
+{
+  GstElement *fakesink = gst_element_factory_make ("fakesink", NULL);
+
+  g_object_set (fakesink, "sync", FALSE, "signal-handoffs", TRUE, NULL);
+  g_signal_connect (fakesink, "handoff", G_CALLBACK (count_buffer_cb), count);
+
+  return fakesink;
+}
+
+
+/* Creates a branch that takes a few milliseconds for each buffer, and counts
+ * the buffers that make it all the way through */
+static GstElement *
+create_slow_branch (int *count)
+{
+  GstElement *bin = gst_bin_new (NULL);
+  g_autoptr(GstPad) pad = NULL;
+  GstPad *ghost_pad;
+
+  GstElement *identity;
+  GstElement *fakesink;
+
+  identity = gst_element_factory_make ("identity", NULL);
+  fakesink = gst_element_factory_make ("fakesink", NULL);
+
+  g_object_set (identity, "sleep-time", 5000, NULL);
+  g_object_set (fakesink, "sync", FALSE, "signal-handoffs", TRUE, NULL);
+  g_signal_connect (fakesink, "handoff", G_CALLBACK (count_buffer_cb), count);
+
+  gst_bin_add_many (GST_BIN (bin), identity, fakesink, NULL);
+  gst_element_link (identity, fakesink);
+
+  pad = gst_element_get_static_pad (identity, "sink");
+  ghost_pad = gst_ghost_pad_new ("sink", pad);
+  gst_pad_set_active (ghost_pad, TRUE);
+  gst_element_add_pad (bin, ghost_pad);
+
+  return bin;
+}
+
+
+/* Waits (without a main loop; the tee doesn't need one) until @count reaches
+ * at least @n */
+static void
+wait_for_count (int *count, int n)
+{
+  int i;
+
+  for (i = 0; i < 500 && g_atomic_int_get (count) < n; i ++) {
+    g_usleep (10000);
+  }
+
+  g_assert_cmpint (g_atomic_int_get (count), >=, n);
+}
+
+
+static void
+run_until_eos (GstElement *pipeline)
+{
+  g_autoptr(GstBus) bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  g_autoptr(GstMessage) message = NULL;
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  message = gst_bus_timed_pop_filtered (bus, 10 * GST_SECOND, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  g_assert_nonnull (message);
+  g_assert_cmpint (GST_MESSAGE_TYPE (message), ==, GST_MESSAGE_EOS);
+}
+
+
+static void
+test_pipeline_tee_default_policy ()
+{
+  AperturePipelineTee *tee = aperture_pipeline_tee_new ();
+  g_autoptr(GstElement) pipeline = create_test_pipeline (tee, 20);
+  AperturePipelineTeeBranchStats stats;
+  GstElement *branch;
+  int count = 0;
+
+  g_test_summary ("Test that branches with the default policy receive every buffer");
+
+  branch = create_slow_branch (&count);
+  aperture_pipeline_tee_add_branch (tee, branch);
+
+  run_until_eos (pipeline);
+
+  aperture_pipeline_tee_get_branch_stats (tee, branch, &stats);
+  g_assert_cmpint (count, ==, 20);
+  g_assert_cmpuint (stats.dropped, ==, 0);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+}
+
+
+static void
+test_pipeline_tee_drop_oldest ()
+{
+  AperturePipelineTee *tee = aperture_pipeline_tee_new ();
+  g_autoptr(GstElement) pipeline = create_test_pipeline (tee, 100);
+  AperturePipelineTeeBranchPolicy policy = {
+    .drop_policy = APERTURE_PIPELINE_TEE_DROP_OLDEST,
+    .max_buffers = 1,
+  };
+  AperturePipelineTeeBranchStats stats;
+  GstElement *branch;
+  int count = 0;
+
+  g_test_summary ("Test that a slow, leaky branch drops buffers instead of queueing them");
+
+  branch = create_slow_branch (&count);
+  aperture_pipeline_tee_add_branch_full (tee, branch, &policy);
+
+  run_until_eos (pipeline);
+
+  aperture_pipeline_tee_get_branch_stats (tee, branch, &stats);
+  g_assert_cmpuint (stats.dropped, >, 0);
+  g_assert_cmpuint (stats.level_buffers, <=, 1);
+  g_assert_cmpint (count + stats.dropped, ==, 100);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+}
+
+
+static void
+test_pipeline_tee_every_nth_frame ()
+{
+  AperturePipelineTee *tee = aperture_pipeline_tee_new ();
+  g_autoptr(GstElement) pipeline = create_test_pipeline (tee, 100);
+  AperturePipelineTeeBranchPolicy policy = APERTURE_PIPELINE_TEE_BRANCH_POLICY_INIT;
+  AperturePipelineTeeBranchStats stats;
+  GstElement *branch;
+  int count = 0;
+
+  g_test_summary ("Test that a branch can ask for only every Nth frame");
+
+  policy.every_nth_frame = 4;
+  branch = create_slow_branch (&count);
+  aperture_pipeline_tee_add_branch_full (tee, branch, &policy);
+
+  run_until_eos (pipeline);
+
+  aperture_pipeline_tee_get_branch_stats (tee, branch, &stats);
+  g_assert_cmpint (count, ==, 25);
+  g_assert_cmpuint (stats.decimated, ==, 75);
+  g_assert_cmpuint (stats.dropped, ==, 0);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+}
+
+
+static void
+test_pipeline_tee_min_frame_interval ()
+{
+  AperturePipelineTee *tee = aperture_pipeline_tee_new ();
+  /* videotestsrc produces 30 fps by default, so this is 3 seconds */
+  g_autoptr(GstElement) pipeline = create_test_pipeline (tee, 90);
+  AperturePipelineTeeBranchPolicy policy = APERTURE_PIPELINE_TEE_BRANCH_POLICY_INIT;
+  AperturePipelineTeeBranchStats stats;
+  GstElement *branch;
+  int count = 0;
+
+  g_test_summary ("Test that a branch can limit its frame rate");
+
+  policy.min_frame_interval = GST_SECOND / 10;
+  branch = create_slow_branch (&count);
+  aperture_pipeline_tee_add_branch_full (tee, branch, &policy);
+
+  run_until_eos (pipeline);
+
+  aperture_pipeline_tee_get_branch_stats (tee, branch, &stats);
+  g_assert_cmpint (count, ==, 30);
+  g_assert_cmpuint (stats.decimated, ==, 60);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+}
+
+
+static void
+test_pipeline_tee_transaction ()
+{
+  AperturePipelineTee *tee = aperture_pipeline_tee_new ();
+  g_autoptr(GstElement) pipeline = create_test_pipeline (tee, -1);
+  g_autoptr(GstElement) old_branch = NULL;
+  AperturePipelineTeeTransaction *transaction;
+  GstElement *new_branch_1;
+  GstElement *new_branch_2;
+  int old_count = 0;
+  int new_count_1 = 0;
+  int new_count_2 = 0;
+  int old_count_after;
+  int i;
+
+  g_test_summary ("Test adding and removing several branches in one transaction");
+
+  old_branch = gst_object_ref (create_slow_branch (&old_count));
+  aperture_pipeline_tee_add_branch (tee, old_branch);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  wait_for_count (&old_count, 5);
+
+  new_branch_1 = create_slow_branch (&new_count_1);
+  new_branch_2 = create_slow_branch (&new_count_2);
+
+  transaction = aperture_pipeline_tee_begin (tee);
+  aperture_pipeline_tee_transaction_add_branch (transaction, new_branch_1, NULL);
+  aperture_pipeline_tee_transaction_add_branch (transaction, new_branch_2, NULL);
+  aperture_pipeline_tee_transaction_remove_branch (transaction, old_branch);
+  aperture_pipeline_tee_commit (transaction);
+
+  wait_for_count (&new_count_1, 5);
+  wait_for_count (&new_count_2, 5);
+  g_assert_true (GST_CLOCK_TIME_IS_VALID (aperture_pipeline_tee_get_last_stall (tee)));
+
+  /* the old branch is shut down asynchronously */
+  for (i = 0; i < 500 && GST_OBJECT_PARENT (old_branch) != NULL; i ++) {
+    g_usleep (10000);
+  }
+  g_assert_null (GST_OBJECT_PARENT (old_branch));
+
+  old_count_after = g_atomic_int_get (&old_count);
+  wait_for_count (&new_count_1, new_count_1 + 5);
+  g_assert_cmpint (g_atomic_int_get (&old_count), ==, old_count_after);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+}
+
+
+#define N_PERF_BRANCHES 3
+
+static void
+test_pipeline_tee_transaction_perf ()
+{
+  AperturePipelineTee *tee = aperture_pipeline_tee_new ();
+  g_autoptr(GstElement) pipeline = create_test_pipeline (tee, -1);
+  AperturePipelineTeeTransaction *transaction;
+  GstElement *branches[N_PERF_BRANCHES];
+  int counts[N_PERF_BRANCHES] = { 0 };
+  int new_counts[N_PERF_BRANCHES] = { 0 };
+  int preview_count = 0;
+  GstClockTime separate = 0;
+  GstClockTime batched;
+  int i;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Performance tests are only run with -m perf");
+    return;
+  }
+
+  g_test_summary ("Compare the stream stall of separate branch changes with a single transaction");
+
+  aperture_pipeline_tee_add_branch (tee, create_slow_branch (&preview_count));
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  wait_for_count (&preview_count, 5);
+
+  for (i = 0; i < N_PERF_BRANCHES; i ++) {
+    branches[i] = create_slow_branch (&counts[i]);
+    aperture_pipeline_tee_add_branch (tee, branches[i]);
+    wait_for_count (&counts[i], 1);
+    separate += aperture_pipeline_tee_get_last_stall (tee);
+  }
+
+  transaction = aperture_pipeline_tee_begin (tee);
+  for (i = 0; i < N_PERF_BRANCHES; i ++) {
+    aperture_pipeline_tee_transaction_remove_branch (transaction, branches[i]);
+    branches[i] = create_slow_branch (&new_counts[i]);
+    aperture_pipeline_tee_transaction_add_branch (transaction, branches[i], NULL);
+  }
+  aperture_pipeline_tee_commit (transaction);
+
+  for (i = 0; i < N_PERF_BRANCHES; i ++) {
+    wait_for_count (&new_counts[i], 1);
+  }
+  batched = aperture_pipeline_tee_get_last_stall (tee);
+
+  g_test_message ("Adding %d branches separately: %" GST_TIME_FORMAT " total stall",
+                  N_PERF_BRANCHES, GST_TIME_ARGS (separate));
+  g_test_message ("Replacing %d branches in one transaction: %" GST_TIME_FORMAT " stall",
+                  N_PERF_BRANCHES, GST_TIME_ARGS (batched));
+  g_test_minimized_result ((double) batched / GST_SECOND,
+                           "Stall for a %d-branch transaction: %" GST_TIME_FORMAT,
+                           N_PERF_BRANCHES, GST_TIME_ARGS (batched));
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+}
+
+
+static void
+test_pipeline_tee_threading ()
+{
+  AperturePipelineTee *tee = aperture_pipeline_tee_new ();
+  g_autoptr(GstElement) pipeline = create_test_pipeline (tee, 50);
+  AperturePipelineTeeBranchPolicy policy = APERTURE_PIPELINE_TEE_BRANCH_POLICY_INIT;
+  AperturePipelineTeeBranchPolicy lossless = APERTURE_PIPELINE_TEE_BRANCH_POLICY_INIT;
+  AperturePipelineTeeBranchStats stats;
+  GstElement *inline_branch;
+  int dedicated_count = 0;
+  int shared_count_1 = 0;
+  int shared_count_2 = 0;
+  int inline_count = 0;
+
+  g_test_summary ("Test that branches receive every buffer with each threading policy");
+
+  aperture_pipeline_tee_add_branch_full (tee, create_counting_sink (&dedicated_count), &policy);
+
+  policy.threading = APERTURE_PIPELINE_TEE_THREADING_SHARED;
+  aperture_pipeline_tee_add_branch_full (tee, create_counting_sink (&shared_count_1), &policy);
+  aperture_pipeline_tee_add_branch_full (tee, create_counting_sink (&shared_count_2), &policy);
+  /* the shared worker drops frames by default; we want to count them all */
+  aperture_pipeline_tee_set_shared_policy (tee, &lossless);
+
+  policy.threading = APERTURE_PIPELINE_TEE_THREADING_INLINE;
+  inline_branch = create_counting_sink (&inline_count);
+  aperture_pipeline_tee_add_branch_full (tee, inline_branch, &policy);
+
+  run_until_eos (pipeline);
+
+  g_assert_cmpint (dedicated_count, ==, 50);
+  g_assert_cmpint (shared_count_1, ==, 50);
+  g_assert_cmpint (shared_count_2, ==, 50);
+  g_assert_cmpint (inline_count, ==, 50);
+
+  aperture_pipeline_tee_get_branch_stats (tee, inline_branch, &stats);
+  g_assert_cmpuint (stats.level_buffers, ==, 0);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+}
+
+
+static void
+test_pipeline_tee_abort ()
+{
+  AperturePipelineTee *tee = aperture_pipeline_tee_new ();
+  g_autoptr(GstElement) pipeline = create_test_pipeline (tee, -1);
+  AperturePipelineTeeBranchPolicy policy = APERTURE_PIPELINE_TEE_BRANCH_POLICY_INIT;
+  AperturePipelineTeeTransaction *transaction;
+  AperturePipelineTeeTransaction *other;
+  g_autoptr(GstElement) aborted = NULL;
+  GstElement *shared_1;
+  GstElement *shared_2;
+  int count = 0;
+  int aborted_count = 0;
+  int shared_count_1 = 0;
+  int shared_count_2 = 0;
+  int i;
+
+  g_test_summary ("Test that an aborted transaction leaves nothing behind, and that the shared worker goes away with its last branch");
+
+  aperture_pipeline_tee_add_branch (tee, create_counting_sink (&count));
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  wait_for_count (&count, 5);
+
+  aborted = gst_object_ref (create_counting_sink (&aborted_count));
+  policy.threading = APERTURE_PIPELINE_TEE_THREADING_SHARED;
+  transaction = aperture_pipeline_tee_begin (tee);
+  aperture_pipeline_tee_transaction_add_branch (transaction, aborted, &policy);
+  aperture_pipeline_tee_abort (transaction);
+
+  /* only the tee, and the branch that was already there with its queue */
+  g_assert_null (GST_OBJECT_PARENT (aborted));
+  g_assert_cmpint (GST_BIN_NUMCHILDREN (tee), ==, 3);
+
+  /* the transaction that created the shared worker is aborted, while
+   * another one that uses it is still open */
+  transaction = aperture_pipeline_tee_begin (tee);
+  other = aperture_pipeline_tee_begin (tee);
+  aperture_pipeline_tee_transaction_add_branch (transaction, create_counting_sink (&aborted_count), &policy);
+  shared_1 = create_counting_sink (&shared_count_1);
+  aperture_pipeline_tee_transaction_add_branch (other, shared_1, &policy);
+  aperture_pipeline_tee_abort (transaction);
+  aperture_pipeline_tee_commit (other);
+  wait_for_count (&shared_count_1, 5);
+
+  shared_2 = create_counting_sink (&shared_count_2);
+  aperture_pipeline_tee_add_branch_full (tee, shared_2, &policy);
+  wait_for_count (&shared_count_2, 5);
+
+  aperture_pipeline_tee_remove_branch (tee, shared_1);
+  aperture_pipeline_tee_remove_branch (tee, shared_2);
+
+  /* the shared worker's tee and queue are shut down asynchronously */
+  for (i = 0; i < 500 && GST_BIN_NUMCHILDREN (tee) > 3; i ++) {
+    g_usleep (10000);
+  }
+  g_assert_cmpint (GST_BIN_NUMCHILDREN (tee), ==, 3);
+
+  g_assert_cmpint (g_atomic_int_get (&aborted_count), ==, 0);
+  wait_for_count (&count, count + 5);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+}
+
+
+#define N_THREADING_PERF_BRANCHES 5
+#define N_THREADING_PERF_BUFFERS 1000
+
+static void
+run_threading_perf (AperturePipelineTeeThreading threading, const char *name)
+{
+  AperturePipelineTee *tee = aperture_pipeline_tee_new ();
+  g_autoptr(GstElement) pipeline = create_test_pipeline (tee, N_THREADING_PERF_BUFFERS);
+  AperturePipelineTeeBranchPolicy policy = APERTURE_PIPELINE_TEE_BRANCH_POLICY_INIT;
+  int counts[N_THREADING_PERF_BRANCHES] = { 0 };
+  struct rusage before, after;
+  gint64 start;
+  double wall, cpu;
+  long switches;
+  int i;
+
+  policy.threading = threading;
+  for (i = 0; i < N_THREADING_PERF_BRANCHES; i ++) {
+    aperture_pipeline_tee_add_branch_full (tee, create_counting_sink (&counts[i]), &policy);
+  }
+  if (threading == APERTURE_PIPELINE_TEE_THREADING_SHARED) {
+    aperture_pipeline_tee_set_shared_policy (tee, &policy);
+  }
+
+  getrusage (RUSAGE_SELF, &before);
+  start = g_get_monotonic_time ();
+
+  run_until_eos (pipeline);
+
+  wall = (g_get_monotonic_time () - start) / (double) G_USEC_PER_SEC;
+  getrusage (RUSAGE_SELF, &after);
+
+  cpu = (after.ru_utime.tv_sec - before.ru_utime.tv_sec)
+      + (after.ru_stime.tv_sec - before.ru_stime.tv_sec)
+      + ((after.ru_utime.tv_usec - before.ru_utime.tv_usec)
+         + (after.ru_stime.tv_usec - before.ru_stime.tv_usec)) / (double) G_USEC_PER_SEC;
+  switches = (after.ru_nvcsw - before.ru_nvcsw) + (after.ru_nivcsw - before.ru_nivcsw);
+
+  for (i = 0; i < N_THREADING_PERF_BRANCHES; i ++) {
+    g_assert_cmpint (counts[i], ==, N_THREADING_PERF_BUFFERS);
+  }
+
+  g_test_message ("%-9s %d branches, %d buffers: %.3f s wall, %.3f s CPU, %ld context switches",
+                  name, N_THREADING_PERF_BRANCHES, N_THREADING_PERF_BUFFERS, wall, cpu, switches);
+  g_test_minimized_result (cpu, "%s: %.3f s CPU", name, cpu);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+}
+
+
+static void
+test_pipeline_tee_threading_perf ()
+{
+  if (!g_test_perf ()) {
+    g_test_skip ("Performance tests are only run with -m perf");
+    return;
+  }
+
+  g_test_summary ("Compare CPU use and context switches of the threading policies");
+
+  run_threading_perf (APERTURE_PIPELINE_TEE_THREADING_DEDICATED, "dedicated");
+  run_threading_perf (APERTURE_PIPELINE_TEE_THREADING_SHARED, "shared");
+  run_threading_perf (APERTURE_PIPELINE_TEE_THREADING_INLINE, "inline");
+}
+
+
+void
+add_pipeline_tee_tests ()
+{
+  g_test_add_func ("/pipeline-tee/default_policy", test_pipeline_tee_default_policy);
+  g_test_add_func ("/pipeline-tee/drop_oldest", test_pipeline_tee_drop_oldest);
+  g_test_add_func ("/pipeline-tee/every_nth_frame", test_pipeline_tee_every_nth_frame);
+  g_test_add_func ("/pipeline-tee/min_frame_interval", test_pipeline_tee_min_frame_interval);
+  g_test_add_func ("/pipeline-tee/transaction", test_pipeline_tee_transaction);
+  g_test_add_func ("/pipeline-tee/abort", test_pipeline_tee_abort);
+  g_test_add_func ("/pipeline-tee/transaction_perf", test_pipeline_tee_transaction_perf);
+  g_test_add_func ("/pipeline-tee/threading", test_pipeline_tee_threading);
+  g_test_add_func ("/pipeline-tee/threading_perf", test_pipeline_tee_threading_perf);
+}
@@ -21,6 +21,7 @@
 
 #include <glib.h>
 #include <aperture.h>
+#include <glib/gstdio.h>
 
 #include "dummy-device-provider.h"
 #include "utils.h"
@@ -99,6 +100,47 @@ test_viewfinder_take_picture ()
 }
 
 
+static void
+test_viewfinder_take_picture_while_recording ()
+{
+  g_autoptr(ApertureDeviceManager) manager = aperture_device_manager_get_instance ();
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  g_autofree char *dir = g_dir_make_tmp ("aperture-viewfinder-XXXXXX", NULL);
+  g_autofree char *path = g_build_filename (dir, "video.mp4", NULL);
+  g_autoptr(GError) err = NULL;
+  ApertureViewfinder *viewfinder;
+  GtkWidget *window;
+  TestUtilsCallback picture_callback;
+  DummyDevice *device;
+
+  testutils_callback_init (&picture_callback);
+
+  g_test_summary ("Test that a picture can be taken from the viewfinder while a video is recording");
+
+  device = dummy_device_provider_add (provider);
+  dummy_device_set_image (device, "/aperture/quadrants.png");
+  testutils_wait_for_device_change (manager);
+
+  viewfinder = aperture_viewfinder_new ();
+
+  window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET (viewfinder));
+  gtk_widget_show_all (window);
+
+  aperture_viewfinder_start_recording_to_file (viewfinder, path, &err);
+  g_assert_no_error (err);
+
+  aperture_viewfinder_take_picture_async (viewfinder, NULL, (GAsyncReadyCallback) on_picture_taken, &picture_callback);
+
+  testutils_callback_assert_called (&picture_callback, 1000);
+
+  gtk_widget_destroy (window);
+
+  g_unlink (path);
+  g_rmdir (dir);
+}
+
+
 static void
 simultaneous_operations_on_picture_taken_1 (ApertureViewfinder *source, GAsyncResult *res, TestUtilsCallback *callback)
 {
@@ -216,11 +258,74 @@ test_viewfinder_disconnect_camera ()
 }
 
 
+static gboolean
+frame_tap_main_thread_cb (TestUtilsCallback *callback)
+{
+  testutils_callback_call (callback);
+  return G_SOURCE_REMOVE;
+}
+
+
+static void
+frame_tap_cb (ApertureViewfinder *viewfinder, GstSample *sample, GstVideoFrame *frame, TestUtilsCallback *callback)
+{
+  static gint called = FALSE;
+
+  g_assert_true (APERTURE_IS_VIEWFINDER (viewfinder));
+  g_assert_cmpint (GST_VIDEO_FRAME_FORMAT (frame), ==, GST_VIDEO_FORMAT_RGBA);
+  g_assert_cmpint (GST_VIDEO_FRAME_WIDTH (frame), ==, 64);
+  g_assert_cmpint (GST_VIDEO_FRAME_HEIGHT (frame), ==, 48);
+  g_assert_nonnull (GST_VIDEO_FRAME_PLANE_DATA (frame, 0));
+  g_assert_true (gst_sample_get_buffer (sample) == frame->buffer);
+
+  /* this runs on a worker thread; report back to the main thread once */
+  if (g_atomic_int_compare_and_exchange (&called, FALSE, TRUE)) {
+    g_idle_add ((GSourceFunc) frame_tap_main_thread_cb, callback);
+  }
+}
+
+
+static void
+test_viewfinder_frame_tap ()
+{
+  g_autoptr(ApertureDeviceManager) manager = aperture_device_manager_get_instance ();
+  g_autoptr(DummyDeviceProvider) provider = DUMMY_DEVICE_PROVIDER (gst_device_provider_factory_get_by_name ("dummy-device-provider"));
+  g_autoptr(GstCaps) caps = gst_caps_from_string ("video/x-raw, format=RGBA, width=64, height=48");
+  ApertureViewfinder *viewfinder;
+  GtkWidget *window;
+  TestUtilsCallback frame_callback;
+  guint tap_id;
+
+  testutils_callback_init (&frame_callback);
+
+  g_test_summary ("Test that a frame tap receives mapped frames in the requested format");
+
+  dummy_device_provider_add (provider);
+  testutils_wait_for_device_change (manager);
+
+  viewfinder = aperture_viewfinder_new ();
+  tap_id = aperture_viewfinder_add_frame_tap (viewfinder, caps, 1, (ApertureFrameTapFunc) frame_tap_cb, &frame_callback, NULL);
+  g_assert_cmpuint (tap_id, !=, 0);
+
+  window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET (viewfinder));
+  gtk_widget_show_all (window);
+
+  testutils_callback_assert_called (&frame_callback, 1000);
+
+  aperture_viewfinder_remove_frame_tap (viewfinder, tap_id);
+
+  gtk_widget_destroy (window);
+}
+
+
 void
 add_viewfinder_tests ()
 {
   g_test_add_func ("/viewfinder/no_camera", test_viewfinder_no_camera_state);
   g_test_add_func ("/viewfinder/take_picture", test_viewfinder_take_picture);
+  g_test_add_func ("/viewfinder/take_picture_while_recording", test_viewfinder_take_picture_while_recording);
   g_test_add_func ("/viewfinder/simultaneous_operations", test_viewfinder_simultaneous_operations);
   g_test_add_func ("/viewfinder/disconnect_camera", test_viewfinder_disconnect_camera);
+  g_test_add_func ("/viewfinder/frame_tap", test_viewfinder_frame_tap);
 }